@@ -0,0 +1,84 @@
+#include "StdAfx.h"
+#include "GrMappedFile.h"
+#include <algorithm>
+
+CGrMappedFile::CGrMappedFile()
+{
+    mFile = INVALID_HANDLE_VALUE;
+    mMapping = NULL;
+    mData = NULL;
+    mSize = 0;
+}
+
+CGrMappedFile::~CGrMappedFile()
+{
+    Close();
+}
+
+
+//
+// Name :         CGrMappedFile::Open()
+// Description :  Map a file. Empty files cannot be mapped.
+// Returns :      true if successful
+//
+bool CGrMappedFile::Open(const wchar_t *filename)
+{
+    Close();
+
+    mFile = CreateFileW(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, NULL);
+    if(mFile == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(mFile, &size) || size.QuadPart == 0 ||
+        (unsigned long long)size.QuadPart > (size_t)-1)
+    {
+        Close();
+        return false;
+    }
+
+    mMapping = CreateFileMappingW(mFile, NULL, PAGE_READONLY, 0, 0, NULL);
+    if(mMapping == NULL)
+    {
+        Close();
+        return false;
+    }
+
+    mData = (const char *)MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0);
+    if(mData == NULL)
+    {
+        Close();
+        return false;
+    }
+
+    mSize = (size_t)size.QuadPart;
+    return true;
+}
+
+
+void CGrMappedFile::Close()
+{
+    if(mData != NULL)
+        UnmapViewOfFile(mData);
+
+    if(mMapping != NULL)
+        CloseHandle(mMapping);
+
+    if(mFile != INVALID_HANDLE_VALUE)
+        CloseHandle(mFile);
+
+    mFile = INVALID_HANDLE_VALUE;
+    mMapping = NULL;
+    mData = NULL;
+    mSize = 0;
+}
+
+
+void CGrMappedFile::Swap(CGrMappedFile &other)
+{
+    std::swap(mFile, other.mFile);
+    std::swap(mMapping, other.mMapping);
+    std::swap(mData, other.mData);
+    std::swap(mSize, other.mSize);
+}
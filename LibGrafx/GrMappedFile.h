@@ -0,0 +1,47 @@
+//
+// Name :         GrMappedFile.h
+// Description :  Header for CGrMappedFile, a read only memory mapped file.
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+
+#pragma once
+//! \cond ignore
+
+//
+// class CGrMappedFile
+// Maps an entire file read only. The data stays valid until Close()
+// or destruction. Pages are read from the file as they are touched,
+// so opening even a large file is fast.
+//
+
+class CGrMappedFile
+{
+public:
+    CGrMappedFile();
+    ~CGrMappedFile();
+
+    bool Open(const wchar_t *filename);
+    void Close();
+
+    // Exchange the files two objects have mapped
+    void Swap(CGrMappedFile &other);
+
+    bool IsOpen() const {return mData != NULL;}
+    const char *GetData() const {return mData;}
+    size_t GetSize() const {return mSize;}
+
+private:
+    CGrMappedFile(const CGrMappedFile &);
+    CGrMappedFile &operator=(const CGrMappedFile &);
+
+    HANDLE mFile;
+    HANDLE mMapping;
+    const char *mData;
+    size_t mSize;
+};
+
+//! \endcond
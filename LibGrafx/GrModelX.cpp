@@ -8,27 +8,52 @@
 CGrModelX::CGrModelX()
 {
     mModel = new CGrModelXp();
+    mLoad = NULL;
 }
 
 CGrModelX::~CGrModelX()
 {
+    CancelLoad();
     delete mModel;
 }
 
 
 void CGrModelX::Clear() {mModel->Clear();}
-bool CGrModelX::LoadFile(const wchar_t *filename) {return mModel->LoadFile(filename);}
+
+bool CGrModelX::LoadFile(const wchar_t *filename) 
+{
+    CancelLoad();
+    return mModel->LoadFile(filename);
+}
+
+void CGrModelX::SetThreadPool(CGrThreadPool *pool) {mModel->SetThreadPool(pool);}
 
 void CGrModelX::SetTransform(const CGrTransform &t) {mModel->SetTransform(t);}
 void CGrModelX::Draw() {mModel->Draw();}
 void CGrModelX::Draw(IRenderer *renderer) {mModel->Draw(renderer);}
+void CGrModelX::DrawPose(const CGrTransform *absolute) {mModel->DrawPose(absolute);}
+void CGrModelX::DrawPose(IRenderer *renderer, const CGrTransform *absolute) {mModel->DrawPose(renderer, absolute);}
 
 bool CGrModelX::IntersectionTest(const CGrSphere &sphere)
 {return mModel->IntersectionTest(sphere);}
 void CGrModelX::ComputeBonesAbsolute() {mModel->ComputeBonesAbsolute();}
+unsigned CGrModelX::GetPoseGeneration() const {return mModel->GetPoseGeneration();}
+void CGrModelX::ComputeBonesAbsolute(const CGrTransform &t, const CGrTransform *local, CGrTransform *absolute) const
+{mModel->ComputeBonesAbsolute(t, local, absolute);}
 
 const wchar_t *CGrModelX::GetError() const {return mModel->GetError();}
 CGrModelX::IBone *CGrModelX::GetBone(const wchar_t *name) {return mModel->GetBone(name);}
+CGrModelX::BoneId CGrModelX::ResolveBone(const wchar_t *name) const {return mModel->ResolveBone(name);}
+const CGrTransform &CGrModelX::GetLocalTransform(BoneId bone) const {return mModel->GetLocalTransform(bone);}
+void CGrModelX::SetLocalTransform(BoneId bone, const CGrTransform &t) {mModel->SetLocalTransform(bone, t);}
+void CGrModelX::SetLocalTransforms(const BoneId *bones, const CGrTransform *t, int count)
+{mModel->SetLocalTransforms(bones, t, count);}
+int CGrModelX::GetTriangleCount() const {return mModel->GetTriangleCount();}
+int CGrModelX::GetMeshCount() const {return mModel->GetMeshCount();}
+int CGrModelX::GetMeshBone(int mesh) const {return mModel->GetMeshBone(mesh);}
+int CGrModelX::GetBoneCount() const {return mModel->GetBoneCount();}
+int CGrModelX::GetBoneParent(int bone) const {return mModel->GetBoneParent(bone);}
+CGrModelX::IBone *CGrModelX::GetBone(int bone) {return mModel->GetBone(bone);}
 
 
 CGrModelX::IEffect::IEffect() {}
@@ -39,6 +64,34 @@ CGrModelX::IRenderer::~IRenderer() {}
 
 void CGrModelX::IRenderer::NewMesh(const wchar_t *name) {}
 
+//
+// Name :         CGrModelX::IRenderer::DrawMeshPart()
+// Description :  Default implementation that sends a mesh part to the
+//                renderer one vertex at a time. The vertex order within
+//                each triangle is reversed, since the model is clockwise.
+//
+void CGrModelX::IRenderer::DrawMeshPart(const MeshPart &part)
+{
+    float *vertices = const_cast<float *>(part.mVertices);
+    float *normals = const_cast<float *>(part.mNormals);
+    float *tcoords = const_cast<float *>(part.mTcoords);
+    const int *indices = part.mIndices;
+
+    BeginTriangles();
+    for(int t=0;  t<part.mNumTriangles * 3;  t+=3)
+    {
+        for(int c=2;  c>=0;  c--)
+        {
+            int ndx = indices[t + c];
+            if(tcoords != NULL)
+                TexCoord2fv(&tcoords[ndx * 2]);
+            Normal3fv(&normals[ndx * 3]);
+            Vertex3fv(&vertices[ndx * 3]);
+        }
+    }
+    EndTriangles();
+}
+
 
 CGrModelX::IBone::IBone() {}
 CGrModelX::IBone::~IBone() {}
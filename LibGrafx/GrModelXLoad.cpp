@@ -0,0 +1,275 @@
+#include "StdAfx.h"
+
+#include "grafx.h"
+#include "GrModelXp.h"
+#include <process.h>
+#include <algorithm>
+
+//! \cond ignore
+
+//
+// class CGrModelXLoadp
+// The state of one background load, shared by the CGrModelXLoad
+// objects that refer to it and the thread doing the loading. It is
+// deleted when the last of them releases it.
+//
+class CGrModelXLoadp
+{
+public:
+    CGrModelXLoadp(CGrModelX *target, CGrThreadPool *pool, const wchar_t *filename);
+    ~CGrModelXLoadp();
+
+    void AddRef() {InterlockedIncrement(&mRefs);}
+    void Release() {if(InterlockedDecrement(&mRefs) == 0) delete this;}
+
+    void Start();
+
+    volatile LONG mRefs;
+
+    // The model to put the result in. Only used on the thread that
+    // uses the model. NULL once the load no longer belongs to it.
+    CGrModelX *mTarget;
+
+    // The model being loaded, NULL once it is given to the target
+    CGrModelXp *mModel;
+    CGrModelXp::LoadStatus mStatus;
+    std::wstring mFilename;
+
+    // Set when the load finishes
+    HANDLE mDone;
+    bool mResult;
+    std::wstring mError;
+
+private:
+    CGrModelXLoadp(const CGrModelXLoadp &);
+    CGrModelXLoadp &operator=(const CGrModelXLoadp &);
+
+    void Run();
+    static unsigned __stdcall ThreadProc(void *param);
+};
+
+
+CGrModelXLoadp::CGrModelXLoadp(CGrModelX *target, CGrThreadPool *pool, const wchar_t *filename)
+{
+    mRefs = 1;
+    mTarget = target;
+    mModel = new CGrModelXp();
+    mModel->SetThreadPool(pool);
+    mFilename = filename;
+    mDone = CreateEvent(NULL, TRUE, FALSE, NULL);
+    mResult = false;
+}
+
+
+CGrModelXLoadp::~CGrModelXLoadp()
+{
+    delete mModel;
+    CloseHandle(mDone);
+}
+
+
+//
+// Name :         CGrModelXLoadp::Start()
+// Description :  Start the load on its own thread. The thread holds
+//                a reference until it is done. If no thread can be
+//                created, the load is done here.
+//
+void CGrModelXLoadp::Start()
+{
+    AddRef();
+    HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, ThreadProc, this, 0, NULL);
+    if(thread != NULL)
+    {
+        CloseHandle(thread);
+        return;
+    }
+
+    Release();
+    Run();
+}
+
+
+unsigned __stdcall CGrModelXLoadp::ThreadProc(void *param)
+{
+    CGrModelXLoadp *load = (CGrModelXLoadp *)param;
+    load->Run();
+    load->Release();
+    return 0;
+}
+
+
+void CGrModelXLoadp::Run()
+{
+    mResult = mModel->LoadFile(mFilename.c_str(), &mStatus);
+    if(!mResult)
+        mError = mModel->GetError();
+
+    SetEvent(mDone);
+}
+
+//! \endcond
+
+
+//
+// CGrModelXLoad
+//
+
+CGrModelXLoad::CGrModelXLoad()
+{
+    mLoad = NULL;
+}
+
+CGrModelXLoad::CGrModelXLoad(CGrModelXLoadp *load)
+{
+    mLoad = load;
+    if(mLoad != NULL)
+        mLoad->AddRef();
+}
+
+CGrModelXLoad::CGrModelXLoad(const CGrModelXLoad &load)
+{
+    mLoad = load.mLoad;
+    if(mLoad != NULL)
+        mLoad->AddRef();
+}
+
+CGrModelXLoad::~CGrModelXLoad()
+{
+    if(mLoad != NULL)
+        mLoad->Release();
+}
+
+CGrModelXLoad &CGrModelXLoad::operator=(const CGrModelXLoad &load)
+{
+    if(load.mLoad != NULL)
+        load.mLoad->AddRef();
+
+    if(mLoad != NULL)
+        mLoad->Release();
+
+    mLoad = load.mLoad;
+    return *this;
+}
+
+
+bool CGrModelXLoad::IsValid() const {return mLoad != NULL;}
+
+bool CGrModelXLoad::IsReady() const
+{
+    return mLoad != NULL && WaitForSingleObject(mLoad->mDone, 0) == WAIT_OBJECT_0;
+}
+
+void CGrModelXLoad::Wait() const
+{
+    if(mLoad != NULL)
+        WaitForSingleObject(mLoad->mDone, INFINITE);
+}
+
+
+//
+// Name :         CGrModelXLoad::Get()
+// Description :  Wait for the load, then exchange the loaded model
+//                with the one in the target. What the target had is
+//                destroyed here, on the thread that uses the model.
+// Returns :      true if the load succeeded
+//
+bool CGrModelXLoad::Get()
+{
+    if(mLoad == NULL)
+        return false;
+
+    Wait();
+
+    CGrModelX *target = mLoad->mTarget;
+    if(target != NULL && target->mLoad == mLoad)
+    {
+        if(mLoad->mResult)
+        {
+            // Keep the transform set on the target, as LoadFile() does
+            mLoad->mModel->SetTransform(target->mModel->GetTransform());
+
+            // Keep the generation going up so anything that
+            // cached the old pose sees the new one as changed
+            mLoad->mModel->SetPoseGeneration(target->mModel->GetPoseGeneration() + 1);
+            std::swap(target->mModel, mLoad->mModel);
+            delete mLoad->mModel;
+            mLoad->mModel = NULL;
+        }
+
+        target->CancelLoad();
+    }
+
+    return mLoad->mResult;
+}
+
+
+double CGrModelXLoad::GetProgress() const
+{
+    if(mLoad == NULL)
+        return 0;
+
+    if(IsReady())
+        return 1;
+
+    LONG done = mLoad->mStatus.mDone;
+    LONG total = mLoad->mStatus.mTotal;
+    if(total <= 0)
+        return 0;
+
+    return done < total ? double(done) / double(total) : 1.;
+}
+
+
+void CGrModelXLoad::Cancel()
+{
+    if(mLoad != NULL)
+        InterlockedExchange(&mLoad->mStatus.mCancel, 1);
+}
+
+
+const wchar_t *CGrModelXLoad::GetError() const
+{
+    if(mLoad == NULL || !IsReady())
+        return L"";
+
+    return mLoad->mError.c_str();
+}
+
+
+//
+// CGrModelX
+//
+
+//
+// Name :         CGrModelX::LoadFileAsync()
+// Description :  Start loading a file into a new model on another
+//                thread. The load belongs to this model until it is
+//                passed to Get() or another load is started.
+//
+CGrModelXLoad CGrModelX::LoadFileAsync(const wchar_t *filename)
+{
+    CancelLoad();
+
+    mLoad = new CGrModelXLoadp(this, mModel->GetThreadPool(), filename);
+    mLoad->Start();
+
+    return CGrModelXLoad(mLoad);
+}
+
+
+//
+// Name :         CGrModelX::CancelLoad()
+// Description :  Cancel any background load that still belongs to
+//                this model and let it go. Nothing happens if it
+//                already finished.
+//
+void CGrModelX::CancelLoad()
+{
+    if(mLoad == NULL)
+        return;
+
+    InterlockedExchange(&mLoad->mStatus.mCancel, 1);
+    mLoad->mTarget = NULL;
+    mLoad->Release();
+    mLoad = NULL;
+}
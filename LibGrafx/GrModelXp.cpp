@@ -1,64 +1,130 @@
 #include "StdAfx.h"
 #include "GrModelXp.h"
-#include <wchar.h>
-#include "xml-noexport/xmlhelp.h"
+#include <cstring>
+#include <algorithm>
+#include "xml-noexport/XmlNumbers.h"
 
 using namespace std;
 
-inline bool GetXmlAttribute(IXMLDOMNamedNodeMap *attributes, const wchar_t *name, CGrTransform &transform)
+// Progress is counted in kilobytes so it fits in a LONG
+static LONG Kilobytes(unsigned long long bytes) {return LONG(bytes / 1024);}
+
+//
+// class CLoadPool
+// The pool set on the model, or if there is none, one created
+// the first time it is needed and destroyed with this object.
+//
+class CLoadPool
+{
+public:
+    CLoadPool(CGrThreadPool *pool) : mPool(pool), mOwned(NULL) {}
+    ~CLoadPool() {delete mOwned;}
+
+    CGrThreadPool *operator->()
+    {
+        if(mPool == NULL)
+            mPool = mOwned = new CGrThreadPool();
+
+        return mPool;
+    }
+
+private:
+    CLoadPool(const CLoadPool &);
+    CLoadPool &operator=(const CLoadPool &);
+
+    CGrThreadPool *mPool;
+    CGrThreadPool *mOwned;
+};
+
+static bool XmlGetAttribute(CXmlPullParser &xml, const char *name, CGrTransform &transform)
 {
-    IXMLDOMNode *node;
-    CComBSTR nameB = name;
-    attributes->getNamedItem(nameB, &node);
-    if(node == NULL)
+    const char *s = xml.GetAttribute(name);
+    if(s == NULL)
         return false;
 
-    CComVariant valueV;
-    node->get_nodeValue(&valueV);
-    std::wstringstream str(valueV.bstrVal);
-    for(int r=0;  r<4; r++)
+    double m[16];
+    int n = XmlScanDoubles(s, m, 16);
+    for(int i=0;  i<n;  i++)
     {
-        for (int c=0;  c<4;  c++)
-        {
-            str >> transform.M(r, c);
-        }
+        transform.M(i / 4, i % 4) = m[i];
     }
 
     return true;
 }
 
-inline bool GetXmlAttribute(IXMLDOMNamedNodeMap *attributes, const wchar_t *name, CGrVector &v)
+static void XmlGetColor(CXmlPullParser &xml, const char *name, float *color)
 {
-    IXMLDOMNode *node;
-    CComBSTR nameB = name;
-    attributes->getNamedItem(nameB, &node);
-    if(node == NULL)
-        return false;
+    color[0] = color[1] = color[2] = color[3] = 0;
+
+    const char *s = xml.GetAttribute(name);
+    if(s == NULL)
+        return;
 
-    CComVariant valueV;
-    node->get_nodeValue(&valueV);
-    std::wstringstream str(valueV.bstrVal);
-    double x, y, z, w;
-    str >> x >> y >> z >> w;
-    v.Set(x, y, z, w);
+    XmlScanFloats(s, color, 3);
+    color[3] = 1;
+}
 
-    return true;
+//
+// Name :         CountVertexElements()
+// Description :  Count the v elements in the text of a vertices
+//                element, so the buffer can be sized before parsing.
+//
+static size_t CountVertexElements(const char *text, size_t size)
+{
+    size_t count = 0;
+    const char *end = text + size;
+    for(const char *p=text;  p + 2 < end;  p++)
+    {
+        p = (const char *)memchr(p, '<', end - p - 2);
+        if(p == NULL)
+            break;
+
+        if(p[1] == 'v' && (p[2] == ' ' || p[2] == '\t' || p[2] == '\r' || p[2] == '\n' || p[2] == '/' || p[2] == '>'))
+            count++;
+    }
+
+    return count;
 }
 
-static void ToXYZ(wstring &v, float &x, float &y, float &z)
+//
+// Name :         XmlNextChild()
+// Description :  Advance to the next child element of the element
+//                at depth. Anything below the children is skipped.
+// Returns :      false at the end tag of the element or on an error
+//
+static bool XmlNextChild(CXmlPullParser &xml, int depth)
 {
-    // Find the two spaces
-    const wchar_t *vs = v.c_str();
-    wchar_t *vs2;
-    x = (float)wcstod(vs, &vs2);
-    y = (float)wcstod(vs2, &vs2);
-    z = (float)wcstod(vs2, NULL);
+    while(true)
+    {
+        CXmlPullParser::Event event = xml.Next();
+        if(event == CXmlPullParser::StartElement)
+        {
+            if(xml.GetDepth() == depth + 1)
+                return true;
+
+            xml.SkipElement();
+        }
+        else if(event == CXmlPullParser::EndElement)
+        {
+            if(xml.GetDepth() < depth)
+                return false;
+        }
+        else
+        {
+            return false;
+        }
+    }
 }
 
 CGrModelXp::CGrModelXp(void)
 {
+    mPool = NULL;
+    mSections = NULL;
     mRootBone = -1;     // Not known
     mTransform.SetIdentity();
+    mFirstDirty = 0;
+    mRootDirty = true;
+    mGeneration = 0;
 }
 
 CGrModelXp::~CGrModelXp(void)
@@ -72,6 +138,17 @@ void CGrModelXp::Draw()
     // Compute the bones
     ComputeBonesAbsolute();
 
+    DrawPose(NULL);
+}
+
+
+//
+// Name :         CGrModelXp::DrawPose()
+// Description :  Draw with OpenGL using a set of absolute bone
+//                transforms, or the bones own if absolute is NULL.
+//
+void CGrModelXp::DrawPose(const CGrTransform *absolute)
+{
     // Settings for these models
     glFrontFace(GL_CW);
     glEnable(GL_NORMALIZE);
@@ -85,7 +162,7 @@ void CGrModelXp::Draw()
         Mesh *mesh = *m;
 
         glPushMatrix();
-        glTransform(mBones[mesh->mBone].mAbsoluteTransform);
+        glTransform(BoneAbsolute(absolute, mesh->mBone));
 
         // Loop over the mesh parts
         for(std::vector<MeshPart>::iterator p=mesh->mParts.begin();  p!=mesh->mParts.end();  p++)
@@ -114,7 +191,7 @@ void CGrModelXp::Draw()
                             0,          // Stride (assume packed)
                             &vbuffer->mNormals[part->mBaseVertex * 3]);
 
-            bool hasTexture = !vbuffer->mTcoords.empty() && effect->mTexture != NULL;
+            bool hasTexture = vbuffer->mTcoords != NULL && effect->mTexture != NULL;
             if(hasTexture)
             {
                 glEnableClientState(GL_TEXTURE_COORD_ARRAY);
@@ -153,6 +230,12 @@ void CGrModelXp::Draw(CGrModelX::IRenderer *renderer)
     // Compute the bones
     ComputeBonesAbsolute();
 
+    DrawPose(renderer, NULL);
+}
+
+
+void CGrModelXp::DrawPose(CGrModelX::IRenderer *renderer, const CGrTransform *absolute)
+{
     renderer->PushMatrix();
 
     // Loop over the meshes
@@ -163,7 +246,7 @@ void CGrModelXp::Draw(CGrModelX::IRenderer *renderer)
         renderer->NewMesh(mesh->mName.c_str());
 
         renderer->PushMatrix();
-        renderer->MultMatrix(mBones[mesh->mBone].mAbsoluteTransform);
+        renderer->MultMatrix(BoneAbsolute(absolute, mesh->mBone));
 
         // Loop over the mesh parts
         for(std::vector<MeshPart>::iterator p=mesh->mParts.begin();  p!=mesh->mParts.end();  p++)
@@ -177,41 +260,22 @@ void CGrModelXp::Draw(CGrModelX::IRenderer *renderer)
             // Set the material for the effect
             renderer->SetEffect(effect);
 
-            bool hasTexture = !vbuffer->mTcoords.empty() && effect->mTexture != NULL;
-            float *tcoords = NULL;
-            if(hasTexture)
-            {
-                tcoords = &vbuffer->mTcoords[part->mBaseVertex * 2];
-            }
-
-            float *vertices = &vbuffer->mVertices[part->mBaseVertex * 3];
-            float *normals = &vbuffer->mNormals[part->mBaseVertex * 3];
-            int *indices = &ibuffer->mIndices[part->mStartIndex];
-
-            renderer->BeginTriangles();
-            for(int t=0;  t<part->mNumTriangles * 3;  t+=3)
-            {
-                int ndx;
-
-                ndx = indices[t + 2];
-                if(tcoords != NULL)
-                    renderer->TexCoord2fv(&tcoords[ndx * 2]);
-                renderer->Normal3fv(&normals[ndx * 3]);
-                renderer->Vertex3fv(&vertices[ndx * 3]);
-
-                ndx = indices[t + 1];
-                if(tcoords != NULL)
-                    renderer->TexCoord2fv(&tcoords[ndx * 2]);
-                renderer->Normal3fv(&normals[ndx * 3]);
-                renderer->Vertex3fv(&vertices[ndx * 3]);
-
-                ndx = indices[t];
-                if(tcoords != NULL)
-                    renderer->TexCoord2fv(&tcoords[ndx * 2]);
-                renderer->Normal3fv(&normals[ndx * 3]);
-                renderer->Vertex3fv(&vertices[ndx * 3]);
-            }
-            renderer->EndTriangles();
+            // Describe the part to the renderer
+            CGrModelX::IRenderer::MeshPart batch;
+            batch.mVertices = &vbuffer->mVertices[part->mBaseVertex * 3];
+            batch.mNormals = &vbuffer->mNormals[part->mBaseVertex * 3];
+            batch.mTcoords = NULL;
+            if(vbuffer->mTcoords != NULL && effect->mTexture != NULL)
+                batch.mTcoords = &vbuffer->mTcoords[part->mBaseVertex * 2];
+            batch.mIndices = &ibuffer->mIndices[part->mStartIndex];
+            batch.mNumVertices = part->mNumVertices;
+            batch.mNumTriangles = part->mNumTriangles;
+            batch.mBaseVertex = part->mBaseVertex;
+            batch.mStartIndex = part->mStartIndex;
+            batch.mEffect = effect;
+            batch.mTransform = &BoneAbsolute(absolute, mesh->mBone);
+
+            renderer->DrawMeshPart(batch);
 
             renderer->EndEffect(effect);
         }
@@ -284,12 +348,20 @@ void CGrModelXp::Clear()
     // Destroy any bones
     mRootBone = -1;
     mBones.clear();
+    mRootDirty = true;
+    PoseChanged(0);
     mEffects.clear();
     mVertices.clear();
     mIndices.clear();
-    mTextures.clear();
+    mBoneNames.clear();
     mBonesByName.clear();
 
+    // Give back the textures
+    for(map<wstring, CGrTexture *>::iterator t=mTextures.begin();  t!=mTextures.end();  t++)
+        CGrTextureCache::GetShared().Release(t->second);
+
+    mTextures.clear();
+
     // Destroy any allocated meshes
     for(vector<Mesh *>::iterator m=mMeshes.begin();  m!=mMeshes.end();  m++)
     {
@@ -297,6 +369,33 @@ void CGrModelXp::Clear()
     }
 
     mMeshes.clear();
+
+    // Nothing refers to the cache now
+    mCache.Close();
+}
+
+
+//
+// Name :         CGrModelXp::VertexBuffer::Bind()
+// Description :  Point the views at the vectors of this buffer.
+//                Texture coordinates are only used if every vertex
+//                has them.
+//
+void CGrModelXp::VertexBuffer::Bind()
+{
+    mNumVertices = (int)mVertexData.size() / 3;
+    mVertices = mVertexData.empty() ? NULL : &mVertexData[0];
+    mNormals = mNormalData.empty() ? NULL : &mNormalData[0];
+    mTcoords = NULL;
+    if(!mTcoordData.empty() && mTcoordData.size() == mNumVertices * 2)
+        mTcoords = &mTcoordData[0];
+}
+
+
+void CGrModelXp::IndexBuffer::Bind()
+{
+    mNumIndices = (int)mIndexData.size();
+    mIndices = mIndexData.empty() ? NULL : &mIndexData[0];
 }
 
 
@@ -304,11 +403,16 @@ void CGrModelXp::Clear()
 // Name :         CGrModelXp::LoadFile()
 // Description :  Load the model from an XML file.
 // Parameters :   filename - Name of the file to load from
+//                status - Progress and cancellation or NULL
 // Returns :      true if successful
 //                If false, an error message is stored in mErrorMessage
 //
-bool CGrModelXp::LoadFile(const wchar_t *filename)
+bool CGrModelXp::LoadFile(const wchar_t *filename, LoadStatus *status)
 {
+    LoadStatus local;
+    if(status == NULL)
+        status = &local;
+
     // Make a path to where this file is located
     wstring path(filename);
     int i;
@@ -324,485 +428,738 @@ bool CGrModelXp::LoadFile(const wchar_t *filename)
     if(i < 0)
         path = L"";
 
-    CXmlDocument xml;
+    // The first stage reads everything but the buffers and textures.
+    // Use the compiled cache next to the file if it is current, 
+    // which has the buffers as well.
+    CGrMappedFile document;
+    vector<Section> sections;
+    wstring cachename = wstring(filename) + L"b";
+    bool cached = CacheLoad(cachename.c_str(), filename);
+    if(!cached && !XmlParse(filename, document, sections, status))
+        return false;
 
-    if(!xml.OpenXmlDocument(filename, L"model"))
+    // Once we know the effects, we find all of the 
+    // necessary textures and load them as well.
+    vector<TextureFile> textures;
+    FindTextures(path, textures, status);
+
+    // The first stage read everything outside of the sections
+    LONG first = Kilobytes(document.GetSize());
+    for(vector<Section>::const_iterator sc=sections.begin();  sc!=sections.end();  sc++)
+        first -= Kilobytes(sc->mEnd - sc->mBegin);
+
+    InterlockedExchangeAdd(&status->mDone, first);
+
+    if(!LoadParallel(document.GetData(), sections, textures, status))
+    {
+        wstring msg = mErrorMessage;
+        Clear();
+        return Error(msg.c_str());
+    }
+
+    for(vector<Effect>::iterator e=mEffects.begin(); e!=mEffects.end(); e++)
+    {
+        if(!e->mTextureFile.empty())
+            e->mTexture = mTextures[e->mTextureFile];
+    }
+
+    if(!cached)
+    {
+        // The buffers are in their final place now
+        for(vector<VertexBuffer>::iterator v=mVertices.begin();  v!=mVertices.end();  v++)
+            v->Bind();
+
+        for(vector<IndexBuffer>::iterator ib=mIndices.begin();  ib!=mIndices.end();  ib++)
+            ib->Bind();
+
+        CacheSave(cachename.c_str(), filename);
+    }
+
+    return true;
+}
+
+
+//
+// Name :         CGrModelXp::XmlParse()
+// Description :  Parse the XML file. A UTF-8 file is mapped into
+//                document, and the vertex and index buffers are
+//                skipped. Where they are is put in sections for
+//                LoadParallel(). Anything else is parsed as it is 
+//                reached.
+// Returns :      true if successful
+//
+bool CGrModelXp::XmlParse(const wchar_t *filename, CGrMappedFile &document, vector<Section> &sections, LoadStatus *status)
+{
+    CXmlPullParser xml;
+    if(document.Open(filename))
+    {
+        xml.OpenMemory(document.GetData(), document.GetSize());
+        InterlockedExchangeAdd(&status->mTotal, Kilobytes(document.GetSize()));
+    }
+    else if(!xml.Open(filename))
+    {
         return Error(xml.GetErrorMessage());
+    }
+
+    // Find the root element
+    if(xml.Next() != CXmlPullParser::StartElement || !xml.IsName("model"))
+    {
+        if(xml.GetEvent() == CXmlPullParser::Error)
+            return Error(xml.GetErrorMessage());
+
+        return Error(L"XMODL file does not have a model root element");
+    }
 
-    if(!XmlTestVersion(&xml, xml.GetRootNode()))
+    const char *version = xml.GetAttribute("version");
+    if(version == NULL || strcmp(version, "2.0") != 0)
         return Error(L"XMODL file is not the correct version. Version 2.0 required");
 
     Clear();
 
-    XmlLoad(&xml, xml.GetRootNode());
+    // Converted UTF-16 is not where the file offsets say it is,
+    // so it is parsed in one pass
+    mSections = document.IsOpen() && !xml.IsUtf16() ? &sections : NULL;
 
-    // Once we have loaded all of the meshes, we find all of the 
-    // necessary textures and load them as well.
-    // Loop over the meshes
-    for(vector<Mesh *>::iterator m=mMeshes.begin();  m!=mMeshes.end();  m++)
+    bool loaded = XmlLoad(xml, status);
+    mSections = NULL;
+
+    if(!loaded)
     {
-        Mesh *mesh = *m;
+        wstring msg = status->IsCancelled() ? L"Load cancelled" : xml.GetErrorMessage();
+        Clear();
+        return Error(msg.c_str());
+    }
+
+    return true;
+}
+
+
+//
+// Name :         CGrModelXp::FindTextures()
+// Description :  Find the textures the effects use. Each file is
+//                put in textures to be acquired once.
+//
+void CGrModelXp::FindTextures(const wstring &path, vector<TextureFile> &textures, LoadStatus *status)
+{
+    // Loop over the effects
+    for(vector<Effect>::iterator e=mEffects.begin(); e!=mEffects.end(); e++)
+    {
+        Effect *effect = &(*e);
+
+        // Does this effect use a texture?
+        if(effect->mTextureFile.empty())
+            continue;
 
-        // Loop over the effects
-        for(vector<Effect>::iterator e=mEffects.begin(); e!=mEffects.end(); e++)
+        // Do we know it already?
+        map<wstring, CGrTexture *>::iterator t=mTextures.find(effect->mTextureFile);
+        if(t == mTextures.end())
         {
-            Effect *effect = &(*e);
+            t = mTextures.insert(make_pair(effect->mTextureFile, (CGrTexture *)NULL)).first;
 
-            // Does this effect use a texture?
-            if(!effect->mTextureFile.empty())
-            {
-                // Do we know it already?
-                std::map<wstring, CGrTexture>::iterator t=mTextures.find(effect->mTextureFile);
-                if(t == mTextures.end())
-                {
-                    // Load the texture
-                    mTextures[effect->mTextureFile] = CGrTexture();
-                    effect->mTexture = &mTextures[effect->mTextureFile];
-                    wstring filepath = path + effect->mTextureFile;
-                    effect->mTexture->LoadFile(filepath.c_str());
-                }
-                else
-                {
-                    // We have already loaded it
-                    effect->mTexture = &t->second;
-                }
+            TextureFile texture;
+            texture.mPath = path + effect->mTextureFile;
+            texture.mTexture = &t->second;
+            texture.mSize = 1;
 
+            // Progress counts the size of the image files
+            WIN32_FILE_ATTRIBUTE_DATA info;
+            if(GetFileAttributesExW(texture.mPath.c_str(), GetFileExInfoStandard, &info))
+            {
+                unsigned long long size = (unsigned long long)info.nFileSizeHigh << 32 | info.nFileSizeLow;
+                texture.mSize = max(Kilobytes(size), LONG(1));
             }
+
+            textures.push_back(texture);
+            InterlockedExchangeAdd(&status->mTotal, texture.mSize);
         }
     }
-
-    return true;
 }
 
+
 //
-// Name :         CGrModelXp::XmlTestVersion()
-// Description :  Test to ensure this file version can be read by this reader version
+// One task of the second load stage, run on a pool thread. Each
+// section fills its own buffer and each file its own texture, so
+// the tasks do not interfere with each other.
 //
-bool CGrModelXp::XmlTestVersion(CXmlDocument *xml, IXMLDOMNode *topNode)
+struct CGrModelXp::StageLoader
 {
-    CComPtr<IXMLDOMNamedNodeMap> attributes;
-    topNode->get_attributes(&attributes);
-    wstring name;
-    if(!GetXmlAttribute(attributes, L"version", name))
-        return false;
+    CGrModelXp *mModel;
+    const char *mDocument;
+    vector<Section> *mSections;
+    vector<TextureFile> *mTextures;
+    LoadStatus *mStatus;
 
-    // Versions we can read:
-    if(name == L"2.0")
-        return true;
+    void operator()(int i, int worker) const
+    {
+        if(mStatus->IsCancelled())
+            return;
 
-    return false;
-}
+        if(i < (int)mTextures->size())
+            LoadTexture((*mTextures)[i]);
+        else
+            LoadSection((*mSections)[i - mTextures->size()]);
+    }
 
+    void LoadTexture(TextureFile &texture) const
+    {
+        *texture.mTexture = CGrTextureCache::GetShared().Acquire(texture.mPath.c_str());
+        InterlockedExchangeAdd(&mStatus->mDone, texture.mSize);
+    }
+
+    void LoadSection(Section &section) const
+    {
+        CXmlPullParser xml;
+        const char *text = mDocument + section.mBegin;
+        size_t size = section.mEnd - section.mBegin;
+        xml.OpenMemory(text, size, section.mBegin);
+        if(xml.Next() == CXmlPullParser::StartElement)
+        {
+            if(section.mIndices)
+                mModel->XmlLoadIndices(xml, section.mBuffer);
+            else
+                mModel->XmlLoadVertices(xml, section.mBuffer, CountVertexElements(text, size));
+        }
+
+        if(xml.GetEvent() == CXmlPullParser::Error)
+            section.mError = xml.GetErrorMessage();
+
+        InterlockedExchangeAdd(&mStatus->mDone, Kilobytes(section.mEnd - section.mBegin));
+    }
+
+    static bool Larger(const Section &a, const Section &b)
+    {
+        return a.mEnd - a.mBegin > b.mEnd - b.mBegin;
+    }
+};
 
 
+//
+// Name :         CGrModelXp::LoadParallel()
+// Description :  The second load stage. The textures are acquired
+//                and the sections found by the first stage are parsed,
+//                all as one batch on the pool. The textures and then
+//                the largest sections are started first, so that no
+//                long task is left running alone at the end.
+//                Nothing here uses OpenGL. The textures are sent to 
+//                OpenGL the first time they are drawn.
+// Returns :      true if successful
+//
+bool CGrModelXp::LoadParallel(const char *document, vector<Section> &sections, vector<TextureFile> &textures, LoadStatus *status)
+{
+    sort(sections.begin(), sections.end(), StageLoader::Larger);
+
+    StageLoader loader;
+    loader.mModel = this;
+    loader.mDocument = document;
+    loader.mSections = &sections;
+    loader.mTextures = &textures;
+    loader.mStatus = status;
+
+    int count = int(textures.size() + sections.size());
+    if(count == 1)
+    {
+        loader(0, 0);
+    }
+    else if(count > 1)
+    {
+        CLoadPool pool(mPool);
+        pool->ParallelFor(count, 1, loader);
+    }
+
+    if(status->IsCancelled())
+        return Error(L"Load cancelled");
+
+    for(vector<Section>::const_iterator sc=sections.begin();  sc!=sections.end();  sc++)
+    {
+        if(!sc->mError.empty())
+            return Error(sc->mError.c_str());
+    }
+
+    return true;
+}
+
 //
 // Name :         CGrModelXp::ComputeBonesAbsolute()
 // Description :  The bones as loaded by the model are relative to the
 //                parent bone. Create a list of bones that is relative to
 //                the world, an absolute set of bone transforms.
 //
+//                Only bones whose local transform changed and the bones
+//                below them are computed. If nothing changed since the
+//                last call, this returns immediately.
+//
 void CGrModelXp::ComputeBonesAbsolute()
 {
-    // This is simplified because Microsoft sorted the bones into
-    // topological order.
-    for(unsigned int i=0;  i<mBones.size();  i++)
+    if(mFirstDirty < 0)
+        return;
+
+    // A bone is computed if it changed itself or its parent was
+    // computed in this pass, which is simplified because Microsoft 
+    // sorted the bones into topological order.
+    unsigned generation = mGeneration + 1;
+    for(unsigned int i=mFirstDirty;  i<mBones.size();  i++)
     {
-        if(mBones[i].mParent < 0)
+        Bone &bone = mBones[i];
+        if(bone.mParent < 0)
         {
             // This bone has no parent
-            mBones[i].ComputeAbsoluteTransform(mTransform);
+            if(!bone.mDirty && !mRootDirty)
+                continue;
+
+            bone.ComputeAbsoluteTransform(mTransform);
         }
         else
         {
             // This bone is the product of the bone
             // transform and it's parent transform
-            mBones[i].ComputeAbsoluteTransform(mBones[mBones[i].mParent].mAbsoluteTransform);
+            const Bone &parent = mBones[bone.mParent];
+            if(!bone.mDirty && parent.mGeneration != generation)
+                continue;
+
+            bone.ComputeAbsoluteTransform(parent.mAbsoluteTransform);
         }
+
+        bone.mDirty = false;
+        bone.mGeneration = generation;
     }
+
+    mFirstDirty = -1;
+    mRootDirty = false;
+    mGeneration = generation;
 }
 
 
 
-CGrModelX::IBone *CGrModelXp::GetBone(const wchar_t *name)
+//
+// Name :         CGrModelXp::ComputeBonesAbsolute()
+// Description :  Evaluate a pose without changing the bones. The
+//                bones are placed relative to t times the model 
+//                transform, using the given local transforms or the
+//                bone local transforms if local is NULL.
+//
+void CGrModelXp::ComputeBonesAbsolute(const CGrTransform &t, const CGrTransform *local, CGrTransform *absolute) const
 {
-    map<wstring, int>::iterator bone = mBonesByName.find(name);
-    if(bone == mBonesByName.end())
-        return NULL;
+    CGrTransform root = t * mTransform;
+    for(unsigned int i=0;  i<mBones.size();  i++)
+    {
+        const Bone &bone = mBones[i];
+        const CGrTransform &parent = bone.mParent < 0 ? root : absolute[bone.mParent];
+        const CGrTransform &boneLocal = local != NULL ? local[i] : bone.GetLocalTransform();
+        absolute[i] = parent * bone.mTransform * boneLocal;
+    }
+}
+
 
-    return &mBones[bone->second];
+
+int CGrModelXp::GetTriangleCount() const
+{
+    int count = 0;
+    for(vector<Mesh *>::const_iterator m=mMeshes.begin();  m!=mMeshes.end();  m++)
+    {
+        const Mesh *mesh = *m;
+        for(std::vector<MeshPart>::const_iterator p=mesh->mParts.begin();  p!=mesh->mParts.end();  p++)
+        {
+            count += p->mNumTriangles;
+        }
+    }
+
+    return count;
+}
+
+
+CGrModelX::IBone *CGrModelXp::GetBone(const wchar_t *name)
+{
+    int bone = ResolveBone(name);
+    return bone >= 0 ? &mBones[bone] : NULL;
 }
 
 
-void CGrModelXp::XmlLoad(CXmlDocument *xml, IXMLDOMNode *topNode)
+//
+// Name :         CGrModelXp::ResolveBone()
+// Description :  Binary search of the bone indices sorted by name.
+//                If two bones have the same name, the later one is
+//                found, as the name map used to do.
+//
+int CGrModelXp::ResolveBone(const wchar_t *name) const
 {
-    CComPtr<IXMLDOMNode> node;
-    topNode->get_firstChild(&node);
-    for( ;  node != NULL;  NextNode(node))
+    int lo = 0;
+    int hi = (int)mBonesByName.size();
+    while(lo < hi)
     {
-        DOMNodeType nodeType;
-        CComBSTR nodeName;
+        int mid = (lo + hi) / 2;
+        if(wcscmp(mBones[mBonesByName[mid]].GetName(), name) <= 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
 
-        node->get_nodeType(&nodeType);
-        node->get_nodeName(&nodeName);
+    if(lo == 0 || wcscmp(mBones[mBonesByName[lo - 1]].GetName(), name) != 0)
+        return -1;
 
-        if(nodeType == NODE_ELEMENT)
-        {
-            if(nodeName == "bones")
-                XmlLoadBones(xml, node);
-            else if(nodeName == "effects")
-                XmlLoadEffects(xml, node);
-            else if(nodeName == "vertexbuffers")
-                XmlLoadVertexBuffers(xml, node);
-            else if(nodeName == "indexbuffers")
-                XmlLoadIndexBuffers(xml, node);
-            else if(nodeName == "meshes")
-                XmlLoadMeshes(xml, node);
-        }
+    return mBonesByName[lo - 1];
+}
+
+
+//
+// Name :         CGrModelXp::SetLocalTransforms()
+// Description :  Set many bone local transforms at once. Negative
+//                bone handles are skipped.
+//
+void CGrModelXp::SetLocalTransforms(const int *bones, const CGrTransform *t, int count)
+{
+    for(int i=0;  i<count;  i++)
+    {
+        if(bones[i] >= 0)
+            mBones[bones[i]].Bone::SetLocalTransform(t[i]);
     }
 }
 
 
+void CGrModelXp::SetBoneName(Bone &bone, const wchar_t *name)
+{
+    bone.mName = (int)mBoneNames.size();
+    mBoneNames.insert(mBoneNames.end(), name, name + wcslen(name) + 1);
+}
+
 
-void CGrModelXp::XmlLoadBones(CXmlDocument *xml, IXMLDOMNode *topNode)
+//
+// Name :         CGrModelXp::IndexBoneNames()
+// Description :  Sort the bone indices by name once the bones are
+//                loaded. The sort is stable, so bones with the same
+//                name stay in index order.
+//
+void CGrModelXp::IndexBoneNames()
 {
-    CComPtr<IXMLDOMNamedNodeMap> attributes;
-    topNode->get_attributes(&attributes);
-    GetXmlAttribute(attributes, L"root-bone", mRootBone);
+    mBonesByName.resize(mBones.size());
+    for(size_t i=0;  i<mBones.size();  i++)
+        mBonesByName[i] = (int)i;
 
-    CComPtr<IXMLDOMNode> node;
-    topNode->get_firstChild(&node);
-    for( ;  node != NULL;  NextNode(node))
+    BoneNameLess less;
+    less.mModel = this;
+    stable_sort(mBonesByName.begin(), mBonesByName.end(), less);
+}
+
+
+//
+// Name :         CGrModelXp::XmlLoad()
+// Description :  Load the contents of the model element.
+// Returns :      false if the document is not well formed
+//                or the load is cancelled
+//
+bool CGrModelXp::XmlLoad(CXmlPullParser &xml, const LoadStatus *status)
+{
+    int depth = xml.GetDepth();
+    while(XmlNextChild(xml, depth))
     {
-        DOMNodeType nodeType;
-        CComBSTR nodeName;
+        if(status->IsCancelled())
+            return false;
+
+        if(xml.IsName("bones"))
+            XmlLoadBones(xml);
+        else if(xml.IsName("effects"))
+            XmlLoadEffects(xml);
+        else if(xml.IsName("vertexbuffers"))
+            XmlLoadVertexBuffers(xml);
+        else if(xml.IsName("indexbuffers"))
+            XmlLoadIndexBuffers(xml);
+        else if(xml.IsName("meshes"))
+            XmlLoadMeshes(xml);
+        else
+            xml.SkipElement();
+    }
 
-        node->get_nodeType(&nodeType);
-        node->get_nodeName(&nodeName);
+    return xml.GetEvent() != CXmlPullParser::Error;
+}
 
-        if(nodeType == NODE_ELEMENT)
-        {
-            if(nodeName == "bone")
-                XmlLoadBone(xml, node);
-        }
+
+
+void CGrModelXp::XmlLoadBones(CXmlPullParser &xml)
+{
+    xml.GetAttribute("root-bone", mRootBone);
+
+    int depth = xml.GetDepth();
+    while(XmlNextChild(xml, depth))
+    {
+        if(xml.IsName("bone"))
+            XmlLoadBone(xml);
+        else
+            xml.SkipElement();
     }
+
+    IndexBoneNames();
 }
 
-void CGrModelXp::XmlLoadBone(CXmlDocument *xml, IXMLDOMNode *topNode)
+void CGrModelXp::XmlLoadBone(CXmlPullParser &xml)
 {
-    Bone bone;
+    mBones.push_back(Bone());
+    Bone &bone = mBones.back();
+    bone.mModel = this;
 
     // Attributes to load:  index, name, transform, parent
-    CComPtr<IXMLDOMNamedNodeMap> attributes;
-    topNode->get_attributes(&attributes);
-    GetXmlAttribute(attributes, L"index", bone.mIndex);
+    xml.GetAttribute("index", bone.mIndex);
     wstring name;
-    GetXmlAttribute(attributes, L"name", name);
-    bone.SetName(name.c_str());
+    xml.GetAttribute("name", name);
+    SetBoneName(bone, name.c_str());
 
     bone.mParent = -1;
-    GetXmlAttribute(attributes, L"parent", bone.mParent);
-    GetXmlAttribute(attributes, L"transform", bone.mTransform);
+    xml.GetAttribute("parent", bone.mParent);
+    XmlGetAttribute(xml, "transform", bone.mTransform);
 
-    mBonesByName[bone.GetName()] = (int)mBones.size();
-    mBones.push_back(bone);
+    xml.SkipElement();
 }
 
 
-void CGrModelXp::XmlLoadMeshes(CXmlDocument *xml, IXMLDOMNode *topNode)
+void CGrModelXp::XmlLoadMeshes(CXmlPullParser &xml)
 {
-    CComPtr<IXMLDOMNode> node;
-    topNode->get_firstChild(&node);
-    for( ;  node != NULL;  NextNode(node))
+    int depth = xml.GetDepth();
+    while(XmlNextChild(xml, depth))
     {
-        DOMNodeType nodeType;
-        CComBSTR nodeName;
-
-        node->get_nodeType(&nodeType);
-        node->get_nodeName(&nodeName);
-
-        if(nodeType == NODE_ELEMENT)
-        {
-            if(nodeName == "mesh")
-                XmlLoadMesh(xml, node);
-        }
+        if(xml.IsName("mesh"))
+            XmlLoadMesh(xml);
+        else
+            xml.SkipElement();
     }
 }
 
-void CGrModelXp::XmlLoadMesh(CXmlDocument *xml, IXMLDOMNode *topNode)
+void CGrModelXp::XmlLoadMesh(CXmlPullParser &xml)
 {
     // Create the mesh object
     Mesh *mesh = new Mesh();
-    CComPtr<IXMLDOMNamedNodeMap> attributes;
-    topNode->get_attributes(&attributes);
-    GetXmlAttribute(attributes, L"name", mesh->mName);
-    GetXmlAttribute(attributes, L"bone", mesh->mBone);
+    xml.GetAttribute("name", mesh->mName);
+    xml.GetAttribute("bone", mesh->mBone);
 
-    wstring bs;
-    if(GetXmlAttribute(attributes, L"bounding-sphere", bs))
+    const char *bs = xml.GetAttribute("bounding-sphere");
+    if(bs != NULL)
     {
-        wstringstream str(bs);
-        double x, y, z, r;
-        str >> x >> y >> z >> r;
-        mesh->mBoundingSphere.SetOrigin(CGrVector(x, y, z));
-        mesh->mBoundingSphere.SetRadius(r);
+        float s[4] = {0, 0, 0, 0};
+        XmlScanFloats(bs, s, 4);
+        mesh->mBoundingSphere.SetOrigin(CGrVector(s[0], s[1], s[2]));
+        mesh->mBoundingSphere.SetRadius(s[3]);
     }
 
+    // Add to list of meshes
+    mMeshes.push_back(mesh);
 
     // Now the parts of the mesh
-    // vertices, indices, parts
-    CComPtr<IXMLDOMNode> node;
-    topNode->get_firstChild(&node);
-    for( ;  node != NULL;  NextNode(node))
+    int depth = xml.GetDepth();
+    while(XmlNextChild(xml, depth))
     {
-        DOMNodeType nodeType;
-        CComBSTR nodeName;
-
-        node->get_nodeType(&nodeType);
-        node->get_nodeName(&nodeName);
-
-        if(nodeType == NODE_ELEMENT)
-        {
-            if(nodeName == "parts")
-                XmlLoadMeshParts(xml, node, mesh);
-        }
+        if(xml.IsName("parts"))
+            XmlLoadMeshParts(xml, mesh);
+        else
+            xml.SkipElement();
     }
-
-    // Add to list of meshes
-    mMeshes.push_back(mesh);
 }
 
 
-void CGrModelXp::XmlLoadVertexBuffers(CXmlDocument *xml, IXMLDOMNode *topNode)
+void CGrModelXp::XmlLoadVertexBuffers(CXmlPullParser &xml)
 {
     // Loop over the children of the vertexbuffer tag. Each will
     // be a vertex buffer we are adding to this mesh
-    CComPtr<IXMLDOMNode> node;
-    topNode->get_firstChild(&node);
-    for( ;  node != NULL;  NextNode(node))
+    int depth = xml.GetDepth();
+    while(XmlNextChild(xml, depth))
     {
-        DOMNodeType nodeType;
-        CComBSTR nodeName;
-
-        node->get_nodeType(&nodeType);
-        node->get_nodeName(&nodeName);
-
-        if(nodeType == NODE_ELEMENT)
+        if(xml.IsName("vertices"))
         {
-            if(nodeName == "vertices")
-                XmlLoadVertices(xml, node);
+            mVertices.push_back(VertexBuffer());
+            if(!XmlDefer(xml, false))
+                XmlLoadVertices(xml, (int)mVertices.size() - 1, 0);
+        }
+        else
+        {
+            xml.SkipElement();
         }
     }
 }
 
 
-void CGrModelXp::XmlLoadIndexBuffers(CXmlDocument *xml, IXMLDOMNode *topNode)
+void CGrModelXp::XmlLoadIndexBuffers(CXmlPullParser &xml)
 {
     // Loop over the children of the indexbuffer tag. Each will
     // be an index buffer we are adding to this mesh
-    CComPtr<IXMLDOMNode> node;
-    topNode->get_firstChild(&node);
-    for( ;  node != NULL;  NextNode(node))
+    int depth = xml.GetDepth();
+    while(XmlNextChild(xml, depth))
     {
-        DOMNodeType nodeType;
-        CComBSTR nodeName;
-
-        node->get_nodeType(&nodeType);
-        node->get_nodeName(&nodeName);
-
-        if(nodeType == NODE_ELEMENT)
-        {         
-            if(nodeName == "indices")
-                XmlLoadIndices(xml, node);
+        if(xml.IsName("indices"))
+        {
+            mIndices.push_back(IndexBuffer());
+            if(!XmlDefer(xml, true))
+                XmlLoadIndices(xml, (int)mIndices.size() - 1);
+        }
+        else
+        {
+            xml.SkipElement();
         }
     }
 }
 
 
-void CGrModelXp::XmlLoadVertices(CXmlDocument *xml, IXMLDOMNode *topNode)
+//
+// Name :         CGrModelXp::XmlDefer()
+// Description :  In the first pass over a mapped document, note 
+//                where a vertices or indices element is and skip
+//                over it. The buffer it will fill is the last one.
+// Returns :      false if the element should be loaded now
+//
+bool CGrModelXp::XmlDefer(CXmlPullParser &xml, bool indices)
 {
-    // Create a vertex buffer for the vertices
-    VertexBuffer vbuffer;
+    if(mSections == NULL)
+        return false;
+
+    Section section;
+    section.mIndices = indices;
+    section.mBuffer = indices ? (int)mIndices.size() - 1 : (int)mVertices.size() - 1;
+    section.mBegin = xml.GetTagOffset();
+    xml.SkipElementFast();
+    section.mEnd = xml.GetOffset();
+
+    mSections->push_back(section);
+    return true;
+}
+
+
+//
+// Name :         CGrModelXp::XmlLoadVertices()
+// Description :  The vertices are parsed directly into the vertex
+//                buffer. expected is the number of vertices, counted
+//                from the text when the element was deferred, or 0
+//                when it is not known. Then the buffer grows and is
+//                trimmed at the end.
+//
+void CGrModelXp::XmlLoadVertices(CXmlPullParser &xml, int vb, size_t expected)
+{
+    VertexBuffer &vbuffer = mVertices[vb];
+
+    vbuffer.mVertexData.reserve(expected * 3);
+    vbuffer.mNormalData.reserve(expected * 3);
 
     // Now the individual vertices
-    CComPtr<IXMLDOMNode> node;
-    topNode->get_firstChild(&node);
-    for( ;  node != NULL;  NextNode(node))
+    int depth = xml.GetDepth();
+    while(XmlNextChild(xml, depth))
     {
-        DOMNodeType nodeType;
-        CComBSTR nodeName;
+        if(xml.IsName("v"))
+        {
+            float v[3] = {0, 0, 0};
 
-        node->get_nodeType(&nodeType);
-        node->get_nodeName(&nodeName);
+            const char *s = xml.GetAttribute("v");
+            if(s != NULL)
+                XmlScanFloats(s, v, 3);
 
-        if(nodeType == NODE_ELEMENT)
-        {
-            if(nodeName == "v")
+            vbuffer.mVertexData.insert(vbuffer.mVertexData.end(), v, v + 3);
+
+            v[0] = v[1] = v[2] = 0;
+            s = xml.GetAttribute("n");
+            if(s != NULL)
+                XmlScanFloats(s, v, 3);
+
+            vbuffer.mNormalData.insert(vbuffer.mNormalData.end(), v, v + 3);
+
+            s = xml.GetAttribute("t");
+            if(s != NULL && *s != '\0')
             {
-                float x, y, z;
-
-                CComPtr<IXMLDOMNamedNodeMap> attributes;
-                node->get_attributes(&attributes);
-                wstring v;
-
-                GetXmlAttribute(attributes, L"v", v);
-                ToXYZ(v, x, y, z);
-                vbuffer.mVertices.push_back(x);
-                vbuffer.mVertices.push_back(y);
-                vbuffer.mVertices.push_back(z);
-
-                GetXmlAttribute(attributes, L"n", v);
-                ToXYZ(v, x, y, z);
-                vbuffer.mNormals.push_back(x);
-                vbuffer.mNormals.push_back(y);
-                vbuffer.mNormals.push_back(z);
-
-                v.clear();
-                GetXmlAttribute(attributes, L"t", v);
-                if(!v.empty())
-                {
-                    const wchar_t *vs = v.c_str();
-                    wchar_t *vs2;
-                    x = (float)wcstod(vs, &vs2);
-                    y = (float)wcstod(vs2, &vs2);
-                    vbuffer.mTcoords.push_back(x);
-                    vbuffer.mTcoords.push_back(1 - y);    // y is reversed from Microsoft standard
-                }
+                if(vbuffer.mTcoordData.empty())
+                    vbuffer.mTcoordData.reserve(vbuffer.mNormalData.capacity() / 3 * 2);
+
+                v[0] = v[1] = 0;
+                XmlScanFloats(s, v, 2);
+                vbuffer.mTcoordData.push_back(v[0]);
+                vbuffer.mTcoordData.push_back(1 - v[1]);    // y is reversed from Microsoft standard
             }
         }
+
+        xml.SkipElement();
     }
 
-    mVertices.push_back(vbuffer);
+    // Release the slack from growing the vectors
+    if(vbuffer.mVertexData.capacity() != vbuffer.mVertexData.size())
+        vector<float>(vbuffer.mVertexData).swap(vbuffer.mVertexData);
+
+    if(vbuffer.mNormalData.capacity() != vbuffer.mNormalData.size())
+        vector<float>(vbuffer.mNormalData).swap(vbuffer.mNormalData);
+
+    if(vbuffer.mTcoordData.capacity() != vbuffer.mTcoordData.size())
+        vector<float>(vbuffer.mTcoordData).swap(vbuffer.mTcoordData);
 }
 
 
-void CGrModelXp::XmlLoadIndices(CXmlDocument *xml, IXMLDOMNode *topNode)
+//
+// Name :         CGrModelXp::XmlLoadIndices()
+// Description :  The index list is counted before it is scanned, so
+//                the buffer is allocated once at its final size.
+//
+void CGrModelXp::XmlLoadIndices(CXmlPullParser &xml, int ib)
 {
-    IndexBuffer ibuffer;
+    IndexBuffer &ibuffer = mIndices[ib];
 
-    CComPtr<IXMLDOMNamedNodeMap> attributes;
-    topNode->get_attributes(&attributes);
-    wstring istr;
-    GetXmlAttribute(attributes, L"i", istr);
-    const wchar_t *s1 = istr.c_str();
-    wchar_t *s2;
-    while(true)
+    const char *s = xml.GetAttribute("i");
+    if(s != NULL)
     {
-        int i = wcstol(s1, &s2, 10);
-        if(s2 == s1)
-            break;
-
-        s1 = s2;
-        ibuffer.mIndices.push_back(i);
+        XmlScanInts(s, ibuffer.mIndexData);
     }
 
-    mIndices.push_back(ibuffer);
+    xml.SkipElement();
 }
 
 
-void CGrModelXp::XmlLoadMeshParts(CXmlDocument *xml, IXMLDOMNode *topNode, Mesh *mesh)
+void CGrModelXp::XmlLoadMeshParts(CXmlPullParser &xml, Mesh *mesh)
 {
     // Now the parts
-    CComPtr<IXMLDOMNode> node;
-    topNode->get_firstChild(&node);
-    for( ;  node != NULL;  NextNode(node))
+    int depth = xml.GetDepth();
+    while(XmlNextChild(xml, depth))
     {
-        DOMNodeType nodeType;
-        CComBSTR nodeName;
-
-        node->get_nodeType(&nodeType);
-        node->get_nodeName(&nodeName);
-
-        if(nodeType == NODE_ELEMENT)
+        if(xml.IsName("part"))
         {
-            if(nodeName == "part")
-            {
-                MeshPart part;
-
-                CComPtr<IXMLDOMNamedNodeMap> attributes;
-                node->get_attributes(&attributes);
-                wstring v;
+            MeshPart part;
 
-                GetXmlAttribute(attributes, L"base-vertex", part.mBaseVertex);
-                GetXmlAttribute(attributes, L"num-vertices", part.mNumVertices);
-                GetXmlAttribute(attributes, L"num-triangles", part.mNumTriangles);
-                GetXmlAttribute(attributes, L"start-index", part.mStartIndex);
-                GetXmlAttribute(attributes, L"effect", part.mEffect);
-                GetXmlAttribute(attributes, L"vertices", part.mVertices);
-                GetXmlAttribute(attributes, L"indices", part.mIndices);
+            xml.GetAttribute("base-vertex", part.mBaseVertex);
+            xml.GetAttribute("num-vertices", part.mNumVertices);
+            xml.GetAttribute("num-triangles", part.mNumTriangles);
+            xml.GetAttribute("start-index", part.mStartIndex);
+            xml.GetAttribute("effect", part.mEffect);
+            xml.GetAttribute("vertices", part.mVertices);
+            xml.GetAttribute("indices", part.mIndices);
 
-                mesh->mParts.push_back(part);
-            }
+            mesh->mParts.push_back(part);
         }
+
+        xml.SkipElement();
     }
 }
 
 
-void CGrModelXp::XmlLoadEffects(CXmlDocument *xml, IXMLDOMNode *topNode)
+void CGrModelXp::XmlLoadEffects(CXmlPullParser &xml)
 {
     // Now the parts
-    CComPtr<IXMLDOMNode> node;
-    topNode->get_firstChild(&node);
-    for( ;  node != NULL;  NextNode(node))
+    int depth = xml.GetDepth();
+    while(XmlNextChild(xml, depth))
     {
-        DOMNodeType nodeType;
-        CComBSTR nodeName;
-
-        node->get_nodeType(&nodeType);
-        node->get_nodeName(&nodeName);
-
-        if(nodeType == NODE_ELEMENT)
+        if(xml.IsName("effect"))
         {
-            if(nodeName == "effect")
-            {
-                Effect effect;
-                effect.mTexture = NULL;
-
-                CComPtr<IXMLDOMNamedNodeMap> attributes;
-                node->get_attributes(&attributes);
-                wstring v;
-
-                double a = 1;
-                GetXmlAttribute(attributes, L"name", effect.mName);
-                GetXmlAttribute(attributes, L"alpha", a);
-                effect.mAlpha = float(a);
-                XmlGetColor(attributes, L"diffuse", effect.mDiffuse);
-                XmlGetColor(attributes, L"emissive", effect.mEmissive);
-                XmlGetColor(attributes, L"specular", effect.mSpecular);
-                XmlGetColor(attributes, L"specularOther", effect.mSpecularOther);
-                XmlGetColor(attributes, L"transmission", effect.mTransmission);
-
-                GetXmlAttribute(attributes, L"shininess", a);
-                effect.mShininess = float(a);
-
-                a = 1;
-                GetXmlAttribute(attributes, L"eta", a);
-                effect.mEta = float(a);
-                GetXmlAttribute(attributes, L"texture", effect.mTextureFile);
-                
-
-                mEffects.push_back(effect);
-            }
+            mEffects.push_back(Effect());
+            Effect &effect = mEffects.back();
+            effect.mTexture = NULL;
+
+            double a = 1;
+            xml.GetAttribute("name", effect.mName);
+            xml.GetAttribute("alpha", a);
+            effect.mAlpha = float(a);
+            XmlGetColor(xml, "diffuse", effect.mDiffuse);
+            XmlGetColor(xml, "emissive", effect.mEmissive);
+            XmlGetColor(xml, "specular", effect.mSpecular);
+            XmlGetColor(xml, "specularOther", effect.mSpecularOther);
+            XmlGetColor(xml, "transmission", effect.mTransmission);
+
+            xml.GetAttribute("shininess", a);
+            effect.mShininess = float(a);
+
+            a = 1;
+            xml.GetAttribute("eta", a);
+            effect.mEta = float(a);
+            xml.GetAttribute("texture", effect.mTextureFile);
         }
-    }
-}
-
-
 
-void CGrModelXp::XmlGetColor(IXMLDOMNamedNodeMap *attributes, const wchar_t *name, float *color)
-{
-    wstring c;
-    if(!GetXmlAttribute(attributes, BSTR(name), c))
-    {
-        color[0] = color[1] = color[2] = color[3] = 0;
-        return;
+        xml.SkipElement();
     }
-
-    const wchar_t *vs = c.c_str();
-    wchar_t *vs2;
-    color[0] = (float)wcstod(vs, &vs2);
-    color[1] = (float)wcstod(vs2, &vs2);
-    color[2] = (float)wcstod(vs2, NULL);
-    color[3] = 1;
 }
 
 
@@ -825,6 +1182,17 @@ bool CGrModelXp::Error(const wchar_t *msg1, const wchar_t *msg2)
 }
 
 
+void CGrModelXp::Bone::SetLocalTransform(const CGrTransform &t)
+{
+    mLocalTransform = t;
+    if(!mDirty)
+    {
+        mDirty = true;
+        mModel->PoseChanged(int(this - &mModel->mBones[0]));
+    }
+}
+
+
 void CGrModelXp::Bone::ComputeAbsoluteTransform(const CGrTransform &parent)
 {
     mAbsoluteTransform = parent * mTransform * mLocalTransform;
@@ -15,7 +15,8 @@
 
 #include "grafx.h"
 
-#include "xml-noexport/XmlDocument.h"
+#include "xml-noexport/XmlPullParser.h"
+#include "GrMappedFile.h"
 
 class CGrModelXp
 {
@@ -23,60 +24,126 @@ public:
     CGrModelXp(void);
     virtual ~CGrModelXp(void);
 
+    // Progress and cancellation of a load, shared with the thread
+    // that started it. Progress is counted in kilobytes of input.
+    struct LoadStatus
+    {
+        LoadStatus() : mCancel(0), mDone(0), mTotal(0) {}
+
+        bool IsCancelled() const {return mCancel != 0;}
+
+        volatile LONG mCancel;
+        volatile LONG mDone;
+        volatile LONG mTotal;
+    };
+
     void Clear();
-    bool LoadFile(const wchar_t *filename);
+    bool LoadFile(const wchar_t *filename, LoadStatus *status=NULL);
 
-    void SetTransform(const CGrTransform &t) {mTransform = t;}
+    void SetThreadPool(CGrThreadPool *pool) {mPool = pool;}
+    CGrThreadPool *GetThreadPool() const {return mPool;}
+
+    void SetTransform(const CGrTransform &t) {mTransform = t; mRootDirty = true; PoseChanged(0);}
+    const CGrTransform &GetTransform() const {return mTransform;}
     void Draw();
     void Draw(CGrModelX::IRenderer *renderer);
+    void DrawPose(const CGrTransform *absolute);
+    void DrawPose(CGrModelX::IRenderer *renderer, const CGrTransform *absolute);
 
     bool IntersectionTest(const CGrSphere &sphere);
 
     const wchar_t *GetError() const {return mErrorMessage.c_str();}
 
     void ComputeBonesAbsolute();
+    void ComputeBonesAbsolute(const CGrTransform &t, const CGrTransform *local, CGrTransform *absolute) const;
+    unsigned GetPoseGeneration() const {return mGeneration;}
+    void SetPoseGeneration(unsigned generation) {mGeneration = generation;}
     CGrModelX::IBone *GetBone(const wchar_t *name);
 
+    int ResolveBone(const wchar_t *name) const;
+    const CGrTransform &GetLocalTransform(int bone) const {return mBones[bone].GetLocalTransform();}
+    void SetLocalTransform(int bone, const CGrTransform &t) {mBones[bone].Bone::SetLocalTransform(t);}
+    void SetLocalTransforms(const int *bones, const CGrTransform *t, int count);
+
+    int GetTriangleCount() const;
+
+    int GetMeshCount() const {return (int)mMeshes.size();}
+    int GetMeshBone(int mesh) const {return mMeshes[mesh]->mBone;}
+    int GetBoneCount() const {return (int)mBones.size();}
+    int GetBoneParent(int bone) const {return mBones[bone].mParent;}
+    CGrModelX::IBone *GetBone(int bone) {return &mBones[bone];}
+
 protected:
 
 private:
     bool Error(const wchar_t *msg);
+
+    // Absolute transform for a bone from a supplied pose or the bones
+    const CGrTransform &BoneAbsolute(const CGrTransform *absolute, int bone) const 
+        {return absolute != NULL ? absolute[bone] : mBones[bone].mAbsoluteTransform;}
     bool Error(const wchar_t *msg1, const wchar_t *msg2);
 
+    // Note that a bone and everything below it need computing
+    void PoseChanged(int bone) {if(mFirstDirty < 0 || bone < mFirstDirty) mFirstDirty = bone;}
+
     // Transform that places the object
     CGrTransform mTransform;
 
+    // Pose tracking. The bones are in topological order, so nothing
+    // before mFirstDirty needs computing, and -1 means nothing does.
+    // mRootDirty is set when mTransform changes. mGeneration counts
+    // the ComputeBonesAbsolute() calls that changed anything.
+    int mFirstDirty;
+    bool mRootDirty;
+    unsigned mGeneration;
+
     // Bones representation
     class Bone : public CGrModelX::IBone
     {
     public:
-        Bone() {mLocalTransform.SetIdentity();}
+        Bone() : mModel(NULL), mDirty(true), mGeneration(0) {mLocalTransform.SetIdentity();}
 
-        virtual const wchar_t *GetName() const {return mName.c_str();}
+        virtual const wchar_t *GetName() const {return &mModel->mBoneNames[mName];}
         virtual const CGrTransform &GetTransform() const {return mTransform;}
         virtual const CGrTransform &GetAbsoluteTransform() const {return mAbsoluteTransform;}
 
         virtual const CGrTransform &GetLocalTransform() const {return mLocalTransform;}
-        virtual void SetLocalTransform(const CGrTransform &t) {mLocalTransform = t;}
-
-        void SetName(const wchar_t *name) {mName = name;}
+        virtual void SetLocalTransform(const CGrTransform &t);
+        virtual unsigned GetGeneration() const {return mGeneration;}
 
         int mIndex;
         int mParent;
+        int mName;                  // Offset of the name in the model mBoneNames
         CGrTransform mTransform;
         CGrTransform mAbsoluteTransform;
 
+        CGrModelXp *mModel;         // Model told when the local transform changes
+        bool mDirty;                // Local transform changed since last computed
+        unsigned mGeneration;       // Model generation the absolute transform was computed in
+
         void ComputeAbsoluteTransform(const CGrTransform &parent);
 
     private:
         CGrTransform mLocalTransform;           // Local transformation
-        std::wstring mName;
     };
 
     std::vector<Bone> mBones;
     int mRootBone;
 
-    std::map<std::wstring, int> mBonesByName;
+    // The bone names, each null terminated, one after another, and
+    // the bone indices sorted by name for ResolveBone()
+    std::vector<wchar_t> mBoneNames;
+    std::vector<int> mBonesByName;
+
+    // Orders bone indices by name
+    struct BoneNameLess
+    {
+        const CGrModelXp *mModel;
+        bool operator()(int a, int b) const {return wcscmp(mModel->mBones[a].GetName(), mModel->mBones[b].GetName()) < 0;}
+    };
+
+    void SetBoneName(Bone &bone, const wchar_t *name);
+    void IndexBoneNames();
 
     //
     // Effects
@@ -93,7 +160,7 @@ private:
         virtual CGrTexture *GetTexture() {return mTexture;}
         virtual const float *GetSpecularOther() const {return mSpecularOther;}
         virtual const float *GetTransmission() const {return mTransmission;}
-        virtual float GetEta() {return mEta;}
+        virtual float GetEta() const {return mEta;}
 
         std::wstring mName;
 
@@ -119,12 +186,23 @@ private:
     // Vertices
     //
 
-    // Vertex buffer representation
+    // Vertex buffer representation. The arrays are views, either of
+    // the vectors here when the buffer was parsed or of the mapped
+    // cache file. mTcoords is NULL if there are no texture coordinates.
     struct VertexBuffer
     {
-        std::vector<float> mVertices;
-        std::vector<float> mNormals;
-        std::vector<float> mTcoords;
+        VertexBuffer() : mNumVertices(0), mVertices(NULL), mNormals(NULL), mTcoords(NULL) {}
+
+        void Bind();
+
+        int mNumVertices;
+        const float *mVertices;
+        const float *mNormals;
+        const float *mTcoords;
+
+        std::vector<float> mVertexData;
+        std::vector<float> mNormalData;
+        std::vector<float> mTcoordData;
     };
 
     // Vertex buffers associated with the mesh
@@ -134,10 +212,17 @@ private:
     // Index buffers
     //
 
-    // Index buffer representation
+    // Index buffer representation, a view like VertexBuffer
     struct IndexBuffer
     {
-        std::vector<int> mIndices;
+        IndexBuffer() : mNumIndices(0), mIndices(NULL) {}
+
+        void Bind();
+
+        int mNumIndices;
+        const int *mIndices;
+
+        std::vector<int> mIndexData;
     };
 
     // Index buffers associated with the mesh
@@ -172,26 +257,68 @@ private:
 
     std::vector<Mesh *> mMeshes;
 
-    // Texture management
-    std::map<std::wstring, CGrTexture> mTextures;
+    // Texture management. The textures come from the shared
+    // CGrTextureCache and are released by Clear().
+    std::map<std::wstring, CGrTexture *> mTextures;
 
     // Any current error message
     std::wstring mErrorMessage;
 
-    void XmlGetColor(IXMLDOMNamedNodeMap *attributes, const wchar_t *name, float *color);
-
-    void XmlLoad(CXmlDocument *xml, IXMLDOMNode *topNode);
-    bool XmlTestVersion(CXmlDocument *xml, IXMLDOMNode *topNode);
-    void XmlLoadBones(CXmlDocument *xml, IXMLDOMNode *topNode);
-    void XmlLoadBone(CXmlDocument *xml, IXMLDOMNode *topNode);
-    void XmlLoadMeshes(CXmlDocument *xml, IXMLDOMNode *topNode);
-    void XmlLoadMesh(CXmlDocument *xml, IXMLDOMNode *topNode);
-    void XmlLoadVertexBuffers(CXmlDocument *xml, IXMLDOMNode *topNode);
-    void XmlLoadIndexBuffers(CXmlDocument *xml, IXMLDOMNode *topNode);
-    void XmlLoadVertices(CXmlDocument *xml, IXMLDOMNode *topNode);
-    void XmlLoadIndices(CXmlDocument *xml, IXMLDOMNode *topNode);
-    void XmlLoadMeshParts(CXmlDocument *xml, IXMLDOMNode *topNode, Mesh *mesh);
-    void XmlLoadEffects(CXmlDocument *xml, IXMLDOMNode *topNode);
+    // Compiled cache the buffers were loaded from, if any
+    CGrMappedFile mCache;
+
+    // Pool for loading or NULL to create one when needed
+    CGrThreadPool *mPool;
+
+    // A vertices or indices element found by the first pass over
+    // a mapped document, to be parsed in parallel afterwards
+    struct Section
+    {
+        bool mIndices;
+        int mBuffer;
+        size_t mBegin;
+        size_t mEnd;
+        std::wstring mError;
+    };
+
+    // Sections found by the first pass or NULL if the
+    // buffers are parsed as they are reached
+    std::vector<Section> *mSections;
+
+    // A texture file to load and the texture to load it into
+    struct TextureFile
+    {
+        std::wstring mPath;
+        CGrTexture **mTexture;  // Where to put the texture
+        LONG mSize;             // Kilobytes, for progress
+    };
+
+    // Pool task for the second load stage
+    struct StageLoader;
+    friend struct StageLoader;
+
+    bool XmlParse(const wchar_t *filename, CGrMappedFile &document, std::vector<Section> &sections, LoadStatus *status);
+    void FindTextures(const std::wstring &path, std::vector<TextureFile> &textures, LoadStatus *status);
+    bool LoadParallel(const char *document, std::vector<Section> &sections, std::vector<TextureFile> &textures, LoadStatus *status);
+
+    // The compiled .xmodlb cache in GrModelXpCache.cpp
+    bool CacheLoad(const wchar_t *cachename, const wchar_t *filename);
+    void CacheSave(const wchar_t *cachename, const wchar_t *filename);
+
+    // The loaders are called with the parser at the start tag
+    // of their element and return at its end tag
+    bool XmlLoad(CXmlPullParser &xml, const LoadStatus *status);
+    bool XmlDefer(CXmlPullParser &xml, bool indices);
+    void XmlLoadBones(CXmlPullParser &xml);
+    void XmlLoadBone(CXmlPullParser &xml);
+    void XmlLoadMeshes(CXmlPullParser &xml);
+    void XmlLoadMesh(CXmlPullParser &xml);
+    void XmlLoadVertexBuffers(CXmlPullParser &xml);
+    void XmlLoadIndexBuffers(CXmlPullParser &xml);
+    void XmlLoadVertices(CXmlPullParser &xml, int vb, size_t expected);
+    void XmlLoadIndices(CXmlPullParser &xml, int ib);
+    void XmlLoadMeshParts(CXmlPullParser &xml, Mesh *mesh);
+    void XmlLoadEffects(CXmlPullParser &xml);
 };
 
 //! \endcond
@@ -0,0 +1,671 @@
+#include "StdAfx.h"
+#include "GrModelXp.h"
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+
+using namespace std;
+
+//
+// The compiled model cache (.xmodlb)
+//
+// A .xmodl file is compiled to a .xmodlb file next to it the first
+// time it is loaded. Later loads map the .xmodlb file and use the
+// vertex and index arrays in place, so no geometry is parsed or copied.
+//
+// The file is little endian. It starts with a CacheHeader followed by
+// tables of fixed size records, the strings, and finally the vertex and
+// index arrays. Everything is located by byte offsets from the start of
+// the file. Arrays start on 16 byte boundaries. A string is an unsigned
+// length followed by that many UTF-16 code units; offset 0 is the empty
+// string.
+//
+// The cache records the size, write time and FNV-1a hash of the .xmodl
+// it was compiled from. If the size differs it is stale. If only the
+// time differs, the source is hashed and the cache is used if the hash
+// still matches.
+//
+
+const char CacheMagic[8] = {'X', 'M', 'O', 'D', 'L', 'B', '\r', '\n'};
+const unsigned CacheVersion = 1;
+const unsigned CacheAlign = 16;
+
+struct CacheHeader
+{
+    char mMagic[8];
+    unsigned mVersion;
+    unsigned mHeaderSize;
+    unsigned long long mFileSize;
+
+    unsigned long long mSourceSize;
+    unsigned long long mSourceTime;
+    unsigned long long mSourceHash;
+
+    int mRootBone;
+    unsigned mNumBones;
+    unsigned mBones;
+    unsigned mNumEffects;
+    unsigned mEffects;
+    unsigned mNumVertexBuffers;
+    unsigned mVertexBuffers;
+    unsigned mNumIndexBuffers;
+    unsigned mIndexBuffers;
+    unsigned mNumMeshes;
+    unsigned mMeshes;
+    unsigned mNumParts;
+    unsigned mParts;
+    unsigned mPad;
+};
+
+struct CacheBone
+{
+    int mIndex;
+    int mParent;
+    unsigned mName;
+    unsigned mPad;
+    double mTransform[16];      // Row major
+};
+
+struct CacheEffect
+{
+    unsigned mName;
+    unsigned mTexture;
+    float mAlpha;
+    float mDiffuse[4];
+    float mEmissive[4];
+    float mSpecular[4];
+    float mShininess;
+    float mSpecularOther[4];
+    float mTransmission[4];
+    float mEta;
+};
+
+struct CacheVertexBuffer
+{
+    unsigned mNumVertices;
+    unsigned mVertices;         // 3 floats per vertex
+    unsigned mNormals;          // 3 floats per vertex
+    unsigned mTcoords;          // 2 floats per vertex or 0 if none
+};
+
+struct CacheIndexBuffer
+{
+    unsigned mNumIndices;
+    unsigned mIndices;
+};
+
+struct CacheMesh
+{
+    unsigned mName;
+    int mBone;
+    unsigned mFirstPart;
+    unsigned mNumParts;
+    double mBoundingSphere[4];  // x, y, z, radius
+};
+
+struct CachePart
+{
+    int mBaseVertex;
+    int mNumVertices;
+    int mNumTriangles;
+    int mStartIndex;
+    int mEffect;
+    int mVertices;
+    int mIndices;
+};
+
+
+//
+// Name :         CacheHash()
+// Description :  64 bit FNV-1a hash of a block of memory.
+//
+static unsigned long long CacheHash(const char *data, size_t size)
+{
+    unsigned long long hash = 14695981039346656037ULL;
+    for(size_t i=0;  i<size;  i++)
+    {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+static bool CacheHashFile(const wchar_t *filename, unsigned long long &hash)
+{
+    CGrMappedFile file;
+    if(!file.Open(filename))
+        return false;
+
+    hash = CacheHash(file.GetData(), file.GetSize());
+    return true;
+}
+
+//
+// Name :         CacheStamp()
+// Description :  Change the source time recorded in a cache file.
+//
+static void CacheStamp(const wchar_t *cachename, unsigned long long sourceTime)
+{
+    FILE *file = _wfopen(cachename, L"r+b");
+    if(file == NULL)
+        return;
+
+    if(fseek(file, offsetof(CacheHeader, mSourceTime), SEEK_SET) == 0)
+        fwrite(&sourceTime, sizeof(sourceTime), 1, file);
+
+    fclose(file);
+}
+
+//
+// Name :         CacheCheckHeader()
+// Description :  Check that a file is a cache for a source of the
+//                given size in the format we read.
+// Returns :      The header or NULL if it is not usable
+//
+static const CacheHeader *CacheCheckHeader(const CGrMappedFile &cache, unsigned long long sourceSize)
+{
+    if(cache.GetSize() < sizeof(CacheHeader))
+        return NULL;
+
+    const CacheHeader *header = (const CacheHeader *)cache.GetData();
+    if(memcmp(header->mMagic, CacheMagic, sizeof(CacheMagic)) != 0 ||
+        header->mVersion != CacheVersion || header->mHeaderSize != sizeof(CacheHeader) ||
+        header->mFileSize != cache.GetSize() || header->mSourceSize != sourceSize)
+        return NULL;
+
+    return header;
+}
+
+inline unsigned CacheAligned(size_t offset) {return unsigned((offset + CacheAlign - 1) & ~size_t(CacheAlign - 1));}
+
+//
+// Name :         CacheRange()
+// Description :  Is count items of the given size at offset entirely
+//                inside the file?
+//
+inline bool CacheRange(const CGrMappedFile &file, unsigned offset, unsigned long long count, size_t size)
+{
+    return offset <= file.GetSize() && count * size <= file.GetSize() - offset;
+}
+
+template<class T> inline const T *CacheTable(const CGrMappedFile &file, unsigned offset, unsigned long long count)
+{
+    if(!CacheRange(file, offset, count, sizeof(T)) || offset % sizeof(int) != 0)
+        return NULL;
+
+    return (const T *)(file.GetData() + offset);
+}
+
+static bool CacheString(const CGrMappedFile &file, unsigned offset, wstring &str)
+{
+    str.clear();
+    if(offset == 0)
+        return true;
+
+    const unsigned *length = CacheTable<unsigned>(file, offset, 1);
+    if(length == NULL || !CacheRange(file, offset + sizeof(unsigned), *length, sizeof(unsigned short)))
+        return false;
+
+    const unsigned short *c = (const unsigned short *)(length + 1);
+    str.assign(c, c + *length);
+    return true;
+}
+
+
+//
+// class CCacheWriter
+// Accumulates the header, tables and strings of a cache file. The big
+// arrays are written after these straight from the model.
+//
+class CCacheWriter
+{
+public:
+    CCacheWriter() {}
+
+    unsigned Add(const void *data, size_t size)
+    {
+        size_t offset = mData.size();
+        mData.insert(mData.end(), (const char *)data, (const char *)data + size);
+        return unsigned(offset);
+    }
+
+    unsigned AddString(const wstring &str)
+    {
+        if(str.empty())
+            return 0;
+
+        unsigned offset = CacheAligned(mData.size());
+        mData.resize(offset);
+        unsigned length = unsigned(str.size());
+        Add(&length, sizeof(length));
+        for(size_t i=0;  i<str.size();  i++)
+        {
+            unsigned short c = (unsigned short)str[i];
+            Add(&c, sizeof(c));
+        }
+
+        return offset;
+    }
+
+    void Align() {mData.resize(CacheAligned(mData.size()));}
+
+    template<class T> T *At(unsigned offset) {return (T *)&mData[offset];}
+
+    size_t GetSize() const {return mData.size();}
+    const char *GetData() const {return &mData[0];}
+
+private:
+    vector<char> mData;
+};
+
+
+//
+// Name :         CGrModelXp::CacheLoad()
+// Description :  Load the model from its compiled cache.
+// Parameters :   cachename - The .xmodlb file
+//                filename - The .xmodl file it was compiled from
+// Returns :      false if there is no current cache. The model is
+//                unchanged in that case.
+//
+bool CGrModelXp::CacheLoad(const wchar_t *cachename, const wchar_t *filename)
+{
+    WIN32_FILE_ATTRIBUTE_DATA source;
+    if(!GetFileAttributesExW(filename, GetFileExInfoStandard, &source))
+        return false;
+
+    unsigned long long sourceSize = ((unsigned long long)source.nFileSizeHigh << 32) | source.nFileSizeLow;
+    unsigned long long sourceTime = ((unsigned long long)source.ftLastWriteTime.dwHighDateTime << 32) |
+        source.ftLastWriteTime.dwLowDateTime;
+
+    CGrMappedFile cache;
+    if(!cache.Open(cachename))
+        return false;
+
+    const CacheHeader *header = CacheCheckHeader(cache, sourceSize);
+    if(header == NULL)
+        return false;
+
+    if(header->mSourceTime != sourceTime)
+    {
+        // The source was touched. If it is unchanged, record
+        // the new time so we do not hash it on every load.
+        unsigned long long hash;
+        if(!CacheHashFile(filename, hash) || hash != header->mSourceHash)
+            return false;
+
+        cache.Close();
+        CacheStamp(cachename, sourceTime);
+        if(!cache.Open(cachename))
+            return false;
+
+        header = CacheCheckHeader(cache, sourceSize);
+        if(header == NULL || header->mSourceHash != hash)
+            return false;
+    }
+
+    const CacheBone *bones = CacheTable<CacheBone>(cache, header->mBones, header->mNumBones);
+    const CacheEffect *effects = CacheTable<CacheEffect>(cache, header->mEffects, header->mNumEffects);
+    const CacheVertexBuffer *vbuffers = CacheTable<CacheVertexBuffer>(cache, header->mVertexBuffers, header->mNumVertexBuffers);
+    const CacheIndexBuffer *ibuffers = CacheTable<CacheIndexBuffer>(cache, header->mIndexBuffers, header->mNumIndexBuffers);
+    const CacheMesh *meshes = CacheTable<CacheMesh>(cache, header->mMeshes, header->mNumMeshes);
+    const CachePart *parts = CacheTable<CachePart>(cache, header->mParts, header->mNumParts);
+    if(bones == NULL || effects == NULL || vbuffers == NULL || ibuffers == NULL || meshes == NULL || parts == NULL)
+        return false;
+
+    // Check everything the drawing code indexes with, so
+    // a damaged cache cannot take us outside the file
+    for(unsigned i=0;  i<header->mNumVertexBuffers;  i++)
+    {
+        const CacheVertexBuffer &vb = vbuffers[i];
+        if(CacheTable<float>(cache, vb.mVertices, vb.mNumVertices * 3ULL) == NULL ||
+            CacheTable<float>(cache, vb.mNormals, vb.mNumVertices * 3ULL) == NULL ||
+            (vb.mTcoords != 0 && CacheTable<float>(cache, vb.mTcoords, vb.mNumVertices * 2ULL) == NULL))
+            return false;
+    }
+
+    for(unsigned i=0;  i<header->mNumIndexBuffers;  i++)
+    {
+        if(CacheTable<int>(cache, ibuffers[i].mIndices, ibuffers[i].mNumIndices) == NULL)
+            return false;
+    }
+
+    for(unsigned i=0;  i<header->mNumParts;  i++)
+    {
+        const CachePart &p = parts[i];
+        if(p.mVertices < 0 || unsigned(p.mVertices) >= header->mNumVertexBuffers ||
+            p.mIndices < 0 || unsigned(p.mIndices) >= header->mNumIndexBuffers ||
+            p.mEffect < 0 || unsigned(p.mEffect) >= header->mNumEffects ||
+            p.mStartIndex < 0 || p.mNumTriangles < 0 || p.mBaseVertex < 0 ||
+            (unsigned long long)p.mStartIndex + p.mNumTriangles * 3ULL > ibuffers[p.mIndices].mNumIndices)
+            return false;
+
+        // Every index must land in the vertex buffer
+        unsigned numVertices = vbuffers[p.mVertices].mNumVertices;
+        const int *indices = (const int *)(cache.GetData() + ibuffers[p.mIndices].mIndices) + p.mStartIndex;
+        for(int j=0;  j<p.mNumTriangles * 3;  j++)
+        {
+            if(indices[j] < 0 || (unsigned long long)p.mBaseVertex + indices[j] >= numVertices)
+                return false;
+        }
+    }
+
+    for(unsigned i=0;  i<header->mNumMeshes;  i++)
+    {
+        const CacheMesh &m = meshes[i];
+        if(m.mBone < 0 || unsigned(m.mBone) >= header->mNumBones ||
+            (unsigned long long)m.mFirstPart + m.mNumParts > header->mNumParts)
+            return false;
+    }
+
+    for(unsigned i=0;  i<header->mNumBones;  i++)
+    {
+        if(bones[i].mParent >= int(i))
+            return false;
+    }
+
+    //
+    // The cache is good. Replace the model with it.
+    //
+
+    Clear();
+    mRootBone = header->mRootBone;
+
+    mBones.resize(header->mNumBones);
+    for(unsigned i=0;  i<header->mNumBones;  i++)
+    {
+        Bone &bone = mBones[i];
+        bone.mModel = this;
+        bone.mIndex = bones[i].mIndex;
+        bone.mParent = bones[i].mParent;
+        for(int j=0;  j<16;  j++)
+            bone.mTransform.M(j / 4, j % 4) = bones[i].mTransform[j];
+
+        wstring name;
+        CacheString(cache, bones[i].mName, name);
+        SetBoneName(bone, name.c_str());
+    }
+
+    IndexBoneNames();
+
+    mEffects.resize(header->mNumEffects);
+    for(unsigned i=0;  i<header->mNumEffects;  i++)
+    {
+        const CacheEffect &from = effects[i];
+        Effect &effect = mEffects[i];
+        CacheString(cache, from.mName, effect.mName);
+        CacheString(cache, from.mTexture, effect.mTextureFile);
+        effect.mTexture = NULL;
+        effect.mAlpha = from.mAlpha;
+        memcpy(effect.mDiffuse, from.mDiffuse, sizeof(effect.mDiffuse));
+        memcpy(effect.mEmissive, from.mEmissive, sizeof(effect.mEmissive));
+        memcpy(effect.mSpecular, from.mSpecular, sizeof(effect.mSpecular));
+        effect.mShininess = from.mShininess;
+        memcpy(effect.mSpecularOther, from.mSpecularOther, sizeof(effect.mSpecularOther));
+        memcpy(effect.mTransmission, from.mTransmission, sizeof(effect.mTransmission));
+        effect.mEta = from.mEta;
+    }
+
+    // The arrays are used where they are in the mapped file
+    mVertices.resize(header->mNumVertexBuffers);
+    for(unsigned i=0;  i<header->mNumVertexBuffers;  i++)
+    {
+        const CacheVertexBuffer &from = vbuffers[i];
+        VertexBuffer &vbuffer = mVertices[i];
+        vbuffer.mNumVertices = from.mNumVertices;
+        vbuffer.mVertices = (const float *)(cache.GetData() + from.mVertices);
+        vbuffer.mNormals = (const float *)(cache.GetData() + from.mNormals);
+        vbuffer.mTcoords = from.mTcoords != 0 ? (const float *)(cache.GetData() + from.mTcoords) : NULL;
+    }
+
+    mIndices.resize(header->mNumIndexBuffers);
+    for(unsigned i=0;  i<header->mNumIndexBuffers;  i++)
+    {
+        mIndices[i].mNumIndices = ibuffers[i].mNumIndices;
+        mIndices[i].mIndices = (const int *)(cache.GetData() + ibuffers[i].mIndices);
+    }
+
+    for(unsigned i=0;  i<header->mNumMeshes;  i++)
+    {
+        const CacheMesh &from = meshes[i];
+        Mesh *mesh = new Mesh();
+        CacheString(cache, from.mName, mesh->mName);
+        mesh->mBone = from.mBone;
+        mesh->mBoundingSphere.SetOrigin(CGrVector(from.mBoundingSphere[0], from.mBoundingSphere[1], from.mBoundingSphere[2]));
+        mesh->mBoundingSphere.SetRadius(from.mBoundingSphere[3]);
+
+        mesh->mParts.resize(from.mNumParts);
+        for(unsigned j=0;  j<from.mNumParts;  j++)
+        {
+            const CachePart &p = parts[from.mFirstPart + j];
+            MeshPart &part = mesh->mParts[j];
+            part.mBaseVertex = p.mBaseVertex;
+            part.mNumVertices = p.mNumVertices;
+            part.mNumTriangles = p.mNumTriangles;
+            part.mStartIndex = p.mStartIndex;
+            part.mEffect = p.mEffect;
+            part.mVertices = p.mVertices;
+            part.mIndices = p.mIndices;
+        }
+
+        mMeshes.push_back(mesh);
+    }
+
+    mCache.Swap(cache);
+    return true;
+}
+
+
+//
+// Name :         CGrModelXp::CacheSave()
+// Description :  Write the compiled cache for the model just loaded
+//                from filename. This is only an optimization, so any
+//                failure, such as a read only folder, is ignored.
+//
+void CGrModelXp::CacheSave(const wchar_t *cachename, const wchar_t *filename)
+{
+    WIN32_FILE_ATTRIBUTE_DATA source;
+    if(!GetFileAttributesExW(filename, GetFileExInfoStandard, &source))
+        return;
+
+    CacheHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.mMagic, CacheMagic, sizeof(CacheMagic));
+    header.mVersion = CacheVersion;
+    header.mHeaderSize = sizeof(CacheHeader);
+    header.mSourceSize = ((unsigned long long)source.nFileSizeHigh << 32) | source.nFileSizeLow;
+    header.mSourceTime = ((unsigned long long)source.ftLastWriteTime.dwHighDateTime << 32) |
+        source.ftLastWriteTime.dwLowDateTime;
+    if(!CacheHashFile(filename, header.mSourceHash))
+        return;
+
+    header.mRootBone = mRootBone;
+
+    CCacheWriter writer;
+    writer.Add(&header, sizeof(header));
+
+    //
+    // The tables. Strings are added after them.
+    //
+
+    header.mNumBones = unsigned(mBones.size());
+    header.mBones = writer.Add(NULL, 0);
+    for(vector<Bone>::const_iterator b=mBones.begin();  b!=mBones.end();  b++)
+    {
+        CacheBone bone;
+        memset(&bone, 0, sizeof(bone));
+        bone.mIndex = b->mIndex;
+        bone.mParent = b->mParent;
+        for(int j=0;  j<16;  j++)
+            bone.mTransform[j] = b->mTransform.M(j / 4, j % 4);
+
+        writer.Add(&bone, sizeof(bone));
+    }
+
+    header.mNumEffects = unsigned(mEffects.size());
+    header.mEffects = writer.Add(NULL, 0);
+    for(vector<Effect>::const_iterator e=mEffects.begin();  e!=mEffects.end();  e++)
+    {
+        CacheEffect effect;
+        memset(&effect, 0, sizeof(effect));
+        effect.mAlpha = e->mAlpha;
+        memcpy(effect.mDiffuse, e->mDiffuse, sizeof(effect.mDiffuse));
+        memcpy(effect.mEmissive, e->mEmissive, sizeof(effect.mEmissive));
+        memcpy(effect.mSpecular, e->mSpecular, sizeof(effect.mSpecular));
+        effect.mShininess = e->mShininess;
+        memcpy(effect.mSpecularOther, e->mSpecularOther, sizeof(effect.mSpecularOther));
+        memcpy(effect.mTransmission, e->mTransmission, sizeof(effect.mTransmission));
+        effect.mEta = e->mEta;
+        writer.Add(&effect, sizeof(effect));
+    }
+
+    // Offsets of the arrays are filled in once we know where they start
+    header.mNumVertexBuffers = unsigned(mVertices.size());
+    header.mVertexBuffers = writer.Add(NULL, 0);
+    for(vector<VertexBuffer>::const_iterator v=mVertices.begin();  v!=mVertices.end();  v++)
+    {
+        CacheVertexBuffer vbuffer;
+        memset(&vbuffer, 0, sizeof(vbuffer));
+        vbuffer.mNumVertices = v->mNumVertices;
+        writer.Add(&vbuffer, sizeof(vbuffer));
+    }
+
+    header.mNumIndexBuffers = unsigned(mIndices.size());
+    header.mIndexBuffers = writer.Add(NULL, 0);
+    for(vector<IndexBuffer>::const_iterator i=mIndices.begin();  i!=mIndices.end();  i++)
+    {
+        CacheIndexBuffer ibuffer;
+        memset(&ibuffer, 0, sizeof(ibuffer));
+        ibuffer.mNumIndices = i->mNumIndices;
+        writer.Add(&ibuffer, sizeof(ibuffer));
+    }
+
+    writer.Align();
+    header.mNumMeshes = unsigned(mMeshes.size());
+    header.mMeshes = writer.Add(NULL, 0);
+    unsigned numParts = 0;
+    for(vector<Mesh *>::const_iterator m=mMeshes.begin();  m!=mMeshes.end();  m++)
+    {
+        CacheMesh mesh;
+        memset(&mesh, 0, sizeof(mesh));
+        mesh.mBone = (*m)->mBone;
+        mesh.mFirstPart = numParts;
+        mesh.mNumParts = unsigned((*m)->mParts.size());
+        CGrVector origin = (*m)->mBoundingSphere.GetOrigin();
+        mesh.mBoundingSphere[0] = origin.X();
+        mesh.mBoundingSphere[1] = origin.Y();
+        mesh.mBoundingSphere[2] = origin.Z();
+        mesh.mBoundingSphere[3] = (*m)->mBoundingSphere.GetRadius();
+        writer.Add(&mesh, sizeof(mesh));
+        numParts += mesh.mNumParts;
+    }
+
+    header.mNumParts = numParts;
+    header.mParts = writer.Add(NULL, 0);
+    for(vector<Mesh *>::const_iterator m=mMeshes.begin();  m!=mMeshes.end();  m++)
+    {
+        for(vector<MeshPart>::const_iterator p=(*m)->mParts.begin();  p!=(*m)->mParts.end();  p++)
+        {
+            CachePart part;
+            part.mBaseVertex = p->mBaseVertex;
+            part.mNumVertices = p->mNumVertices;
+            part.mNumTriangles = p->mNumTriangles;
+            part.mStartIndex = p->mStartIndex;
+            part.mEffect = p->mEffect;
+            part.mVertices = p->mVertices;
+            part.mIndices = p->mIndices;
+            writer.Add(&part, sizeof(part));
+        }
+    }
+
+    // Strings
+    for(size_t i=0;  i<mBones.size();  i++)
+        writer.At<CacheBone>(header.mBones)[i].mName = writer.AddString(mBones[i].GetName());
+
+    for(size_t i=0;  i<mEffects.size();  i++)
+    {
+        unsigned name = writer.AddString(mEffects[i].mName);
+        unsigned texture = writer.AddString(mEffects[i].mTextureFile);
+        writer.At<CacheEffect>(header.mEffects)[i].mName = name;
+        writer.At<CacheEffect>(header.mEffects)[i].mTexture = texture;
+    }
+
+    for(size_t i=0;  i<mMeshes.size();  i++)
+        writer.At<CacheMesh>(header.mMeshes)[i].mName = writer.AddString(mMeshes[i]->mName);
+
+    //
+    // Lay out the arrays after the tables
+    //
+
+    writer.Align();
+    unsigned long long offset = writer.GetSize();
+    for(size_t i=0;  i<mVertices.size();  i++)
+    {
+        CacheVertexBuffer &vbuffer = writer.At<CacheVertexBuffer>(header.mVertexBuffers)[i];
+        vbuffer.mVertices = unsigned(offset);
+        offset += CacheAligned(vbuffer.mNumVertices * 3 * sizeof(float));
+        vbuffer.mNormals = unsigned(offset);
+        offset += CacheAligned(vbuffer.mNumVertices * 3 * sizeof(float));
+        if(mVertices[i].mTcoords != NULL)
+        {
+            vbuffer.mTcoords = unsigned(offset);
+            offset += CacheAligned(vbuffer.mNumVertices * 2 * sizeof(float));
+        }
+    }
+
+    for(size_t i=0;  i<mIndices.size();  i++)
+    {
+        CacheIndexBuffer &ibuffer = writer.At<CacheIndexBuffer>(header.mIndexBuffers)[i];
+        ibuffer.mIndices = unsigned(offset);
+        offset += CacheAligned(ibuffer.mNumIndices * sizeof(int));
+    }
+
+    // Offsets are 32 bits
+    if(offset > 0xffffffffULL)
+        return;
+
+    header.mFileSize = offset;
+    *writer.At<CacheHeader>(0) = header;
+
+    //
+    // Write to a temporary file and move it into place, so a
+    // partly written cache is never seen
+    //
+
+    wstring tempname = wstring(cachename) + L".tmp";
+    FILE *file = _wfopen(tempname.c_str(), L"wb");
+    if(file == NULL)
+        return;
+
+    static const char zeros[CacheAlign] = {0};
+    bool ok = fwrite(writer.GetData(), 1, writer.GetSize(), file) == writer.GetSize();
+
+    for(vector<VertexBuffer>::const_iterator v=mVertices.begin();  ok && v!=mVertices.end();  v++)
+    {
+        const float *arrays[3] = {v->mVertices, v->mNormals, v->mTcoords};
+        size_t sizes[3] = {v->mNumVertices * 3 * sizeof(float), v->mNumVertices * 3 * sizeof(float),
+            v->mNumVertices * 2 * sizeof(float)};
+        for(int a=0;  a<3 && ok;  a++)
+        {
+            if(arrays[a] == NULL && a == 2)
+                continue;
+
+            size_t pad = CacheAligned(sizes[a]) - sizes[a];
+            ok = (sizes[a] == 0 || fwrite(arrays[a], 1, sizes[a], file) == sizes[a]) &&
+                fwrite(zeros, 1, pad, file) == pad;
+        }
+    }
+
+    for(vector<IndexBuffer>::const_iterator i=mIndices.begin();  ok && i!=mIndices.end();  i++)
+    {
+        size_t size = i->mNumIndices * sizeof(int);
+        size_t pad = CacheAligned(size) - size;
+        ok = (size == 0 || fwrite(i->mIndices, 1, size, file) == size) && fwrite(zeros, 1, pad, file) == pad;
+    }
+
+    if(fclose(file) != 0)
+        ok = false;
+
+    if(!ok || !MoveFileExW(tempname.c_str(), cachename, MOVEFILE_REPLACE_EXISTING))
+        DeleteFileW(tempname.c_str());
+}
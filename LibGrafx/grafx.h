@@ -39,9 +39,20 @@ Please include author attribution when using this code.
 
 #include "graphics-noexport/GrVector.h"
 #include "graphics-noexport/GrTransform.h"
+#include "graphics-noexport/GrQuaternion.h"
+#include "graphics-noexport/GrRigidTransform.h"
+#include "graphics-noexport/GrImageT.h"
+#include "graphics-noexport/GrBlockImage.h"
 #include "graphics-noexport/GrTexture.h"
+#include "graphics-noexport/GrTextureCache.h"
+#include "graphics-noexport/GrTextureSampler.h"
 #include "graphics-noexport/GrSphere.h"
+#include "graphics-noexport/GrModelXLoad.h"
 #include "graphics-noexport/GrModelX.h"
+#include "graphics-noexport/GrModelXScene.h"
+#include "graphics-noexport/GrPoseBatch.h"
+#include "graphics-noexport/GrAnimationClip.h"
 #include "graphics-noexport/GrImage.h"
+#include "graphics-noexport/GrThreadPool.h"
 
 
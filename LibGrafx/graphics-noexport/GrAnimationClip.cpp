@@ -0,0 +1,707 @@
+//
+//  Name :         GrAnimationClip.cpp
+//  Description :  Implementation of the CGrAnimationClip class.
+//  Version :      See GrAnimationClip.h
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+
+#include <stdafx.h>
+#include "GrTransform.h"
+#include "GrQuaternion.h"
+#include "GrAnimationClip.h"
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+#ifdef _DEBUG
+#undef THIS_FILE
+static char THIS_FILE[]=__FILE__;
+#define new DEBUG_NEW
+#endif
+
+//! \cond ignore
+
+// Key frame numbers are 16 bits
+const int MaxFrames = 65536;
+
+// Tracks for each bone, in this order
+enum {RotationTrack, TranslationTrack, ScaleTrack, TracksPerBone};
+
+// Cursor steps to take before searching instead
+const int MaxSteps = 4;
+
+// All but the largest component of a unit quaternion are at most this
+const double SmallestRange = 0.70710678118654752;
+const float RotationStep = float(2. * SmallestRange / 32767.);
+
+// A bone local transform split into its parts
+struct Trs
+{
+    CGrQuaternion mRotation;
+    float mTranslation[3];
+    float mScale[3];
+};
+
+// A track of one part of one bone
+struct Track
+{
+    int mKeys;              // Number of keys, 1 if the track is constant
+    int mFrames;            // Offset of the key frame numbers in mKeyFrames
+    int mValues;            // Offset of the first key in mValues, 3 values a key
+    float mMin[3];          // Translation or scale is mMin + value * mStep
+    float mStep[3];
+};
+
+//
+// Private implementation of the clip
+//
+
+class CGrAnimationClipp
+{
+public:
+    CGrAnimationClipp() : mBones(0), mFrames(0), mRate(30) {}
+
+    int mBones;
+    int mFrames;
+    double mRate;
+
+    vector<Track> mTracks;                  // TracksPerBone for each bone
+    vector<unsigned short> mKeyFrames;
+    vector<unsigned short> mValues;
+
+    void AddTrack(int part, const vector<float> &values, double tolerance);
+    void SampleTrack(int track, double frame, int &key, float *value) const;
+    void SampleBone(int bone, double frame, int *keys, Trs &trs) const;
+    double ToFrame(double time) const;
+};
+
+//
+// Name :         Decompose()
+// Description :  Split a transform into rotation, translation, and
+//                scale. The scales are the lengths of the columns. A
+//                mirror is kept as a negative x scale.
+//
+
+static void Decompose(const CGrTransform &t, Trs &trs)
+{
+    CGrTransform r;
+    double scale[3];
+    for(int c=0;  c<3;  c++)
+    {
+        scale[c] = sqrt(t.M(0, c) * t.M(0, c) + t.M(1, c) * t.M(1, c) + t.M(2, c) * t.M(2, c));
+        for(int i=0;  i<3;  i++)
+            r[i][c] = scale[c] > 0 ? t.M(i, c) / scale[c] : (i == c ? 1. : 0.);
+    }
+
+    double det = r[0][0] * (r[1][1] * r[2][2] - r[1][2] * r[2][1]) -
+                 r[0][1] * (r[1][0] * r[2][2] - r[1][2] * r[2][0]) +
+                 r[0][2] * (r[1][0] * r[2][1] - r[1][1] * r[2][0]);
+    if(det < 0)
+    {
+        scale[0] = -scale[0];
+        for(int i=0;  i<3;  i++)
+            r[i][0] = -r[i][0];
+    }
+
+    trs.mRotation.SetFromTransform(r);
+
+    for(int i=0;  i<3;  i++)
+    {
+        trs.mTranslation[i] = float(t.M(i, 3));
+        trs.mScale[i] = float(scale[i]);
+    }
+}
+
+//
+// Name :         Compose()
+// Description :  The top three rows of translation * rotation * scale.
+//
+
+static void Compose(const Trs &trs, float *m)
+{
+    trs.mRotation.GetTransform(m);
+    for(int i=0;  i<3;  i++)
+    {
+        for(int c=0;  c<3;  c++)
+            m[i * 4 + c] *= trs.mScale[c];
+
+        m[i * 4 + 3] = trs.mTranslation[i];
+    }
+}
+
+static void Compose(const Trs &trs, CGrTransform &t)
+{
+    float m[12];
+    Compose(trs, m);
+    for(int e=0;  e<12;  e++)
+        t.M(e / 4, e % 4) = m[e];
+
+    t.M(3, 0) = 0;
+    t.M(3, 1) = 0;
+    t.M(3, 2) = 0;
+    t.M(3, 3) = 1;
+}
+
+inline void Lerp3(const float *a, const float *b, float t, float *v)
+{
+    for(int i=0;  i<3;  i++)
+        v[i] = a[i] + (b[i] - a[i]) * t;
+}
+
+//
+// Name :         EncodeRotation()
+// Description :  Smallest three quantization. The largest component is
+//                made positive and left out, and the other three are 15
+//                bits each over the range they can have. The index of
+//                the left out component is in the top bits of the first
+//                two values.
+//
+
+static void EncodeRotation(const float *q, unsigned short *v)
+{
+    int largest = 0;
+    for(int i=1;  i<4;  i++)
+    {
+        if(fabs(q[i]) > fabs(q[largest]))
+            largest = i;
+    }
+
+    float sign = q[largest] < 0 ? -1.f : 1.f;
+    int n = 0;
+    for(int i=0;  i<4;  i++)
+    {
+        if(i == largest)
+            continue;
+
+        double u = (q[i] * sign / SmallestRange * 0.5 + 0.5) * 32767. + 0.5;
+        v[n++] = (unsigned short)(u < 0 ? 0 : (u > 32767 ? 32767 : int(u)));
+    }
+
+    v[0] |= (largest & 1) << 15;
+    v[1] |= (largest >> 1) << 15;
+}
+
+static void DecodeRotation(const unsigned short *v, float *q)
+{
+    int largest = (v[0] >> 15) | ((v[1] >> 15) << 1);
+    float sum = 0;
+    int n = 0;
+    for(int i=0;  i<4;  i++)
+    {
+        if(i == largest)
+            continue;
+
+        q[i] = (v[n++] & 0x7fff) * RotationStep - float(SmallestRange);
+        sum += q[i] * q[i];
+    }
+
+    q[largest] = sum < 1 ? sqrtf(1 - sum) : 0.f;
+}
+
+inline void DecodeVector(const Track &track, const unsigned short *v, float *value)
+{
+    for(int i=0;  i<3;  i++)
+        value[i] = track.mMin[i] + v[i] * track.mStep[i];
+}
+
+//
+// Name :         ValueError()
+// Description :  How far apart two values of a track are. Rotations
+//                are the angle between them, the others the distance.
+//
+
+static double ValueError(const float *a, const float *b, int dim)
+{
+    if(dim == 4)
+    {
+        double dot = fabs(a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3]);
+        return 2. * acos(dot < 1. ? dot : 1.);
+    }
+
+    return sqrt((a[0] - b[0]) * (a[0] - b[0]) + (a[1] - b[1]) * (a[1] - b[1]) + (a[2] - b[2]) * (a[2] - b[2]));
+}
+
+// Error of a frame interpolated from two keys around it
+static double KeyError(const vector<float> &values, int dim, int from, int to, int frame)
+{
+    const float *a = &values[from * dim];
+    const float *b = &values[to * dim];
+    float t = float(frame - from) / float(to - from);
+
+    if(dim == 4)
+        return ValueError(CGrQuaternion::Nlerp(CGrQuaternion(a), CGrQuaternion(b), t), &values[frame * dim], dim);
+
+    float p[3];
+    Lerp3(a, b, t, p);
+    return ValueError(p, &values[frame * dim], dim);
+}
+
+//
+// Name :         CGrAnimationClipp::AddTrack()
+// Description :  Choose the keys for a track and quantize them. From
+//                each key, the next is the farthest frame that still
+//                reproduces every frame between within the tolerance.
+//
+
+void CGrAnimationClipp::AddTrack(int part, const vector<float> &values, double tolerance)
+{
+    int dim = part == RotationTrack ? 4 : 3;
+
+    vector<int> keys(1, 0);
+    bool constant = true;
+    for(int f=1;  f<mFrames && constant;  f++)
+        constant = ValueError(&values[0], &values[f * dim], dim) <= tolerance;
+
+    if(!constant)
+    {
+        int from = 0;
+        while(from < mFrames - 1)
+        {
+            int to = from + 1;
+            while(to + 1 < mFrames)
+            {
+                bool fits = true;
+                for(int f=from+1;  f<=to && fits;  f++)
+                    fits = KeyError(values, dim, from, to + 1, f) <= tolerance;
+
+                if(!fits)
+                    break;
+
+                to++;
+            }
+
+            keys.push_back(to);
+            from = to;
+        }
+    }
+
+    Track track;
+    track.mKeys = (int)keys.size();
+    track.mFrames = (int)mKeyFrames.size();
+    track.mValues = (int)mValues.size();
+    for(int i=0;  i<3;  i++)
+    {
+        track.mMin[i] = 0;
+        track.mStep[i] = 0;
+    }
+
+    if(track.mKeys > 1)
+    {
+        for(size_t k=0;  k<keys.size();  k++)
+            mKeyFrames.push_back((unsigned short)keys[k]);
+    }
+
+    if(dim == 3)
+    {
+        for(int i=0;  i<3;  i++)
+        {
+            float mn = values[keys[0] * 3 + i];
+            float mx = mn;
+            for(size_t k=1;  k<keys.size();  k++)
+            {
+                float v = values[keys[k] * 3 + i];
+                mn = v < mn ? v : mn;
+                mx = v > mx ? v : mx;
+            }
+
+            track.mMin[i] = mn;
+            track.mStep[i] = (mx - mn) / 65535.f;
+        }
+    }
+
+    for(size_t k=0;  k<keys.size();  k++)
+    {
+        unsigned short v[3];
+        const float *value = &values[keys[k] * dim];
+        if(dim == 4)
+        {
+            EncodeRotation(value, v);
+        }
+        else
+        {
+            for(int i=0;  i<3;  i++)
+            {
+                double u = track.mStep[i] > 0 ? (value[i] - track.mMin[i]) / track.mStep[i] + 0.5 : 0.;
+                v[i] = (unsigned short)(u < 0 ? 0 : (u > 65535 ? 65535 : int(u)));
+            }
+        }
+
+        mValues.insert(mValues.end(), v, v + 3);
+    }
+
+    mTracks.push_back(track);
+}
+
+//
+// Name :         CGrAnimationClipp::SampleTrack()
+// Description :  key is the cursor for the track. Playing forward,
+//                the keys to interpolate are the same or a step or two
+//                later. Otherwise they are searched for.
+//
+
+void CGrAnimationClipp::SampleTrack(int t, double frame, int &key, float *value) const
+{
+    const Track &track = mTracks[t];
+    const unsigned short *values = &mValues[track.mValues];
+    bool rotation = t % TracksPerBone == RotationTrack;
+    if(track.mKeys == 1)
+    {
+        if(rotation)
+            DecodeRotation(values, value);
+        else
+            DecodeVector(track, values, value);
+
+        return;
+    }
+
+    // Find the key at or before the frame, but not the last key
+    const unsigned short *frames = &mKeyFrames[track.mFrames];
+    int last = track.mKeys - 2;
+    int k = key >= 0 && key <= last ? key : 0;
+    int steps = 0;
+    while(k < last && frames[k + 1] <= frame && steps < MaxSteps)
+    {
+        k++;
+        steps++;
+    }
+
+    if(frames[k] > frame || (k < last && frames[k + 1] <= frame))
+    {
+        int lo = 0;
+        int hi = last;
+        while(lo < hi)
+        {
+            int mid = (lo + hi + 1) / 2;
+            if(frames[mid] <= frame)
+                lo = mid;
+            else
+                hi = mid - 1;
+        }
+
+        k = lo;
+    }
+
+    key = k;
+
+    float s = float((frame - frames[k]) / (frames[k + 1] - frames[k]));
+    s = s < 0 ? 0.f : (s > 1 ? 1.f : s);
+    if(rotation)
+    {
+        CGrQuaternion a;
+        CGrQuaternion b;
+        DecodeRotation(values + k * 3, a);
+        DecodeRotation(values + k * 3 + 3, b);
+        CGrQuaternion q = CGrQuaternion::Nlerp(a, b, s);
+        for(int i=0;  i<4;  i++)
+            value[i] = q[i];
+    }
+    else
+    {
+        float a[3];
+        float b[3];
+        DecodeVector(track, values + k * 3, a);
+        DecodeVector(track, values + k * 3 + 3, b);
+        Lerp3(a, b, s, value);
+    }
+}
+
+void CGrAnimationClipp::SampleBone(int bone, double frame, int *keys, Trs &trs) const
+{
+    int t = bone * TracksPerBone;
+    SampleTrack(t + RotationTrack, frame, keys[t + RotationTrack], trs.mRotation);
+    SampleTrack(t + TranslationTrack, frame, keys[t + TranslationTrack], trs.mTranslation);
+    SampleTrack(t + ScaleTrack, frame, keys[t + ScaleTrack], trs.mScale);
+}
+
+double CGrAnimationClipp::ToFrame(double time) const
+{
+    double frame = time * mRate;
+    if(!(frame > 0))
+        return 0;
+
+    return frame < mFrames - 1 ? frame : mFrames - 1;
+}
+
+//
+// Name :         BlendTrs()
+// Description :  Blend two samples part by part.
+//
+
+static void BlendTrs(const Trs &a, const Trs &b, float weight, Trs &trs)
+{
+    trs.mRotation = CGrQuaternion::Nlerp(a.mRotation, b.mRotation, weight);
+    Lerp3(a.mTranslation, b.mTranslation, weight, trs.mTranslation);
+    Lerp3(a.mScale, b.mScale, weight, trs.mScale);
+}
+
+// Where samples are written, 12 floats or a CGrTransform a bone
+struct FloatOutput
+{
+    float *mLocal;
+    void operator()(int bone, const Trs &trs) const {Compose(trs, mLocal + bone * 12);}
+};
+
+struct TransformOutput
+{
+    CGrTransform *mLocal;
+    void operator()(int bone, const Trs &trs) const {Compose(trs, mLocal[bone]);}
+};
+
+template<class O> void SampleBones(const CGrAnimationClipp &c, double time, int *keys, const O &output)
+{
+    double frame = c.ToFrame(time);
+    for(int b=0;  b<c.mBones;  b++)
+    {
+        Trs trs;
+        c.SampleBone(b, frame, keys, trs);
+        output(b, trs);
+    }
+}
+
+template<class O> void BlendBones(const CGrAnimationClipp &ca, double timeA, int *keysA,
+                                  const CGrAnimationClipp &cb, double timeB, int *keysB,
+                                  double weight, const O &output)
+{
+    int bones = ca.mBones < cb.mBones ? ca.mBones : cb.mBones;
+    double frameA = ca.ToFrame(timeA);
+    double frameB = cb.ToFrame(timeB);
+    for(int b=0;  b<bones;  b++)
+    {
+        Trs sa;
+        Trs sb;
+        Trs trs;
+        ca.SampleBone(b, frameA, keysA, sa);
+        cb.SampleBone(b, frameB, keysB, sb);
+        BlendTrs(sa, sb, float(weight), trs);
+        output(b, trs);
+    }
+}
+
+//! \endcond
+
+
+CGrAnimationClip::Cursor::Cursor()
+{
+    mClip = NULL;
+    mKeys = NULL;
+    mCount = 0;
+}
+
+
+CGrAnimationClip::Cursor::Cursor(const Cursor &cursor)
+{
+    mClip = NULL;
+    mKeys = NULL;
+    mCount = 0;
+    *this = cursor;
+}
+
+
+CGrAnimationClip::Cursor::~Cursor()
+{
+    delete [] mKeys;
+}
+
+
+CGrAnimationClip::Cursor &CGrAnimationClip::Cursor::operator=(const Cursor &cursor)
+{
+    if(&cursor == this)
+        return *this;
+
+    delete [] mKeys;
+    mKeys = cursor.mCount > 0 ? new int[cursor.mCount] : NULL;
+    for(int i=0;  i<cursor.mCount;  i++)
+        mKeys[i] = cursor.mKeys[i];
+
+    mCount = cursor.mCount;
+    mClip = cursor.mClip;
+    return *this;
+}
+
+
+void CGrAnimationClip::Cursor::Reset()
+{
+    for(int i=0;  i<mCount;  i++)
+        mKeys[i] = 0;
+}
+
+
+CGrAnimationClip::CGrAnimationClip()
+{
+    mClip = new CGrAnimationClipp();
+}
+
+
+CGrAnimationClip::~CGrAnimationClip()
+{
+    delete mClip;
+}
+
+
+bool CGrAnimationClip::Build(int bones, int frames, double rate, const CGrTransform *local,
+                             double rotationTolerance, double translationTolerance, double scaleTolerance)
+{
+    Clear();
+    if(bones <= 0 || frames <= 0 || frames > MaxFrames || !(rate > 0))
+        return false;
+
+    CGrAnimationClipp &c = *mClip;
+    c.mBones = bones;
+    c.mFrames = frames;
+    c.mRate = rate;
+
+    vector<float> rotations(frames * 4);
+    vector<float> translations(frames * 3);
+    vector<float> scales(frames * 3);
+    for(int b=0;  b<bones;  b++)
+    {
+        for(int f=0;  f<frames;  f++)
+        {
+            Trs trs;
+            Decompose(local[size_t(f) * bones + b], trs);
+
+            // Keep each rotation on the same side as the one before,
+            // so the keys interpolate the short way
+            float *q = &rotations[f * 4];
+            float dot = 0;
+            for(int i=0;  i<4;  i++)
+            {
+                q[i] = trs.mRotation[i];
+                if(f > 0)
+                    dot += q[i] * q[i - 4];
+            }
+
+            if(dot < 0)
+            {
+                for(int i=0;  i<4;  i++)
+                    q[i] = -q[i];
+            }
+
+            for(int i=0;  i<3;  i++)
+            {
+                translations[f * 3 + i] = trs.mTranslation[i];
+                scales[f * 3 + i] = trs.mScale[i];
+            }
+        }
+
+        c.AddTrack(RotationTrack, rotations, rotationTolerance);
+        c.AddTrack(TranslationTrack, translations, translationTolerance);
+        c.AddTrack(ScaleTrack, scales, scaleTolerance);
+    }
+
+    return true;
+}
+
+
+void CGrAnimationClip::Clear()
+{
+    CGrAnimationClipp &c = *mClip;
+    c.mBones = 0;
+    c.mFrames = 0;
+    c.mTracks.clear();
+    c.mKeyFrames.clear();
+    c.mValues.clear();
+}
+
+
+int CGrAnimationClip::GetBoneCount() const
+{
+    return mClip->mBones;
+}
+
+
+int CGrAnimationClip::GetFrameCount() const
+{
+    return mClip->mFrames;
+}
+
+
+double CGrAnimationClip::GetFrameRate() const
+{
+    return mClip->mRate;
+}
+
+
+double CGrAnimationClip::GetDuration() const
+{
+    return mClip->mFrames > 1 ? (mClip->mFrames - 1) / mClip->mRate : 0;
+}
+
+
+size_t CGrAnimationClip::GetBytes() const
+{
+    const CGrAnimationClipp &c = *mClip;
+    return sizeof(CGrAnimationClipp) + c.mTracks.size() * sizeof(Track) +
+        c.mKeyFrames.size() * sizeof(unsigned short) + c.mValues.size() * sizeof(unsigned short);
+}
+
+
+//
+// Name :         CGrAnimationClip::Prepare()
+// Description :  Make a cursor ready for this clip. A cursor last used
+//                with another clip starts over with the first keys.
+//
+
+void CGrAnimationClip::Prepare(Cursor &cursor) const
+{
+    int tracks = mClip->mBones * TracksPerBone;
+    if(cursor.mClip == this && cursor.mCount == tracks)
+        return;
+
+    delete [] cursor.mKeys;
+    cursor.mClip = this;
+    cursor.mCount = tracks;
+    cursor.mKeys = tracks > 0 ? new int[tracks] : NULL;
+    cursor.Reset();
+}
+
+
+void CGrAnimationClip::Sample(double time, Cursor &cursor, float *local) const
+{
+    Prepare(cursor);
+
+    FloatOutput output;
+    output.mLocal = local;
+    SampleBones(*mClip, time, cursor.mKeys, output);
+}
+
+
+void CGrAnimationClip::Sample(double time, Cursor &cursor, CGrTransform *local) const
+{
+    Prepare(cursor);
+
+    TransformOutput output;
+    output.mLocal = local;
+    SampleBones(*mClip, time, cursor.mKeys, output);
+}
+
+
+void CGrAnimationClip::Blend(const CGrAnimationClip &a, double timeA, Cursor &cursorA,
+                             const CGrAnimationClip &b, double timeB, Cursor &cursorB,
+                             double weight, float *local)
+{
+    a.Prepare(cursorA);
+    b.Prepare(cursorB);
+
+    FloatOutput output;
+    output.mLocal = local;
+    BlendBones(*a.mClip, timeA, cursorA.mKeys, *b.mClip, timeB, cursorB.mKeys, weight, output);
+}
+
+
+void CGrAnimationClip::Blend(const CGrAnimationClip &a, double timeA, Cursor &cursorA,
+                             const CGrAnimationClip &b, double timeB, Cursor &cursorB,
+                             double weight, CGrTransform *local)
+{
+    a.Prepare(cursorA);
+    b.Prepare(cursorB);
+
+    TransformOutput output;
+    output.mLocal = local;
+    BlendBones(*a.mClip, timeA, cursorA.mKeys, *b.mClip, timeB, cursorB.mKeys, weight, output);
+}
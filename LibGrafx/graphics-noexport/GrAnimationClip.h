@@ -0,0 +1,157 @@
+//
+// Name :         GrAnimationClip.h
+// Description :  Header for CGrAnimationClip, a keyframed animation
+//                of the bones of a model with compressed tracks.
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+#pragma once
+
+#if !defined(_GRANIMATIONCLIP_H)
+#define _GRANIMATIONCLIP_H
+
+#if !defined(LibGrafx)
+#define LibGrafx
+#endif
+
+#include <cstddef>
+
+class CGrAnimationClipp;
+class CGrTransform;
+
+//! A keyframed animation of the bones of a model.
+
+/*! A clip is built from a local transform for every bone at every
+frame, the form an exporter or a recording produces, and keeps it in a
+compressed form. Each bone local transform is split into a rotation, a
+translation, and a scale, and each of those is a track of its own.
+
+Keys that interpolation between their neighbors reproduces within a
+tolerance are dropped, and a track whose keys are all the same keeps
+only one. Rotations are quantized to 48 bits, the three smallest
+components of the quaternion at 15 bits each. Translations and scales
+are quantized to 16 bits a component over the range of their track.
+A typical clip takes a tenth or less of the memory of a CGrTransform
+per bone per frame.
+
+Sampling goes through a Cursor, which remembers the key each track was
+on. Playing forward, finding the keys to interpolate is a step or two
+per track no matter how long the clip is. Jumping backward or far
+ahead falls back to a binary search.
+
+The clip bones are bone indices of the model the clip was made for,
+the same as CGrModelX::BoneId. The samples are written for all of the
+bones at once, either as CGrTransform objects for
+CGrModelX::SetLocalTransforms() or as 12 floats each for
+CGrPoseBatch::SetLocalTransforms().
+
+\version 1.00 Initial version
+*/
+
+class LibGrafx CGrAnimationClip
+{
+public:
+    //! Playback position in a clip
+    /*! A cursor can be used with any clip, but it is fastest used with
+        one clip playing forward. Each animated instance needs its own. */
+    class LibGrafx Cursor
+    {
+    public:
+        Cursor();
+        Cursor(const Cursor &cursor);
+        ~Cursor();
+        Cursor &operator=(const Cursor &cursor);
+
+        //! Forget the position, so the next sample searches
+        void Reset();
+
+    private:
+        friend class CGrAnimationClip;
+
+        const CGrAnimationClip *mClip;  // Clip mKeys is for
+        int *mKeys;                     // For each track, the key at or before the last sample
+        int mCount;
+    };
+
+    CGrAnimationClip();
+    virtual ~CGrAnimationClip();
+
+    //! Build the clip from a transform for every bone at every frame
+    /*! The transforms must be a rotation, a translation, and a scale
+        along the axes of the rotation, which is what bone local
+        transforms are. Shear is lost.
+        \param bones Number of bones
+        \param frames Number of frames, at most 65536
+        \param rate Frames per second
+        \param local The local transforms, all of the bones for frame 0,
+        then all of the bones for frame 1, and so on
+        \param rotationTolerance Largest rotation error of a dropped key in radians
+        \param translationTolerance Largest translation error of a dropped key
+        \param scaleTolerance Largest scale error of a dropped key
+        \return false if the sizes are out of range */
+    bool Build(int bones, int frames, double rate, const CGrTransform *local,
+               double rotationTolerance=0.001, double translationTolerance=0.001, double scaleTolerance=0.001);
+
+    //! Remove the animation
+    void Clear();
+
+    int GetBoneCount() const;
+    int GetFrameCount() const;
+    double GetFrameRate() const;
+
+    //! Length of the clip in seconds
+    double GetDuration() const;
+
+    //! Bytes of memory the tracks use
+    size_t GetBytes() const;
+
+    //! Sample the clip
+    /*! Times outside the clip are held at the first or last frame.
+        \param time Time in seconds
+        \param cursor Playback position, updated
+        \param local Receives GetBoneCount() local transforms */
+    void Sample(double time, Cursor &cursor, CGrTransform *local) const;
+
+    //! Sample the clip as 12 floats a bone
+    /*! \param time Time in seconds
+        \param cursor Playback position, updated
+        \param local Receives 12 floats for each bone, the top three
+        rows of the local transform */
+    void Sample(double time, Cursor &cursor, float *local) const;
+
+    //! Sample two clips and blend them
+    /*! Rotations, translations, and scales are blended separately, so
+        a blend of two rotations is a rotation. The clips should be for
+        the same model. If they have different numbers of bones, only
+        the bones both have are written.
+        \param a First clip
+        \param timeA Time in the first clip
+        \param cursorA Playback position in the first clip
+        \param b Second clip
+        \param timeB Time in the second clip
+        \param cursorB Playback position in the second clip
+        \param weight 0 for all a, 1 for all b
+        \param local Receives the local transforms */
+    static void Blend(const CGrAnimationClip &a, double timeA, Cursor &cursorA,
+                      const CGrAnimationClip &b, double timeB, Cursor &cursorB,
+                      double weight, CGrTransform *local);
+
+    //! Sample two clips and blend them as 12 floats a bone
+    static void Blend(const CGrAnimationClip &a, double timeA, Cursor &cursorA,
+                      const CGrAnimationClip &b, double timeB, Cursor &cursorB,
+                      double weight, float *local);
+
+private:
+    // Not copyable
+    CGrAnimationClip(const CGrAnimationClip &);
+    CGrAnimationClip &operator=(const CGrAnimationClip &);
+
+    void Prepare(Cursor &cursor) const;
+
+    CGrAnimationClipp *mClip;
+};
+
+#endif
@@ -0,0 +1,731 @@
+//
+//  Name :         GrBlockImage.cpp
+//  Description :  Implementation of CGrBlockImage, the BC1 and BC3
+//                 block encoder and decoder.
+//  Version :      See GrBlockImage.h
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+
+#include <stdafx.h>
+#include "GrBlockImage.h"
+#include "GrThreadPool.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+#ifdef _DEBUG
+#undef THIS_FILE
+static char THIS_FILE[]=__FILE__;
+#define new DEBUG_NEW
+#endif
+
+//! \cond ignore
+
+// Rows of blocks encoded by each thread pool task
+const int EncodeGrain = 4;
+
+// Weight of color 0 for each index of a four color block
+static const float IndexWeights[4] = {1.f, 0.f, 2.f / 3.f, 1.f / 3.f};
+
+inline int Clamp255(float v)
+{
+    // Written so a NaN ends up 0
+    return v > 0 ? (v < 255.f ? int(v + 0.5f) : 255) : 0;
+}
+
+//
+// Name :         Pack565()
+// Description :  B, G, R to 5, 6, and 5 bits, rounded to nearest.
+//
+
+inline int Pack565(int b, int g, int r)
+{
+    return ((r * 31 + 127) / 255) << 11 | ((g * 63 + 127) / 255) << 5 | ((b * 31 + 127) / 255);
+}
+
+inline void Unpack565(int c, int *bgr)
+{
+    int r = (c >> 11) & 31;
+    int g = (c >> 5) & 63;
+    int b = c & 31;
+    bgr[0] = (b << 3) | (b >> 2);
+    bgr[1] = (g << 2) | (g >> 4);
+    bgr[2] = (r << 3) | (r >> 2);
+}
+
+//
+// Name :         ColorPalette()
+// Description :  The four colors of a color block. A BC1 block with
+//                color 0 no greater than color 1 has three colors and
+//                transparent black.
+//
+
+static void ColorPalette(int c0, int c1, bool fourColor, int (*palette)[4])
+{
+    Unpack565(c0, palette[0]);
+    Unpack565(c1, palette[1]);
+    palette[0][3] = palette[1][3] = 255;
+    palette[2][3] = palette[3][3] = 255;
+
+    for(int i=0;  i<3;  i++)
+    {
+        if(fourColor)
+        {
+            palette[2][i] = (2 * palette[0][i] + palette[1][i]) / 3;
+            palette[3][i] = (palette[0][i] + 2 * palette[1][i]) / 3;
+        }
+        else
+        {
+            palette[2][i] = (palette[0][i] + palette[1][i]) / 2;
+            palette[3][i] = 0;
+        }
+    }
+
+    if(!fourColor)
+        palette[3][3] = 0;
+}
+
+//
+// Name :         AlphaPalette()
+// Description :  The eight alpha values of a BC3 alpha block.
+//
+
+static void AlphaPalette(int a0, int a1, int *palette)
+{
+    palette[0] = a0;
+    palette[1] = a1;
+    if(a0 > a1)
+    {
+        for(int k=1;  k<7;  k++)
+            palette[k + 1] = ((7 - k) * a0 + k * a1) / 7;
+    }
+    else
+    {
+        for(int k=1;  k<5;  k++)
+            palette[k + 1] = ((5 - k) * a0 + k * a1) / 5;
+
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+//
+// Name :         MatchColors()
+// Description :  The index of the nearest palette color for each texel.
+// Returns :      The total squared error
+//
+
+static int MatchColors(const unsigned char *bgra, const int (*palette)[4], unsigned &indices)
+{
+    int error = 0;
+    indices = 0;
+    for(int i=0;  i<16;  i++)
+    {
+        const unsigned char *p = bgra + i * 4;
+        int best = 0;
+        int bestError = 0x7fffffff;
+        for(int k=0;  k<4;  k++)
+        {
+            int db = p[0] - palette[k][0];
+            int dg = p[1] - palette[k][1];
+            int dr = p[2] - palette[k][2];
+            int e = db * db + dg * dg + dr * dr;
+            if(e < bestError)
+            {
+                bestError = e;
+                best = k;
+            }
+        }
+
+        indices |= unsigned(best) << (i * 2);
+        error += bestError;
+    }
+
+    return error;
+}
+
+//
+// Name :         RefineColors()
+// Description :  The two colors that fit the texels best by least
+//                squares for the indices chosen.
+// Returns :      false if every texel has the same weight, so there
+//                is no fit
+//
+
+static bool RefineColors(const unsigned char *bgra, unsigned indices, int &c0, int &c1)
+{
+    float aa = 0, ab = 0, bb = 0;
+    float ap[3] = {0, 0, 0};
+    float bp[3] = {0, 0, 0};
+    for(int i=0;  i<16;  i++)
+    {
+        float a = IndexWeights[(indices >> (i * 2)) & 3];
+        float b = 1.f - a;
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for(int k=0;  k<3;  k++)
+        {
+            ap[k] += a * bgra[i * 4 + k];
+            bp[k] += b * bgra[i * 4 + k];
+        }
+    }
+
+    float det = aa * bb - ab * ab;
+    if(fabs(det) < 1e-4f)
+        return false;
+
+    int e0[3], e1[3];
+    for(int k=0;  k<3;  k++)
+    {
+        e0[k] = Clamp255((bb * ap[k] - ab * bp[k]) / det);
+        e1[k] = Clamp255((aa * bp[k] - ab * ap[k]) / det);
+    }
+
+    c0 = Pack565(e0[0], e0[1], e0[2]);
+    c1 = Pack565(e1[0], e1[1], e1[2]);
+    return true;
+}
+
+//
+// Name :         EncodeColor()
+// Description :  Compress the colors of a block into 8 bytes, always
+//                in four color mode. The line the colors lie closest
+//                to is the principal axis of their covariance, found by
+//                power iteration. The texels farthest along it in each
+//                direction are the first guess at the two colors.
+//
+
+static void EncodeColor(const unsigned char *bgra, unsigned char *block)
+{
+    float mean[3] = {0, 0, 0};
+    int lo[3] = {255, 255, 255};
+    int hi[3] = {0, 0, 0};
+    for(int i=0;  i<16;  i++)
+    {
+        for(int k=0;  k<3;  k++)
+        {
+            int v = bgra[i * 4 + k];
+            mean[k] += v;
+            lo[k] = v < lo[k] ? v : lo[k];
+            hi[k] = v > hi[k] ? v : hi[k];
+        }
+    }
+
+    int c0, c1;
+    unsigned indices = 0;
+    if(lo[0] == hi[0] && lo[1] == hi[1] && lo[2] == hi[2])
+    {
+        // One color
+        c0 = c1 = Pack565(lo[0], lo[1], lo[2]);
+    }
+    else
+    {
+        for(int k=0;  k<3;  k++)
+            mean[k] *= 1.f / 16.f;
+
+        // Covariance as bb, bg, br, gg, gr, rr
+        float cov[6] = {0, 0, 0, 0, 0, 0};
+        for(int i=0;  i<16;  i++)
+        {
+            float b = bgra[i * 4] - mean[0];
+            float g = bgra[i * 4 + 1] - mean[1];
+            float r = bgra[i * 4 + 2] - mean[2];
+            cov[0] += b * b;
+            cov[1] += b * g;
+            cov[2] += b * r;
+            cov[3] += g * g;
+            cov[4] += g * r;
+            cov[5] += r * r;
+        }
+
+        float axis[3] = {float(hi[0] - lo[0]), float(hi[1] - lo[1]), float(hi[2] - lo[2])};
+        for(int iter=0;  iter<4;  iter++)
+        {
+            float v[3];
+            v[0] = cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2];
+            v[1] = cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+            v[2] = cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2];
+
+            float m = fabs(v[0]) > fabs(v[1]) ? fabs(v[0]) : fabs(v[1]);
+            m = fabs(v[2]) > m ? fabs(v[2]) : m;
+            if(m < 1e-6f)
+                break;
+
+            for(int k=0;  k<3;  k++)
+                axis[k] = v[k] / m;
+        }
+
+        int first = 0, last = 0;
+        float minDot = 1e30f, maxDot = -1e30f;
+        for(int i=0;  i<16;  i++)
+        {
+            const unsigned char *p = bgra + i * 4;
+            float d = p[0] * axis[0] + p[1] * axis[1] + p[2] * axis[2];
+            if(d < minDot)
+            {
+                minDot = d;
+                last = i;
+            }
+
+            if(d > maxDot)
+            {
+                maxDot = d;
+                first = i;
+            }
+        }
+
+        const unsigned char *p0 = bgra + first * 4;
+        const unsigned char *p1 = bgra + last * 4;
+        c0 = Pack565(p0[0], p0[1], p0[2]);
+        c1 = Pack565(p1[0], p1[1], p1[2]);
+
+        int palette[4][4];
+        ColorPalette(c0, c1, true, palette);
+        int error = MatchColors(bgra, palette, indices);
+
+        // Fit the colors to the indices, and the indices to the
+        // colors, while that helps
+        for(int iter=0;  iter<2 && error > 0;  iter++)
+        {
+            int n0, n1;
+            if(!RefineColors(bgra, indices, n0, n1) || (n0 == c0 && n1 == c1))
+                break;
+
+            unsigned nIndices;
+            ColorPalette(n0, n1, true, palette);
+            int nError = MatchColors(bgra, palette, nIndices);
+            if(nError >= error)
+                break;
+
+            c0 = n0;
+            c1 = n1;
+            indices = nIndices;
+            error = nError;
+        }
+    }
+
+    // Color 0 must be the greater for four color mode in BC1.
+    // Swapping the colors swaps indices 0 and 1 and 2 and 3.
+    if(c0 < c1)
+    {
+        int t = c0;
+        c0 = c1;
+        c1 = t;
+        indices ^= 0x55555555;
+    }
+    else if(c0 == c1)
+    {
+        indices = 0;
+    }
+
+    block[0] = (unsigned char)c0;
+    block[1] = (unsigned char)(c0 >> 8);
+    block[2] = (unsigned char)c1;
+    block[3] = (unsigned char)(c1 >> 8);
+    for(int i=0;  i<4;  i++)
+        block[4 + i] = (unsigned char)(indices >> (i * 8));
+}
+
+//
+// Name :         EncodeAlpha()
+// Description :  Compress the alpha of a block into 8 bytes. The end
+//                points are the least and greatest alpha, using all
+//                eight values between them.
+//
+
+static void EncodeAlpha(const unsigned char *bgra, unsigned char *block)
+{
+    int lo = 255, hi = 0;
+    for(int i=0;  i<16;  i++)
+    {
+        int a = bgra[i * 4 + 3];
+        lo = a < lo ? a : lo;
+        hi = a > hi ? a : hi;
+    }
+
+    block[0] = (unsigned char)hi;
+    block[1] = (unsigned char)lo;
+
+    unsigned long long bits = 0;
+    if(hi > lo)
+    {
+        int palette[8];
+        AlphaPalette(hi, lo, palette);
+        for(int i=0;  i<16;  i++)
+        {
+            int a = bgra[i * 4 + 3];
+            int best = 0;
+            int bestError = 256;
+            for(int k=0;  k<8;  k++)
+            {
+                int e = abs(a - palette[k]);
+                if(e < bestError)
+                {
+                    bestError = e;
+                    best = k;
+                }
+            }
+
+            bits |= (unsigned long long)best << (i * 3);
+        }
+    }
+
+    for(int i=0;  i<6;  i++)
+        block[2 + i] = (unsigned char)(bits >> (i * 8));
+}
+
+
+static void DecodeColor(const unsigned char *block, bool bc1, unsigned char *bgra)
+{
+    int c0 = block[0] | (block[1] << 8);
+    int c1 = block[2] | (block[3] << 8);
+    int palette[4][4];
+    ColorPalette(c0, c1, !bc1 || c0 > c1, palette);
+
+    for(int i=0;  i<16;  i++)
+    {
+        const int *c = palette[(block[4 + (i >> 2)] >> ((i & 3) * 2)) & 3];
+        bgra[i * 4] = (unsigned char)c[0];
+        bgra[i * 4 + 1] = (unsigned char)c[1];
+        bgra[i * 4 + 2] = (unsigned char)c[2];
+        bgra[i * 4 + 3] = (unsigned char)c[3];
+    }
+}
+
+
+static void DecodeAlpha(const unsigned char *block, unsigned char *bgra)
+{
+    int palette[8];
+    AlphaPalette(block[0], block[1], palette);
+
+    unsigned long long bits = 0;
+    for(int i=0;  i<6;  i++)
+        bits |= (unsigned long long)block[2 + i] << (i * 8);
+
+    for(int i=0;  i<16;  i++)
+        bgra[i * 4 + 3] = (unsigned char)palette[(bits >> (i * 3)) & 7];
+}
+
+
+//
+// Encode() split into rows of blocks. The texels of each block are
+// gathered into B, G, R, A order first, repeating the last row and
+// column past the edge of the image.
+//
+
+struct EncodeRows
+{
+    unsigned char *mDest;
+    const unsigned char *mSrc;
+    int mPitch;
+    int mWidth;
+    int mHeight;
+    int mChannels;
+    CGrBlockImage::Format mFormat;
+
+    void operator()(int by, int worker) const
+    {
+        int blockBytes = CGrBlockImage::BlockBytes(mFormat);
+        int across = (mWidth + 3) / 4;
+        unsigned char *dest = mDest + size_t(by) * across * blockBytes;
+
+        unsigned char bgra[64];
+        for(int bx=0;  bx<across;  bx++, dest += blockBytes)
+        {
+            for(int y=0;  y<4;  y++)
+            {
+                int sy = by * 4 + y < mHeight ? by * 4 + y : mHeight - 1;
+                const unsigned char *row = mSrc + size_t(sy) * mPitch;
+                for(int x=0;  x<4;  x++)
+                {
+                    int sx = bx * 4 + x < mWidth ? bx * 4 + x : mWidth - 1;
+                    const unsigned char *p = row + sx * mChannels;
+                    unsigned char *d = bgra + (y * 4 + x) * 4;
+                    d[0] = p[0];
+                    d[1] = p[1];
+                    d[2] = p[2];
+                    d[3] = mChannels == 4 ? p[3] : 255;
+                }
+            }
+
+            CGrBlockImage::EncodeBlock(bgra, mFormat, dest);
+        }
+    }
+};
+
+//! \endcond
+
+
+CGrBlockImage::CGrBlockImage()
+{
+    mData = NULL;
+    mWidth = 0;
+    mHeight = 0;
+    mFormat = None;
+}
+
+
+CGrBlockImage::CGrBlockImage(CGrBlockImage &&img)
+{
+    mData = NULL;
+    mWidth = 0;
+    mHeight = 0;
+    mFormat = None;
+    *this = static_cast<CGrBlockImage &&>(img);
+}
+
+
+CGrBlockImage::~CGrBlockImage()
+{
+    Clear();
+}
+
+
+CGrBlockImage &CGrBlockImage::operator=(CGrBlockImage &&img)
+{
+    if(&img != this)
+    {
+        Clear();
+        mData = img.mData;
+        mWidth = img.mWidth;
+        mHeight = img.mHeight;
+        mFormat = img.mFormat;
+
+        img.mData = NULL;
+        img.mWidth = 0;
+        img.mHeight = 0;
+        img.mFormat = None;
+    }
+
+    return *this;
+}
+
+
+void CGrBlockImage::Copy(const CGrBlockImage &img)
+{
+    if(&img == this)
+        return;
+
+    SetSize(img.mWidth, img.mHeight, img.mFormat);
+    if(mData != NULL)
+        memcpy(mData, img.mData, GetBytes());
+}
+
+
+void CGrBlockImage::Clear()
+{
+    if(mData != NULL)
+        CGrImageKernels::Free(mData);
+
+    mData = NULL;
+    mWidth = 0;
+    mHeight = 0;
+    mFormat = None;
+}
+
+
+void CGrBlockImage::SetSize(int width, int height, Format format)
+{
+    if(width == mWidth && height == mHeight && format == mFormat && mData != NULL)
+        return;
+
+    Clear();
+    if(width <= 0 || height <= 0 || BlockBytes(format) == 0)
+        return;
+
+    mWidth = width;
+    mHeight = height;
+    mFormat = format;
+    mData = (unsigned char *)CGrImageKernels::Allocate(GetBytes());
+}
+
+
+void CGrBlockImage::Encode(const CGrImageBgr8 &image, Format format, CGrThreadPool *pool)
+{
+    Encode(image.GetData(), image.GetPitch(), image.GetWidth(), image.GetHeight(), 3, format, pool);
+}
+
+
+void CGrBlockImage::Encode(const CGrImageBgra8 &image, Format format, CGrThreadPool *pool)
+{
+    Encode(image.GetData(), image.GetPitch(), image.GetWidth(), image.GetHeight(), 4, format, pool);
+}
+
+
+void CGrBlockImage::Encode(const unsigned char *rows, int pitch, int width, int height, int channels,
+                           Format format, CGrThreadPool *pool)
+{
+    SetSize(width, height, format);
+    if(mData == NULL || rows == NULL)
+        return;
+
+    EncodeRows encode;
+    encode.mDest = mData;
+    encode.mSrc = rows;
+    encode.mPitch = pitch;
+    encode.mWidth = width;
+    encode.mHeight = height;
+    encode.mChannels = channels;
+    encode.mFormat = format;
+
+    int down = GetBlocksDown();
+    if(pool != NULL && down > EncodeGrain)
+    {
+        pool->ParallelFor(down, EncodeGrain, encode);
+    }
+    else
+    {
+        for(int by=0;  by<down;  by++)
+            encode(by, 0);
+    }
+}
+
+
+void CGrBlockImage::Decode(CGrImageBgr8 &image) const
+{
+    image.SetSize(mWidth, mHeight);
+    Decode(image.GetData(), image.GetPitch(), 3);
+}
+
+
+void CGrBlockImage::Decode(CGrImageBgra8 &image) const
+{
+    image.SetSize(mWidth, mHeight);
+    Decode(image.GetData(), image.GetPitch(), 4);
+}
+
+
+void CGrBlockImage::Decode(unsigned char *rows, int pitch, int channels) const
+{
+    if(mData == NULL || rows == NULL)
+        return;
+
+    unsigned char bgra[64];
+    for(int by=0;  by<GetBlocksDown();  by++)
+    {
+        for(int bx=0;  bx<GetBlocksAcross();  bx++)
+        {
+            DecodeBlock(bx, by, bgra);
+            for(int y=0;  y<4 && by * 4 + y<mHeight;  y++)
+            {
+                unsigned char *dest = rows + size_t(by * 4 + y) * pitch + bx * 4 * channels;
+                for(int x=0;  x<4 && bx * 4 + x<mWidth;  x++, dest += channels)
+                    memcpy(dest, bgra + (y * 4 + x) * 4, channels);
+            }
+        }
+    }
+}
+
+
+void CGrBlockImage::DecodeBlock(int bx, int by, unsigned char *bgra) const
+{
+    DecodeBlock(GetBlock(bx, by), mFormat, bgra);
+}
+
+
+//
+// Name :         CGrBlockImage::DecodeTexel()
+// Description :  Decode only the palette entries this texel uses.
+//
+
+unsigned CGrBlockImage::DecodeTexel(int x, int y) const
+{
+    const unsigned char *block = GetBlock(x >> 2, y >> 2);
+    int i = (y & 3) * 4 + (x & 3);
+
+    unsigned alpha = 255;
+    if(mFormat == Bc3)
+    {
+        int shift = i * 3;
+        int bits = (block[2 + (shift >> 3)] | (block[3 + (shift >> 3)] << 8)) >> (shift & 7);
+        int k = bits & 7;
+        int a0 = block[0];
+        int a1 = block[1];
+        if(k < 2)
+            alpha = k == 0 ? a0 : a1;
+        else if(a0 > a1)
+            alpha = ((8 - k) * a0 + (k - 1) * a1) / 7;
+        else if(k < 6)
+            alpha = ((6 - k) * a0 + (k - 1) * a1) / 5;
+        else
+            alpha = k == 6 ? 0 : 255;
+
+        block += 8;
+    }
+
+    int c0 = block[0] | (block[1] << 8);
+    int c1 = block[2] | (block[3] << 8);
+    int k = (block[4 + (i >> 2)] >> ((i & 3) * 2)) & 3;
+
+    int a[3], b[3], c[3];
+    if(k == 1)
+    {
+        Unpack565(c1, c);
+    }
+    else
+    {
+        Unpack565(c0, a);
+        if(k == 0)
+        {
+            c[0] = a[0];
+            c[1] = a[1];
+            c[2] = a[2];
+        }
+        else
+        {
+            Unpack565(c1, b);
+            if(mFormat != Bc1 || c0 > c1)
+            {
+                for(int j=0;  j<3;  j++)
+                    c[j] = k == 2 ? (2 * a[j] + b[j]) / 3 : (a[j] + 2 * b[j]) / 3;
+            }
+            else if(k == 2)
+            {
+                for(int j=0;  j<3;  j++)
+                    c[j] = (a[j] + b[j]) / 2;
+            }
+            else
+            {
+                c[0] = c[1] = c[2] = 0;
+                alpha = 0;
+            }
+        }
+    }
+
+    return unsigned(c[0]) | unsigned(c[1]) << 8 | unsigned(c[2]) << 16 | alpha << 24;
+}
+
+
+void CGrBlockImage::EncodeBlock(const unsigned char *bgra, Format format, unsigned char *block)
+{
+    if(format == Bc3)
+    {
+        EncodeAlpha(bgra, block);
+        EncodeColor(bgra, block + 8);
+    }
+    else if(format == Bc1)
+    {
+        EncodeColor(bgra, block);
+    }
+}
+
+
+void CGrBlockImage::DecodeBlock(const unsigned char *block, Format format, unsigned char *bgra)
+{
+    if(format == Bc3)
+    {
+        DecodeColor(block + 8, false, bgra);
+        DecodeAlpha(block, bgra);
+    }
+    else if(format == Bc1)
+    {
+        DecodeColor(block, true, bgra);
+    }
+}
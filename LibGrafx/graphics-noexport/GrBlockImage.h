@@ -0,0 +1,155 @@
+//
+// Name :         GrBlockImage.h
+// Description :  Header for CGrBlockImage, an image in BC1 or BC3
+//                block compressed form.
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+#pragma once
+
+#if !defined(_GRBLOCKIMAGE_H)
+#define _GRBLOCKIMAGE_H
+
+#if !defined(LibGrafx)
+#define LibGrafx
+#endif
+
+#include <cstddef>
+#include "GrImageT.h"
+
+class CGrThreadPool;
+
+//! An image compressed into 4 by 4 texel blocks.
+
+/*! The blocks are the BC1 and BC3 formats of Direct3D, which are the
+DXT1 and DXT5 formats of the OpenGL S3TC extension, so they can be sent
+to OpenGL as they are. BC1 is 8 bytes a block, half a byte a texel, and
+has no alpha. BC3 is 16 bytes a block, a byte a texel, and adds an
+alpha channel compressed on its own.
+
+Each block keeps two colors rounded to 5, 6, and 5 bits and a 2 bit
+index per texel that picks one of them or one of the two colors a third
+of the way between them. The encoder finds the line through the colors
+of a block by principal components, takes the ends of it as the first
+guess, and then refines the two colors by least squares to fit the
+indices chosen.
+
+The blocks are stored a row of blocks at a time with no padding, the
+layout glCompressedTexImage2D() expects. An image whose size is not a
+multiple of 4 still has whole blocks; the texels past the edge repeat
+the last row and column.
+
+Images move rather than copy. Copy() makes a copy.
+
+\version 1.00 Initial version
+*/
+
+class LibGrafx CGrBlockImage
+{
+public:
+    //! Block formats
+    enum Format {None, Bc1, Bc3};
+
+    //! Constructor. The image is empty.
+    CGrBlockImage();
+
+    //! Move Constructor. The other image is left empty.
+    CGrBlockImage(CGrBlockImage &&img);
+
+    ~CGrBlockImage();
+
+    //! Move assignment. The other image is left empty.
+    CGrBlockImage &operator=(CGrBlockImage &&img);
+
+    //! Copy another image into this one
+    void Copy(const CGrBlockImage &img);
+
+    //! Release the blocks. The image is empty afterwards.
+    void Clear();
+
+    bool IsEmpty() const {return mData == NULL;}
+
+    //! Compress an image
+    /*! \param image B, G, R image. Alpha in BC3 is 255.
+        \param format Bc1 or Bc3
+        \param pool Threads to split the rows of blocks over, or NULL for this thread only */
+    void Encode(const CGrImageBgr8 &image, Format format, CGrThreadPool *pool=NULL);
+
+    //! Compress an image with alpha
+    /*! \param image B, G, R, A image. Alpha is dropped in BC1.
+        \param format Bc1 or Bc3
+        \param pool Threads to split the rows of blocks over, or NULL for this thread only */
+    void Encode(const CGrImageBgra8 &image, Format format, CGrThreadPool *pool=NULL);
+
+    //! Decompress the whole image
+    /*! \param image Set to the size of this image and filled */
+    void Decode(CGrImageBgr8 &image) const;
+
+    //! Decompress the whole image with alpha
+    /*! \param image Set to the size of this image and filled */
+    void Decode(CGrImageBgra8 &image) const;
+
+    //! Decompress one block
+    /*! \param bx Block column
+        \param by Block row
+        \param bgra Returned 16 texels of B, G, R, A, a row of 4 at a time */
+    void DecodeBlock(int bx, int by, unsigned char *bgra) const;
+
+    //! Decompress one texel
+    /*! Only the part of the block the texel needs is decoded, so this
+        is cheap enough to use for every texture lookup.
+        \param x Column
+        \param y Row
+        \return B, G, R, and A from the low byte up */
+    unsigned DecodeTexel(int x, int y) const;
+
+    Format GetFormat() const {return mFormat;}
+    int GetWidth() const {return mWidth;}
+    int GetHeight() const {return mHeight;}
+    int GetBlocksAcross() const {return (mWidth + 3) / 4;}
+    int GetBlocksDown() const {return (mHeight + 3) / 4;}
+
+    //! Bytes in a block, 8 for BC1 and 16 for BC3
+    int GetBlockBytes() const {return BlockBytes(mFormat);}
+
+    //! Bytes of memory used by the blocks
+    size_t GetBytes() const {return size_t(GetBlocksAcross()) * GetBlocksDown() * GetBlockBytes();}
+
+    const unsigned char *GetData() const {return mData;}
+
+    const unsigned char *GetBlock(int bx, int by) const {return mData + (size_t(by) * GetBlocksAcross() + bx) * GetBlockBytes();}
+
+    //! Bytes in a block of a format
+    static int BlockBytes(Format format) {return format == Bc1 ? 8 : (format == Bc3 ? 16 : 0);}
+
+    //! Compress one block
+    /*! \param bgra 16 texels of B, G, R, A, a row of 4 at a time
+        \param format Bc1 or Bc3
+        \param block Returned BlockBytes(format) bytes */
+    static void EncodeBlock(const unsigned char *bgra, Format format, unsigned char *block);
+
+    //! Decompress one block
+    /*! \param block BlockBytes(format) bytes
+        \param format Bc1 or Bc3
+        \param bgra Returned 16 texels of B, G, R, A, a row of 4 at a time */
+    static void DecodeBlock(const unsigned char *block, Format format, unsigned char *bgra);
+
+private:
+    CGrBlockImage(const CGrBlockImage &);
+    CGrBlockImage &operator=(const CGrBlockImage &);
+
+    void Encode(const unsigned char *rows, int pitch, int width, int height, int channels,
+                Format format, CGrThreadPool *pool);
+    void Decode(unsigned char *rows, int pitch, int channels) const;
+    void SetSize(int width, int height, Format format);
+
+    unsigned char *mData;
+    int mWidth;
+    int mHeight;
+    Format mFormat;
+};
+
+#endif
@@ -15,6 +15,7 @@
 #include <stdafx.h>
 #include "GrImage.h"
 #include <cassert>
+#include <utility>
 
 using namespace std;
 
@@ -46,24 +47,14 @@ inline void _swap(int &a, int &b)
 
 CGrImage::CGrImage()
 {
-    m_planes = 3;       // Default is RGB
-    m_rowpitch = 0;
-    m_height = 0;
-    m_width = 0;
     m_error = NULL;
-    m_image = NULL;
 }
 
-CGrImage::CGrImage(const CGrImage &p_img)
+CGrImage::CGrImage(CGrImage &&p_img)
 {
-    m_planes = 3;       // Default is RGB
-    m_rowpitch = 0;
-    m_height = 0;
-    m_width = 0;
-    m_image = NULL;
     m_error = NULL;
 
-    Copy(p_img);
+    *this = std::move(p_img);
 }
 
 CGrImage::~CGrImage()
@@ -72,19 +63,14 @@ CGrImage::~CGrImage()
 }
 
 
-int CGrImage::GetPlanes() const {return m_planes;}
+int CGrImage::GetPlanes() const {return m_image.GetChannels();}
 
-int CGrImage::GetRowPitch() const {return m_rowpitch;}
+int CGrImage::GetRowPitch() const {return m_image.GetPitch();}
 
 
 void CGrImage::Clear()
 {
-    if(m_image != NULL)
-    {
-        delete [] m_image[0];
-        delete [] m_image;
-        m_image = NULL;
-    }
+    m_image.Clear();
 
     if(m_error != NULL)
     {
@@ -94,16 +80,17 @@ void CGrImage::Clear()
 }
 
 
-bool CGrImage::IsEmpty() const {return m_width <= 0 || m_height <= 0;}
+bool CGrImage::IsEmpty() const {return m_image.IsEmpty();}
 
-BYTE *CGrImage::operator[](int i) {return m_image[i];}
-const BYTE *CGrImage::operator[](int i) const {return m_image[i];}
-BYTE *CGrImage::GetRow(int i) {return m_image[i];}
-const BYTE *CGrImage::GetRow(int i) const {return m_image[i];}
+BYTE *CGrImage::operator[](int i) {return m_image.GetRow(i);}
+const BYTE *CGrImage::operator[](int i) const {return m_image.GetRow(i);}
+BYTE *CGrImage::GetRow(int i) {return m_image.GetRow(i);}
+const BYTE *CGrImage::GetRow(int i) const {return m_image.GetRow(i);}
 
-int CGrImage::GetWidth() const {return m_width;}
-int CGrImage::GetHeight() const {return m_height;}
-BYTE *CGrImage::GetImageBits() const {return m_image[0];}
+int CGrImage::GetWidth() const {return m_image.GetWidth();}
+int CGrImage::GetHeight() const {return m_image.GetHeight();}
+BYTE *CGrImage::GetImageBits() const {return m_image.GetData();}
+const CGrImageT<BYTE, 0> &CGrImage::GetImage() const {return m_image;}
 
 
 //
@@ -118,11 +105,16 @@ bool CGrImage::Draw(CDC *pDC, int p_x, int p_y) const
 
 	BITMAPINFOHEADER bmi;
 
+	int width = m_image.GetWidth();
+	int height = m_image.GetHeight();
+
+	// The DIB width is the whole padded row so the DIB rows
+	// line up with ours. Only the image itself is drawn.
 	bmi.biSize = sizeof(BITMAPINFOHEADER);
-	bmi.biWidth = m_width;
-	bmi.biHeight = m_height;
+	bmi.biWidth = m_image.GetRowLength();
+	bmi.biHeight = height;
 	bmi.biPlanes = 1;
-	bmi.biBitCount = m_planes * 8;
+	bmi.biBitCount = m_image.GetChannels() * 8;
 	bmi.biCompression = BI_RGB;
 	bmi.biSizeImage = 0;
 	bmi.biXPelsPerMeter = 1;
@@ -133,13 +125,13 @@ bool CGrImage::Draw(CDC *pDC, int p_x, int p_y) const
 	SetDIBitsToDevice(pDC->m_hDC,             // hDC
 							p_x,              // DestX
 							p_y,              // DestY
-							m_width,                // nDestWidth
-							m_height,               // nDestHeight
+							width,                  // nDestWidth
+							height,                 // nDestHeight
 							0,                      // SrcX
 							0,                      // SrcY
 							0,                      // nStartScan
-							m_height,               // nNumScans
-							m_image[0],             // lpBits
+							height,                 // nNumScans
+							m_image.GetData(),      // lpBits
 							(LPBITMAPINFO)&bmi,     // lpBitsInfo
 							DIB_RGB_COLORS);        // wUsage
 
@@ -199,18 +191,39 @@ void CGrImage::DrawLine(int x1, int y1, int x2, int y2, int r, int g, int b, int
 
 void CGrImage::Copy(const CGrImage &p_img)
 {
-    SetSameSize(p_img);
+    if(&p_img == this)
+        return;
 
-    for(int i=0;  i<m_height;  i++)
-    {
-        memcpy(m_image[i], p_img.m_image[i], m_width * m_planes);
-    }
+    m_image.Copy(p_img.m_image);
 }
 
 
-CGrImage & CGrImage::operator =(const CGrImage &p_img)
+CGrImage CGrImage::Clone() const
+{
+    CGrImage copy;
+    copy.Copy(*this);
+    return copy;
+}
+
+
+//
+// Name :         CGrImage::operator=(CGrImage &&)
+// Description :  Move another image into this one. The image block
+//                and any error message change owner and the other
+//                image is left empty.
+//
+
+CGrImage &CGrImage::operator=(CGrImage &&p_img)
 {
-    Copy(p_img);
+    if(&p_img == this)
+        return *this;
+
+    Clear();
+
+    m_image = std::move(p_img.m_image);
+    m_error = p_img.m_error;
+    p_img.m_error = NULL;
+
     return *this;
 }
 
@@ -219,9 +232,9 @@ CGrImage & CGrImage::operator =(const CGrImage &p_img)
 void CGrImage::SetSameSize(const CGrImage &p_img, int planes)
 {
     if(planes < 0)
-        SetSize(p_img.m_width, p_img.m_height, p_img.m_planes);
+        SetSize(p_img.GetWidth(), p_img.GetHeight(), p_img.GetPlanes());
     else
-        SetSize(p_img.m_width, p_img.m_height, planes);
+        SetSize(p_img.GetWidth(), p_img.GetHeight(), planes);
 }
 
 //
@@ -232,52 +245,26 @@ void CGrImage::SetSameSize(const CGrImage &p_img, int planes)
 
 void CGrImage::SetSize(int p_x, int p_y, int planes)
 {
-    // If already the right size, don't do anything, we are happy
-    if(p_x == m_width && m_height == p_y && m_planes == planes)
-        return;
-
-    Clear();
-
-    // Member variables
-    m_height = p_y;
-    m_width = p_x;
-    m_planes = planes;
-
-    if(p_x <= 0 || p_y <= 0)
-        return;
-
-    // Allocate memory for the image.  Note that storage for rows must
-    // be on DWORD boundaries.  (32 bit boundaries)
-    const int PADSIZE = 4;
-
-    int usewidth = (m_width * m_planes + (PADSIZE - 1)) / PADSIZE;
-    usewidth *= PADSIZE;
-    m_rowpitch = usewidth;
-
-    BYTE *image = new BYTE[usewidth * m_height];
-    m_image = new BYTE *[m_height];
-    for(int i=0;  i<m_height;  i++, image += usewidth)
-    {
-        m_image[i] = image;
-    }
+    m_image.SetSize(p_x, p_y, planes);
 }
 
 void CGrImage::Set(int x, int y, int r, int g, int b, int a)
 {
-    if(x >= 0 && x < m_width && y >= 0 && y < m_height)
+    if(x >= 0 && x < m_image.GetWidth() && y >= 0 && y < m_image.GetHeight())
     {
-        BYTE *img = m_image[y] + x * m_planes;
-        if(m_planes == 1)
+        int planes = m_image.GetChannels();
+        BYTE *img = m_image.GetPixel(x, y);
+        if(planes == 1)
         {
             *img = r;
         }
-        else if(m_planes == 3)
+        else if(planes == 3)
         {
             *img++ = b;
             *img++ = g;
             *img = r;
         }
-        else if(m_planes == 4)
+        else if(planes == 4)
         {
             *img++ = b;
             *img++ = g;
@@ -291,47 +278,9 @@ void CGrImage::Set(int x, int y, int r, int g, int b, int a)
 
 void CGrImage::Fill(int r, int g, int b, int a)
 {
-    switch(m_planes)
-    {
-    case 1:
-        for(int i=0; i<m_height;  i++)
-        {
-            BYTE *img = m_image[i];
-            for(int j=0;  j<m_width;  j++)
-            {
-                *img++ = b;
-            }
-        }
-        break;
-
-    case 3:
-        for(int i=0; i<m_height;  i++)
-        {
-            BYTE *img = m_image[i];
-            for(int j=0;  j<m_width * 3;  j+=3)
-            {
-                *img++ = b;
-                *img++ = g;
-                *img++ = r;
-            }
-        }
-        break;
-
-    case 4:
-        for(int i=0; i<m_height;  i++)
-        {
-            BYTE *img = m_image[i];
-            for(int j=0;  j<m_width * 4;  j+=4)
-            {
-                *img++ = b;
-                *img++ = g;
-                *img++ = r;
-                *img++ = a;
-            }
-        }
-        break;
-    }
-
+    // A single plane takes the blue component
+    BYTE pixel[4] = {BYTE(b), BYTE(g), BYTE(r), BYTE(a)};
+    m_image.Fill(pixel);
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -468,20 +417,24 @@ bool CGrImage::LoadFrom(const CImage *image)
 
 bool CGrImage::SaveTo(CImage *image)
 {
-    image->Create(m_width, m_height, m_planes * 8, 
-        m_planes == 4 ? CImage::createAlphaChannel : 0);
+    int width = GetWidth();
+    int height = GetHeight();
+    int planes = GetPlanes();
+
+    image->Create(width, height, planes * 8, 
+        planes == 4 ? CImage::createAlphaChannel : 0);
 
     int pitch = image->GetPitch();
     BYTE *bits = (BYTE *)image->GetBits();
 
-    for(int r=0;  r<m_height;  r++)
+    for(int r=0;  r<height;  r++)
     {
         // Bits in the destination image row
         BYTE *pixel = bits;
-        BYTE *row = m_image[m_height - r - 1];
+        BYTE *row = GetRow(height - r - 1);
 
         // Copy the row
-        for(int c=0;  c<m_width * m_planes;  c++)
+        for(int c=0;  c<width * planes;  c++)
         {
             *pixel++ = *row++;
         }
@@ -499,10 +452,6 @@ bool CGrImage::LoadFrom(const CImage *image, LPCTSTR filename)
 {
     Clear();
 
-    int bpp = image->GetBPP();
-    int pitch = image->GetPitch();
-    BYTE *bits = (BYTE *)image->GetBits();
-    bool idib = image->IsDIBSection();
     if(!image->IsDIBSection())
     {
         tstring msg = TEXT("Unable to read image");
@@ -520,98 +469,107 @@ bool CGrImage::LoadFrom(const CImage *image, LPCTSTR filename)
         SetTString(&m_error, msg.c_str(), msg.size());
     }
 
-
-    switch(bpp)
+    CGrImageKernels::PixelFormat format;
+    unsigned char palette[256 * 4];
+    if(!GetPixelFormat(image, format, palette))
     {
-    case 8:
+        tstring msg = TEXT("Unable to read image");
+        if(filename != NULL)
         {
-            SetSize(image->GetWidth(), image->GetHeight(), 1);
-            for(int r=0;  r<m_height;  r++)
-            {
-                BYTE *pixel = bits;
+            msg += TEXT(" file:");
+            msg += filename;
+        }
+        else
+        {
+            msg += TEXT(": ");
+        }
 
-                for(int c=0;  c<m_width;  c++)
-                {
-                    int g = pixel[0];
+        msg += TEXT(" - File format could not be loaded");
 
-                    Set(c, m_height - r - 1, g, g, g);
+        SetTString(&m_error, msg.c_str(), msg.size());
+        return true;
+    }
 
-                    pixel++;
-                }
+    // CImage rows are top down and ours are bottom up, so start
+    // at the last row and step back
+    int height = image->GetHeight();
+    int pitch = image->GetPitch();
+    const BYTE *bits = (const BYTE *)image->GetBits() + (height - 1) * pitch;
 
-                bits += pitch;
-            }
-        }
-        break;
+    LoadFrom(bits, -pitch, format, image->GetWidth(), height, palette);
+    return true;
+}
 
-    case 24:
-        {
-            SetSize(image->GetWidth(), image->GetHeight(), 3);
-            for(int r=0;  r<m_height;  r++)
-            {
-                BYTE *pixel = bits;
 
-                for(int c=0;  c<m_width;  c++)
-                {
-                    int blu = pixel[0];
-                    int grn = pixel[1];
-                    int red = pixel[2];
+bool CGrImage::LoadFrom(const void *pixels, int pitch, CGrImageKernels::PixelFormat format, 
+                        int width, int height, const unsigned char *palette)
+{
+    int planes = 3;
+    if(format == CGrImageKernels::Gray8)
+        planes = 1;
+    else if(format == CGrImageKernels::Bgra8 || format == CGrImageKernels::Rgba8)
+        planes = 4;
+
+    SetSize(width, height, planes);
+    if(IsEmpty())
+        return false;
 
-                    Set(c, m_height - r - 1, red, grn, blu);
+    CGrImageKernels::PixelFormat dest = planes == 1 ? CGrImageKernels::Gray8 : 
+        (planes == 3 ? CGrImageKernels::Bgr8 : CGrImageKernels::Bgra8);
 
-                    pixel += 3;
-                }
+    CGrImageKernels::ConvertRows(GetRow(0), GetRowPitch(), dest, pixels, pitch, format, 
+        width, height, palette);
 
-                bits += pitch;
-            }
-        }
-        break;
+    return true;
+}
 
-    case 32:
+
+bool CGrImage::GetPixelFormat(const CImage *image, CGrImageKernels::PixelFormat &format, unsigned char *palette)
+{
+    switch(image->GetBPP())
+    {
+    case 8:
         {
-            SetSize(image->GetWidth(), image->GetHeight(), 4);
-            for(int r=0;  r<m_height;  r++)
+            // A palette that is a gray ramp, or no palette at all, is
+            // plain gray. Anything else goes through the palette.
+            int entries = image->IsIndexed() ? image->GetMaxColorTableEntries() : 0;
+            if(entries > 256)
+                entries = 256;
+
+            RGBQUAD table[256];
+            if(entries > 0)
+                image->GetColorTable(0, entries, table);
+
+            bool gray = true;
+            for(int i=0;  i<256;  i++)
             {
-                BYTE *pixel = bits;
+                RGBQUAD entry = {BYTE(i), BYTE(i), BYTE(i), 0};
+                if(i < entries)
+                    entry = table[i];
 
-                for(int c=0;  c<m_width;  c++)
-                {
-                    int blu = pixel[0];
-                    int grn = pixel[1];
-                    int red = pixel[2];
-                    int a = pixel[3];
+                palette[i * 4] = entry.rgbBlue;
+                palette[i * 4 + 1] = entry.rgbGreen;
+                palette[i * 4 + 2] = entry.rgbRed;
+                palette[i * 4 + 3] = 255;
 
-                    Set(c, m_height - r - 1, red, grn, blu, a);
-
-                    pixel += 4;
-                }
-
-                bits += pitch;
+                if(entry.rgbBlue != i || entry.rgbGreen != i || entry.rgbRed != i)
+                    gray = false;
             }
-        }
-        break;
 
-    default:
-        {
-            tstring msg = TEXT("Unable to read image");
-            if(filename != NULL)
-            {
-                msg += TEXT(" file:");
-                msg += filename;
-            }
-            else
-            {
-                msg += TEXT(": ");
-            }
+            format = gray ? CGrImageKernels::Gray8 : CGrImageKernels::Indexed8;
+        }
+        return true;
 
-            msg += TEXT(" - File format could not be loaded");
+    case 24:
+        format = CGrImageKernels::Bgr8;
+        return true;
 
-            SetTString(&m_error, msg.c_str(), msg.size());
-        }
-        break;
+    case 32:
+        format = CGrImageKernels::Bgra8;
+        return true;
     }
 
-    return true;
+    return false;
 }
 
 
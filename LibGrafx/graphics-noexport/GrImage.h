@@ -20,6 +20,7 @@
 
 #include <atlimage.h>
 #include <fstream>
+#include "GrImageT.h"
 
 class CDC; //Avoids unknown CDC type; not used here anyway
 
@@ -29,6 +30,9 @@ class CDC; //Avoids unknown CDC type; not used here anyway
 be easily manipulated. This class
 will load any image that can be loaded using the MFC function: CImage::Load().
 
+The pixels are kept in a CGrImageT, so rows start on 64 byte boundaries
+and are GetRowPitch() bytes apart.
+
 \version 1.00 01-01-2012 New version merging CPix and CGrTexture
 */
 
@@ -38,14 +42,25 @@ public:
     //! Default Constructor
     CGrImage();
 
-    //! Copy Constructor. 
-    /*! The copy constructor will copy another image. 
+    //! Move Constructor
+    /*! Takes the image from another image, which is left empty. 
+        Nothing is copied. Use Clone() to make a copy.
         \param img The other image */
-    CGrImage(const CGrImage &img);
+    CGrImage(CGrImage &&img);
 
     //! Destructor
     virtual ~CGrImage();
 
+    //! Move assignment
+    /*! Takes the image from another image, which is left empty.
+        \param img The other image */
+    CGrImage &operator=(CGrImage &&img);
+
+    //! Make a copy of this image
+    /*! This is the only way to copy an image.
+        \return The copy */
+    CGrImage Clone() const;
+
     //! Draw the image at a specified location on the screen
     /*! \param pDC Pointer to an MFC Device Context
         \param x X location on the screen.
@@ -56,6 +71,30 @@ public:
     /* \param image The image we are loading from */
     bool LoadFrom(const ATL::CImage *image);
 
+    //! Load an image from pixels in memory
+    /*! The image takes 1 plane for Gray8, 4 for Bgra8 and Rgba8,
+        and 3 for the rest. Pixels are converted with
+        CGrImageKernels::ConvertRows().
+        \param pixels The bottom row
+        \param pitch Bytes from a row to the one above it, negative if
+        the rows are stored top down
+        \param format Layout of the pixels
+        \param width Width in pixels
+        \param height Height in pixels
+        \param palette 256 B, G, R, A entries for Indexed8
+        \return false if the image is empty */
+    bool LoadFrom(const void *pixels, int pitch, CGrImageKernels::PixelFormat format, 
+                  int width, int height, const unsigned char *palette=NULL);
+
+    //! Get the pixel layout of an MFC image
+    /*! An 8 bit image is Gray8 if its palette is a gray ramp and
+        Indexed8 otherwise.
+        \param image The image
+        \param format Returned layout
+        \param palette Returned 256 B, G, R, A entries, filled for 8 bit images
+        \return false if the image has no layout we load */
+    static bool GetPixelFormat(const ATL::CImage *image, CGrImageKernels::PixelFormat &format, unsigned char *palette);
+
     //! Load a image from a file
     /* \param filename The filename as a character string in the current 
        setting of Unicode or multibyte strings. 
@@ -128,9 +167,6 @@ public:
     //! Returns true if the texture image is empty.
     bool IsEmpty() const;
 
-    //! Assignment operator that copies a texture image into this one.
-    CGrImage &operator=(const CGrImage &p_img);
-
     //! Bracket operator gets access to a given row of the image
     /*! This operator can be used like this:  \code
     BYTE value = texture[row][byte];
@@ -182,9 +218,12 @@ public:
     /*! This function can be used to directly access the 
         data for the image data. It consists of a sequence of 
         bytes in the order B, G, and R. Rows start on a
-        word (32 bit) boundary. */
+        64 byte boundary. */
     BYTE *GetImageBits() const;
 
+    //! The pixels of the image
+    const CGrImageT<BYTE, 0> &GetImage() const;
+
     //! Get the number of color planes
     //! \return The number of color planes. Can be 1, 3, or 4
     int GetPlanes() const;
@@ -202,22 +241,14 @@ public:
     void DrawLine(int x1, int y1, int x2, int y2, int r, int g=0, int b=0, int a=0);
 
 private:
-    bool LoadFrom(const ATL::CImage *image, LPCTSTR filename);
-
-    // Number of image planes (colors)
-    int m_planes;
-
-    // Number of bytes per row
-    int m_rowpitch;
-
-    // Image height
-    int m_height;
+    // Images are copied only with Clone() or Copy()
+    CGrImage(const CGrImage &img);
+    CGrImage &operator=(const CGrImage &img);
 
-    // Image width
-    int m_width;
+    bool LoadFrom(const ATL::CImage *image, LPCTSTR filename);
 
-    // The actual image data
-    BYTE ** m_image;
+    // The actual image data. The number of planes is chosen at run time.
+    CGrImageT<BYTE, 0> m_image;
 
     // Any error message
     TCHAR *m_error;
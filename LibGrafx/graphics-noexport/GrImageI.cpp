@@ -8,6 +8,7 @@
 #include <stdafx.h>
 #include "GrImageI.h"
 #include <cassert>
+#include <utility>
 
 using namespace std;
 
@@ -26,22 +27,11 @@ static char THIS_FILE[]=__FILE__;
 
 CGrImageI::CGrImageI()
 {
-    m_planes = 3;       // Default is RGB
-    m_rowpitch = 0;
-    m_height = 0;
-    m_width = 0;
-    m_image = NULL;
 }
 
-CGrImageI::CGrImageI(const CGrImageI &p_img)
+CGrImageI::CGrImageI(CGrImageI &&p_img)
 {
-    m_planes = 3;       // Default is RGB
-    m_rowpitch = 0;
-    m_height = 0;
-    m_width = 0;
-    m_image = NULL;
-
-    Copy(p_img);
+    *this = std::move(p_img);
 }
 
 CGrImageI::~CGrImageI()
@@ -52,26 +42,20 @@ CGrImageI::~CGrImageI()
 
 void CGrImageI::Clear()
 {
-    if(m_image != NULL)
-    {
-        delete [] m_image[0];
-        delete [] m_image;
-        m_image = NULL;
-    }
-
+    m_image.Clear();
 }
 
 
-bool CGrImageI::IsEmpty() const {return m_width <= 0 || m_height <= 0;}
+bool CGrImageI::IsEmpty() const {return m_image.IsEmpty();}
 
-int *CGrImageI::operator[](int i) {return m_image[i];}
-const int *CGrImageI::operator[](int i) const {return m_image[i];}
-int *CGrImageI::GetRow(int i) {return m_image[i];}
-const int *CGrImageI::GetRow(int i) const {return m_image[i];}
+int *CGrImageI::operator[](int i) {return m_image.GetRow(i);}
+const int *CGrImageI::operator[](int i) const {return m_image.GetRow(i);}
+int *CGrImageI::GetRow(int i) {return m_image.GetRow(i);}
+const int *CGrImageI::GetRow(int i) const {return m_image.GetRow(i);}
 
-int CGrImageI::GetWidth() const {return m_width;}
-int CGrImageI::GetHeight() const {return m_height;}
-int *CGrImageI::GetImageBits() const {return m_image[0];}
+int CGrImageI::GetWidth() const {return m_image.GetWidth();}
+int CGrImageI::GetHeight() const {return m_image.GetHeight();}
+int *CGrImageI::GetImageBits() const {return m_image.GetData();}
 
 
 
@@ -86,18 +70,21 @@ int *CGrImageI::GetImageBits() const {return m_image[0];}
 
 void CGrImageI::Copy(const CGrImageI &p_img)
 {
-    SetSameSize(p_img);
+    m_image.Copy(p_img.m_image);
+}
 
-    for(int i=0;  i<m_height;  i++)
-    {
-        memcpy(m_image[i], p_img.m_image[i], m_width * m_planes * sizeof(int));
-    }
+
+CGrImageI CGrImageI::Clone() const
+{
+    CGrImageI copy;
+    copy.Copy(*this);
+    return copy;
 }
 
 
-CGrImageI & CGrImageI::operator =(const CGrImageI &p_img)
+CGrImageI &CGrImageI::operator=(CGrImageI &&p_img)
 {
-    Copy(p_img);
+    m_image = std::move(p_img.m_image);
     return *this;
 }
 
@@ -106,9 +93,9 @@ CGrImageI & CGrImageI::operator =(const CGrImageI &p_img)
 void CGrImageI::SetSameSize(const CGrImageI &p_img, int planes)
 {
     if(planes < 0)
-        SetSize(p_img.m_width, p_img.m_height, p_img.m_planes);
+        SetSize(p_img.GetWidth(), p_img.GetHeight(), p_img.GetPlanes());
     else
-        SetSize(p_img.m_width, p_img.m_height, planes);
+        SetSize(p_img.GetWidth(), p_img.GetHeight(), planes);
 }
 
 //
@@ -119,48 +106,26 @@ void CGrImageI::SetSameSize(const CGrImageI &p_img, int planes)
 
 void CGrImageI::SetSize(int p_x, int p_y, int planes)
 {
-    // If already the right size, don't do anything, we are happy
-    if(p_x == m_width && m_height == p_y && m_planes == planes)
-        return;
-
-    Clear();
-
-    // Member variables
-    m_height = p_y;
-    m_width = p_x;
-    m_planes = planes;
-
-    if(p_x <= 0 || p_y <= 0)
-        return;
-
-    // Allocate memory for the image.
-    int usewidth = m_width * m_planes;
-    m_rowpitch = usewidth;
-
-    int *image = new int[usewidth * m_height];
-    m_image = new int *[m_height];
-    for(int i=0;  i<m_height;  i++, image += usewidth)
-    {
-        m_image[i] = image;
-    }
+    m_image.SetSize(p_x, p_y, planes);
 }
 
 void CGrImageI::Set(int x, int y, int r, int g, int b, int a)
 {
-    if(x >= 0 && x < m_width && y >= 0 && y < m_height)
+    if(x >= 0 && x < m_image.GetWidth() && y >= 0 && y < m_image.GetHeight())
     {
-        int *img = m_image[y] + x * m_planes;
-        if(m_planes == 1)
+        int planes = m_image.GetChannels();
+        int *img = m_image.GetPixel(x, y);
+        if(planes == 1)
         {
             *img++ = b;
         }
-        else if(m_planes == 3)
+        else if(planes == 3)
         {
             *img++ = b;
             *img++ = g;
             *img++ = r;
         }
-        else if(m_planes == 4)
+        else if(planes == 4)
         {
             *img++ = b;
             *img++ = g;
@@ -174,45 +139,7 @@ void CGrImageI::Set(int x, int y, int r, int g, int b, int a)
 
 void CGrImageI::Fill(int r, int g, int b, int a)
 {
-    switch(m_planes)
-    {
-    case 1:
-        for(int i=0; i<m_height;  i++)
-        {
-            int *img = m_image[i];
-            for(int j=0;  j<m_width;  j++)
-            {
-                *img++ = b;
-            }
-        }
-        break;
-
-    case 3:
-        for(int i=0; i<m_height;  i++)
-        {
-            int *img = m_image[i];
-            for(int j=0;  j<m_width * 3;  j+=3)
-            {
-                *img++ = b;
-                *img++ = g;
-                *img++ = r;
-            }
-        }
-        break;
-
-    case 4:
-        for(int i=0; i<m_height;  i++)
-        {
-            int *img = m_image[i];
-            for(int j=0;  j<m_width * 4;  j+=4)
-            {
-                *img++ = b;
-                *img++ = g;
-                *img++ = r;
-                *img++ = a;
-            }
-        }
-        break;
-    }
-
+    // A single plane takes the blue component
+    int pixel[4] = {b, g, r, a};
+    m_image.Fill(pixel);
 }
@@ -8,18 +8,33 @@
 #if !defined(_GRIMAGEI_H)
 #define _GRIMAGEI_H
 
+#include "GrImageT.h"
 
 class CGrImageI
 {
 public:
     //! Default Constructor
     CGrImageI();
-    
-    CGrImageI(const CGrImageI &p_img);
+
+    //! Move Constructor
+    /*! Takes the image from another image, which is left empty. 
+        Nothing is copied. Use Clone() to make a copy.
+        \param img The other image */
+    CGrImageI(CGrImageI &&p_img);
 
     //! Destructor
     virtual ~CGrImageI();
 
+    //! Move assignment
+    /*! Takes the image from another image, which is left empty.
+        \param img The other image */
+    CGrImageI &operator=(CGrImageI &&p_img);
+
+    //! Make a copy of this image
+    /*! This is the only way to copy an image.
+        \return The copy */
+    CGrImageI Clone() const;
+
     //! Clear the image 
     /*! Clears the image and releases any memory. */
     void Clear();
@@ -67,9 +82,6 @@ public:
     //! Returns true if the texture image is empty.
     bool IsEmpty() const;
 
-    //! Assignment operator that copies a texture image into this one.
-    CGrImageI &operator=(const CGrImageI &p_img);
-
     //! Bracket operator gets access to a given row of the image
     /*! This operator can be used like this:  \code
     BYTE value = texture[row][byte];
@@ -121,34 +133,29 @@ public:
     /*! This function can be used to directly access the 
         data for the image data. It consists of a sequence of 
         bytes in the order B, G, and R. Rows start on a
-        word (32 bit) boundary. */
+        64 byte boundary. */
     int *GetImageBits() const;
 
     //! Get the number of color planes
     //! \return The number of color planes. Can be 1, 3, or 4
-    int GetPlanes() const {return m_planes;}
+    int GetPlanes() const {return m_image.GetChannels();}
 
     //! Get the row pitch
-    //! \return The row pitch. This is the number of bytes from
+    //! \return The row pitch. This is the number of ints from
     //! the start of one row to the start of the next.
-    int GetRowPitch() const {return m_rowpitch;}
-
-
-private:
-    // Number of image planes (colors)
-    int m_planes;
+    int GetRowPitch() const {return m_image.GetPitch() / (int)sizeof(int);}
 
-    // Number of bytes per row
-    int m_rowpitch;
+    //! The pixels of the image
+    const CGrImageT<int, 0> &GetImage() const {return m_image;}
 
-    // Image height
-    int m_height;
 
-    // Image width
-    int m_width;
+private:
+    // Images are copied only with Clone() or Copy()
+    CGrImageI(const CGrImageI &p_img);
+    CGrImageI &operator=(const CGrImageI &p_img);
 
-    // The actual image data
-    int ** m_image;
+    // The actual image data. The number of planes is chosen at run time.
+    CGrImageT<int, 0> m_image;
 };
 
 #endif 
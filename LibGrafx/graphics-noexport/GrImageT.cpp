@@ -0,0 +1,909 @@
+//
+//  Name :         GrImageT.cpp
+//  Description :  Implementation of CGrImageKernels, the memory and
+//                 pixel kernels behind CGrImageT.
+//  Version :      See GrImageT.h
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+
+#include <stdafx.h>
+#include "GrImageT.h"
+#include "GrThreadPool.h"
+#include <cmath>
+#include <cstring>
+#include <malloc.h>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define GRIMAGET_SSE2
+#endif
+
+// SSSE3 is checked for when the library loads, except where the
+// compiler has been told it is there
+#if defined(_M_IX86) || defined(_M_X64)
+#include <tmmintrin.h>
+#include <intrin.h>
+#define GRIMAGET_SSSE3
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#define GRIMAGET_SSSE3
+#endif
+
+using namespace std;
+
+#ifdef _DEBUG
+#undef THIS_FILE
+static char THIS_FILE[]=__FILE__;
+#define new DEBUG_NEW
+#endif
+
+//! \cond ignore
+
+// Values are converted this many at a time through a float buffer
+const int ConvertBlock = 256;
+
+inline int ChannelSize(CGrImageKernels::ChannelType type)
+{
+    switch(type)
+    {
+    case CGrImageKernels::UInt8:
+        return 1;
+
+    case CGrImageKernels::UInt16:
+        return 2;
+
+    default:
+        return 4;
+    }
+}
+
+//
+// Name :         ToFloat()
+// Description :  Channel values to floats from 0 to 1.
+//
+
+static void ToFloat(float *dest, const void *src, CGrImageKernels::ChannelType type, int count)
+{
+    int i = 0;
+
+    switch(type)
+    {
+    case CGrImageKernels::UInt8:
+        {
+            const unsigned char *s = (const unsigned char *)src;
+#ifdef GRIMAGET_SSE2
+            const __m128 scale = _mm_set1_ps(1.f / 255.f);
+            const __m128i zero = _mm_setzero_si128();
+            for( ;  i + 16 <= count;  i += 16)
+            {
+                __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+                __m128i lo = _mm_unpacklo_epi8(v, zero);
+                __m128i hi = _mm_unpackhi_epi8(v, zero);
+                _mm_storeu_ps(dest + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(lo, zero)), scale));
+                _mm_storeu_ps(dest + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(lo, zero)), scale));
+                _mm_storeu_ps(dest + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(hi, zero)), scale));
+                _mm_storeu_ps(dest + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(hi, zero)), scale));
+            }
+#endif
+            for( ;  i<count;  i++)
+                dest[i] = float(s[i]) * (1.f / 255.f);
+        }
+        break;
+
+    case CGrImageKernels::UInt16:
+        {
+            const unsigned short *s = (const unsigned short *)src;
+#ifdef GRIMAGET_SSE2
+            const __m128 scale = _mm_set1_ps(1.f / 65535.f);
+            const __m128i zero = _mm_setzero_si128();
+            for( ;  i + 8 <= count;  i += 8)
+            {
+                __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+                _mm_storeu_ps(dest + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)), scale));
+                _mm_storeu_ps(dest + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)), scale));
+            }
+#endif
+            for( ;  i<count;  i++)
+                dest[i] = float(s[i]) * (1.f / 65535.f);
+        }
+        break;
+
+    case CGrImageKernels::Int32:
+        {
+            const int *s = (const int *)src;
+            for( ;  i<count;  i++)
+                dest[i] = float(s[i]) * (1.f / 255.f);
+        }
+        break;
+
+    case CGrImageKernels::Float32:
+        memcpy(dest, src, count * sizeof(float));
+        break;
+    }
+}
+
+
+//
+// Name :         FromFloat()
+// Description :  Floats from 0 to 1 to channel values, clamped and
+//                rounded to nearest.
+//
+
+static void FromFloat(void *dest, CGrImageKernels::ChannelType type, const float *src, int count)
+{
+    int i = 0;
+
+    switch(type)
+    {
+    case CGrImageKernels::UInt8:
+        {
+            unsigned char *d = (unsigned char *)dest;
+#ifdef GRIMAGET_SSE2
+            // max() with zero first so a NaN becomes 0
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 one = _mm_set1_ps(1.f);
+            const __m128 scale = _mm_set1_ps(255.f);
+            const __m128 half = _mm_set1_ps(0.5f);
+            for( ;  i + 16 <= count;  i += 16)
+            {
+                __m128i v[4];
+                for(int j=0;  j<4;  j++)
+                {
+                    __m128 f = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + j * 4), zero), one);
+                    v[j] = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(f, scale), half));
+                }
+
+                __m128i lo = _mm_packs_epi32(v[0], v[1]);
+                __m128i hi = _mm_packs_epi32(v[2], v[3]);
+                _mm_storeu_si128((__m128i *)(d + i), _mm_packus_epi16(lo, hi));
+            }
+#endif
+            for( ;  i<count;  i++)
+            {
+                float f = src[i] > 0 ? src[i] : 0;
+                f = f < 1 ? f : 1;
+                d[i] = (unsigned char)(f * 255.f + 0.5f);
+            }
+        }
+        break;
+
+    case CGrImageKernels::UInt16:
+        {
+            unsigned short *d = (unsigned short *)dest;
+#ifdef GRIMAGET_SSE2
+            // SSE2 can only pack to signed 16 bits, so the values are
+            // offset by 32768 and the sign bit flipped back after
+            const __m128 zero = _mm_setzero_ps();
+            const __m128 one = _mm_set1_ps(1.f);
+            const __m128 scale = _mm_set1_ps(65535.f);
+            const __m128 half = _mm_set1_ps(0.5f);
+            const __m128i offset = _mm_set1_epi32(32768);
+            const __m128i flip = _mm_set1_epi16(-32768);
+            for( ;  i + 8 <= count;  i += 8)
+            {
+                __m128 f0 = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i), zero), one);
+                __m128 f1 = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(src + i + 4), zero), one);
+                __m128i v0 = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(f0, scale), half)), offset);
+                __m128i v1 = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(f1, scale), half)), offset);
+                _mm_storeu_si128((__m128i *)(d + i), _mm_xor_si128(_mm_packs_epi32(v0, v1), flip));
+            }
+#endif
+            for( ;  i<count;  i++)
+            {
+                float f = src[i] > 0 ? src[i] : 0;
+                f = f < 1 ? f : 1;
+                d[i] = (unsigned short)(f * 65535.f + 0.5f);
+            }
+        }
+        break;
+
+    case CGrImageKernels::Int32:
+        {
+            int *d = (int *)dest;
+            for( ;  i<count;  i++)
+            {
+                float f = src[i] * 255.f;
+                d[i] = f >= 0 ? int(f + 0.5f) : -int(0.5f - f);
+            }
+        }
+        break;
+
+    case CGrImageKernels::Float32:
+        memcpy(dest, src, count * sizeof(float));
+        break;
+    }
+}
+
+//
+// Tables for the sRGB conversions in Downsample(). Going to linear
+// light is a lookup of the byte. Coming back, the linear value is
+// scaled to 16 bits and looked up. Near black, where sRGB is steepest,
+// one 16 bit step is still only a twentieth of an 8 bit step.
+//
+
+struct SrgbTables
+{
+    enum {EncodeSize = 65536};
+
+    SrgbTables()
+    {
+        for(int i=0;  i<256;  i++)
+        {
+            double v = i / 255.;
+            mToLinear[i] = float(v <= 0.04045 ? v / 12.92 : pow((v + 0.055) / 1.055, 2.4));
+            mToUnit[i] = float(v);
+        }
+
+        for(int i=0;  i<EncodeSize;  i++)
+        {
+            double v = double(i) / (EncodeSize - 1);
+            double s = v <= 0.0031308 ? v * 12.92 : 1.055 * pow(v, 1 / 2.4) - 0.055;
+            mToSrgb[i] = (unsigned char)(s * 255. + 0.5);
+            mToByte[i] = (unsigned char)(v * 255. + 0.5);
+        }
+    }
+
+    float mToLinear[256];                   // sRGB byte to linear light
+    float mToUnit[256];                     // Byte to 0 to 1, for alpha
+    unsigned char mToSrgb[EncodeSize];      // Linear light to sRGB byte
+    unsigned char mToByte[EncodeSize];      // 0 to 1 to byte, for alpha
+};
+
+static const SrgbTables Srgb;
+
+// Rows of a mipmap level done as one task
+const int MipBandRows = 16;
+
+// The source texels one mipmap texel covers on one axis
+struct MipTap
+{
+    int mIndex[3];
+    float mWeight[3];
+};
+
+
+//
+// Name :         MipTaps()
+// Description :  Source texels and weights for each texel of the next
+//                mipmap level on one axis. An even size averages pairs.
+//                An odd size 2n+1 goes to n texels that each cover 2+1/n
+//                source texels, weighted by how much of each they cover.
+//
+
+static void MipTaps(std::vector<MipTap> &taps, int srcSize)
+{
+    int size = CGrImageKernels::MipSize(srcSize);
+    taps.resize(size);
+    for(int i=0;  i<size;  i++)
+    {
+        MipTap &t = taps[i];
+        if(srcSize == 1)
+        {
+            t.mIndex[0] = t.mIndex[1] = t.mIndex[2] = 0;
+            t.mWeight[0] = 1;
+            t.mWeight[1] = t.mWeight[2] = 0;
+        }
+        else if(srcSize % 2 == 0)
+        {
+            t.mIndex[0] = 2 * i;
+            t.mIndex[1] = t.mIndex[2] = 2 * i + 1;
+            t.mWeight[0] = t.mWeight[1] = 0.5f;
+            t.mWeight[2] = 0;
+        }
+        else
+        {
+            float n = float(size);
+            t.mIndex[0] = 2 * i;
+            t.mIndex[1] = 2 * i + 1;
+            t.mIndex[2] = 2 * i + 2;
+            t.mWeight[0] = (n - i) / (2 * n + 1);
+            t.mWeight[1] = n / (2 * n + 1);
+            t.mWeight[2] = (i + 1) / (2 * n + 1);
+        }
+    }
+}
+
+
+//
+// Name :         MipFilterRow()
+// Description :  One source row to linear light, filtered across to
+//                the width of the next level.
+//
+
+static void MipFilterRow(float *dest, const unsigned char *src, const MipTap *taps, int width, 
+                         int channels, bool pairs, const float *const *decode)
+{
+    if(pairs && channels == 3)
+    {
+        // The usual case for textures
+        const float *d = decode[0];
+        for(int x=0;  x<width;  x++, src += 6, dest += 3)
+        {
+            dest[0] = 0.5f * (d[src[0]] + d[src[3]]);
+            dest[1] = 0.5f * (d[src[1]] + d[src[4]]);
+            dest[2] = 0.5f * (d[src[2]] + d[src[5]]);
+        }
+
+        return;
+    }
+
+    for(int x=0;  x<width;  x++, dest += channels)
+    {
+        const MipTap &t = taps[x];
+        const unsigned char *a = src + t.mIndex[0] * channels;
+        const unsigned char *b = src + t.mIndex[1] * channels;
+        const unsigned char *c = src + t.mIndex[2] * channels;
+        for(int ch=0;  ch<channels;  ch++)
+        {
+            const float *d = decode[ch];
+            dest[ch] = t.mWeight[0] * d[a[ch]] + t.mWeight[1] * d[b[ch]] + t.mWeight[2] * d[c[ch]];
+        }
+    }
+}
+
+
+//
+// Name :         MipEncodeRow()
+// Description :  Three filtered rows weighted together and converted
+//                back to bytes. index is scratch space for the table
+//                indices, one per channel value.
+//
+
+static void MipEncodeRow(unsigned char *dest, const float *const *rows, const float *weights, int width, 
+                         int channels, const unsigned char *const *encode, int *index)
+{
+    const float scale = float(SrgbTables::EncodeSize - 1);
+    int count = width * channels;
+    int i = 0;
+
+#ifdef GRIMAGET_SSE2
+    const __m128 w0 = _mm_set1_ps(weights[0] * scale);
+    const __m128 w1 = _mm_set1_ps(weights[1] * scale);
+    const __m128 w2 = _mm_set1_ps(weights[2] * scale);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 top = _mm_set1_ps(scale);
+    const __m128 half = _mm_set1_ps(0.5f);
+    for( ;  i + 4 <= count;  i += 4)
+    {
+        __m128 v = _mm_mul_ps(_mm_loadu_ps(rows[0] + i), w0);
+        v = _mm_add_ps(v, _mm_mul_ps(_mm_loadu_ps(rows[1] + i), w1));
+        v = _mm_add_ps(v, _mm_mul_ps(_mm_loadu_ps(rows[2] + i), w2));
+        v = _mm_min_ps(_mm_max_ps(v, zero), top);
+        _mm_storeu_si128((__m128i *)(index + i), _mm_cvttps_epi32(_mm_add_ps(v, half)));
+    }
+#endif
+
+    for( ;  i<count;  i++)
+    {
+        float v = (weights[0] * rows[0][i] + weights[1] * rows[1][i] + weights[2] * rows[2][i]) * scale;
+        v = v > 0 ? v : 0;
+        v = v < scale ? v : scale;
+        index[i] = int(v + 0.5f);
+    }
+
+    if(channels == 3 && encode[0] == encode[2])
+    {
+        const unsigned char *e = encode[0];
+        for(i=0;  i<count;  i++)
+            dest[i] = e[index[i]];
+
+        return;
+    }
+
+    for(i=0;  i<count;  i += channels)
+    {
+        for(int ch=0;  ch<channels;  ch++)
+            dest[i + ch] = encode[ch][index[i + ch]];
+    }
+}
+
+
+//
+// Downsample() split into bands of rows. Each band filters the source
+// rows it needs across into a small cache, then weights them together
+// down the columns. An odd height shares a source row between
+// neighboring texels, and the cache keeps it from being filtered twice.
+//
+
+struct MipBands
+{
+    unsigned char *mDest;
+    int mDestPitch;
+    const unsigned char *mSrc;
+    int mSrcPitch;
+    int mDestWidth;
+    int mDestHeight;
+    int mChannels;
+    bool mPairs;
+    const MipTap *mColumns;
+    const MipTap *mRows;
+    const float *mDecode[4];
+    const unsigned char *mEncode[4];
+
+    void operator()(int band, int worker) const
+    {
+        int begin = band * MipBandRows;
+        int end = begin + MipBandRows < mDestHeight ? begin + MipBandRows : mDestHeight;
+        int count = mDestWidth * mChannels;
+
+        std::vector<float> cache(size_t(count) * 3);
+        std::vector<int> index(count);
+        int keys[3] = {-1, -1, -1};
+
+        for(int y=begin;  y<end;  y++)
+        {
+            const MipTap &t = mRows[y];
+            const float *rows[3];
+            bool used[3] = {false, false, false};
+
+            for(int k=0;  k<3;  k++)
+            {
+                int slot = 0;
+                while(slot < 3 && keys[slot] != t.mIndex[k])
+                    slot++;
+
+                if(slot == 3)
+                {
+                    slot = 0;
+                    while(used[slot])
+                        slot++;
+
+                    MipFilterRow(&cache[slot * count], mSrc + size_t(t.mIndex[k]) * mSrcPitch, 
+                        mColumns, mDestWidth, mChannels, mPairs, mDecode);
+                    keys[slot] = t.mIndex[k];
+                }
+
+                used[slot] = true;
+                rows[k] = &cache[slot * count];
+            }
+
+            MipEncodeRow(mDest + size_t(y) * mDestPitch, rows, t.mWeight, mDestWidth, 
+                mChannels, mEncode, &index[0]);
+        }
+    }
+};
+
+
+#ifdef GRIMAGET_SSSE3
+
+static bool HasSsse3()
+{
+#if defined(_M_IX86) || defined(_M_X64)
+    int info[4];
+    __cpuid(info, 0);
+    if(info[0] < 1)
+        return false;
+
+    __cpuid(info, 1);
+    return (info[2] & (1 << 9)) != 0;
+#else
+    return true;
+#endif
+}
+
+static const bool UseSsse3 = HasSsse3();
+
+#endif
+
+// Byte offsets of B, G, R, and A in a pixel of each layout, -1 if
+// there is none. Indexed8 is after the palette lookup.
+static const int SourceOffsets[6][4] = {
+    {0, 0, 0, -1},      // Gray8
+    {0, 0, 0, -1},      // Indexed8
+    {0, 1, 2, -1},      // Bgr8
+    {0, 1, 2, 3},       // Bgra8
+    {2, 1, 0, -1},      // Rgb8
+    {2, 1, 0, 3}};      // Rgba8
+
+// Which of B, G, R, and A each byte of a pixel of each layout holds
+static const int DestChannels[6][4] = {
+    {0, 0, 0, 0},       // Gray8
+    {0, 0, 0, 0},       // Indexed8, as Gray8
+    {0, 1, 2, 0},       // Bgr8
+    {0, 1, 2, 3},       // Bgra8
+    {2, 1, 0, 0},       // Rgb8
+    {2, 1, 0, 3}};      // Rgba8
+
+//
+// A conversion from one 8 bit pixel layout to another, set up once
+// for any number of rows. Each destination byte is a source byte or
+// an alpha of 255, except gray from color, which is the luminance.
+// Indexed pixels go through a table of palette entries already in
+// the destination layout.
+//
+// With SSSE3, a load of 16 source bytes is shuffled into up to four
+// groups of 4 destination pixels. Each group is stored as 16 bytes,
+// past the end of its pixels, and the next group or the scalar loop
+// writes over the extra.
+//
+
+struct PixelConverter
+{
+    int mDestBytes;
+    int mSrcBytes;
+    int mMap[4];            // Source byte for each destination byte, -1 for 255
+    bool mLuminance;
+    int mLuma[3];           // Source bytes of B, G, R for the luminance
+    bool mIndexed;
+    unsigned mTable[256];   // Palette entries in the destination layout
+
+    bool mShuffle;
+    int mGroups;            // Groups of 4 pixels in a 16 byte load
+    int mMinLeft;           // Pixels that must be left for a vector step
+    unsigned char mMasks[4][16];
+    unsigned char mAlpha[16];
+
+    void Init(CGrImageKernels::PixelFormat destFormat, CGrImageKernels::PixelFormat srcFormat, const unsigned char *palette)
+    {
+        if(destFormat == CGrImageKernels::Indexed8)
+            destFormat = CGrImageKernels::Gray8;
+
+        mDestBytes = CGrImageKernels::PixelBytes(destFormat);
+        mSrcBytes = CGrImageKernels::PixelBytes(srcFormat);
+        mIndexed = srcFormat == CGrImageKernels::Indexed8;
+        mLuminance = destFormat == CGrImageKernels::Gray8 && mSrcBytes >= 3;
+        for(int c=0;  c<3;  c++)
+            mLuma[c] = SourceOffsets[srcFormat][c];
+
+        for(int j=0;  j<4;  j++)
+            mMap[j] = j < mDestBytes ? SourceOffsets[srcFormat][DestChannels[destFormat][j]] : -1;
+
+        mShuffle = false;
+        if(mIndexed)
+        {
+            // Each palette entry as a B, G, R, A pixel, through the
+            // conversion from Bgra8
+            PixelConverter entry;
+            entry.Init(destFormat, CGrImageKernels::Bgra8, NULL);
+            for(int i=0;  i<256;  i++)
+            {
+                unsigned char bgra[4] = {(unsigned char)i, (unsigned char)i, (unsigned char)i, 255};
+                if(palette != NULL)
+                {
+                    bgra[0] = palette[i * 4];
+                    bgra[1] = palette[i * 4 + 1];
+                    bgra[2] = palette[i * 4 + 2];
+                }
+
+                unsigned char pixel[4] = {0, 0, 0, 0};
+                entry.Row(pixel, bgra, 1);
+                memcpy(&mTable[i], pixel, 4);
+            }
+
+            return;
+        }
+
+#ifdef GRIMAGET_SSSE3
+        if(mLuminance || !UseSsse3)
+            return;
+
+        int perLoad = 16 / mSrcBytes / 4 * 4;
+        mGroups = perLoad / 4;
+        mShuffle = mGroups > 0;
+        if(!mShuffle)
+            return;
+
+        memset(mAlpha, 0, sizeof(mAlpha));
+        for(int g=0;  g<mGroups;  g++)
+        {
+            for(int j=0;  j<16;  j++)
+            {
+                int p = j / mDestBytes;
+                int m = mMap[j % mDestBytes];
+                if(p >= 4 || m < 0)
+                {
+                    mMasks[g][j] = 0x80;
+                    if(p < 4)
+                        mAlpha[j] = 255;
+                }
+                else
+                {
+                    mMasks[g][j] = (unsigned char)((g * 4 + p) * mSrcBytes + m);
+                }
+            }
+        }
+
+        // A step loads 16 source bytes and stores 16 bytes for each group
+        int load = (16 + mSrcBytes - 1) / mSrcBytes;
+        int store = (mGroups - 1) * 4 + (16 + mDestBytes - 1) / mDestBytes;
+        mMinLeft = perLoad;
+        mMinLeft = load > mMinLeft ? load : mMinLeft;
+        mMinLeft = store > mMinLeft ? store : mMinLeft;
+#endif
+    }
+
+    void Row(unsigned char *dest, const unsigned char *src, int count) const
+    {
+        int i = 0;
+        if(mIndexed)
+        {
+            if(mDestBytes == 4)
+            {
+                for( ;  i<count;  i++)
+                    memcpy(dest + i * 4, &mTable[src[i]], 4);
+            }
+            else if(mDestBytes == 3)
+            {
+                // Four bytes at a time, but for the last pixel
+                for( ;  i + 1<count;  i++)
+                    memcpy(dest + i * 3, &mTable[src[i]], 4);
+
+                if(i < count)
+                    memcpy(dest + i * 3, &mTable[src[i]], 3);
+            }
+            else
+            {
+                for( ;  i<count;  i++)
+                    dest[i] = (unsigned char)mTable[src[i]];
+            }
+
+            return;
+        }
+
+#ifdef GRIMAGET_SSSE3
+        if(mShuffle && count >= mMinLeft)
+        {
+            __m128i masks[4];
+            for(int g=0;  g<mGroups;  g++)
+                masks[g] = _mm_loadu_si128((const __m128i *)mMasks[g]);
+
+            const __m128i alpha = _mm_loadu_si128((const __m128i *)mAlpha);
+            int step = mGroups * 4;
+            for( ;  count - i >= mMinLeft;  i += step)
+            {
+                __m128i v = _mm_loadu_si128((const __m128i *)(src + i * mSrcBytes));
+                unsigned char *d = dest + i * mDestBytes;
+                for(int g=0;  g<mGroups;  g++, d += 4 * mDestBytes)
+                    _mm_storeu_si128((__m128i *)d, _mm_or_si128(_mm_shuffle_epi8(v, masks[g]), alpha));
+            }
+        }
+#endif
+
+        const unsigned char *s = src + i * mSrcBytes;
+        unsigned char *d = dest + i * mDestBytes;
+        if(mLuminance)
+        {
+            for( ;  i<count;  i++, s += mSrcBytes, d++)
+                *d = (unsigned char)((114 * s[mLuma[0]] + 587 * s[mLuma[1]] + 299 * s[mLuma[2]] + 500) / 1000);
+
+            return;
+        }
+
+        for( ;  i<count;  i++, s += mSrcBytes, d += mDestBytes)
+        {
+            for(int j=0;  j<mDestBytes;  j++)
+                d[j] = mMap[j] >= 0 ? s[mMap[j]] : 255;
+        }
+    }
+};
+
+//! \endcond
+
+
+void *CGrImageKernels::Allocate(size_t bytes)
+{
+    return _aligned_malloc(bytes, Alignment);
+}
+
+
+void CGrImageKernels::Free(void *data)
+{
+    _aligned_free(data);
+}
+
+
+void CGrImageKernels::Copy(void *dest, const void *src, size_t bytes)
+{
+#ifdef GRIMAGET_SSE2
+    __m128i *d = (__m128i *)dest;
+    const __m128i *s = (const __m128i *)src;
+    for(size_t i=0;  i<bytes / 64;  i++, d += 4, s += 4)
+    {
+        __m128i a = _mm_load_si128(s);
+        __m128i b = _mm_load_si128(s + 1);
+        __m128i c = _mm_load_si128(s + 2);
+        __m128i e = _mm_load_si128(s + 3);
+        _mm_store_si128(d, a);
+        _mm_store_si128(d + 1, b);
+        _mm_store_si128(d + 2, c);
+        _mm_store_si128(d + 3, e);
+    }
+#else
+    memcpy(dest, src, bytes);
+#endif
+}
+
+
+//
+// Name :         CGrImageKernels::Fill()
+// Description :  The pixel is repeated into a pattern as long as the
+//                smallest common multiple of the pixel size and the
+//                alignment. The memory is a whole number of those, so
+//                the pattern is simply stored over and over.
+//
+
+void CGrImageKernels::Fill(void *dest, size_t bytes, const void *pixel, int pixelBytes)
+{
+    if(bytes == 0 || pixelBytes <= 0)
+        return;
+
+    int pattern = Alignment;
+    while(pattern % pixelBytes != 0)
+        pattern += Alignment;
+
+    if(bytes % pattern != 0 || pattern > 16 * Alignment)
+    {
+        // Not a whole number of patterns, so a pixel at a time
+        for(size_t i=0;  i + pixelBytes <= bytes;  i += pixelBytes)
+            memcpy((char *)dest + i, pixel, pixelBytes);
+
+        return;
+    }
+
+    char block[16 * Alignment];
+    for(int i=0;  i<pattern;  i += pixelBytes)
+        memcpy(block + i, pixel, pixelBytes);
+
+#ifdef GRIMAGET_SSE2
+    int vectors = pattern / 16;
+    __m128i *d = (__m128i *)dest;
+    __m128i *end = (__m128i *)((char *)dest + bytes);
+    while(d < end)
+    {
+        for(int i=0;  i<vectors;  i++)
+            _mm_store_si128(d + i, _mm_loadu_si128((const __m128i *)block + i));
+
+        d += vectors;
+    }
+#else
+    for(size_t i=0;  i<bytes;  i += pattern)
+        memcpy((char *)dest + i, block, pattern);
+#endif
+}
+
+
+void CGrImageKernels::Convert(void *dest, ChannelType destType, const void *src, ChannelType srcType, size_t count)
+{
+    if(destType == srcType)
+    {
+        memcpy(dest, src, count * ChannelSize(srcType));
+        return;
+    }
+
+    int srcSize = ChannelSize(srcType);
+    int destSize = ChannelSize(destType);
+    const char *s = (const char *)src;
+    char *d = (char *)dest;
+
+    float block[ConvertBlock];
+    while(count > 0)
+    {
+        int n = count < ConvertBlock ? (int)count : ConvertBlock;
+
+        if(srcType == Float32)
+            FromFloat(d, destType, (const float *)s, n);
+        else if(destType == Float32)
+            ToFloat((float *)d, s, srcType, n);
+        else
+        {
+            ToFloat(block, s, srcType, n);
+            FromFloat(d, destType, block, n);
+        }
+
+        s += n * srcSize;
+        d += n * destSize;
+        count -= n;
+    }
+}
+
+
+void CGrImageKernels::Remap(float *dest, int destChannels, const float *src, int srcChannels, int pixels)
+{
+    for(int p=0;  p<pixels;  p++, dest += destChannels, src += srcChannels)
+    {
+        // Blue, green, red, and alpha of the source
+        float bgra[4] = {0, 0, 0, 1};
+        if(srcChannels == 1 || srcChannels == 2)
+        {
+            bgra[0] = bgra[1] = bgra[2] = src[0];
+            if(srcChannels == 2)
+                bgra[3] = src[1];
+        }
+        else
+        {
+            for(int c=0;  c<srcChannels && c<4;  c++)
+                bgra[c] = src[c];
+        }
+
+        if(destChannels == 1 || destChannels == 2)
+        {
+            dest[0] = srcChannels >= 3 ? 0.114f * bgra[0] + 0.587f * bgra[1] + 0.299f * bgra[2] : bgra[0];
+            if(destChannels == 2)
+                dest[1] = bgra[3];
+        }
+        else
+        {
+            for(int c=0;  c<destChannels;  c++)
+                dest[c] = c < 4 ? bgra[c] : 0;
+        }
+    }
+}
+
+
+void CGrImageKernels::ConvertPixels(void *dest, PixelFormat destFormat, const void *src, PixelFormat srcFormat, 
+                                    int count, const unsigned char *palette)
+{
+    PixelConverter converter;
+    converter.Init(destFormat, srcFormat, palette);
+    converter.Row((unsigned char *)dest, (const unsigned char *)src, count);
+}
+
+
+void CGrImageKernels::ConvertRows(void *dest, int destPitch, PixelFormat destFormat, const void *src, int srcPitch, 
+                                  PixelFormat srcFormat, int width, int height, const unsigned char *palette)
+{
+    if(width <= 0 || height <= 0)
+        return;
+
+    PixelConverter converter;
+    converter.Init(destFormat, srcFormat, palette);
+
+    unsigned char *d = (unsigned char *)dest;
+    const unsigned char *s = (const unsigned char *)src;
+    for(int r=0;  r<height;  r++, d += destPitch, s += srcPitch)
+        converter.Row(d, s, width);
+}
+
+
+//
+// Name :         CGrImageKernels::Downsample()
+// Description :  The box filter is separable, so rows are filtered
+//                across first and the results weighted together down
+//                the columns. Everything between the two conversions is
+//                linear light in floats.
+//
+
+void CGrImageKernels::Downsample(unsigned char *dest, int destPitch, const unsigned char *src, int srcPitch, 
+                                 int srcWidth, int srcHeight, int channels, CGrThreadPool *pool)
+{
+    if(srcWidth <= 0 || srcHeight <= 0 || channels < 1 || channels > 4)
+        return;
+
+    std::vector<MipTap> columns;
+    std::vector<MipTap> rows;
+    MipTaps(columns, srcWidth);
+    MipTaps(rows, srcHeight);
+
+    MipBands bands;
+    bands.mDest = dest;
+    bands.mDestPitch = destPitch;
+    bands.mSrc = src;
+    bands.mSrcPitch = srcPitch;
+    bands.mDestWidth = (int)columns.size();
+    bands.mDestHeight = (int)rows.size();
+    bands.mChannels = channels;
+    bands.mPairs = srcWidth > 1 && srcWidth % 2 == 0;
+    bands.mColumns = &columns[0];
+    bands.mRows = &rows[0];
+    for(int ch=0;  ch<4;  ch++)
+    {
+        bool alpha = ch == 3;
+        bands.mDecode[ch] = alpha ? Srgb.mToUnit : Srgb.mToLinear;
+        bands.mEncode[ch] = alpha ? Srgb.mToByte : Srgb.mToSrgb;
+    }
+
+    int numBands = (bands.mDestHeight + MipBandRows - 1) / MipBandRows;
+    if(pool != NULL && numBands > 1)
+    {
+        pool->ParallelFor(numBands, 1, bands);
+    }
+    else
+    {
+        for(int b=0;  b<numBands;  b++)
+            bands(b, 0);
+    }
+}
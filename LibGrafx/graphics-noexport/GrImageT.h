@@ -0,0 +1,370 @@
+//
+// Name :         GrImageT.h
+// Description :  Header for CGrImageT, an image container template
+//                with aligned rows, and the kernels behind it.
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+#pragma once
+
+#if !defined(_GRIMAGET_H)
+#define _GRIMAGET_H
+
+#if !defined(LibGrafx)
+#define LibGrafx
+#endif
+
+#include <cstddef>
+#include <vector>
+
+class CGrThreadPool;
+
+//! Memory and pixel kernels used by CGrImageT.
+
+/*! These work on raw rows so the template itself stays small. The
+memory for every image is allocated and freed here, inside the library,
+so images can be passed between the library and a program built against
+a different runtime.
+
+\version 1.00 Initial version
+*/
+
+class LibGrafx CGrImageKernels
+{
+public:
+    //! Channel types the kernels convert between
+    enum ChannelType {UInt8, UInt16, Int32, Float32};
+
+    //! Byte layouts of 8 bit pixels ConvertPixels() converts between
+    /*! Indexed8 is a byte per pixel that picks an entry of a palette. It
+        is only a source. */
+    enum PixelFormat {Gray8, Indexed8, Bgr8, Bgra8, Rgb8, Rgba8};
+
+    //! Alignment of image memory and of every row in bytes
+    enum {Alignment = 64};
+
+    //! Allocate image memory aligned to Alignment
+    static void *Allocate(size_t bytes);
+
+    //! Free memory from Allocate()
+    static void Free(void *data);
+
+    //! Copy image memory
+    /*! \param dest Destination, aligned to Alignment
+        \param src Source, aligned to Alignment
+        \param bytes Bytes to copy, a multiple of Alignment */
+    static void Copy(void *dest, const void *src, size_t bytes);
+
+    //! Fill image memory with one pixel value repeated
+    /*! \param dest Destination, aligned to Alignment
+        \param bytes Bytes to fill, a multiple of both Alignment and pixelBytes
+        \param pixel The pixel value
+        \param pixelBytes Size of a pixel in bytes */
+    static void Fill(void *dest, size_t bytes, const void *pixel, int pixelBytes);
+
+    //! Convert channel values from one type to another
+    /*! Values are converted through a float from 0 to 1. UInt8 and
+        Int32 channels run from 0 to 255 and UInt16 channels from 0 to
+        65535. Values out of range are clamped, except for Int32.
+        \param dest Destination values
+        \param destType Destination channel type
+        \param src Source values
+        \param srcType Source channel type
+        \param count Number of values */
+    static void Convert(void *dest, ChannelType destType, const void *src, ChannelType srcType, size_t count);
+
+    //! Change the number of channels of float pixels
+    /*! Gray is copied to blue, green, and red. Color becomes gray by
+        luminance. A missing alpha is 1 and an unwanted one is dropped.
+        \param dest Destination pixels
+        \param destChannels Channels in a destination pixel
+        \param src Source pixels
+        \param srcChannels Channels in a source pixel
+        \param pixels Number of pixels */
+    static void Remap(float *dest, int destChannels, const float *src, int srcChannels, int pixels);
+
+    //! Bytes in a pixel of a layout
+    static int PixelBytes(PixelFormat format) 
+    {
+        return format == Gray8 || format == Indexed8 ? 1 : (format == Bgr8 || format == Rgb8 ? 3 : 4);
+    }
+
+    //! Convert 8 bit pixels from one layout to another
+    /*! Where a conversion only moves bytes around, which is every one
+        but color to gray, it is done 16 bytes at a time with SSSE3
+        shuffles on processors that have them. Indexed8 pixels are
+        looked up in a table made from the palette that holds each
+        entry already in the destination layout. Color becomes gray by
+        luminance. A missing alpha is 255 and an unwanted one is
+        dropped.
+        \param dest Destination pixels
+        \param destFormat Destination layout. Not Indexed8.
+        \param src Source pixels
+        \param srcFormat Source layout
+        \param count Number of pixels
+        \param palette For Indexed8, 256 entries of B, G, R, and an unused byte,
+        the layout of a Windows RGBQUAD */
+    static void ConvertPixels(void *dest, PixelFormat destFormat, const void *src, PixelFormat srcFormat, 
+                              int count, const unsigned char *palette=NULL);
+
+    //! Convert rows of 8 bit pixels from one layout to another
+    /*! ConvertPixels() for each row, with the conversion set up only
+        once. Either pitch may be negative, so rows stored top down can
+        be read or written from the bottom up without a copy.
+        \param dest First destination row
+        \param destPitch Bytes from one destination row to the next
+        \param destFormat Destination layout. Not Indexed8.
+        \param src First source row
+        \param srcPitch Bytes from one source row to the next
+        \param srcFormat Source layout
+        \param width Pixels in a row
+        \param height Number of rows
+        \param palette For Indexed8, as for ConvertPixels() */
+    static void ConvertRows(void *dest, int destPitch, PixelFormat destFormat, const void *src, int srcPitch, 
+                            PixelFormat srcFormat, int width, int height, const unsigned char *palette=NULL);
+
+    //! Size of the next mipmap level in one dimension
+    static int MipSize(int size) {return size > 1 ? size / 2 : 1;}
+
+    //! Make the next mipmap level of an 8 bit sRGB image
+    /*! The level is MipSize() of the source in each dimension. Each
+        texel is the box filtered average of the source in linear light,
+        so it is converted from sRGB first and back to sRGB after. Where
+        a source dimension is odd, each texel covers a source texel and
+        a half on that axis, so no source texel is dropped. A fourth
+        channel is alpha and is averaged as it is.
+        \param dest Destination rows
+        \param destPitch Bytes between destination rows
+        \param src Source rows
+        \param srcPitch Bytes between source rows
+        \param srcWidth Source width in pixels
+        \param srcHeight Source height in pixels
+        \param channels Channels in a pixel, 1 to 4
+        \param pool Threads to split the rows over, or NULL for this thread only */
+    static void Downsample(unsigned char *dest, int destPitch, const unsigned char *src, int srcPitch, 
+                           int srcWidth, int srcHeight, int channels, CGrThreadPool *pool=NULL);
+};
+
+
+//! Channel type information for CGrImageT
+template<class T> struct CGrChannelTraits;
+
+template<> struct CGrChannelTraits<unsigned char> {enum {Type = CGrImageKernels::UInt8};};
+template<> struct CGrChannelTraits<unsigned short> {enum {Type = CGrImageKernels::UInt16};};
+template<> struct CGrChannelTraits<int> {enum {Type = CGrImageKernels::Int32};};
+template<> struct CGrChannelTraits<float> {enum {Type = CGrImageKernels::Float32};};
+
+
+//! An image of any channel type and number of channels.
+
+/*! T is the channel type: unsigned char, unsigned short, int, or float.
+C is the number of channels in a pixel. A C of 0 means the number of
+channels is chosen at run time by SetSize().
+
+Channels are in the order B, G, R, and A, the same as a Windows DIB.
+The image is one block of memory. Each row starts on a 64 byte
+boundary and is padded to a multiple of both 64 bytes and the pixel
+size, so a whole row can be processed with aligned vector loads and
+stores without a special case at the end. GetRowLength() is the row
+in pixels, including the padding, for GL_UNPACK_ROW_LENGTH.
+
+Images move rather than copy. Clone() or Copy() make a copy.
+
+\version 1.00 Initial version
+*/
+
+template<class T, int C> class CGrImageT
+{
+public:
+    typedef T Channel;
+
+    //! Constructor. The image is empty.
+    CGrImageT() {Init();}
+
+    //! Constructor
+    /*! \param width Image width
+        \param height Image height
+        \param channels Number of channels, if C is 0 */
+    CGrImageT(int width, int height, int channels=C) {Init(); SetSize(width, height, channels);}
+
+    //! Move Constructor. The other image is left empty.
+    CGrImageT(CGrImageT &&img) {Init(); *this = static_cast<CGrImageT &&>(img);}
+
+    ~CGrImageT() {Clear();}
+
+    //! Move assignment. The other image is left empty.
+    CGrImageT &operator=(CGrImageT &&img)
+    {
+        if(&img != this)
+        {
+            Clear();
+            mData = img.mData;
+            mWidth = img.mWidth;
+            mHeight = img.mHeight;
+            mChannels = img.mChannels;
+            mPitch = img.mPitch;
+            img.Init();
+        }
+
+        return *this;
+    }
+
+    //! Make a copy of this image
+    CGrImageT Clone() const
+    {
+        CGrImageT copy;
+        copy.Copy(*this);
+        return copy;
+    }
+
+    //! Copy another image into this one
+    void Copy(const CGrImageT &img)
+    {
+        if(&img == this)
+            return;
+
+        SetSize(img.mWidth, img.mHeight, img.mChannels);
+        if(mData != NULL)
+            CGrImageKernels::Copy(mData, img.mData, GetBytes());
+    }
+
+    //! Set the image size
+    /*! The image is reallocated only if the size changes. The content
+        is undefined afterwards.
+        \param width Image width
+        \param height Image height
+        \param channels Number of channels. Only used if C is 0. */
+    void SetSize(int width, int height, int channels=C)
+    {
+        if(C != 0)
+            channels = C;
+
+        if(width == mWidth && height == mHeight && channels == mChannels)
+            return;
+
+        Clear();
+        mChannels = channels;
+        if(width <= 0 || height <= 0 || channels <= 0)
+            return;
+
+        mWidth = width;
+        mHeight = height;
+
+        // Pad to the alignment, and further until it is a whole
+        // number of pixels as well
+        int pixel = GetPixelBytes();
+        int align = CGrImageKernels::Alignment;
+        mPitch = (width * pixel + align - 1) / align * align;
+        while(mPitch % pixel != 0)
+            mPitch += align;
+
+        mData = (T *)CGrImageKernels::Allocate(GetBytes());
+    }
+
+    //! Release the image memory. The image is empty afterwards.
+    void Clear()
+    {
+        if(mData != NULL)
+            CGrImageKernels::Free(mData);
+
+        int channels = mChannels;
+        Init();
+        mChannels = channels;
+    }
+
+    bool IsEmpty() const {return mData == NULL;}
+
+    int GetWidth() const {return mWidth;}
+    int GetHeight() const {return mHeight;}
+    int GetChannels() const {return mChannels;}
+
+    //! Bytes from the start of one row to the start of the next
+    int GetPitch() const {return mPitch;}
+
+    //! Pixels from the start of one row to the start of the next
+    int GetRowLength() const {return mPitch > 0 ? mPitch / GetPixelBytes() : 0;}
+
+    int GetPixelBytes() const {return mChannels * (int)sizeof(T);}
+
+    //! Bytes of memory used by the image
+    size_t GetBytes() const {return size_t(mPitch) * mHeight;}
+
+    T *GetData() const {return mData;}
+
+    T *GetRow(int r) {return (T *)((char *)mData + size_t(r) * mPitch);}
+    const T *GetRow(int r) const {return (const T *)((const char *)mData + size_t(r) * mPitch);}
+
+    T *GetPixel(int x, int y) {return GetRow(y) + x * mChannels;}
+    const T *GetPixel(int x, int y) const {return GetRow(y) + x * mChannels;}
+
+    //! Fill the image with one pixel value
+    /*! \param pixel GetChannels() channel values */
+    void Fill(const T *pixel)
+    {
+        if(mData != NULL)
+            CGrImageKernels::Fill(mData, GetBytes(), pixel, GetPixelBytes());
+    }
+
+    //! Set this image from an image of any type
+    /*! The image takes the size of the other. If C is 0 it takes the
+        number of channels as well. Channel values are converted as
+        CGrImageKernels::Convert() does and channels are added or removed
+        as CGrImageKernels::Remap() does.
+        \param img The other image */
+    template<class U, int D> void ConvertFrom(const CGrImageT<U, D> &img)
+    {
+        SetSize(img.GetWidth(), img.GetHeight(), C != 0 ? C : img.GetChannels());
+        if(mData == NULL)
+            return;
+
+        CGrImageKernels::ChannelType destType = (CGrImageKernels::ChannelType)CGrChannelTraits<T>::Type;
+        CGrImageKernels::ChannelType srcType = (CGrImageKernels::ChannelType)CGrChannelTraits<U>::Type;
+        if(mChannels == img.GetChannels())
+        {
+            for(int r=0;  r<mHeight;  r++)
+                CGrImageKernels::Convert(GetRow(r), destType, img.GetRow(r), srcType, size_t(mWidth) * mChannels);
+
+            return;
+        }
+
+        // Different channels go through float
+        std::vector<float> src(size_t(mWidth) * img.GetChannels());
+        std::vector<float> dest(size_t(mWidth) * mChannels);
+        for(int r=0;  r<mHeight;  r++)
+        {
+            CGrImageKernels::Convert(&src[0], CGrImageKernels::Float32, img.GetRow(r), srcType, src.size());
+            CGrImageKernels::Remap(&dest[0], mChannels, &src[0], img.GetChannels(), mWidth);
+            CGrImageKernels::Convert(GetRow(r), destType, &dest[0], CGrImageKernels::Float32, dest.size());
+        }
+    }
+
+private:
+    CGrImageT(const CGrImageT &);
+    CGrImageT &operator=(const CGrImageT &);
+
+    void Init()
+    {
+        mData = NULL;
+        mWidth = 0;
+        mHeight = 0;
+        mChannels = C;
+        mPitch = 0;
+    }
+
+    T *mData;
+    int mWidth;
+    int mHeight;
+    int mChannels;
+    int mPitch;
+};
+
+typedef CGrImageT<unsigned char, 3> CGrImageBgr8;
+typedef CGrImageT<unsigned char, 4> CGrImageBgra8;
+typedef CGrImageT<unsigned short, 3> CGrImageBgr16;
+typedef CGrImageT<float, 3> CGrImageBgrF;
+typedef CGrImageT<float, 4> CGrImageBgraF;
+
+#endif
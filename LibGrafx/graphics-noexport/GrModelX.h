@@ -12,6 +12,9 @@ class CGrModelXp;
 class CGrSphere;
 class CGrTransform;
 class CGrTexture;
+class CGrThreadPool;
+class CGrModelXLoad;
+class CGrModelXLoadp;
 
 #if !defined(LibGrafx)
 #define LibGrafx
@@ -24,8 +27,25 @@ public:
     virtual ~CGrModelX();
 
     void Clear();
+
+    //! Load a .xmodl file
+    /*! The first load compiles the file to a .xmodlb cache next to it,
+        which later loads map directly until the .xmodl changes. */
     bool LoadFile(const wchar_t *filename);
 
+    //! Load a .xmodl file in the background
+    /*! The model is unchanged until CGrModelXLoad::Get() is called
+        on the result. Any earlier load still in progress is cancelled.
+        \param filename File to load
+        \return The load in progress */
+    CGrModelXLoad LoadFileAsync(const wchar_t *filename);
+
+    //! Set the thread pool used to load
+    /*! The vertex and index buffers and the textures are loaded in
+        parallel. If no pool is set, one is created for each load.
+        \param pool The pool or NULL. It must outlive any load. */
+    void SetThreadPool(CGrThreadPool *pool);
+
     void SetTransform(const CGrTransform &t);
 
     bool IntersectionTest(const CGrSphere &sphere);
@@ -46,6 +66,15 @@ public:
         virtual const float *GetSpecular() const = 0;
         virtual float GetShininess() const = 0;
         virtual CGrTexture *GetTexture() = 0;
+
+        //! Color of the mirror reflection
+        virtual const float *GetSpecularOther() const = 0;
+
+        //! Color of the light transmitted through the surface
+        virtual const float *GetTransmission() const = 0;
+
+        //! Index of refraction inside the surface
+        virtual float GetEta() const = 0;
     };
 
     // Interface to a renderer
@@ -55,6 +84,26 @@ public:
         IRenderer();
         virtual ~IRenderer();
 
+        //! Description of a mesh part passed to DrawMeshPart()
+        /*! All of the pointers point into the model's own buffers and are 
+            only valid for the duration of the DrawMeshPart() call. The 
+            vertex, normal, and texture coordinate pointers have already 
+            been advanced to the part base vertex, so the indices can be 
+            used on them directly. */
+        struct MeshPart
+        {
+            const float *mVertices;         //!< 3 floats per vertex
+            const float *mNormals;          //!< 3 floats per vertex
+            const float *mTcoords;          //!< 2 floats per vertex or NULL if not textured
+            const int *mIndices;            //!< 3 indices per triangle
+            int mNumVertices;               //!< Number of vertices in the part
+            int mNumTriangles;              //!< Number of triangles in the part
+            int mBaseVertex;                //!< Base vertex in the model vertex buffer
+            int mStartIndex;                //!< Start index in the model index buffer
+            IEffect *mEffect;               //!< Effect for the part
+            const CGrTransform *mTransform; //!< Current bone absolute transform
+        };
+
         virtual void PushMatrix() = 0;
         virtual void PopMatrix() = 0;
         virtual void MultMatrix(const CGrTransform &t) = 0;
@@ -66,6 +115,15 @@ public:
         virtual void Normal3fv(float *n) = 0;
         virtual void Vertex3fv(float *v) = 0;
         virtual void NewMesh(const wchar_t *name);
+
+        //! Draw an entire mesh part in one call
+        /*! This is called between SetEffect() and EndEffect() for every
+            mesh part. The default implementation sends the part one
+            vertex at a time through BeginTriangles(), TexCoord2fv(),
+            Normal3fv(), Vertex3fv(), and EndTriangles(). Renderers that
+            can consume indexed arrays directly should override it.
+            \param part The mesh part to draw */
+        virtual void DrawMeshPart(const MeshPart &part);
     };
 
     class LibGrafx IBone
@@ -113,14 +171,125 @@ public:
             parent transform and is used to animate the bone.
             \param t New bone local transform */
         virtual void SetLocalTransform(const CGrTransform &t) = 0;
+
+        //! Get the pose generation the absolute transform was last computed in
+        /*! This is the value of CGrModelX::GetPoseGeneration() after the
+            ComputeBonesAbsolute() call that last changed the absolute
+            transform of this bone, so comparing it to a saved generation
+            tells if the bone has moved since.
+            \return Generation */
+        virtual unsigned GetGeneration() const = 0;
     };
 
     void Draw();
     void Draw(IRenderer *renderer);
 
+    //! Draw the model in a pose
+    /*! This draws just like Draw(), but with the absolute bone
+        transforms from ComputeBonesAbsolute(const CGrTransform &, 
+        const CGrTransform *, CGrTransform *) rather than the ones
+        stored in the bones. The model itself is not changed, so one 
+        model can be drawn many times in different poses.
+        \param absolute Absolute transforms, GetBoneCount() of them */
+    void DrawPose(const CGrTransform *absolute);
+
+    //! Draw the model in a pose to a renderer
+    /*! \param renderer The renderer
+        \param absolute Absolute transforms, GetBoneCount() of them */
+    void DrawPose(IRenderer *renderer, const CGrTransform *absolute);
+
+    //! Compute the absolute transforms of the bones
+    /*! Only bones whose local transform was set since the last call, 
+        and the bones below them, are computed. Everything is computed 
+        if SetTransform() was called. When nothing has changed this 
+        does no work at all, so it is cheap to call before any use of 
+        the absolute transforms. */
     void ComputeBonesAbsolute();
+
+    //! Get the pose generation
+    /*! The generation goes up each time ComputeBonesAbsolute() changes
+        any absolute transform, which includes the first call after a
+        model is loaded. Anything 
+        built from the pose, like a bounding volume hierarchy or a render 
+        cache, can save the generation and skip rebuilding while it 
+        stays the same.
+        \return Generation */
+    unsigned GetPoseGeneration() const;
+
+    //! Evaluate a pose without changing the model
+    /*! This computes the absolute transforms for the bones the same 
+        way ComputeBonesAbsolute() does, except that the root bones are
+        placed relative to t times the model transform, and the local
+        transforms come from an array rather than the bones.
+        \param t Transform to place the model with
+        \param local Local transform for each bone, or NULL to use
+        the bone local transforms.
+        \param absolute Receives the absolute transform for each bone.
+        There must be room for GetBoneCount() of them. */
+    void ComputeBonesAbsolute(const CGrTransform &t, const CGrTransform *local, CGrTransform *absolute) const;
+
     IBone *GetBone(const wchar_t *name);
 
+    //! Handle for a bone
+    /*! A handle is the bone index, as for GetBone(int), and stays
+        valid until the model is cleared or loaded again. -1 is no bone. */
+    typedef int BoneId;
+
+    //! Find a bone by name once
+    /*! Looking a bone up by name is a search, so code that poses a
+        bone every frame should resolve the name once and keep the
+        handle.
+        \param name Bone name
+        \return Bone handle or -1 if there is no bone with that name */
+    BoneId ResolveBone(const wchar_t *name) const;
+
+    //! Get a bone local transform by handle
+    const CGrTransform &GetLocalTransform(BoneId bone) const;
+
+    //! Set a bone local transform by handle
+    /*! This is the same as IBone::SetLocalTransform() without the
+        lookup or the virtual call. */
+    void SetLocalTransform(BoneId bone, const CGrTransform &t);
+
+    //! Set many bone local transforms at once
+    /*! \param bones Bone handles. Handles of -1 are skipped, so the
+        results of ResolveBone() can be passed without checking them.
+        \param t A local transform for each handle
+        \param count Number of handles */
+    void SetLocalTransforms(const BoneId *bones, const CGrTransform *t, int count);
+
+    //! Get the total number of triangles in the model
+    /*! This is the number of triangles Draw(IRenderer *) will send
+        to a renderer and can be used to reserve space in advance. */
+    int GetTriangleCount() const;
+
+    //! Get the number of meshes in the model
+    /*! Draw(IRenderer *) calls IRenderer::NewMesh() once for each
+        mesh, in index order. */
+    int GetMeshCount() const;
+
+    //! Get the bone a mesh is attached to
+    /*! Every vertex of a mesh is transformed by the absolute transform
+        of its bone, so animating the bones moves each mesh rigidly.
+        \param mesh Mesh index
+        \return Bone index for use with GetBone(int) */
+    int GetMeshBone(int mesh) const;
+
+    //! Get the number of bones in the model
+    int GetBoneCount() const;
+
+    //! Get the parent of a bone
+    /*! The bones are in topological order, so a parent always comes
+        before its children.
+        \param bone Bone index
+        \return Parent bone index or -1 for a root bone */
+    int GetBoneParent(int bone) const;
+
+    //! Get a bone by index
+    /*! \param bone Bone index from 0 to GetBoneCount() - 1
+        \return The bone */
+    IBone *GetBone(int bone);
+
     //! Get the position of a camera if specified in the ModelX file.
     /*! This function returns the position of a camera if one has been 
         specified in the ModelX file. If no camera is specified, this 
@@ -144,5 +313,11 @@ public:
     CGrVector GetCameraTarget(void);
 
 private:
+    friend class CGrModelXLoad;
+    void CancelLoad();
+
     CGrModelXp *mModel;
+
+    // Load from LoadFileAsync() not yet passed to Get()
+    CGrModelXLoadp *mLoad;
 };
@@ -0,0 +1,93 @@
+//
+// Name :         GrModelXLoad.h
+// Description :  Header for CGrModelXLoad, a CGrModelX load running
+//                in the background.
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+#pragma once
+
+#if !defined(_GRMODELXLOAD_H)
+#define _GRMODELXLOAD_H
+
+#if !defined(LibGrafx)
+#define LibGrafx
+#endif
+
+class CGrModelX;
+class CGrModelXLoadp;
+
+//! A model load running in the background.
+
+/*! CGrModelX::LoadFileAsync() returns one of these. It works like a
+future: the load runs on another thread while this object is used to
+follow its progress, cancel it, or wait for the result.
+
+The load fills a separate model, so the CGrModelX is unchanged and can
+still be drawn while the load runs. Get() waits for the load to finish
+and, if it succeeded, puts the new contents into the CGrModelX. Get()
+must be called from the thread that uses the model. A load that is
+never passed to Get() never changes the model.
+
+Copies refer to the same load. Starting another load of the same model
+or destroying the model cancels a load that has not been passed to
+Get() yet.
+
+\version 1.00 Initial version
+*/
+
+class LibGrafx CGrModelXLoad
+{
+public:
+    //! Constructor. The object refers to no load until assigned one.
+    CGrModelXLoad();
+
+    //! Copy constructor. Both objects refer to the same load.
+    CGrModelXLoad(const CGrModelXLoad &load);
+
+    //! Destructor. The load continues if it is still running.
+    virtual ~CGrModelXLoad();
+
+    //! Assignment. Both objects refer to the same load.
+    CGrModelXLoad &operator=(const CGrModelXLoad &load);
+
+    //! Does this object refer to a load?
+    bool IsValid() const;
+
+    //! Has the load finished, whether it succeeded or not?
+    bool IsReady() const;
+
+    //! Wait for the load to finish
+    void Wait() const;
+
+    //! Wait for the load to finish and put the result in the model
+    /*! The model is only changed the first time Get() is called,
+        and only if the load succeeded.
+        \return true if the load succeeded */
+    bool Get();
+
+    //! Fraction of the load done so far
+    /*! The progress counts the bytes of the model and texture files
+        that have been read, so it may move unevenly.
+        \return Progress from 0 to 1 */
+    double GetProgress() const;
+
+    //! Ask the load to stop
+    /*! The load stops soon after, at the end of whatever section or
+        texture it is in the middle of. It then fails with an error. */
+    void Cancel();
+
+    //! Error message if the load failed
+    const wchar_t *GetError() const;
+
+private:
+    friend class CGrModelX;
+    CGrModelXLoad(CGrModelXLoadp *load);
+
+    CGrModelXLoadp *mLoad;
+};
+
+#endif
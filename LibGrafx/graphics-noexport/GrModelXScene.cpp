@@ -0,0 +1,217 @@
+//
+//  Name :         GrModelXScene.cpp
+//  Description :  Implementation of the CGrModelXScene class.
+//  Version :      See GrModelXScene.h
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+
+#include <stdafx.h>
+#include "GrTransform.h"
+#include "GrModelX.h"
+#include "GrModelXScene.h"
+#include <vector>
+
+using namespace std;
+
+#ifdef _DEBUG
+#undef THIS_FILE
+static char THIS_FILE[]=__FILE__;
+#define new DEBUG_NEW
+#endif
+
+//! \cond ignore
+
+//
+// Private implementation of the scene
+//
+
+class CGrModelXScenep
+{
+public:
+    CGrModelXScenep() : mModel(NULL) {}
+
+    struct Instance
+    {
+        CGrTransform mTransform;
+        int mPose;              // Index into mPoses or -1 for the model pose
+    };
+
+    CGrModelX *mModel;
+    std::vector<Instance> mInstances;
+
+    // Per bone local transforms for the instances that have their own
+    std::vector<std::vector<CGrTransform> > mPoses;
+
+    // Indices into mPoses released by ClearPose() for reuse
+    std::vector<int> mFreePoses;
+
+    // Scratch space for the absolute transforms while drawing
+    std::vector<CGrTransform> mAbsolute;
+
+    void Pose(int instance)
+    {
+        if(mInstances[instance].mPose >= 0)
+            return;
+
+        int numBones = mModel->GetBoneCount();
+        int index;
+        if(!mFreePoses.empty())
+        {
+            index = mFreePoses.back();
+            mFreePoses.pop_back();
+        }
+        else
+        {
+            index = (int)mPoses.size();
+            mPoses.push_back(vector<CGrTransform>(numBones));
+        }
+
+        vector<CGrTransform> &pose = mPoses[index];
+        for(int b=0;  b<numBones;  b++)
+            pose[b] = mModel->GetBone(b)->GetLocalTransform();
+
+        mInstances[instance].mPose = index;
+    }
+};
+
+//! \endcond
+
+
+CGrModelXScene::CGrModelXScene()
+{
+    mScene = new CGrModelXScenep();
+}
+
+
+CGrModelXScene::~CGrModelXScene()
+{
+    delete mScene;
+}
+
+
+void CGrModelXScene::SetModel(CGrModelX *model)
+{
+    Clear();
+    mScene->mModel = model;
+}
+
+
+CGrModelX *CGrModelXScene::GetModel() const
+{
+    return mScene->mModel;
+}
+
+
+void CGrModelXScene::Clear()
+{
+    mScene->mInstances.clear();
+    mScene->mPoses.clear();
+    mScene->mFreePoses.clear();
+}
+
+
+int CGrModelXScene::AddInstance(const CGrTransform &t)
+{
+    CGrModelXScenep::Instance instance;
+    instance.mTransform = t;
+    instance.mPose = -1;
+    mScene->mInstances.push_back(instance);
+    return (int)mScene->mInstances.size() - 1;
+}
+
+
+int CGrModelXScene::GetInstanceCount() const
+{
+    return (int)mScene->mInstances.size();
+}
+
+
+void CGrModelXScene::SetInstanceTransform(int instance, const CGrTransform &t)
+{
+    mScene->mInstances[instance].mTransform = t;
+}
+
+
+const CGrTransform &CGrModelXScene::GetInstanceTransform(int instance) const
+{
+    return mScene->mInstances[instance].mTransform;
+}
+
+
+void CGrModelXScene::SetBoneLocalTransform(int instance, int bone, const CGrTransform &t)
+{
+    mScene->Pose(instance);
+    mScene->mPoses[mScene->mInstances[instance].mPose][bone] = t;
+}
+
+
+const CGrTransform &CGrModelXScene::GetBoneLocalTransform(int instance, int bone) const
+{
+    int pose = mScene->mInstances[instance].mPose;
+    if(pose < 0)
+        return mScene->mModel->GetBone(bone)->GetLocalTransform();
+
+    return mScene->mPoses[pose][bone];
+}
+
+
+bool CGrModelXScene::HasPose(int instance) const
+{
+    return mScene->mInstances[instance].mPose >= 0;
+}
+
+
+//
+// Name :         CGrModelXScene::ClearPose()
+// Description :  The pose storage is kept for reuse by the next
+//                instance that needs one.
+//
+void CGrModelXScene::ClearPose(int instance)
+{
+    int &pose = mScene->mInstances[instance].mPose;
+    if(pose < 0)
+        return;
+
+    mScene->mFreePoses.push_back(pose);
+    pose = -1;
+}
+
+
+void CGrModelXScene::ComputeBonesAbsolute(int instance, CGrTransform *absolute) const
+{
+    const CGrModelXScenep::Instance &inst = mScene->mInstances[instance];
+    const CGrTransform *local = inst.mPose >= 0 ? &mScene->mPoses[inst.mPose][0] : NULL;
+    mScene->mModel->ComputeBonesAbsolute(inst.mTransform, local, absolute);
+}
+
+
+void CGrModelXScene::Draw()
+{
+    if(mScene->mModel == NULL || mScene->mModel->GetBoneCount() == 0)
+        return;
+
+    mScene->mAbsolute.resize(mScene->mModel->GetBoneCount());
+    for(int i=0;  i<GetInstanceCount();  i++)
+    {
+        ComputeBonesAbsolute(i, &mScene->mAbsolute[0]);
+        mScene->mModel->DrawPose(&mScene->mAbsolute[0]);
+    }
+}
+
+
+void CGrModelXScene::Draw(CGrModelX::IRenderer *renderer)
+{
+    if(mScene->mModel == NULL || mScene->mModel->GetBoneCount() == 0)
+        return;
+
+    mScene->mAbsolute.resize(mScene->mModel->GetBoneCount());
+    for(int i=0;  i<GetInstanceCount();  i++)
+    {
+        ComputeBonesAbsolute(i, &mScene->mAbsolute[0]);
+        mScene->mModel->DrawPose(renderer, &mScene->mAbsolute[0]);
+    }
+}
@@ -0,0 +1,110 @@
+//
+// Name :         GrModelXScene.h
+// Description :  Header for CGrModelXScene, many instances of one
+//                CGrModelX.
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+#pragma once
+
+#if !defined(_GRMODELXSCENE_H)
+#define _GRMODELXSCENE_H
+
+#if !defined(LibGrafx)
+#define LibGrafx
+#endif
+
+class CGrModelXScenep;
+class CGrTransform;
+
+//! A scene made of many instances of one loaded model.
+
+/*! Every instance draws the same CGrModelX, so the vertex buffers,
+index buffers, and textures are loaded once no matter how many copies
+are placed. Each instance has its own transform.
+
+By default an instance uses the pose set on the model bones. An
+instance can be given a pose of its own with SetBoneLocalTransform(),
+which stores one local transform per bone for that instance only.
+Instances without their own pose cost only the size of a transform.
+
+The scene does not own the model. The model must outlive the scene
+and must not be reloaded while the scene refers to it.
+
+\version 1.00 Initial version
+*/
+
+class LibGrafx CGrModelXScene
+{
+public:
+    CGrModelXScene();
+    virtual ~CGrModelXScene();
+
+    //! Set the model all of the instances draw
+    /*! This removes any existing instances. */
+    void SetModel(CGrModelX *model);
+
+    //! The model all of the instances draw
+    CGrModelX *GetModel() const;
+
+    //! Remove all of the instances
+    void Clear();
+
+    //! Add an instance
+    /*! \param t Transform that places the instance
+        \return Instance index */
+    int AddInstance(const CGrTransform &t);
+
+    //! Number of instances
+    int GetInstanceCount() const;
+
+    //! Move an instance
+    void SetInstanceTransform(int instance, const CGrTransform &t);
+
+    //! The transform that places an instance
+    const CGrTransform &GetInstanceTransform(int instance) const;
+
+    //! Set a bone local transform for one instance
+    /*! The first call for an instance gives it a pose of its own,
+        starting from the current bone local transforms of the model.
+        \param instance Instance index
+        \param bone Bone index, as for CGrModelX::GetBone(int)
+        \param t New local transform */
+    void SetBoneLocalTransform(int instance, int bone, const CGrTransform &t);
+
+    //! Get a bone local transform for one instance
+    const CGrTransform &GetBoneLocalTransform(int instance, int bone) const;
+
+    //! Does an instance have a pose of its own?
+    bool HasPose(int instance) const;
+
+    //! Return an instance to the pose set on the model bones
+    void ClearPose(int instance);
+
+    //! Compute the absolute bone transforms for an instance
+    /*! \param instance Instance index
+        \param absolute Receives CGrModelX::GetBoneCount() transforms */
+    void ComputeBonesAbsolute(int instance, CGrTransform *absolute) const;
+
+    //! Draw every instance with OpenGL
+    void Draw();
+
+    //! Draw every instance to a renderer
+    /*! The renderer receives the meshes of the model once for each
+        instance. A renderer that can share geometry between instances
+        should instead capture the model once and place it with
+        ComputeBonesAbsolute(). */
+    void Draw(CGrModelX::IRenderer *renderer);
+
+private:
+    // Not copyable
+    CGrModelXScene(const CGrModelXScene &);
+    CGrModelXScene &operator=(const CGrModelXScene &);
+
+    CGrModelXScenep *mScene;
+};
+
+#endif
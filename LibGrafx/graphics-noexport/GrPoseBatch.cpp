@@ -0,0 +1,416 @@
+//
+//  Name :         GrPoseBatch.cpp
+//  Description :  Implementation of the CGrPoseBatch class.
+//  Version :      See GrPoseBatch.h
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+
+#include <stdafx.h>
+#include "GrTransform.h"
+#include "GrModelX.h"
+#include "GrPoseBatch.h"
+#include "GrThreadPool.h"
+#include <vector>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE__)
+#include <xmmintrin.h>
+#define GRPOSEBATCH_SSE
+#endif
+
+using namespace std;
+
+#ifdef _DEBUG
+#undef THIS_FILE
+static char THIS_FILE[]=__FILE__;
+#define new DEBUG_NEW
+#endif
+
+//! \cond ignore
+
+// Instances in a group, one per SIMD lane
+const int Lanes = 4;
+
+// Floats in a bone transform for a group
+const int GroupTransform = 12 * Lanes;
+
+// Bone transforms evaluated by each thread pool task, roughly
+const int EvaluateGrain = 8192;
+
+//
+// Private implementation of the pose batch. The local and absolute
+// transforms are stored a group at a time, a bone at a time within
+// the group, then an element at a time, then a lane at a time.
+//
+
+class CGrPoseBatchp
+{
+public:
+    CGrPoseBatchp() : mNumBones(0), mNumInstances(0) {}
+
+    int mNumBones;
+    int mNumInstances;
+
+    // Hierarchy, one entry per bone
+    vector<int> mParents;
+    vector<float> mBones;           // Bone transforms, 12 floats each, roots include the model transform
+    vector<char> mIdentity;         // True where the bone transform is an identity
+    vector<float> mDefaults;        // Local transforms of new instances, 12 floats each
+
+    // Per group storage
+    vector<float> mRoots;           // Instance transforms
+    vector<float> mLocal;
+    vector<float> mAbsolute;
+
+    int GetGroups() const {return (mNumInstances + Lanes - 1) / Lanes;}
+
+    // Offset of element 0 of a bone of a group in mLocal or mAbsolute
+    size_t Offset(int instance, int bone) const
+    {
+        return (size_t(instance / Lanes) * mNumBones + bone) * GroupTransform + instance % Lanes;
+    }
+
+    // Offset of element 0 of an instance transform in mRoots
+    size_t RootOffset(int instance) const
+    {
+        return size_t(instance / Lanes) * GroupTransform + instance % Lanes;
+    }
+
+    void EvaluateGroup(int group) const;
+};
+
+inline void ToFloats(const CGrTransform &t, float *f)
+{
+    for(int e=0;  e<12;  e++)
+        f[e] = float(t.M(e / 4, e % 4));
+}
+
+inline void FromFloats(const float *f, CGrTransform &t)
+{
+    for(int e=0;  e<12;  e++)
+        t.M(e / 4, e % 4) = f[e];
+
+    t.M(3, 0) = 0;
+    t.M(3, 1) = 0;
+    t.M(3, 2) = 0;
+    t.M(3, 3) = 1;
+}
+
+// Scatter 12 floats into the lane of a group transform
+inline void Scatter(const float *f, float *group)
+{
+    for(int e=0;  e<12;  e++)
+        group[e * Lanes] = f[e];
+}
+
+// Gather 12 floats from the lane of a group transform
+inline void Gather(const float *group, float *f)
+{
+    for(int e=0;  e<12;  e++)
+        f[e] = group[e * Lanes];
+}
+
+//
+// Name :         MultiplyGroup()
+// Description :  absolute = parent * bone * local for the four lanes
+//                of a group. The bone transform is the same for every
+//                lane, so it is broadcast. A row at a time of parent *
+//                bone is formed and then multiplied by the local
+//                transform, which keeps everything in registers.
+//
+
+#ifdef GRPOSEBATCH_SSE
+
+static void MultiplyGroup(float *absolute, const float *parent, const float *bone, bool identity, const float *local)
+{
+    for(int r=0;  r<3;  r++, parent += 4 * Lanes, absolute += 4 * Lanes)
+    {
+        __m128 p0 = _mm_loadu_ps(parent);
+        __m128 p1 = _mm_loadu_ps(parent + Lanes);
+        __m128 p2 = _mm_loadu_ps(parent + 2 * Lanes);
+        __m128 p3 = _mm_loadu_ps(parent + 3 * Lanes);
+        if(!identity)
+        {
+            __m128 q0 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p0, _mm_set1_ps(bone[0])), _mm_mul_ps(p1, _mm_set1_ps(bone[4]))), 
+                _mm_mul_ps(p2, _mm_set1_ps(bone[8])));
+            __m128 q1 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p0, _mm_set1_ps(bone[1])), _mm_mul_ps(p1, _mm_set1_ps(bone[5]))), 
+                _mm_mul_ps(p2, _mm_set1_ps(bone[9])));
+            __m128 q2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p0, _mm_set1_ps(bone[2])), _mm_mul_ps(p1, _mm_set1_ps(bone[6]))), 
+                _mm_mul_ps(p2, _mm_set1_ps(bone[10])));
+            __m128 q3 = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(p0, _mm_set1_ps(bone[3])), _mm_mul_ps(p1, _mm_set1_ps(bone[7]))), 
+                _mm_mul_ps(p2, _mm_set1_ps(bone[11]))), p3);
+            p0 = q0;
+            p1 = q1;
+            p2 = q2;
+            p3 = q3;
+        }
+
+        for(int c=0;  c<4;  c++)
+        {
+            __m128 v = _mm_add_ps(_mm_add_ps(_mm_mul_ps(p0, _mm_loadu_ps(local + c * Lanes)), 
+                _mm_mul_ps(p1, _mm_loadu_ps(local + (4 + c) * Lanes))), _mm_mul_ps(p2, _mm_loadu_ps(local + (8 + c) * Lanes)));
+            if(c == 3)
+                v = _mm_add_ps(v, p3);
+
+            _mm_storeu_ps(absolute + c * Lanes, v);
+        }
+    }
+}
+
+#else
+
+static void MultiplyGroup(float *absolute, const float *parent, const float *bone, bool identity, const float *local)
+{
+    for(int r=0;  r<3;  r++, parent += 4 * Lanes, absolute += 4 * Lanes)
+    {
+        for(int lane=0;  lane<Lanes;  lane++)
+        {
+            float p[4];
+            for(int k=0;  k<4;  k++)
+                p[k] = parent[k * Lanes + lane];
+
+            if(!identity)
+            {
+                float q[4];
+                for(int c=0;  c<4;  c++)
+                    q[c] = p[0] * bone[c] + p[1] * bone[4 + c] + p[2] * bone[8 + c] + (c == 3 ? p[3] : 0.f);
+
+                for(int c=0;  c<4;  c++)
+                    p[c] = q[c];
+            }
+
+            for(int c=0;  c<4;  c++)
+            {
+                absolute[c * Lanes + lane] = p[0] * local[c * Lanes + lane] + p[1] * local[(4 + c) * Lanes + lane] + 
+                    p[2] * local[(8 + c) * Lanes + lane] + (c == 3 ? p[3] : 0.f);
+            }
+        }
+    }
+}
+
+#endif
+
+//
+// Name :         CGrPoseBatchp::EvaluateGroup()
+// Description :  Walk the hierarchy for one group. The parent of a
+//                bone was computed earlier in the same walk, so it is
+//                still in the cache.
+//
+
+void CGrPoseBatchp::EvaluateGroup(int group) const
+{
+    size_t base = size_t(group) * mNumBones * GroupTransform;
+    const float *local = &mLocal[base];
+    float *absolute = const_cast<float *>(&mAbsolute[base]);
+    const float *root = &mRoots[size_t(group) * GroupTransform];
+
+    for(int b=0;  b<mNumBones;  b++)
+    {
+        int parent = mParents[b];
+        MultiplyGroup(absolute + size_t(b) * GroupTransform,
+            parent < 0 ? root : absolute + size_t(parent) * GroupTransform,
+            &mBones[b * 12], mIdentity[b] != 0, local + size_t(b) * GroupTransform);
+    }
+}
+
+// Thread pool function object for Evaluate()
+struct EvaluateGroups
+{
+    const CGrPoseBatchp *mBatch;
+
+    void operator()(int group, int worker) const {mBatch->EvaluateGroup(group);}
+};
+
+//! \endcond
+
+
+CGrPoseBatch::CGrPoseBatch()
+{
+    mBatch = new CGrPoseBatchp();
+}
+
+
+CGrPoseBatch::~CGrPoseBatch()
+{
+    delete mBatch;
+}
+
+
+//
+// Name :         CGrPoseBatch::SetModel()
+// Description :  The roots take the model transform by evaluating the
+//                model with identity local transforms and keeping the
+//                root bones, which are then the model transform times
+//                the bone transform.
+//
+
+void CGrPoseBatch::SetModel(CGrModelX *model)
+{
+    Clear();
+
+    CGrPoseBatchp &p = *mBatch;
+    p.mNumBones = model != NULL ? model->GetBoneCount() : 0;
+    p.mParents.resize(p.mNumBones);
+    p.mBones.resize(p.mNumBones * 12);
+    p.mIdentity.resize(p.mNumBones);
+    p.mDefaults.resize(p.mNumBones * 12);
+    if(p.mNumBones == 0)
+        return;
+
+    CGrTransform identity;
+    identity.SetIdentity();
+    vector<CGrTransform> locals(p.mNumBones, identity);
+    vector<CGrTransform> roots(p.mNumBones);
+    model->ComputeBonesAbsolute(identity, &locals[0], &roots[0]);
+
+    for(int b=0;  b<p.mNumBones;  b++)
+    {
+        p.mParents[b] = model->GetBoneParent(b);
+        const CGrTransform &bone = p.mParents[b] < 0 ? roots[b] : model->GetBone(b)->GetTransform();
+        ToFloats(bone, &p.mBones[b * 12]);
+        ToFloats(model->GetBone(b)->GetLocalTransform(), &p.mDefaults[b * 12]);
+
+        p.mIdentity[b] = 1;
+        for(int e=0;  e<12;  e++)
+        {
+            if(p.mBones[b * 12 + e] != (e % 5 == 0 ? 1.f : 0.f))
+                p.mIdentity[b] = 0;
+        }
+    }
+}
+
+
+void CGrPoseBatch::Clear()
+{
+    SetInstanceCount(0);
+}
+
+
+//
+// Name :         CGrPoseBatch::SetInstanceCount()
+// Description :  The groups are stored one after another, so growing or
+//                shrinking keeps the existing instances where they are.
+//                Every lane past the old count is initialized, including
+//                the unused lanes of the last group, so the evaluation
+//                never sees garbage.
+//
+
+void CGrPoseBatch::SetInstanceCount(int count)
+{
+    CGrPoseBatchp &p = *mBatch;
+    int oldCount = p.mNumInstances;
+    p.mNumInstances = count > 0 ? count : 0;
+
+    int groups = p.GetGroups();
+    p.mRoots.resize(size_t(groups) * GroupTransform);
+    p.mLocal.resize(size_t(groups) * p.mNumBones * GroupTransform);
+    p.mAbsolute.resize(size_t(groups) * p.mNumBones * GroupTransform);
+
+    float identity[12] = {1, 0, 0, 0,  0, 1, 0, 0,  0, 0, 1, 0};
+    for(int i=oldCount;  i<groups * Lanes;  i++)
+    {
+        Scatter(identity, &p.mRoots[p.RootOffset(i)]);
+        for(int b=0;  b<p.mNumBones;  b++)
+        {
+            Scatter(&p.mDefaults[b * 12], &p.mLocal[p.Offset(i, b)]);
+            Scatter(identity, &p.mAbsolute[p.Offset(i, b)]);
+        }
+    }
+}
+
+
+int CGrPoseBatch::GetInstanceCount() const
+{
+    return mBatch->mNumInstances;
+}
+
+
+int CGrPoseBatch::GetBoneCount() const
+{
+    return mBatch->mNumBones;
+}
+
+
+void CGrPoseBatch::SetInstanceTransform(int instance, const CGrTransform &t)
+{
+    float f[12];
+    ToFloats(t, f);
+    Scatter(f, &mBatch->mRoots[mBatch->RootOffset(instance)]);
+}
+
+
+void CGrPoseBatch::SetLocalTransform(int instance, int bone, const CGrTransform &t)
+{
+    float f[12];
+    ToFloats(t, f);
+    Scatter(f, &mBatch->mLocal[mBatch->Offset(instance, bone)]);
+}
+
+
+void CGrPoseBatch::SetLocalTransform(int instance, int bone, const float *local)
+{
+    Scatter(local, &mBatch->mLocal[mBatch->Offset(instance, bone)]);
+}
+
+
+void CGrPoseBatch::SetLocalTransforms(int instance, int first, int count, const float *local)
+{
+    float *dest = &mBatch->mLocal[mBatch->Offset(instance, first)];
+    for(int b=0;  b<count;  b++, dest += GroupTransform, local += 12)
+        Scatter(local, dest);
+}
+
+
+void CGrPoseBatch::GetLocalTransform(int instance, int bone, CGrTransform &t) const
+{
+    float f[12];
+    Gather(&mBatch->mLocal[mBatch->Offset(instance, bone)], f);
+    FromFloats(f, t);
+}
+
+
+void CGrPoseBatch::Evaluate(CGrThreadPool *pool)
+{
+    const CGrPoseBatchp &p = *mBatch;
+    int groups = p.GetGroups();
+    if(p.mNumBones == 0 || groups == 0)
+        return;
+
+    EvaluateGroups evaluate;
+    evaluate.mBatch = mBatch;
+
+    int grain = EvaluateGrain / (p.mNumBones * Lanes);
+    if(pool != NULL && groups > grain)
+    {
+        pool->ParallelFor(groups, grain, evaluate);
+    }
+    else
+    {
+        for(int g=0;  g<groups;  g++)
+            evaluate(g, 0);
+    }
+}
+
+
+void CGrPoseBatch::GetAbsoluteTransform(int instance, int bone, CGrTransform &t) const
+{
+    float f[12];
+    Gather(&mBatch->mAbsolute[mBatch->Offset(instance, bone)], f);
+    FromFloats(f, t);
+}
+
+
+void CGrPoseBatch::GetAbsoluteTransform(int instance, int bone, float *absolute) const
+{
+    Gather(&mBatch->mAbsolute[mBatch->Offset(instance, bone)], absolute);
+}
+
+
+void CGrPoseBatch::GetAbsoluteTransforms(int instance, CGrTransform *absolute) const
+{
+    for(int b=0;  b<mBatch->mNumBones;  b++)
+        GetAbsoluteTransform(instance, b, absolute[b]);
+}
@@ -0,0 +1,127 @@
+//
+// Name :         GrPoseBatch.h
+// Description :  Header for CGrPoseBatch, bone poses for many
+//                instances of one model evaluated together.
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+#pragma once
+
+#if !defined(_GRPOSEBATCH_H)
+#define _GRPOSEBATCH_H
+
+#if !defined(LibGrafx)
+#define LibGrafx
+#endif
+
+class CGrModelX;
+class CGrPoseBatchp;
+class CGrThreadPool;
+class CGrTransform;
+
+//! Bone poses for many instances of one model, evaluated together.
+
+/*! CGrModelX::ComputeBonesAbsolute() evaluates one pose at a time in
+double precision 4 by 4 matrices. When hundreds of instances are
+animated every frame, that is a lot of work and none of it vectorizes.
+A pose batch keeps the local and absolute transforms of every bone of
+every instance itself and evaluates them all in one pass.
+
+Transforms are stored as the top 3 rows of the matrix in float, since
+the bottom row of a bone transform is always 0 0 0 1. Where the batch
+takes or returns that form directly, it is 12 floats in row major
+order. The instances are in groups of four, and the same element of a
+bone transform is stored together for the four instances of a group,
+so the hierarchy is walked once for the whole group with each SIMD
+operation working on all four. Each group is a contiguous piece of
+memory, and Evaluate() splits the groups over a thread pool.
+
+The hierarchy comes from a CGrModelX, which must have its bones in
+topological order the way ComputeBonesAbsolute() expects. The model
+transform is folded into the root bones, so the absolute transforms
+match those of CGrModelX::ComputeBonesAbsolute(const CGrTransform &,
+const CGrTransform *, CGrTransform *) with the instance transform as t.
+
+\version 1.00 Initial version
+*/
+
+class LibGrafx CGrPoseBatch
+{
+public:
+    CGrPoseBatch();
+    virtual ~CGrPoseBatch();
+
+    //! Set the model the instances are poses of
+    /*! This removes any existing instances. The bone transforms, the
+        model transform, and the current local transforms of the bones
+        are copied, so changes to the model afterwards do not affect the
+        batch until SetModel() is called again.
+        \param model The model or NULL for none */
+    void SetModel(CGrModelX *model);
+
+    //! Remove all of the instances
+    void Clear();
+
+    //! Set the number of instances
+    /*! Instances are kept or removed from the end. New instances start
+        with an identity instance transform and the local transforms
+        the model had when SetModel() was called.
+        \param count Number of instances */
+    void SetInstanceCount(int count);
+
+    int GetInstanceCount() const;
+    int GetBoneCount() const;
+
+    //! Set the transform that places an instance
+    void SetInstanceTransform(int instance, const CGrTransform &t);
+
+    //! Set a bone local transform for an instance
+    void SetLocalTransform(int instance, int bone, const CGrTransform &t);
+
+    //! Set a bone local transform for an instance
+    /*! \param instance Instance index
+        \param bone Bone index
+        \param local 12 floats, the top three rows of the transform */
+    void SetLocalTransform(int instance, int bone, const float *local);
+
+    //! Set the local transforms of a run of bones for an instance
+    /*! \param instance Instance index
+        \param first First bone index
+        \param count Number of bones
+        \param local 12 floats for each bone */
+    void SetLocalTransforms(int instance, int first, int count, const float *local);
+
+    //! Get a bone local transform for an instance
+    void GetLocalTransform(int instance, int bone, CGrTransform &t) const;
+
+    //! Evaluate the absolute transforms of every instance
+    /*! \param pool Threads to split the instances over, or NULL for this thread only */
+    void Evaluate(CGrThreadPool *pool=NULL);
+
+    //! Get a bone absolute transform as of the last Evaluate()
+    void GetAbsoluteTransform(int instance, int bone, CGrTransform &t) const;
+
+    //! Get a bone absolute transform as of the last Evaluate()
+    /*! \param instance Instance index
+        \param bone Bone index
+        \param absolute Returned 12 floats */
+    void GetAbsoluteTransform(int instance, int bone, float *absolute) const;
+
+    //! Get the absolute transforms of every bone of an instance
+    /*! This is the form CGrModelX::DrawPose() takes.
+        \param instance Instance index
+        \param absolute Receives GetBoneCount() transforms */
+    void GetAbsoluteTransforms(int instance, CGrTransform *absolute) const;
+
+private:
+    // Not copyable
+    CGrPoseBatch(const CGrPoseBatch &);
+    CGrPoseBatch &operator=(const CGrPoseBatch &);
+
+    CGrPoseBatchp *mBatch;
+};
+
+#endif
@@ -0,0 +1,133 @@
+//
+//  Name :         GrQuaternion.cpp
+//  Description :  Implementation of the CGrQuaternion class.
+//  Version :      See GrQuaternion.h
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+
+#include <stdafx.h>
+#include "GrQuaternion.h"
+#include <cmath>
+
+#ifdef _DEBUG
+#undef THIS_FILE
+static char THIS_FILE[]=__FILE__;
+#define new DEBUG_NEW
+#endif
+
+//! \cond ignore
+
+// Above this cosine of the angle between the rotations, Slerp() blends
+// linearly, since the sine it divides by is too small to be accurate
+const double SlerpLinear = 0.9995;
+
+//! \endcond
+
+//
+// Name :         CGrQuaternion::SetFromTransform()
+// Description :  Rotation matrix to a unit quaternion, from whichever
+//                of the diagonal sums is largest so the division is safe.
+//
+
+CGrQuaternion &CGrQuaternion::SetFromTransform(const CGrTransform &t)
+{
+    double q[4];
+    double trace = t[0][0] + t[1][1] + t[2][2];
+    if(trace > 0)
+    {
+        double s = 0.5 / sqrt(trace + 1.);
+        q[0] = 0.25 / s;
+        q[1] = (t[2][1] - t[1][2]) * s;
+        q[2] = (t[0][2] - t[2][0]) * s;
+        q[3] = (t[1][0] - t[0][1]) * s;
+    }
+    else if(t[0][0] > t[1][1] && t[0][0] > t[2][2])
+    {
+        double s = 2. * sqrt(1. + t[0][0] - t[1][1] - t[2][2]);
+        q[0] = (t[2][1] - t[1][2]) / s;
+        q[1] = 0.25 * s;
+        q[2] = (t[0][1] + t[1][0]) / s;
+        q[3] = (t[0][2] + t[2][0]) / s;
+    }
+    else if(t[1][1] > t[2][2])
+    {
+        double s = 2. * sqrt(1. + t[1][1] - t[0][0] - t[2][2]);
+        q[0] = (t[0][2] - t[2][0]) / s;
+        q[1] = (t[0][1] + t[1][0]) / s;
+        q[2] = 0.25 * s;
+        q[3] = (t[1][2] + t[2][1]) / s;
+    }
+    else
+    {
+        double s = 2. * sqrt(1. + t[2][2] - t[0][0] - t[1][1]);
+        q[0] = (t[1][0] - t[0][1]) / s;
+        q[1] = (t[0][2] + t[2][0]) / s;
+        q[2] = (t[1][2] + t[2][1]) / s;
+        q[3] = 0.25 * s;
+    }
+
+    double len = sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    return Set(q[0] / len, q[1] / len, q[2] / len, q[3] / len);
+}
+
+void CGrQuaternion::GetTransform(float *t) const
+{
+    float w = m[0];
+    float x = m[1];
+    float y = m[2];
+    float z = m[3];
+
+    t[0] = 1 - 2 * (y * y + z * z);
+    t[1] = 2 * (x * y - w * z);
+    t[2] = 2 * (x * z + w * y);
+    t[3] = 0;
+    t[4] = 2 * (x * y + w * z);
+    t[5] = 1 - 2 * (x * x + z * z);
+    t[6] = 2 * (y * z - w * x);
+    t[7] = 0;
+    t[8] = 2 * (x * z - w * y);
+    t[9] = 2 * (y * z + w * x);
+    t[10] = 1 - 2 * (x * x + y * y);
+    t[11] = 0;
+}
+
+//
+// Name :         CGrQuaternion::Slerp()
+// Description :  The weights are sin((1-t)angle) / sin(angle) and
+//                sin(t angle) / sin(angle). The trigonometry is scalar,
+//                the blend of the components is SIMD.
+//
+
+CGrQuaternion CGrQuaternion::Slerp(const CGrQuaternion &a, const CGrQuaternion &b, double t)
+{
+    double dot = Dot(a, b);
+    double sign = 1;
+    if(dot < 0)
+    {
+        dot = -dot;
+        sign = -1;
+    }
+
+    if(dot > SlerpLinear)
+        return Nlerp(a, b, t);
+
+    double angle = acos(dot);
+    double s = 1. / sin(angle);
+    float wa = float(sin((1 - t) * angle) * s);
+    float wb = float(sin(t * angle) * s * sign);
+
+    CGrQuaternion r;
+#ifdef GRQUATERNION_SSE
+    __m128 q = _mm_mul_ps(_mm_loadu_ps(a), _mm_set1_ps(wa));
+    q = _mm_add_ps(q, _mm_mul_ps(_mm_loadu_ps(b), _mm_set1_ps(wb)));
+    _mm_storeu_ps(r, q);
+#else
+    for(int i=0;  i<4;  i++)
+        r[i] = a[i] * wa + b[i] * wb;
+#endif
+    return r;
+}
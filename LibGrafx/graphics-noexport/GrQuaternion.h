@@ -0,0 +1,342 @@
+//
+// Name :         GrQuaternion.h
+// Description :  Header for CGrQuaternion, a rotation as a unit
+//                quaternion.
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+#pragma once
+
+#if !defined(_GRQUATERNION_H)
+#define _GRQUATERNION_H
+
+#if !defined(LibGrafx)
+#define LibGrafx
+#endif
+
+#include "GrVector.h"
+#include "GrTransform.h"
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE__)
+#include <xmmintrin.h>
+#define GRQUATERNION_SSE
+#endif
+
+//! A rotation as a unit quaternion.
+
+/*! Interpolating rotations as CGrTransform matrices means going through
+SetEulerXYZ() and GetEulerXYZ() or building a matrix with
+SetFromQuaternion() from values kept somewhere else. A CGrQuaternion
+keeps the rotation itself, composes and interpolates it directly, and
+converts to and from CGrTransform when a matrix is needed.
+
+The components are in the order w, x, y, z, the same order as
+CGrTransform::SetFromQuaternion() takes. They are float, so the four
+of them are one SIMD register, and products, rotations of vectors, and
+interpolation use SSE where it is available.
+
+Angles are radians, as for CGrTransform::SetRotate().
+
+See also CGrRigidTransform, a rotation and a translation.
+
+\version 1.00 Initial version
+*/
+
+class LibGrafx CGrQuaternion
+{
+public:
+    //! Default constructor. Initializes to the identity rotation.
+    CGrQuaternion() {m[0] = 1;  m[1] = m[2] = m[3] = 0;}
+
+    //! Constructor from the components
+    /*! \param w Real part
+        \param x i element
+        \param y j element
+        \param z k element */
+    CGrQuaternion(double w, double x, double y, double z) {Set(w, x, y, z);}
+
+    //! Constructor from an array of four floats in the order w, x, y, z
+    explicit CGrQuaternion(const float *q) {m[0] = q[0];  m[1] = q[1];  m[2] = q[2];  m[3] = q[3];}
+
+    //! Constructor from the rotation of a transform
+    /*! \param t Transform, see SetFromTransform() */
+    explicit CGrQuaternion(const CGrTransform &t) {SetFromTransform(t);}
+
+    //! Set to the identity rotation
+    CGrQuaternion &SetIdentity() {m[0] = 1;  m[1] = m[2] = m[3] = 0;  return *this;}
+
+    //! Set the components
+    CGrQuaternion &Set(double w, double x, double y, double z) {m[0] = float(w);  m[1] = float(x);  m[2] = float(y);  m[3] = float(z);  return *this;}
+
+    //! Set to a rotation around an arbitrary vector.
+    /*! \param r Rotation angle (radians).
+        \param v Vector to rotate around. Must be normalized! */
+    CGrQuaternion &SetRotate(double r, const CGrVector &v)
+    {
+        double s = sin(r * 0.5);
+        return Set(cos(r * 0.5), v.X() * s, v.Y() * s, v.Z() * s);
+    }
+
+    //! Set from the rotation of a transform
+    /*! The upper left 3 by 3 of the transform must be a rotation. Scale
+        has to be removed first.
+        \param t Transform to take the rotation from */
+    CGrQuaternion &SetFromTransform(const CGrTransform &t);
+
+    //! Get the rotation as a transform
+    /*! \param t Set to the rotation matrix */
+    void GetTransform(CGrTransform &t) const {t.SetFromQuaternion(m[0], m[1], m[2], m[3]);}
+
+    //! Get the rotation as the top three rows of a transform
+    /*! \param t 12 floats in row major order. The translation column is 0. */
+    void GetTransform(float *t) const;
+
+    //! Access the value of W, the real part
+    float &W() {return m[0];}
+
+    //! Access the value of X
+    float &X() {return m[1];}
+
+    //! Access the value of Y
+    float &Y() {return m[2];}
+
+    //! Access the value of Z
+    float &Z() {return m[3];}
+
+    //! Access the value of W, the real part
+    const float &W() const {return m[0];}
+
+    //! Access the value of X
+    const float &X() const {return m[1];}
+
+    //! Access the value of Y
+    const float &Y() const {return m[2];}
+
+    //! Access the value of Z
+    const float &Z() const {return m[3];}
+
+    //! The components as an array of four floats in the order w, x, y, z
+    operator const float *() const {return m;}
+
+    //! The components as an array of four floats in the order w, x, y, z
+    operator float *() {return m;}
+
+    //! Length of the quaternion, 1 for a rotation
+    double Length() const {return sqrt(LengthSquared());}
+
+    //! Squared length of the quaternion
+    double LengthSquared() const {return double(m[0]) * m[0] + double(m[1]) * m[1] + double(m[2]) * m[2] + double(m[3]) * m[3];}
+
+    //! Scale to length 1
+    CGrQuaternion &Normalize() {float l = float(1. / Length());  m[0] *= l;  m[1] *= l;  m[2] *= l;  m[3] *= l;  return *this;}
+
+    //! Negate the vector part, which inverts a unit quaternion
+    CGrQuaternion &Conjugate() {m[1] = -m[1];  m[2] = -m[2];  m[3] = -m[3];  return *this;}
+
+    //! Invert the quaternion
+    /*! For a rotation this is the same as Conjugate(). */
+    CGrQuaternion &Invert() {Conjugate();  float l = float(1. / LengthSquared());  m[0] *= l;  m[1] *= l;  m[2] *= l;  m[3] *= l;  return *this;}
+
+    //! Get the inverse of a quaternion
+    static CGrQuaternion GetInverse(const CGrQuaternion &q) {CGrQuaternion r(q);  r.Invert();  return r;}
+
+    //! *= operator. Results in this = this * b, the rotation b then this one
+    CGrQuaternion &operator*=(const CGrQuaternion &b);
+
+    //! Rotate a vector
+    /*! W is unchanged.
+        \param v Vector to rotate
+        \return The rotated vector */
+    CGrVector Rotate(const CGrVector &v) const;
+
+    //! Rotate a vector of three floats
+    /*! \param v Vector to rotate
+        \param r Receives the rotated vector, may be v */
+    void Rotate(const float *v, float *r) const;
+
+    //! Spherical linear interpolation
+    /*! Interpolates at a constant angular rate along the shorter way
+        between the rotations.
+        \param a Rotation at t=0
+        \param b Rotation at t=1
+        \param t Interpolation parameter
+        \return The interpolated rotation */
+    static CGrQuaternion Slerp(const CGrQuaternion &a, const CGrQuaternion &b, double t);
+
+    //! Normalized linear interpolation
+    /*! Interpolates along the shorter way between the rotations, but not
+        at a constant rate. It is much cheaper than Slerp() and close to
+        it when the rotations are near each other, as between keyframes.
+        \param a Rotation at t=0
+        \param b Rotation at t=1
+        \param t Interpolation parameter
+        \return The interpolated rotation */
+    static CGrQuaternion Nlerp(const CGrQuaternion &a, const CGrQuaternion &b, double t);
+
+private:
+    float m[4];     // w, x, y, z
+};
+
+//! \cond ignore
+
+//
+// The quaternion arithmetic, shared with CGrRigidTransform and
+// CGrDualQuaternion. The SSE forms take and return the four
+// components w, x, y, z in one register.
+//
+
+#ifdef GRQUATERNION_SSE
+
+// Product a * b
+inline __m128 GrQuaternionMultiply(__m128 a, __m128 b)
+{
+    __m128 r = _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(0, 0, 0, 0)), b);
+
+    // x * (-bx, bw, -bz, by)
+    __m128 t = _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 3, 0, 1));
+    t = _mm_xor_ps(t, _mm_set_ps(0.f, -0.f, 0.f, -0.f));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 1, 1, 1)), t));
+
+    // y * (-by, bz, bw, -bx)
+    t = _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 0, 3, 2));
+    t = _mm_xor_ps(t, _mm_set_ps(-0.f, 0.f, 0.f, -0.f));
+    r = _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 2, 2, 2)), t));
+
+    // z * (-bz, -by, bx, bw)
+    t = _mm_shuffle_ps(b, b, _MM_SHUFFLE(0, 1, 2, 3));
+    t = _mm_xor_ps(t, _mm_set_ps(0.f, 0.f, -0.f, -0.f));
+    return _mm_add_ps(r, _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 3, 3, 3)), t));
+}
+
+// Dot product in every lane
+inline __m128 GrQuaternionDot(__m128 a, __m128 b)
+{
+    __m128 d = _mm_mul_ps(a, b);
+    d = _mm_add_ps(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_add_ps(d, _mm_shuffle_ps(d, d, _MM_SHUFFLE(1, 0, 3, 2)));
+}
+
+// Cross product of the vector parts, 0 in the w lane
+inline __m128 GrQuaternionCross(__m128 a, __m128 b)
+{
+    __m128 r = _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 3, 2, 0)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 1, 3, 0)));
+    return _mm_sub_ps(r, _mm_mul_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 1, 3, 0)), _mm_shuffle_ps(b, b, _MM_SHUFFLE(1, 3, 2, 0))));
+}
+
+// Rotate the vector part of v by the unit quaternion q. The w lane of
+// v is passed through. This is v + 2w(q x v) + 2q x (q x v), which is
+// cheaper than q v q*.
+inline __m128 GrQuaternionRotate(__m128 q, __m128 v)
+{
+    __m128 t = GrQuaternionCross(q, v);
+    t = _mm_add_ps(t, t);
+    __m128 r = _mm_add_ps(v, _mm_mul_ps(_mm_shuffle_ps(q, q, _MM_SHUFFLE(0, 0, 0, 0)), t));
+    return _mm_add_ps(r, GrQuaternionCross(q, t));
+}
+
+#else
+
+inline void GrQuaternionMultiply(const float *a, const float *b, float *r)
+{
+    float w = a[0] * b[0] - a[1] * b[1] - a[2] * b[2] - a[3] * b[3];
+    float x = a[0] * b[1] + a[1] * b[0] + a[2] * b[3] - a[3] * b[2];
+    float y = a[0] * b[2] - a[1] * b[3] + a[2] * b[0] + a[3] * b[1];
+    float z = a[0] * b[3] + a[1] * b[2] - a[2] * b[1] + a[3] * b[0];
+    r[0] = w;  r[1] = x;  r[2] = y;  r[3] = z;
+}
+
+// Rotate the three floats v by the unit quaternion q
+inline void GrQuaternionRotate(const float *q, const float *v, float *r)
+{
+    float tx = 2 * (q[2] * v[2] - q[3] * v[1]);
+    float ty = 2 * (q[3] * v[0] - q[1] * v[2]);
+    float tz = 2 * (q[1] * v[1] - q[2] * v[0]);
+    float x = v[0] + q[0] * tx + q[2] * tz - q[3] * ty;
+    float y = v[1] + q[0] * ty + q[3] * tx - q[1] * tz;
+    float z = v[2] + q[0] * tz + q[1] * ty - q[2] * tx;
+    r[0] = x;  r[1] = y;  r[2] = z;
+}
+
+#endif
+
+//! \endcond
+
+//! Product of two quaternions.
+/*! The result is the rotation b followed by the rotation a.
+    \ingroup VecTranGlobals
+    \param a First quaternion
+    \param b Second quaternion */
+inline CGrQuaternion operator *(const CGrQuaternion &a, const CGrQuaternion &b)
+{
+    CGrQuaternion r;
+#ifdef GRQUATERNION_SSE
+    _mm_storeu_ps(r, GrQuaternionMultiply(_mm_loadu_ps(a), _mm_loadu_ps(b)));
+#else
+    GrQuaternionMultiply(a, b, r);
+#endif
+    return r;
+}
+
+inline CGrQuaternion &CGrQuaternion::operator*=(const CGrQuaternion &b)
+{
+    *this = *this * b;
+    return *this;
+}
+
+inline void CGrQuaternion::Rotate(const float *v, float *r) const
+{
+#ifdef GRQUATERNION_SSE
+    __m128 p = _mm_set_ps(v[2], v[1], v[0], 0.f);
+    __m128 s = GrQuaternionRotate(_mm_loadu_ps(m), p);
+    float t[4];
+    _mm_storeu_ps(t, s);
+    r[0] = t[1];  r[1] = t[2];  r[2] = t[3];
+#else
+    GrQuaternionRotate(m, v, r);
+#endif
+}
+
+inline CGrVector CGrQuaternion::Rotate(const CGrVector &v) const
+{
+    float p[3] = {float(v.X()), float(v.Y()), float(v.Z())};
+    Rotate(p, p);
+    return CGrVector(p[0], p[1], p[2], v.W());
+}
+
+inline CGrQuaternion CGrQuaternion::Nlerp(const CGrQuaternion &a, const CGrQuaternion &b, double t)
+{
+    CGrQuaternion r;
+#ifdef GRQUATERNION_SSE
+    __m128 qa = _mm_loadu_ps(a);
+    __m128 qb = _mm_loadu_ps(b);
+
+    // Negate b if it is on the other side, so it is the shorter way
+    __m128 negative = _mm_cmplt_ps(GrQuaternionDot(qa, qb), _mm_setzero_ps());
+    qb = _mm_xor_ps(qb, _mm_and_ps(negative, _mm_set1_ps(-0.f)));
+
+    __m128 s = _mm_set1_ps(float(t));
+    __m128 q = _mm_add_ps(qa, _mm_mul_ps(_mm_sub_ps(qb, qa), s));
+    _mm_storeu_ps(r, _mm_div_ps(q, _mm_sqrt_ps(GrQuaternionDot(q, q))));
+#else
+    float dot = a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+    float tb = float(dot < 0 ? -t : t);
+    float ta = float(1 - t);
+    for(int i=0;  i<4;  i++)
+        r[i] = a[i] * ta + b[i] * tb;
+
+    r.Normalize();
+#endif
+    return r;
+}
+
+//! Dot product of two quaternions.
+/*! \ingroup VecTranGlobals */
+inline double Dot(const CGrQuaternion &a, const CGrQuaternion &b)
+{
+    return double(a[0]) * b[0] + double(a[1]) * b[1] + double(a[2]) * b[2] + double(a[3]) * b[3];
+}
+
+#endif
@@ -0,0 +1,177 @@
+//
+//  Name :         GrRigidTransform.cpp
+//  Description :  Implementation of the CGrRigidTransform and
+//                 CGrDualQuaternion classes.
+//  Version :      See GrRigidTransform.h
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+
+#include <stdafx.h>
+#include "GrRigidTransform.h"
+#include <cmath>
+
+#ifdef _DEBUG
+#undef THIS_FILE
+static char THIS_FILE[]=__FILE__;
+#define new DEBUG_NEW
+#endif
+
+CGrRigidTransform &CGrRigidTransform::SetFromTransform(const CGrTransform &t)
+{
+    mRotation.SetFromTransform(t);
+    mTranslation[0] = 0;
+    return SetTranslation(t[0][3], t[1][3], t[2][3]);
+}
+
+void CGrRigidTransform::GetTransform(CGrTransform &t) const
+{
+    mRotation.GetTransform(t);
+    t[0][3] = mTranslation[1];
+    t[1][3] = mTranslation[2];
+    t[2][3] = mTranslation[3];
+}
+
+void CGrRigidTransform::GetTransform(float *t) const
+{
+    mRotation.GetTransform(t);
+    t[3] = mTranslation[1];
+    t[7] = mTranslation[2];
+    t[11] = mTranslation[3];
+}
+
+//
+// Name :         CGrRigidTransform::Invert()
+// Description :  The inverse rotation is the conjugate, and the
+//                translation is the negated translation rotated by it.
+//
+
+CGrRigidTransform &CGrRigidTransform::Invert()
+{
+    mRotation.Conjugate();
+#ifdef GRQUATERNION_SSE
+    __m128 t = GrQuaternionRotate(_mm_loadu_ps(mRotation), _mm_loadu_ps(mTranslation));
+    _mm_storeu_ps(mTranslation, _mm_xor_ps(t, _mm_set1_ps(-0.f)));
+#else
+    GrQuaternionRotate(mRotation, mTranslation + 1, mTranslation + 1);
+    for(int i=1;  i<4;  i++)
+        mTranslation[i] = -mTranslation[i];
+#endif
+    mTranslation[0] = 0;
+    return *this;
+}
+
+CGrRigidTransform CGrRigidTransform::Slerp(const CGrRigidTransform &a, const CGrRigidTransform &b, double t)
+{
+    return Interpolate(a, b, t, CGrQuaternion::Slerp(a.mRotation, b.mRotation, t));
+}
+
+CGrRigidTransform CGrRigidTransform::Nlerp(const CGrRigidTransform &a, const CGrRigidTransform &b, double t)
+{
+    return Interpolate(a, b, t, CGrQuaternion::Nlerp(a.mRotation, b.mRotation, t));
+}
+
+//
+// Name :         CGrRigidTransform::Interpolate()
+// Description :  Lerp the translations, with the rotation already
+//                interpolated.
+//
+
+CGrRigidTransform CGrRigidTransform::Interpolate(const CGrRigidTransform &a, const CGrRigidTransform &b, double t, const CGrQuaternion &rotation)
+{
+    CGrRigidTransform r;
+    r.mRotation = rotation;
+#ifdef GRQUATERNION_SSE
+    __m128 ta = _mm_loadu_ps(a.mTranslation);
+    __m128 tb = _mm_loadu_ps(b.mTranslation);
+    _mm_storeu_ps(r.mTranslation, _mm_add_ps(ta, _mm_mul_ps(_mm_sub_ps(tb, ta), _mm_set1_ps(float(t)))));
+#else
+    for(int i=1;  i<4;  i++)
+        r.mTranslation[i] = float(a.mTranslation[i] + (b.mTranslation[i] - a.mTranslation[i]) * t);
+#endif
+    return r;
+}
+
+//
+// Name :         CGrDualQuaternion::SetFromRigidTransform()
+// Description :  The real part is the rotation q and the dual part is
+//                t q / 2, where t is the translation as a quaternion.
+//
+
+CGrDualQuaternion &CGrDualQuaternion::SetFromRigidTransform(const CGrRigidTransform &t)
+{
+    mReal = t.mRotation;
+#ifdef GRQUATERNION_SSE
+    __m128 d = GrQuaternionMultiply(_mm_loadu_ps(t.mTranslation), _mm_loadu_ps(mReal));
+    _mm_storeu_ps(mDual, _mm_mul_ps(d, _mm_set1_ps(0.5f)));
+#else
+    mDual = CGrQuaternion(t.mTranslation) * mReal;
+    for(int i=0;  i<4;  i++)
+        mDual[i] *= 0.5f;
+#endif
+    return *this;
+}
+
+//
+// Name :         CGrDualQuaternion::GetRigidTransform()
+// Description :  The translation is 2 d q*, where d is the dual part
+//                and q the real part.
+//
+
+void CGrDualQuaternion::GetRigidTransform(CGrRigidTransform &t) const
+{
+    t.mRotation = mReal;
+#ifdef GRQUATERNION_SSE
+    __m128 c = _mm_xor_ps(_mm_loadu_ps(mReal), _mm_set_ps(-0.f, -0.f, -0.f, 0.f));
+    __m128 d = GrQuaternionMultiply(_mm_loadu_ps(mDual), c);
+    _mm_storeu_ps(t.mTranslation, _mm_add_ps(d, d));
+#else
+    CGrQuaternion d = mDual * CGrQuaternion(mReal).Conjugate();
+    for(int i=1;  i<4;  i++)
+        t.mTranslation[i] = 2 * d[i];
+#endif
+    t.mTranslation[0] = 0;
+}
+
+CGrDualQuaternion &CGrDualQuaternion::Accumulate(const CGrDualQuaternion &b, double weight)
+{
+    float w = float(Dot(mReal, b.mReal) < 0 ? -weight : weight);
+#ifdef GRQUATERNION_SSE
+    __m128 s = _mm_set1_ps(w);
+    _mm_storeu_ps(mReal, _mm_add_ps(_mm_loadu_ps(mReal), _mm_mul_ps(_mm_loadu_ps(b.mReal), s)));
+    _mm_storeu_ps(mDual, _mm_add_ps(_mm_loadu_ps(mDual), _mm_mul_ps(_mm_loadu_ps(b.mDual), s)));
+#else
+    for(int i=0;  i<4;  i++)
+    {
+        mReal[i] += b.mReal[i] * w;
+        mDual[i] += b.mDual[i] * w;
+    }
+#endif
+    return *this;
+}
+
+//
+// Name :         CGrDualQuaternion::Normalize()
+// Description :  Divide by the length of the real part, then remove
+//                any part of the dual along the real part, so the dual
+//                quaternion is a rigid transform again.
+//
+
+CGrDualQuaternion &CGrDualQuaternion::Normalize()
+{
+    float l = float(1. / mReal.Length());
+    for(int i=0;  i<4;  i++)
+    {
+        mReal[i] *= l;
+        mDual[i] *= l;
+    }
+
+    float d = float(Dot(mReal, mDual));
+    for(int i=0;  i<4;  i++)
+        mDual[i] -= mReal[i] * d;
+
+    return *this;
+}
@@ -0,0 +1,253 @@
+//
+// Name :         GrRigidTransform.h
+// Description :  Header for CGrRigidTransform, a rotation and a
+//                translation, and CGrDualQuaternion, the same as a
+//                dual quaternion for blending.
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+#pragma once
+
+#if !defined(_GRRIGIDTRANSFORM_H)
+#define _GRRIGIDTRANSFORM_H
+
+#if !defined(LibGrafx)
+#define LibGrafx
+#endif
+
+#include "GrQuaternion.h"
+
+//! A rotation followed by a translation.
+
+/*! Bone transforms without scale and camera placements are rigid: a
+rotation and then a translation. As a CGrTransform, composing two of
+them is a 4 by 4 matrix multiply in double. As a CGrRigidTransform
+it is a quaternion product and the rotation of one vector, a small
+fraction of the work, and interpolating one is a slerp of the rotation
+and a lerp of the translation instead of a trip through Euler angles.
+
+The rotation is a CGrQuaternion. The translation is kept as the pure
+quaternion 0, x, y, z, so the SIMD forms of the arithmetic work on it
+directly.
+
+\version 1.00 Initial version
+*/
+
+class LibGrafx CGrRigidTransform
+{
+public:
+    //! Default constructor. Initializes to the identity.
+    CGrRigidTransform() {mTranslation[0] = mTranslation[1] = mTranslation[2] = mTranslation[3] = 0;}
+
+    //! Constructor from a rotation and a translation
+    /*! \param rotation Unit quaternion
+        \param translation X, Y, Z translation */
+    CGrRigidTransform(const CGrQuaternion &rotation, const CGrVector &translation) : mRotation(rotation) {mTranslation[0] = 0;  SetTranslation(translation);}
+
+    //! Constructor from a transform, see SetFromTransform()
+    explicit CGrRigidTransform(const CGrTransform &t) {SetFromTransform(t);}
+
+    //! Set to the identity
+    CGrRigidTransform &SetIdentity() {mRotation.SetIdentity();  mTranslation[1] = mTranslation[2] = mTranslation[3] = 0;  return *this;}
+
+    //! Set the rotation part
+    CGrRigidTransform &SetRotation(const CGrQuaternion &q) {mRotation = q;  return *this;}
+
+    //! Set the translation part
+    CGrRigidTransform &SetTranslation(double x, double y, double z) {mTranslation[1] = float(x);  mTranslation[2] = float(y);  mTranslation[3] = float(z);  return *this;}
+
+    //! Set the translation part
+    /*! \param p The X, Y, Z translation */
+    CGrRigidTransform &SetTranslation(const CGrVector &p) {return SetTranslation(p.X(), p.Y(), p.Z());}
+
+    //! Get the rotation part
+    const CGrQuaternion &GetRotation() const {return mRotation;}
+
+    //! Get the translation part
+    CGrVector GetTranslation() const {return CGrVector(mTranslation[1], mTranslation[2], mTranslation[3], 1);}
+
+    //! Set from a transform
+    /*! The upper left 3 by 3 of the transform must be a rotation. Scale
+        has to be removed first.
+        \param t Transform to set from */
+    CGrRigidTransform &SetFromTransform(const CGrTransform &t);
+
+    //! Get as a transform
+    void GetTransform(CGrTransform &t) const;
+
+    //! Get as the top three rows of a transform
+    /*! This is the form CGrPoseBatch takes.
+        \param t 12 floats in row major order */
+    void GetTransform(float *t) const;
+
+    //! Invert the transform
+    CGrRigidTransform &Invert();
+
+    //! Get the inverse of a transform
+    static CGrRigidTransform GetInverse(const CGrRigidTransform &t) {CGrRigidTransform r(t);  r.Invert();  return r;}
+
+    //! *= operator. Results in this = this * b, the transform b then this one
+    CGrRigidTransform &operator*=(const CGrRigidTransform &b);
+
+    //! Interpolate with a slerp of the rotations and a lerp of the translations
+    /*! \param a Transform at t=0
+        \param b Transform at t=1
+        \param t Interpolation parameter
+        \return The interpolated transform */
+    static CGrRigidTransform Slerp(const CGrRigidTransform &a, const CGrRigidTransform &b, double t);
+
+    //! Interpolate with a nlerp of the rotations and a lerp of the translations
+    /*! See CGrQuaternion::Nlerp() */
+    static CGrRigidTransform Nlerp(const CGrRigidTransform &a, const CGrRigidTransform &b, double t);
+
+private:
+    friend CGrRigidTransform operator *(const CGrRigidTransform &a, const CGrRigidTransform &b);
+    friend CGrVector operator *(const CGrRigidTransform &a, const CGrVector &p);
+    friend class CGrDualQuaternion;
+
+    static CGrRigidTransform Interpolate(const CGrRigidTransform &a, const CGrRigidTransform &b, double t, const CGrQuaternion &rotation);
+
+    CGrQuaternion mRotation;
+    float mTranslation[4];      // 0, x, y, z
+};
+
+//! Composition of rigid transforms.
+/*! The result is the transform b followed by the transform a, the same
+    as the CGrTransform product a * b.
+    \ingroup VecTranGlobals
+    \param a First transform
+    \param b Second transform */
+inline CGrRigidTransform operator *(const CGrRigidTransform &a, const CGrRigidTransform &b)
+{
+    CGrRigidTransform r;
+#ifdef GRQUATERNION_SSE
+    __m128 q = _mm_loadu_ps(a.mRotation);
+    _mm_storeu_ps(r.mRotation, GrQuaternionMultiply(q, _mm_loadu_ps(b.mRotation)));
+    __m128 t = GrQuaternionRotate(q, _mm_loadu_ps(b.mTranslation));
+    _mm_storeu_ps(r.mTranslation, _mm_add_ps(t, _mm_loadu_ps(a.mTranslation)));
+#else
+    GrQuaternionMultiply(a.mRotation, b.mRotation, r.mRotation);
+    GrQuaternionRotate(a.mRotation, b.mTranslation + 1, r.mTranslation + 1);
+    for(int i=1;  i<4;  i++)
+        r.mTranslation[i] += a.mTranslation[i];
+#endif
+    return r;
+}
+
+inline CGrRigidTransform &CGrRigidTransform::operator*=(const CGrRigidTransform &b)
+{
+    *this = *this * b;
+    return *this;
+}
+
+//! Transform a vector.
+/*! As for a CGrTransform, the translation is scaled by W, so a vector
+    with W of 0 is only rotated.
+    \ingroup VecTranGlobals
+    \param a The transform
+    \param p The vector */
+inline CGrVector operator *(const CGrRigidTransform &a, const CGrVector &p)
+{
+    CGrVector r = a.mRotation.Rotate(p);
+    return CGrVector(r.X() + a.mTranslation[1] * p.W(), r.Y() + a.mTranslation[2] * p.W(), r.Z() + a.mTranslation[3] * p.W(), p.W());
+}
+
+//! A rigid transform as a unit dual quaternion.
+
+/*! A dual quaternion is a real part, the rotation, and a dual part that
+holds the translation. It is the form to use when rigid transforms are
+blended, as in skinning a vertex influenced by several bones: the
+weighted sum of unit dual quaternions, normalized, is a rigid transform
+with no shrinking or shearing, where a weighted sum of matrices is not.
+
+To blend, SetZero(), Accumulate() each transform with its weight, then
+Normalize() and GetRigidTransform().
+
+\version 1.00 Initial version
+*/
+
+class LibGrafx CGrDualQuaternion
+{
+public:
+    //! Default constructor. Initializes to the identity.
+    CGrDualQuaternion() : mDual(0, 0, 0, 0) {}
+
+    //! Constructor from a rigid transform
+    explicit CGrDualQuaternion(const CGrRigidTransform &t) {SetFromRigidTransform(t);}
+
+    //! Set to the identity
+    CGrDualQuaternion &SetIdentity() {mReal.SetIdentity();  mDual.Set(0, 0, 0, 0);  return *this;}
+
+    //! Set to all zeros, to start Accumulate()
+    CGrDualQuaternion &SetZero() {mReal.Set(0, 0, 0, 0);  mDual.Set(0, 0, 0, 0);  return *this;}
+
+    //! Set from a rigid transform
+    CGrDualQuaternion &SetFromRigidTransform(const CGrRigidTransform &t);
+
+    //! Get the rigid transform
+    /*! The dual quaternion must be normalized. */
+    void GetRigidTransform(CGrRigidTransform &t) const;
+
+    //! The real part, the rotation
+    const CGrQuaternion &GetReal() const {return mReal;}
+
+    //! The dual part
+    const CGrQuaternion &GetDual() const {return mDual;}
+
+    //! Add a weighted transform
+    /*! The transform is negated if its rotation is on the other side of
+        the sum so far, so the blend is the shorter way.
+        \param b Transform to add
+        \param weight Weight of the transform */
+    CGrDualQuaternion &Accumulate(const CGrDualQuaternion &b, double weight);
+
+    //! Scale to a unit dual quaternion
+    CGrDualQuaternion &Normalize();
+
+    //! Invert a unit dual quaternion
+    CGrDualQuaternion &Invert() {mReal.Conjugate();  mDual.Conjugate();  return *this;}
+
+    //! *= operator. Results in this = this * b, the transform b then this one
+    CGrDualQuaternion &operator*=(const CGrDualQuaternion &b);
+
+private:
+    friend CGrDualQuaternion operator *(const CGrDualQuaternion &a, const CGrDualQuaternion &b);
+
+    CGrQuaternion mReal;
+    CGrQuaternion mDual;
+};
+
+//! Product of dual quaternions.
+/*! The result is the transform b followed by the transform a.
+    \ingroup VecTranGlobals
+    \param a First dual quaternion
+    \param b Second dual quaternion */
+inline CGrDualQuaternion operator *(const CGrDualQuaternion &a, const CGrDualQuaternion &b)
+{
+    CGrDualQuaternion r;
+#ifdef GRQUATERNION_SSE
+    __m128 ra = _mm_loadu_ps(a.mReal);
+    __m128 rb = _mm_loadu_ps(b.mReal);
+    _mm_storeu_ps(r.mReal, GrQuaternionMultiply(ra, rb));
+    __m128 d = _mm_add_ps(GrQuaternionMultiply(ra, _mm_loadu_ps(b.mDual)), GrQuaternionMultiply(_mm_loadu_ps(a.mDual), rb));
+    _mm_storeu_ps(r.mDual, d);
+#else
+    r.mReal = a.mReal * b.mReal;
+    CGrQuaternion d1 = a.mReal * b.mDual;
+    CGrQuaternion d2 = a.mDual * b.mReal;
+    for(int i=0;  i<4;  i++)
+        r.mDual[i] = d1[i] + d2[i];
+#endif
+    return r;
+}
+
+inline CGrDualQuaternion &CGrDualQuaternion::operator*=(const CGrDualQuaternion &b)
+{
+    *this = *this * b;
+    return *this;
+}
+
+#endif
@@ -14,12 +14,14 @@
 
 #include <stdafx.h>
 #include "GrTexture.h"
+#include "GrImage.h"
+#include "GrThreadPool.h"
 #include <cassert>
+#include <cstring>
+#include <utility>
 
 using namespace std;
 
-#include <GL/glu.h>
-
 #ifdef _DEBUG
 #undef THIS_FILE
 static char THIS_FILE[]=__FILE__;
@@ -32,6 +34,56 @@ static char THIS_FILE[]=__FILE__;
 #define tstring string
 #endif
 
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+//! \cond ignore
+
+// glCompressedTexImage2D() is past OpenGL 1.1, so it comes from the driver
+typedef void (APIENTRY *CompressedTexImage2DProc)(GLenum target, GLint level, GLenum internalformat, 
+    GLsizei width, GLsizei height, GLint border, GLsizei imageSize, const GLvoid *data);
+
+static CompressedTexImage2DProc CompressedTexImage2D = NULL;
+
+// 1 if S3TC blocks can be sent to OpenGL, 0 if not, and -1 until
+// we have asked. It is asked once, with the first context, on the
+// assumption that every context is on the same device.
+static int S3tcSupport = -1;
+
+static CompressedTexImage2DProc GetCompressedTexImage2D()
+{
+    if(S3tcSupport < 0)
+    {
+        const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+        if(extensions != NULL && strstr(extensions, "GL_EXT_texture_compression_s3tc") != NULL)
+        {
+            CompressedTexImage2D = (CompressedTexImage2DProc)wglGetProcAddress("glCompressedTexImage2D");
+            if(CompressedTexImage2D == NULL)
+                CompressedTexImage2D = (CompressedTexImage2DProc)wglGetProcAddress("glCompressedTexImage2DARB");
+        }
+
+        S3tcSupport = CompressedTexImage2D != NULL ? 1 : 0;
+    }
+
+    return CompressedTexImage2D;
+}
+
+// What GetBlockLevel() returns for a texture that is not compressed
+static const CGrBlockImage NoBlocks;
+
+static void SetTString(TCHAR **dest, const TCHAR *src, size_t size)
+{
+    delete [] *dest;
+
+    // Leave space for null termination
+    *dest = new TCHAR[size + 1];
+    ::_tcsnccpy_s(*dest, size + 1, src, size);
+}
+
+//! \endcond
+
 
 
 //////////////////////////////////////////////////////////////////////
@@ -40,24 +92,38 @@ static char THIS_FILE[]=__FILE__;
 
 CGrTexture::CGrTexture()
 {
-   m_height = 0;
-   m_width = 0;
-   m_image = NULL;
    m_texname = 0;
+   m_miptexname = 0;
 
    m_initialized = false;
    m_mipinitialized = false;
+
+   m_mips = NULL;
+   m_mipcount = 0;
+
+   m_blocks = NULL;
+   m_blockcount = 0;
+
+   m_error = NULL;
 }
 
-CGrTexture::CGrTexture(const CGrTexture &p_img)
+CGrTexture::CGrTexture(CGrTexture &&p_img)
 {
-   m_height = 0;
-   m_width = 0;
-   m_image = NULL;
+   m_texname = 0;
+   m_miptexname = 0;
+
    m_initialized = false;
    m_mipinitialized = false;
 
-   Copy(p_img);
+   m_mips = NULL;
+   m_mipcount = 0;
+
+   m_blocks = NULL;
+   m_blockcount = 0;
+
+   m_error = NULL;
+
+   *this = std::move(p_img);
 }
 
 CGrTexture::~CGrTexture()
@@ -68,13 +134,18 @@ CGrTexture::~CGrTexture()
 
 void CGrTexture::Clear()
 {
-    if(m_image != NULL)
-    {
-        delete [] m_image[0];
-        delete [] m_image;
-        m_image = NULL;
-    }
+    m_image.Clear();
+    ClearMipmaps();
+    ClearBlocks();
+    ReleaseTexNames();
+
+    delete [] m_error;
+    m_error = NULL;
+}
 
+
+void CGrTexture::ReleaseTexNames()
+{
     if(m_initialized)
     {
         glDeleteTextures(1, &m_texname);
@@ -89,16 +160,57 @@ void CGrTexture::Clear()
 }
 
 
-bool CGrTexture::IsEmpty() const {return m_width <= 0 || m_height <= 0;}
+bool CGrTexture::IsEmpty() const {return m_image.IsEmpty() && m_blocks == NULL;}
+
+BYTE *CGrTexture::operator[](int i) {return m_image.GetRow(i);}
+const BYTE *CGrTexture::operator[](int i) const {return m_image.GetRow(i);}
+BYTE *CGrTexture::Row(int i) {return m_image.GetRow(i);}
+const BYTE *CGrTexture::Row(int i) const {return m_image.GetRow(i);}
+
+int CGrTexture::Width() const {return m_blocks != NULL ? m_blocks[0].GetWidth() : m_image.GetWidth();}
+int CGrTexture::Height() const {return m_blocks != NULL ? m_blocks[0].GetHeight() : m_image.GetHeight();}
+BYTE *CGrTexture::ImageBits() const {return m_image.GetData();}
+int CGrTexture::RowPitch() const {return m_image.GetPitch();}
+const CGrImageBgr8 &CGrTexture::GetImage() const {return m_image;}
+
+size_t CGrTexture::ImageBytes() const
+{
+    size_t bytes = m_image.GetBytes();
+    for(int i=0;  i<m_mipcount;  i++)
+        bytes += m_mips[i].GetBytes();
+
+    for(int i=0;  i<m_blockcount;  i++)
+        bytes += m_blocks[i].GetBytes();
+
+    return bytes;
+}
+
+size_t CGrTexture::TexNameBytes() const
+{
+    size_t pixels = size_t(Width()) * Height();
+    size_t bytes = 0;
+    if(m_blocks != NULL && S3tcSupport > 0)
+    {
+        if(m_initialized)
+            bytes += m_blocks[0].GetBytes();
+
+        if(m_mipinitialized)
+        {
+            for(int i=0;  i<m_blockcount;  i++)
+                bytes += m_blocks[i].GetBytes();
+        }
 
-BYTE *CGrTexture::operator[](int i) {return m_image[i];}
-const BYTE *CGrTexture::operator[](int i) const {return m_image[i];}
-BYTE *CGrTexture::Row(int i) {return m_image[i];}
-const BYTE *CGrTexture::Row(int i) const {return m_image[i];}
+        return bytes;
+    }
 
-int CGrTexture::Width() const {return m_width;}
-int CGrTexture::Height() const {return m_height;}
-BYTE *CGrTexture::ImageBits() const {return m_image[0];}
+    if(m_initialized)
+        bytes += pixels * 4;
+
+    if(m_mipinitialized)
+        bytes += pixels * 4 + pixels * 4 / 3;
+
+    return bytes;
+}
 
 
 //////////////////////////////////////////////////////////////////////
@@ -112,22 +224,66 @@ BYTE *CGrTexture::ImageBits() const {return m_image[0];}
 
 void CGrTexture::Copy(const CGrTexture &p_img)
 {
+    if(&p_img == this)
+        return;
+
     SameSize(p_img);
+    ClearMipmaps();
+    ClearBlocks();
+    m_image.Copy(p_img.m_image);
 
-    for(int i=0;  i<m_height;  i++)
+    if(p_img.m_blocks != NULL)
     {
-        for(int j=0;  j<m_width * 3;  j++)
-        {
-            m_image[i][j] = p_img.m_image[i][j];
-        }
+        m_blocks = new CGrBlockImage[p_img.m_blockcount];
+        m_blockcount = p_img.m_blockcount;
+        for(int i=0;  i<m_blockcount;  i++)
+            m_blocks[i].Copy(p_img.m_blocks[i]);
     }
 }
 
 
-CGrTexture & CGrTexture::operator =(const CGrTexture &p_img)
+CGrTexture CGrTexture::Clone() const
 {
-   Copy(p_img);
-   return *this;
+    CGrTexture copy;
+    copy.Copy(*this);
+    return copy;
+}
+
+
+//
+// Name :         CGrTexture::operator=(CGrTexture &&)
+// Description :  Move another texture into this one. The image block
+//                and the texture names change owner and the other
+//                texture is left empty.
+//
+
+CGrTexture &CGrTexture::operator=(CGrTexture &&p_img)
+{
+    if(&p_img == this)
+        return *this;
+
+    Clear();
+
+    m_image = std::move(p_img.m_image);
+    m_texname = p_img.m_texname;
+    m_miptexname = p_img.m_miptexname;
+    m_initialized = p_img.m_initialized;
+    m_mipinitialized = p_img.m_mipinitialized;
+    m_mips = p_img.m_mips;
+    m_mipcount = p_img.m_mipcount;
+    m_blocks = p_img.m_blocks;
+    m_blockcount = p_img.m_blockcount;
+    m_error = p_img.m_error;
+
+    p_img.m_initialized = false;
+    p_img.m_mipinitialized = false;
+    p_img.m_mips = NULL;
+    p_img.m_mipcount = 0;
+    p_img.m_blocks = NULL;
+    p_img.m_blockcount = 0;
+    p_img.m_error = NULL;
+
+    return *this;
 }
 
 //
@@ -142,7 +298,7 @@ GLuint CGrTexture::TexName()
     if(m_initialized)
         return m_texname;
 
-    if(m_image == NULL)
+    if(IsEmpty())
         return 0;
 
     glGenTextures(1, &m_texname);
@@ -152,8 +308,18 @@ GLuint CGrTexture::TexName()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, m_width, m_height, 0,
-        GL_BGR_EXT, GL_UNSIGNED_BYTE, m_image[0]);
+
+    if(m_blocks != NULL)
+    {
+        UploadBlocks(1);
+    }
+    else
+    {
+        BeginUnpack(m_image);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, Width(), Height(), 0,
+            GL_BGR_EXT, GL_UNSIGNED_BYTE, m_image.GetData());
+        EndUnpack();
+    }
 
     m_initialized = true;
 
@@ -161,12 +327,20 @@ GLuint CGrTexture::TexName()
 }
 
 
+//
+// Name :         CGrTexture::MipTexName()
+// Description :  Obtain the mipmapped texture name. Every level is
+//                sent to OpenGL as it is, so OpenGL does no filtering
+//                or rescaling of its own. Compressed levels are sent
+//                as blocks.
+//
+
 GLuint CGrTexture::MipTexName()
 {
     if(m_mipinitialized)
         return m_miptexname;
 
-    if(m_image == NULL)
+    if(IsEmpty())
         return 0;
 
     glGenTextures(1, &m_miptexname);
@@ -176,17 +350,217 @@ GLuint CGrTexture::MipTexName()
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    gluBuild2DMipmaps(GL_TEXTURE_2D, 3, m_width, m_height, GL_BGR_EXT, GL_UNSIGNED_BYTE, m_image[0]);
+
+    if(m_blocks != NULL)
+    {
+        UploadBlocks(m_blockcount);
+    }
+    else
+    {
+        BuildMipmaps();
+
+        BeginUnpack(m_image);
+        for(int level=0;  level<GetMipLevels();  level++)
+        {
+            const CGrImageBgr8 &image = GetMipLevel(level);
+            glPixelStorei(GL_UNPACK_ROW_LENGTH, image.GetRowLength());
+            glTexImage2D(GL_TEXTURE_2D, level, GL_RGB, image.GetWidth(), image.GetHeight(), 0,
+                GL_BGR_EXT, GL_UNSIGNED_BYTE, image.GetData());
+        }
+        EndUnpack();
+    }
 
     m_mipinitialized = true;
 
     return m_miptexname;
+}
+
+
+//
+// Name :         CGrTexture::BuildMipmaps()
+// Description :  Make each level from the one before it, down to 1 by 1.
+//
+
+void CGrTexture::BuildMipmaps(CGrThreadPool *pool)
+{
+    if(m_mips != NULL || m_image.IsEmpty())
+        return;
+
+    int count = 0;
+    for(int w=Width(), h=Height();  w > 1 || h > 1;  count++)
+    {
+        w = CGrImageKernels::MipSize(w);
+        h = CGrImageKernels::MipSize(h);
+    }
+
+    if(count == 0)
+        return;
+
+    CGrImageBgr8 *mips = new CGrImageBgr8[count];
+    const CGrImageBgr8 *src = &m_image;
+    for(int i=0;  i<count;  i++)
+    {
+        CGrImageBgr8 &dest = mips[i];
+        dest.SetSize(CGrImageKernels::MipSize(src->GetWidth()), CGrImageKernels::MipSize(src->GetHeight()));
+        CGrImageKernels::Downsample(dest.GetData(), dest.GetPitch(), src->GetData(), src->GetPitch(), 
+            src->GetWidth(), src->GetHeight(), dest.GetChannels(), pool);
+        src = &dest;
+    }
+
+    m_mips = mips;
+    m_mipcount = count;
+}
+
+
+void CGrTexture::ClearMipmaps()
+{
+    delete [] m_mips;
+    m_mips = NULL;
+    m_mipcount = 0;
+}
+
 
+int CGrTexture::GetMipLevels() const {return m_blocks != NULL ? m_blockcount : m_mipcount + 1;}
+
+const CGrImageBgr8 &CGrTexture::GetMipLevel(int level) const
+{
+    if(level <= 0 || m_mipcount == 0)
+        return m_image;
+
+    return m_mips[(level <= m_mipcount ? level : m_mipcount) - 1];
 }
 
+
+//
+// Name :         CGrTexture::Compress()
+// Description :  Compress every mipmap level, then let the
+//                uncompressed ones go.
+//
+
+void CGrTexture::Compress(CGrBlockImage::Format format, CGrThreadPool *pool)
+{
+    if(m_blocks != NULL && m_blocks[0].GetFormat() == format)
+        return;
+
+    Decompress();
+    if(format == CGrBlockImage::None || m_image.IsEmpty())
+        return;
+
+    BuildMipmaps(pool);
+
+    int count = GetMipLevels();
+    CGrBlockImage *blocks = new CGrBlockImage[count];
+    for(int i=0;  i<count;  i++)
+        blocks[i].Encode(GetMipLevel(i), format, pool);
+
+    ReleaseTexNames();
+    m_image.Clear();
+    ClearMipmaps();
+
+    m_blocks = blocks;
+    m_blockcount = count;
+}
+
+
+void CGrTexture::Decompress()
+{
+    if(m_blocks == NULL)
+        return;
+
+    CGrImageBgr8 image;
+    m_blocks[0].Decode(image);
+    ClearBlocks();
+    m_image = std::move(image);
+}
+
+
+void CGrTexture::ClearBlocks()
+{
+    delete [] m_blocks;
+    m_blocks = NULL;
+    m_blockcount = 0;
+}
+
+
+bool CGrTexture::IsCompressed() const {return m_blocks != NULL;}
+
+CGrBlockImage::Format CGrTexture::GetCompression() const
+{
+    return m_blocks != NULL ? m_blocks[0].GetFormat() : CGrBlockImage::None;
+}
+
+const CGrBlockImage &CGrTexture::GetBlockLevel(int level) const
+{
+    if(m_blocks == NULL)
+        return NoBlocks;
+
+    return m_blocks[level <= 0 ? 0 : (level < m_blockcount ? level : m_blockcount - 1)];
+}
+
+
+//
+// Name :         CGrTexture::UploadBlocks()
+// Description :  Send the first levels of the compressed texture to
+//                the bound texture object. Without S3TC in OpenGL
+//                they are decoded and sent uncompressed.
+//
+
+void CGrTexture::UploadBlocks(int levels) const
+{
+    CompressedTexImage2DProc upload = GetCompressedTexImage2D();
+    if(upload != NULL)
+    {
+        GLenum format = m_blocks[0].GetFormat() == CGrBlockImage::Bc1 ? 
+            GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+
+        for(int level=0;  level<levels;  level++)
+        {
+            const CGrBlockImage &blocks = m_blocks[level];
+            upload(GL_TEXTURE_2D, level, format, blocks.GetWidth(), blocks.GetHeight(), 0,
+                (GLsizei)blocks.GetBytes(), blocks.GetData());
+        }
+
+        return;
+    }
+
+    CGrImageBgr8 image;
+    for(int level=0;  level<levels;  level++)
+    {
+        m_blocks[level].Decode(image);
+        BeginUnpack(image);
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGB, image.GetWidth(), image.GetHeight(), 0,
+            GL_BGR_EXT, GL_UNSIGNED_BYTE, image.GetData());
+        EndUnpack();
+    }
+}
+
+
+//
+// Name :         CGrTexture::BeginUnpack()
+// Description :  Tell OpenGL how the rows of an image are laid out. The
+//                rows are padded well beyond the 4 byte default, so the
+//                row length is given in pixels. EndUnpack() puts back
+//                what was there before.
+//
+
+void CGrTexture::BeginUnpack(const CGrImageBgr8 &image) const
+{
+    glPushClientAttrib(GL_CLIENT_PIXEL_STORE_BIT);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, image.GetRowLength());
+    glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+    glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+}
+
+void CGrTexture::EndUnpack() const
+{
+    glPopClientAttrib();
+}
+
+
 void CGrTexture::SameSize(const CGrTexture &p_img)
 {
-	SetSize(p_img.m_width, p_img.m_height);
+	SetSize(p_img.Width(), p_img.Height());
 }
 
 //
@@ -197,38 +571,24 @@ void CGrTexture::SameSize(const CGrTexture &p_img)
 
 void CGrTexture::SetSize(int p_x, int p_y)
 {
-   if(p_x == m_width && m_height == p_y)
+   if(p_x == Width() && Height() == p_y && m_blocks == NULL)
       return;
 
    Clear();
-
-	// Member variables
-   m_height = p_y;
-   m_width = p_x;
-
-   if(p_x <= 0 || p_y <= 0)
-      return;
-
-   // Allocate memory for the image.  Note that storage for rows must
-   // be on DWORD boundaries.  (32 bit boundaries)
-   const int PADSIZE = 4;
-
-   int usewidth = (m_width * 3 + (PADSIZE - 1)) / PADSIZE;
-   usewidth *= PADSIZE;
-
-   BYTE *image = new BYTE[usewidth * m_height];
-   m_image = new BYTE *[m_height];
-   for(int i=0;  i<m_height;  i++, image += usewidth)
-   {
-      m_image[i] = image;
-   }
+   m_image.SetSize(p_x, p_y);
 }
 
 void CGrTexture::Set(int x, int y, int r, int g, int b)
 {
-   if(x >= 0 && x < m_width && y >= 0 && y < m_height)
+   if(x >= 0 && x < Width() && y >= 0 && y < Height())
    {
-      BYTE *img = m_image[y] + x * 3;
+      if(m_blocks != NULL)
+         Decompress();
+
+      if(m_mips != NULL)
+         ClearMipmaps();
+
+      BYTE *img = m_image.GetPixel(x, y);
       *img++ = b;
       *img++ = g;
       *img++ = r;
@@ -238,18 +598,10 @@ void CGrTexture::Set(int x, int y, int r, int g, int b)
 
 void CGrTexture::Fill(int r, int g, int b)
 {
-   for(int i=0;  i<m_height;  i++)
-   {
-      BYTE *img = m_image[i];
-      for(int j=0;  j<m_width * 3;  j+=3)
-      {
-         *img++ = b;
-         *img++ = g;
-         *img++ = r;
-      }
-
-   }
-
+   BYTE pixel[3] = {BYTE(b), BYTE(g), BYTE(r)};
+   Decompress();
+   ClearMipmaps();
+   m_image.Fill(pixel);
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -294,7 +646,7 @@ bool CGrTexture::LoadFile(LPCTSTR filename)
         msg += errorText;
         LocalFree(errorText);
 
-        AfxMessageBox(msg.c_str());
+        SetTString(&m_error, msg.c_str(), msg.size());
 
         return false;
     }
@@ -310,14 +662,13 @@ bool CGrTexture::LoadFrom(const ATL::CImage *image)
 
 bool CGrTexture::LoadFrom(const ATL::CImage *image, LPCTSTR filename)
 {
-    SetSize(image->GetWidth(), image->GetHeight());
-
-    int bpp = image->GetBPP();
-    int pitch = image->GetPitch();
-    BYTE *bits = (BYTE *)image->GetBits();
-    bool idib = image->IsDIBSection();
-    if(!image->IsDIBSection())
+    CGrImageKernels::PixelFormat format;
+    unsigned char palette[256 * 4];
+    if(!image->IsDIBSection() || !CGrImage::GetPixelFormat(image, format, palette))
     {
+        SetSize(image->GetWidth(), image->GetHeight());
+        ClearMipmaps();
+
         tstring msg = TEXT("Unable to read image");
         if(filename != NULL)
         {
@@ -331,94 +682,31 @@ bool CGrTexture::LoadFrom(const ATL::CImage *image, LPCTSTR filename)
 
         msg += TEXT(" - File format could not be loaded");
 
-        AfxMessageBox(msg.c_str());
+        SetTString(&m_error, msg.c_str(), msg.size());
+        return false;
     }
 
-    switch(bpp)
-    {
-    case 8:
-        {
-            for(int r=0;  r<m_height;  r++)
-            {
-                BYTE *pixel = bits;
-
-                for(int c=0;  c<m_width;  c++)
-                {
-                    int g = pixel[0];
-
-                    Set(c, m_height - r - 1, g, g, g);
-
-                    pixel++;
-                }
-
-                bits += pitch;
-            }
-        }
-        break;
-
-    case 24:
-        {
-            for(int r=0;  r<m_height;  r++)
-            {
-                BYTE *pixel = bits;
-
-                for(int c=0;  c<m_width;  c++)
-                {
-                    int blu = pixel[0];
-                    int grn = pixel[1];
-                    int red = pixel[2];
-
-                    Set(c, m_height - r - 1, red, grn, blu);
-
-                    pixel += 3;
-                }
-
-                bits += pitch;
-            }
-        }
-        break;
-
-    case 32:
-        {
-            for(int r=0;  r<m_height;  r++)
-            {
-                BYTE *pixel = bits;
-
-                for(int c=0;  c<m_width;  c++)
-                {
-                    int blu = pixel[0];
-                    int grn = pixel[1];
-                    int red = pixel[2];
+    // CImage rows are top down and ours are bottom up, so start
+    // at the last row and step back
+    int height = image->GetHeight();
+    int pitch = image->GetPitch();
+    const BYTE *bits = (const BYTE *)image->GetBits() + (height - 1) * pitch;
 
-                    Set(c, m_height - r - 1, red, grn, blu);
+    LoadFrom(bits, -pitch, format, image->GetWidth(), height, palette);
+    return true;
+}
 
-                    pixel += 4;
-                }
 
-                bits += pitch;
-            }
-        }
-        break;
+bool CGrTexture::LoadFrom(const void *pixels, int pitch, CGrImageKernels::PixelFormat format, 
+                          int width, int height, const unsigned char *palette)
+{
+    Clear();
+    m_image.SetSize(width, height);
+    if(m_image.IsEmpty())
+        return false;
 
-    default:
-        {
-            tstring msg = TEXT("Unable to read image");
-            if(filename != NULL)
-            {
-                msg += TEXT(" file:");
-                msg += filename;
-            }
-            else
-            {
-                msg += TEXT(": ");
-            }
-
-            msg += TEXT(" - File format could not be loaded");
-
-            AfxMessageBox(msg.c_str());
-        }
-        break;
-    }
+    CGrImageKernels::ConvertRows(m_image.GetRow(0), m_image.GetPitch(), CGrImageKernels::Bgr8, 
+        pixels, pitch, format, width, height, palette);
 
     return true;
 }
@@ -21,6 +21,10 @@
 #include <atlimage.h>
 #include <fstream>
 #include <GL/gl.h>
+#include "GrImageT.h"
+#include "GrBlockImage.h"
+
+class CGrThreadPool;
 
 //! Class to load and utilize texture files in OpenGL programs.
 
@@ -31,6 +35,18 @@ are supported by the model.
 Each dimension of the texture image must be a power of two. This function
 will load any image that can be loaded using the MFC function: CImage::Load().
 
+The mipmap levels are made here rather than by OpenGL and kept with the
+image, so a renderer that does not use OpenGL can sample them as well.
+Each level is averaged from the one above in linear light rather than
+in sRGB, so bright and dark detail do not darken as it shrinks.
+
+A texture can be kept block compressed with Compress(). Each mipmap
+level is compressed to BC1 or BC3 and the uncompressed image is freed,
+which takes a texture from 3 bytes a texel to a half or one. The blocks
+are sent to OpenGL as they are when it supports S3TC compression, so
+it keeps the texture compressed as well, and CGrTextureSampler decodes
+the texels it needs from the blocks.
+
 \author Charles B. Owen
 \version 1.01 10-23-1999 Declared version number
 \version 1.02 02-23-2003 Fixed bug where one constructor did not inititalize m_mipinitialized.
@@ -38,6 +54,8 @@ will load any image that can be loaded using the MFC function: CImage::Load().
 \version 1.04 01-14-2012 Now uses CImage from MFC to load images. Will load anything it will load.
 \version 1.05 01-28-2012 Documentation updates
 \version 1.06 01-30-2012 Name change from CTexture to CGrTexture for consistency
+\version 1.07 Mipmap levels are made and kept by the texture
+\version 1.08 Textures can be kept block compressed
 */
 
 class LibGrafx CGrTexture  
@@ -45,21 +63,62 @@ class LibGrafx CGrTexture
 public:
     //! Default Constructor
     CGrTexture();
-    //! Copy Constructor. 
-    /*! The copy constructor will copy another texture image. 
+
+    //! Move Constructor
+    /*! Takes the image and any OpenGL texture objects from another
+        texture, which is left empty. Nothing is copied. Use Clone()
+        to make a copy.
         \param img The other texture image */
-    CGrTexture(const CGrTexture &img);
+    CGrTexture(CGrTexture &&img);
+
     virtual ~CGrTexture();
 
+    //! Move assignment
+    /*! Takes the image and any OpenGL texture objects from another
+        texture, which is left empty. What this texture had is released,
+        so this must be done when the OpenGL context is active.
+        \param img The other texture image */
+    CGrTexture &operator=(CGrTexture &&img);
+
+    //! Make a copy of this texture image
+    /*! This is the only way to copy a texture. The copy has no OpenGL
+        texture objects of its own until it is used.
+        \return The copy */
+    CGrTexture Clone() const;
+
     //! Load a texture from a file
     /* \param filename The filename as a character string in the current 
-       setting of Unicode or multibyte strings. */
+       setting of Unicode or multibyte strings. 
+       \return true if successful. Otherwise the error message can be
+       accessed via the GetError() function. Nothing is displayed, so
+       this can be called from any thread. */
     bool LoadFile(LPCTSTR filename);
 
     //! Load a texture from an MFC image
-    /* \param image The image we are loading from */
+    /* \param image The image we are loading from 
+       \return false if the image format could not be loaded, with
+       the message in GetError() */
     bool LoadFrom(const ATL::CImage *image);
 
+    //! Access any error message generated when a file is
+    //! loaded.
+    //! \return The error string or NULL if no error
+    const TCHAR *GetError() const {return m_error;}
+
+    //! Load a texture from pixels in memory
+    /*! The pixels are converted to B, G, R with
+        CGrImageKernels::ConvertRows(); alpha is dropped.
+        \param pixels The bottom row
+        \param pitch Bytes from a row to the one above it, negative if
+        the rows are stored top down
+        \param format Layout of the pixels
+        \param width Width in pixels
+        \param height Height in pixels
+        \param palette 256 B, G, R, A entries for Indexed8
+        \return false if the texture is empty */
+    bool LoadFrom(const void *pixels, int pitch, CGrImageKernels::PixelFormat format, 
+                  int width, int height, const unsigned char *palette=NULL);
+
     //! Returns an OpenGL texture name for this texture.
     /*! An OpenGL texture name is an integer. The first time this
         function is called the texture is created. Subsequent calls
@@ -70,9 +129,62 @@ public:
     /*! An OpenGL texture name is an integer. The first time this
         function is called the texture is created. Subsequent calls
         return the previously created texture name. The texture will
-        be created with support for mipmapping. */
+        be created with support for mipmapping. The mipmap levels are
+        made by BuildMipmaps() if they have not been already. */
     GLuint MipTexName();
 
+    //! Make the mipmap levels
+    /*! Does nothing if the levels are already made. The levels are
+        discarded when the image is changed through this class. If the
+        image is changed through Row() or ImageBits(), call
+        ClearMipmaps() so they are made again. Call this before the
+        levels are sampled from more than one thread.
+        \param pool Threads to use, or NULL to use only this thread */
+    void BuildMipmaps(CGrThreadPool *pool=NULL);
+
+    //! Discard the mipmap levels
+    void ClearMipmaps();
+
+    //! Number of mipmap levels, including the image itself
+    /*! This is 1 until BuildMipmaps() is called. */
+    int GetMipLevels() const;
+
+    //! Get a mipmap level
+    /*! Level 0 is the image itself. Each level after is half the size
+        of the one before in each dimension, rounded down, to 1 by 1.
+        The levels are empty while the texture is compressed.
+        \param level From 0 to GetMipLevels() - 1 */
+    const CGrImageBgr8 &GetMipLevel(int level) const;
+
+    //! Block compress the texture
+    /*! Makes the mipmap levels if they are not made already and
+        compresses every one of them, then frees the uncompressed image
+        and levels. While the texture is compressed, Row(), ImageBits(),
+        and the bracket operators have no image to return. Set() and
+        Fill() decompress it first. If OpenGL texture objects have been
+        made they are released, so this must be done when the OpenGL
+        context is active or before the texture is first used.
+        \param format The block format, or CGrBlockImage::None to decompress
+        \param pool Threads to use, or NULL to use only this thread */
+    void Compress(CGrBlockImage::Format format, CGrThreadPool *pool=NULL);
+
+    //! Decompress the texture
+    /*! The image becomes the decoded level 0 and the other mipmap
+        levels are made again when they are needed. Does nothing if the
+        texture is not compressed. */
+    void Decompress();
+
+    //! Is the texture block compressed?
+    bool IsCompressed() const;
+
+    //! The block format, or CGrBlockImage::None if not compressed
+    CGrBlockImage::Format GetCompression() const;
+
+    //! Get a compressed mipmap level
+    /*! \param level From 0 to GetMipLevels() - 1
+        \return The level, or an empty image if the texture is not compressed */
+    const CGrBlockImage &GetBlockLevel(int level) const;
+
     //! Clear the texture image 
     /*! Clears the texture image and releases any memory. This function must be 
         called when the OpenGL context is active or it will fail to release the
@@ -116,9 +228,6 @@ public:
     //! Returns true if the texture image is empty.
     bool IsEmpty() const;
 
-    //! Assignment operator that copies a texture image into this one.
-    CGrTexture &operator=(const CGrTexture &p_img);
-
     //! Bracket operator gets access to a given row of the image
     /*! This operator can be used like this:  \code
     BYTE value = texture[row][byte];
@@ -126,8 +235,8 @@ public:
         Use with care. The return value is that same as that for
         ImageBits. It can be used to directly access the 
         data for the texture image. It consists of a sequence of 
-        bytes in the order B, G, and R. Rows start on the texture
-        word (32 bit) boundary. */
+        bytes in the order B, G, and R. Rows start on a 64 byte
+        boundary. */
     BYTE *operator[](int i);
 
     //! Bracket operator gets access to a given row of the image
@@ -169,12 +278,43 @@ public:
     //! Direct access to the texture image bits. 
     /*! This function can be used to directly access the 
         data for the texture image. It consists of a sequence of 
-        bytes in the order B, G, and R. Rows start on the texture
-        word (32 bit) boundary. */
+        bytes in the order B, G, and R. Rows start on a 64 byte
+        boundary and are padded to RowPitch() bytes. */
     BYTE *ImageBits() const;
 
+    //! Gets the row pitch
+    /*! \return The number of bytes from the start of one row to 
+        the start of the next. */
+    int RowPitch() const;
+
+    //! The image the texture is made from
+    const CGrImageBgr8 &GetImage() const;
+
+    //! Release the OpenGL texture objects, but keep the image
+    /*! TexName() and MipTexName() create the objects again when they 
+        are next called. This function must be called when the OpenGL 
+        context is active or it will fail to release the objects. */
+    void ReleaseTexNames();
+
+    //! Bytes of memory used by the texture image and mipmap levels
+    size_t ImageBytes() const;
+
+    //! Estimated bytes of OpenGL memory used by the texture objects
+    /*! This counts the objects TexName() and MipTexName() have created,
+        at 4 bytes per pixel plus a third more for the mipmap levels,
+        or the size of the blocks if they were sent compressed. */
+    size_t TexNameBytes() const;
+
 private:
+    // Textures are copied only with Clone() or Copy()
+    CGrTexture(const CGrTexture &img);
+    CGrTexture &operator=(const CGrTexture &img);
+
     bool LoadFrom(const ATL::CImage *image, LPCTSTR filename);
+    void BeginUnpack(const CGrImageBgr8 &image) const;
+    void EndUnpack() const;
+    void UploadBlocks(int levels) const;
+    void ClearBlocks();
 
     // Set true if the texture map has been initialized as a MIPMAP texture
     bool m_mipinitialized;
@@ -188,14 +328,19 @@ private:
     // OpenGL name for the MIPMAP texture
     GLuint m_miptexname;
 
-    // Texture image height
-    int m_height;
+    // The actual texture image data
+    CGrImageBgr8 m_image;
 
-    // Texture image width
-    int m_width;
+    // Mipmap levels after the image, smallest last
+    CGrImageBgr8 *m_mips;
+    int m_mipcount;
 
-    // The actual texture image data
-    BYTE ** m_image;
+    // Compressed image and mipmap levels, or NULL
+    CGrBlockImage *m_blocks;
+    int m_blockcount;
+
+    // Error message from the last load, or NULL
+    TCHAR *m_error;
 };
 
 #endif 
@@ -0,0 +1,555 @@
+//
+//  Name :         GrTextureCache.cpp
+//  Description :  Implementation of the CGrTextureCache class.
+//  Version :      See GrTextureCache.h
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+
+#include <stdafx.h>
+#include "GrTexture.h"
+#include "GrTextureCache.h"
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <map>
+#include <list>
+
+using namespace std;
+
+#ifdef _DEBUG
+#undef THIS_FILE
+static char THIS_FILE[]=__FILE__;
+#define new DEBUG_NEW
+#endif
+
+//! \cond ignore
+
+//
+// Private implementation of the texture cache
+//
+
+class CGrTextureCachep
+{
+public:
+    CGrTextureCachep(size_t imageBudget, size_t glBudget);
+    ~CGrTextureCachep();
+
+    CGrTexture *Acquire(const wchar_t *filename);
+    void Release(CGrTexture *texture);
+    void SetBudget(size_t imageBudget, size_t glBudget);
+    void SetCompression(CGrBlockImage::Format format, CGrThreadPool *pool);
+    void Trim();
+    void Purge();
+    CGrTextureCache::Stats GetStats();
+    void ResetStats();
+
+    size_t mImageBudget;
+    size_t mGLBudget;
+    CGrBlockImage::Format mCompression;
+    CGrThreadPool *mPool;
+
+private:
+    // Files are identified by the hash and size of their content
+    typedef pair<unsigned long long, unsigned long long> Key;
+
+    struct Entry
+    {
+        CGrTexture mTexture;
+        Key mKey;
+        int mRefs;
+
+        // Set while a thread loads the file. Other threads
+        // that want the texture wait for mLoaded.
+        bool mLoading;
+        bool mFailed;
+        HANDLE mLoaded;
+
+        // Memory counted for this texture
+        size_t mImageBytes;
+        size_t mGLBytes;
+
+        // Place in mUnused while mRefs is 0
+        list<Entry *>::iterator mUnused;
+    };
+
+    // What we know about a file, so unchanged files are not hashed again
+    struct File
+    {
+        unsigned long long mSize;
+        unsigned long long mTime;
+        Key mKey;
+    };
+
+    static wstring Canonical(const wchar_t *filename);
+    static bool HashFile(const wchar_t *filename, Key &key);
+
+    void UpdateBytes(Entry *entry);
+    void Evict();
+    void Remove(Entry *entry);
+    void Unreference(Entry *entry);
+
+    CRITICAL_SECTION mLock;
+
+    map<wstring, File> mFiles;
+    map<Key, Entry *> mEntries;
+    map<const CGrTexture *, Entry *> mTextures;
+
+    // Unreferenced textures, most recently used first
+    list<Entry *> mUnused;
+
+    size_t mImageBytes;
+    size_t mGLBytes;
+    CGrTextureCache::Stats mStats;
+};
+
+
+CGrTextureCachep::CGrTextureCachep(size_t imageBudget, size_t glBudget)
+{
+    InitializeCriticalSection(&mLock);
+    mImageBudget = imageBudget;
+    mGLBudget = glBudget;
+    mCompression = CGrBlockImage::None;
+    mPool = NULL;
+    mImageBytes = 0;
+    mGLBytes = 0;
+    ResetStats();
+}
+
+
+CGrTextureCachep::~CGrTextureCachep()
+{
+    while(!mEntries.empty())
+        Remove(mEntries.begin()->second);
+
+    DeleteCriticalSection(&mLock);
+}
+
+
+//
+// Name :         CGrTextureCachep::Canonical()
+// Description :  A full path for a file name, in lower case since
+//                Windows file names are not case sensitive.
+//
+wstring CGrTextureCachep::Canonical(const wchar_t *filename)
+{
+    vector<wchar_t> path(MAX_PATH);
+    DWORD len = GetFullPathNameW(filename, (DWORD)path.size(), &path[0], NULL);
+    if(len >= path.size())
+    {
+        path.resize(len + 1);
+        len = GetFullPathNameW(filename, (DWORD)path.size(), &path[0], NULL);
+    }
+
+    if(len == 0 || len >= path.size())
+        return filename;
+
+    CharLowerBuffW(&path[0], len);
+    return wstring(&path[0], len);
+}
+
+
+//
+// Name :         CGrTextureCachep::HashFile()
+// Description :  Hash the content of a file. This is FNV-1a taken a
+//                64 bit word at a time, which is plenty to tell image
+//                files apart and much faster than a byte at a time.
+// Returns :      false if the file cannot be read
+//
+bool CGrTextureCachep::HashFile(const wchar_t *filename, Key &key)
+{
+    FILE *file = _wfopen(filename, L"rb");
+    if(file == NULL)
+        return false;
+
+    unsigned long long hash = 14695981039346656037ULL;
+    unsigned long long size = 0;
+
+    vector<unsigned long long> block(8192);
+    while(true)
+    {
+        size_t n = fread(&block[0], 1, block.size() * 8, file);
+        if(n == 0)
+            break;
+
+        // Zero the tail of a partial word
+        if(n % 8 != 0)
+            memset((char *)&block[0] + n, 0, 8 - n % 8);
+
+        for(size_t i=0;  i<(n + 7) / 8;  i++)
+        {
+            hash ^= block[i];
+            hash *= 1099511628211ULL;
+        }
+
+        size += n;
+    }
+
+    fclose(file);
+
+    key = Key(hash, size);
+    return true;
+}
+
+
+//
+// Name :         CGrTextureCachep::Acquire()
+// Description :  Find the texture for a file or load it. The lock
+//                is not held while a file is hashed or loaded, so
+//                other threads can load other files at the same time.
+//
+CGrTexture *CGrTextureCachep::Acquire(const wchar_t *filename)
+{
+    wstring path = Canonical(filename);
+
+    WIN32_FILE_ATTRIBUTE_DATA info;
+    if(!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &info))
+        return NULL;
+
+    unsigned long long size = (unsigned long long)info.nFileSizeHigh << 32 | info.nFileSizeLow;
+    unsigned long long time = (unsigned long long)info.ftLastWriteTime.dwHighDateTime << 32 |
+        info.ftLastWriteTime.dwLowDateTime;
+
+    // Only hash files we have not seen or that have changed
+    EnterCriticalSection(&mLock);
+    map<wstring, File>::iterator f = mFiles.find(path);
+    bool known = f != mFiles.end() && f->second.mSize == size && f->second.mTime == time;
+    Key key = known ? f->second.mKey : Key();
+    LeaveCriticalSection(&mLock);
+
+    if(!known)
+    {
+        if(!HashFile(path.c_str(), key))
+            return NULL;
+
+        EnterCriticalSection(&mLock);
+        File &file = mFiles[path];
+        file.mSize = size;
+        file.mTime = time;
+        file.mKey = key;
+        LeaveCriticalSection(&mLock);
+    }
+
+    EnterCriticalSection(&mLock);
+
+    map<Key, Entry *>::iterator e = mEntries.find(key);
+    if(e != mEntries.end())
+    {
+        Entry *entry = e->second;
+        if(entry->mRefs++ == 0)
+            mUnused.erase(entry->mUnused);
+
+        mStats.mHits++;
+
+        // Another thread may still be loading it
+        if(entry->mLoading)
+        {
+            LeaveCriticalSection(&mLock);
+            WaitForSingleObject(entry->mLoaded, INFINITE);
+            EnterCriticalSection(&mLock);
+        }
+
+        if(entry->mFailed)
+        {
+            Unreference(entry);
+            LeaveCriticalSection(&mLock);
+            return NULL;
+        }
+
+        LeaveCriticalSection(&mLock);
+        return &entry->mTexture;
+    }
+
+    // Not here, so we load it
+    mStats.mMisses++;
+
+    Entry *entry = new Entry();
+    entry->mKey = key;
+    entry->mRefs = 1;
+    entry->mLoading = true;
+    entry->mFailed = false;
+    entry->mLoaded = CreateEvent(NULL, TRUE, FALSE, NULL);
+    entry->mImageBytes = 0;
+    entry->mGLBytes = 0;
+
+    mEntries[key] = entry;
+    mTextures[&entry->mTexture] = entry;
+
+    CGrBlockImage::Format compression = mCompression;
+    CGrThreadPool *pool = mPool;
+
+    LeaveCriticalSection(&mLock);
+
+    bool loaded = entry->mTexture.LoadFile(filename);
+    if(loaded && compression != CGrBlockImage::None)
+        entry->mTexture.Compress(compression, pool);
+
+    EnterCriticalSection(&mLock);
+
+    entry->mLoading = false;
+    SetEvent(entry->mLoaded);
+
+    if(!loaded)
+    {
+        // Take it out now so the next request tries again.
+        // Threads waiting for it let it go when they wake.
+        entry->mFailed = true;
+        mEntries.erase(entry->mKey);
+        mTextures.erase(&entry->mTexture);
+        Unreference(entry);
+        LeaveCriticalSection(&mLock);
+        return NULL;
+    }
+
+    entry->mImageBytes = entry->mTexture.ImageBytes();
+    mImageBytes += entry->mImageBytes;
+    Evict();
+
+    LeaveCriticalSection(&mLock);
+    return &entry->mTexture;
+}
+
+
+//
+// Name :         CGrTextureCachep::Unreference()
+// Description :  Drop a reference with the lock held. A texture that
+//                failed to load is deleted when the last waiting
+//                thread is done with it. Others become unused.
+//
+void CGrTextureCachep::Unreference(Entry *entry)
+{
+    if(--entry->mRefs > 0)
+        return;
+
+    if(entry->mFailed)
+    {
+        CloseHandle(entry->mLoaded);
+        delete entry;
+        return;
+    }
+
+    mUnused.push_front(entry);
+    entry->mUnused = mUnused.begin();
+}
+
+
+void CGrTextureCachep::Release(CGrTexture *texture)
+{
+    if(texture == NULL)
+        return;
+
+    EnterCriticalSection(&mLock);
+
+    map<const CGrTexture *, Entry *>::iterator t = mTextures.find(texture);
+    if(t != mTextures.end())
+    {
+        Entry *entry = t->second;
+        Unreference(entry);
+
+        // It may have built mipmaps or been sent to OpenGL while it was
+        // in use. Only recount it once nobody else can be doing that.
+        if(entry->mRefs == 0)
+        {
+            UpdateBytes(entry);
+            Evict();
+        }
+    }
+
+    LeaveCriticalSection(&mLock);
+}
+
+
+//
+// Name :         CGrTextureCachep::UpdateBytes()
+// Description :  Recount the memory of a texture. Both counts change
+//                after the load: the mipmap levels are built the first
+//                time they are needed and the OpenGL objects the first
+//                time the texture is drawn. The texture must not be
+//                referenced, since whoever has it may be building them.
+//
+void CGrTextureCachep::UpdateBytes(Entry *entry)
+{
+    mImageBytes -= entry->mImageBytes;
+    entry->mImageBytes = entry->mTexture.ImageBytes();
+    mImageBytes += entry->mImageBytes;
+
+    mGLBytes -= entry->mGLBytes;
+    entry->mGLBytes = entry->mTexture.TexNameBytes();
+    mGLBytes += entry->mGLBytes;
+}
+
+
+//
+// Name :         CGrTextureCachep::Evict()
+// Description :  Evict unused textures, least recently used first,
+//                until we are within the budgets. Textures with
+//                OpenGL objects are only touched if this thread has
+//                an OpenGL context. Called with the lock held.
+//
+void CGrTextureCachep::Evict()
+{
+    bool gl = wglGetCurrentContext() != NULL;
+
+    if(gl)
+    {
+        for(list<Entry *>::reverse_iterator u=mUnused.rbegin();  u!=mUnused.rend() && mGLBytes > mGLBudget;  u++)
+        {
+            Entry *entry = *u;
+            if(entry->mGLBytes == 0)
+                continue;
+
+            entry->mTexture.ReleaseTexNames();
+            UpdateBytes(entry);
+            mStats.mGLEvictions++;
+        }
+    }
+
+    list<Entry *>::iterator u = mUnused.end();
+    while(u != mUnused.begin() && mImageBytes > mImageBudget)
+    {
+        Entry *entry = *--u;
+        if(entry->mGLBytes != 0 && !gl)
+            continue;
+
+        // Step past it before it is removed
+        u++;
+        Remove(entry);
+        mStats.mEvictions++;
+    }
+}
+
+
+//
+// Name :         CGrTextureCachep::Remove()
+// Description :  Delete a texture, which must not be referenced
+//                unless the cache is being destroyed.
+//
+void CGrTextureCachep::Remove(Entry *entry)
+{
+    if(entry->mRefs == 0)
+        mUnused.erase(entry->mUnused);
+
+    mEntries.erase(entry->mKey);
+    mTextures.erase(&entry->mTexture);
+
+    mImageBytes -= entry->mImageBytes;
+    mGLBytes -= entry->mGLBytes;
+
+    CloseHandle(entry->mLoaded);
+    delete entry;
+}
+
+
+void CGrTextureCachep::SetBudget(size_t imageBudget, size_t glBudget)
+{
+    EnterCriticalSection(&mLock);
+    mImageBudget = imageBudget;
+    mGLBudget = glBudget;
+    Evict();
+    LeaveCriticalSection(&mLock);
+}
+
+
+void CGrTextureCachep::SetCompression(CGrBlockImage::Format format, CGrThreadPool *pool)
+{
+    EnterCriticalSection(&mLock);
+    mCompression = format;
+    mPool = pool;
+    LeaveCriticalSection(&mLock);
+}
+
+
+void CGrTextureCachep::Trim()
+{
+    EnterCriticalSection(&mLock);
+
+    for(list<Entry *>::iterator u=mUnused.begin();  u!=mUnused.end();  u++)
+        UpdateBytes(*u);
+
+    Evict();
+    LeaveCriticalSection(&mLock);
+}
+
+
+void CGrTextureCachep::Purge()
+{
+    EnterCriticalSection(&mLock);
+
+    bool gl = wglGetCurrentContext() != NULL;
+    list<Entry *>::iterator u = mUnused.begin();
+    while(u != mUnused.end())
+    {
+        Entry *entry = *u++;
+        if(entry->mGLBytes == 0 || gl)
+            Remove(entry);
+    }
+
+    LeaveCriticalSection(&mLock);
+}
+
+
+CGrTextureCache::Stats CGrTextureCachep::GetStats()
+{
+    EnterCriticalSection(&mLock);
+    CGrTextureCache::Stats stats = mStats;
+    stats.mTextures = (int)mEntries.size();
+    stats.mUnused = (int)mUnused.size();
+    stats.mImageBytes = mImageBytes;
+    stats.mGLBytes = mGLBytes;
+    LeaveCriticalSection(&mLock);
+
+    return stats;
+}
+
+
+void CGrTextureCachep::ResetStats()
+{
+    EnterCriticalSection(&mLock);
+    mStats.mHits = 0;
+    mStats.mMisses = 0;
+    mStats.mEvictions = 0;
+    mStats.mGLEvictions = 0;
+    mStats.mTextures = 0;
+    mStats.mUnused = 0;
+    mStats.mImageBytes = 0;
+    mStats.mGLBytes = 0;
+    LeaveCriticalSection(&mLock);
+}
+
+//! \endcond
+
+
+//
+// CGrTextureCache
+//
+
+// The cache shared by the process. It is constructed when the library
+// is loaded, before any model can use it.
+static CGrTextureCache SharedCache;
+
+CGrTextureCache::CGrTextureCache(size_t imageBudget, size_t glBudget)
+{
+    mCache = new CGrTextureCachep(imageBudget, glBudget);
+}
+
+CGrTextureCache::~CGrTextureCache()
+{
+    delete mCache;
+}
+
+CGrTextureCache &CGrTextureCache::GetShared() {return SharedCache;}
+
+CGrTexture *CGrTextureCache::Acquire(const wchar_t *filename) {return mCache->Acquire(filename);}
+void CGrTextureCache::Release(CGrTexture *texture) {mCache->Release(texture);}
+void CGrTextureCache::SetBudget(size_t imageBudget, size_t glBudget) {mCache->SetBudget(imageBudget, glBudget);}
+size_t CGrTextureCache::GetImageBudget() const {return mCache->mImageBudget;}
+size_t CGrTextureCache::GetGLBudget() const {return mCache->mGLBudget;}
+void CGrTextureCache::SetCompression(CGrBlockImage::Format format, CGrThreadPool *pool) {mCache->SetCompression(format, pool);}
+CGrBlockImage::Format CGrTextureCache::GetCompression() const {return mCache->mCompression;}
+void CGrTextureCache::Trim() {mCache->Trim();}
+void CGrTextureCache::Purge() {mCache->Purge();}
+CGrTextureCache::Stats CGrTextureCache::GetStats() const {return mCache->GetStats();}
+void CGrTextureCache::ResetStats() {mCache->ResetStats();}
@@ -0,0 +1,137 @@
+//
+// Name :         GrTextureCache.h
+// Description :  Header for CGrTextureCache, a shared cache of
+//                textures loaded from files.
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+#pragma once
+
+#if !defined(_GRTEXTURECACHE_H)
+#define _GRTEXTURECACHE_H
+
+#if !defined(LibGrafx)
+#define LibGrafx
+#endif
+
+#include "GrBlockImage.h"
+
+class CGrTexture;
+class CGrTextureCachep;
+class CGrThreadPool;
+
+//! A shared cache of textures loaded from files.
+
+/*! Acquire() returns the texture for a file, loading the file only if
+the cache does not have it already, and Release() gives the texture
+back. The textures are reference counted, so every model that uses a
+file shares one copy of the image and one set of OpenGL objects.
+
+A file name is made into a full path first, so different names for one
+file find the same texture. The content of the file is hashed as well,
+and identical files under different names share a texture too. A file
+that changes is loaded again.
+
+A texture that is no longer referenced stays in the cache in case it
+is needed again. When the cache goes over its budget, the least
+recently used of those textures are evicted. There are two budgets,
+one for the images in memory and one for the OpenGL texture objects.
+Going over the OpenGL budget releases the OpenGL objects of
+unreferenced textures but keeps their images, so they can be sent to
+OpenGL again without reading the file. Going over the memory budget
+removes unreferenced textures entirely.
+
+All of the functions may be called from any thread. OpenGL objects
+are only released on a thread with a current OpenGL context. Other
+threads skip textures that have them, so the cache can stay over its
+budget until the next call on the OpenGL thread.
+
+The cache can block compress textures as it loads them, which is a
+good deal less memory for both budgets. See SetCompression().
+
+CGrModelX loads its textures through GetShared().
+
+\version 1.00 Initial version
+*/
+
+class LibGrafx CGrTextureCache
+{
+public:
+    //! Counters for the cache activity
+    struct Stats
+    {
+        unsigned long long mHits;           //!< Acquire() calls that found the texture
+        unsigned long long mMisses;         //!< Acquire() calls that loaded a file
+        unsigned long long mEvictions;      //!< Textures removed to stay within the memory budget
+        unsigned long long mGLEvictions;    //!< OpenGL objects released to stay within the OpenGL budget
+        int mTextures;                      //!< Textures in the cache
+        int mUnused;                        //!< Textures in the cache nobody references
+        size_t mImageBytes;                 //!< Memory used by the images, as of their last release
+        size_t mGLBytes;                    //!< Estimated memory used by the OpenGL objects, as of their last release
+    };
+
+    //! Constructor
+    /*! \param imageBudget Bytes of memory for the images
+        \param glBudget Bytes of memory for the OpenGL objects */
+    CGrTextureCache(size_t imageBudget=256 << 20, size_t glBudget=256 << 20);
+
+    //! Destructor. Any textures still referenced are destroyed as well.
+    virtual ~CGrTextureCache();
+
+    //! The cache shared by the whole process
+    static CGrTextureCache &GetShared();
+
+    //! Get the texture for a file
+    /*! \param filename The image file
+        \return The texture or NULL if the file could not be loaded.
+        Pass it to Release() when it is no longer needed. */
+    CGrTexture *Acquire(const wchar_t *filename);
+
+    //! Give back a texture from Acquire()
+    /*! \param texture The texture. NULL is ignored. */
+    void Release(CGrTexture *texture);
+
+    //! Set the budgets
+    /*! \param imageBudget Bytes of memory for the images
+        \param glBudget Bytes of memory for the OpenGL objects */
+    void SetBudget(size_t imageBudget, size_t glBudget);
+
+    size_t GetImageBudget() const;
+    size_t GetGLBudget() const;
+
+    //! Compress textures as they are loaded
+    /*! Textures already in the cache are left as they are.
+        \param format The block format, or CGrBlockImage::None to keep them uncompressed
+        \param pool Threads to compress with, or NULL to use the loading thread only.
+        It must last as long as the cache uses it. */
+    void SetCompression(CGrBlockImage::Format format, CGrThreadPool *pool=NULL);
+
+    CGrBlockImage::Format GetCompression() const;
+
+    //! Evict textures until the cache is within its budgets
+    /*! The memory used changes as textures are drawn and their
+        mipmap levels are built. A texture in use is counted again when
+        it is released, and an unused one when this is called, so this
+        is worth calling now and then on the OpenGL thread. */
+    void Trim();
+
+    //! Remove every texture that is not referenced
+    void Purge();
+
+    //! Get the counters and the memory in use
+    Stats GetStats() const;
+
+    //! Set the hit, miss, and eviction counters to zero
+    void ResetStats();
+
+private:
+    CGrTextureCache(const CGrTextureCache &);
+    CGrTextureCache &operator=(const CGrTextureCache &);
+
+    CGrTextureCachep *mCache;
+};
+
+#endif
@@ -0,0 +1,603 @@
+//
+//  Name :         GrTextureSampler.cpp
+//  Description :  Implementation of the CGrTextureSampler class.
+//  Version :      See GrTextureSampler.h
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+
+#include <stdafx.h>
+#include "GrTexture.h"
+#include "GrTextureSampler.h"
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define GRSAMPLER_SSE2
+#endif
+
+using namespace std;
+
+#ifdef _DEBUG
+#undef THIS_FILE
+static char THIS_FILE[]=__FILE__;
+#define new DEBUG_NEW
+#endif
+
+//! \cond ignore
+
+// Tiles are 8 by 8 texels of 4 bytes
+const int TileShift = 3;
+const int TileBytes = 256;
+
+// A 3 bit coordinate with its bits spread to every other bit,
+// so x | y << 1 is the Morton order of a texel in a tile
+static const int MortonBits[8] = {0, 1, 4, 5, 16, 17, 20, 21};
+
+// One mipmap level as the sampler sees it
+struct SamplerLevel
+{
+    const unsigned char *mRows;     // Rows of the texture level
+    int mPitch;
+    const CGrBlockImage *mBlocks;   // Compressed level, or NULL to use mRows
+    unsigned char *mTiles;          // Tiled copy, or NULL
+    int mTilesAcross;
+    int mWidth;
+    int mHeight;
+
+    // Where a texel is in the tiled copy
+    size_t TileOffset(int x, int y) const
+    {
+        return size_t((y >> TileShift) * mTilesAcross + (x >> TileShift)) * TileBytes
+            + (MortonBits[x & 7] | (MortonBits[y & 7] << 1)) * 4;
+    }
+
+    // B, G, R of a texel in the low three bytes. The high byte
+    // is not used.
+    unsigned Texel32(int x, int y) const
+    {
+        if(mTiles != NULL)
+        {
+            unsigned v;
+            memcpy(&v, mTiles + TileOffset(x, y), 4);
+            return v;
+        }
+
+        if(mBlocks != NULL)
+            return mBlocks->DecodeTexel(x, y);
+
+        // A texel in the rows may be the last three bytes of the image
+        const unsigned char *p = mRows + y * mPitch + x * 3;
+        return p[0] | (p[1] << 8) | (p[2] << 16);
+    }
+};
+
+
+//
+// Private implementation of the sampler
+//
+
+class CGrTextureSamplerp
+{
+public:
+    CGrTextureSamplerp();
+    ~CGrTextureSamplerp();
+
+    void SetTexture(CGrTexture *texture, bool tiled);
+    void Release();
+
+    int NearestLevel(float lod) const;
+    void TrilinearLevels(float lod, int &level, float &f) const;
+
+    void Nearest(const SamplerLevel &level, float s, float t, float *bgr) const;
+    void Bilinear(const SamplerLevel &level, float s, float t, float *bgr) const;
+    void Bilinear4(const SamplerLevel *const *levels, const float *s, const float *t, float (*bgrx)[4]) const;
+
+    CGrTexture *mTexture;
+    bool mTiled;
+    CGrTextureSampler::Filter mFilter;
+    CGrTextureSampler::Wrap mWrapS;
+    CGrTextureSampler::Wrap mWrapT;
+    vector<SamplerLevel> mLevels;
+};
+
+
+//
+// Name :         WrapCoord()
+// Description :  A coordinate brought into 0 to 1 by the wrap mode.
+//                Written so a NaN ends up 0.
+//
+
+inline float WrapCoord(float s, CGrTextureSampler::Wrap wrap)
+{
+    if(wrap == CGrTextureSampler::Repeat)
+        s -= floor(s);
+
+    return s > 0 ? (s < 1 ? s : 1) : 0;
+}
+
+
+// The texel a coordinate is in
+inline int NearestCoord(float s, CGrTextureSampler::Wrap wrap, int size)
+{
+    int i = int(WrapCoord(s, wrap) * size);
+    return i < size ? i : size - 1;
+}
+
+
+//
+// Name :         BilinearCoord()
+// Description :  The two texels on either side of a coordinate and the
+//                weight of the second.
+//
+
+inline void BilinearCoord(float s, CGrTextureSampler::Wrap wrap, int size, int &i0, int &i1, float &f)
+{
+    float u = WrapCoord(s, wrap) * size - 0.5f;
+    float fl = floor(u);
+    f = u - fl;
+    i0 = int(fl);
+    i1 = i0 + 1;
+
+    if(i0 < 0)
+        i0 = wrap == CGrTextureSampler::Repeat ? size - 1 : 0;
+    if(i1 >= size)
+        i1 = wrap == CGrTextureSampler::Repeat ? 0 : size - 1;
+}
+
+
+#ifdef GRSAMPLER_SSE2
+
+//
+// Name :         Floor4()
+// Description :  floor() of four floats. The conversion to int only
+//                works within the range of an int, so values of 2^23
+//                or more, which are whole numbers already, and NaNs
+//                are passed through as they are.
+//
+
+inline __m128 Floor4(__m128 v)
+{
+    __m128 i = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+    i = _mm_sub_ps(i, _mm_and_ps(_mm_cmpgt_ps(i, v), _mm_set1_ps(1.f)));
+
+    __m128 inRange = _mm_cmplt_ps(_mm_andnot_ps(_mm_set1_ps(-0.f), v), _mm_set1_ps(8388608.f));
+    return _mm_or_ps(_mm_and_ps(inRange, i), _mm_andnot_ps(inRange, v));
+}
+
+// The B, G, R, and unused bytes of a texel as floats
+inline __m128 Unpack4(unsigned texel)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i v = _mm_unpacklo_epi8(_mm_cvtsi32_si128(int(texel)), zero);
+    return _mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero));
+}
+
+inline __m128i Select4(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+
+//
+// Name :         BilinearCoord4()
+// Description :  BilinearCoord() for four coordinates at once.
+//
+
+static void BilinearCoord4(const float *s, CGrTextureSampler::Wrap wrap, const int *sizes, int *i0, int *i1, float *f)
+{
+    const __m128 zero = _mm_setzero_ps();
+    __m128 v = _mm_loadu_ps(s);
+    if(wrap == CGrTextureSampler::Repeat)
+        v = _mm_sub_ps(v, Floor4(v));
+
+    // max() with the value first so a NaN becomes 0
+    v = _mm_min_ps(_mm_max_ps(v, zero), _mm_set1_ps(1.f));
+
+    __m128i size = _mm_loadu_si128((const __m128i *)sizes);
+    __m128 u = _mm_sub_ps(_mm_mul_ps(v, _mm_cvtepi32_ps(size)), _mm_set1_ps(0.5f));
+    __m128 fl = Floor4(u);
+    _mm_storeu_ps(f, _mm_sub_ps(u, fl));
+
+    __m128i a = _mm_cvttps_epi32(fl);
+    __m128i b = _mm_add_epi32(a, _mm_set1_epi32(1));
+    __m128i last = _mm_sub_epi32(size, _mm_set1_epi32(1));
+    __m128i under = _mm_cmplt_epi32(a, _mm_setzero_si128());
+    __m128i over = _mm_cmpgt_epi32(b, last);
+    if(wrap == CGrTextureSampler::Repeat)
+    {
+        a = Select4(under, last, a);
+        b = Select4(over, _mm_setzero_si128(), b);
+    }
+    else
+    {
+        a = Select4(under, _mm_setzero_si128(), a);
+        b = Select4(over, last, b);
+    }
+
+    _mm_storeu_si128((__m128i *)i0, a);
+    _mm_storeu_si128((__m128i *)i1, b);
+}
+
+#endif
+
+
+CGrTextureSamplerp::CGrTextureSamplerp()
+{
+    mTexture = NULL;
+    mTiled = false;
+    mFilter = CGrTextureSampler::Bilinear;
+    mWrapS = CGrTextureSampler::Repeat;
+    mWrapT = CGrTextureSampler::Repeat;
+}
+
+
+CGrTextureSamplerp::~CGrTextureSamplerp()
+{
+    Release();
+}
+
+
+void CGrTextureSamplerp::Release()
+{
+    for(vector<SamplerLevel>::iterator l=mLevels.begin();  l!=mLevels.end();  l++)
+    {
+        if(l->mTiles != NULL)
+            CGrImageKernels::Free(l->mTiles);
+    }
+
+    mLevels.clear();
+    mTexture = NULL;
+    mTiled = false;
+}
+
+
+//
+// Name :         CGrTextureSamplerp::SetTexture()
+// Description :  Describe each mipmap level, and copy each one into
+//                tiles if asked to. The tiles are allocated to the
+//                cache line, so each 4 by 4 Morton block is one line.
+//                A compressed texture is sampled from its blocks, or
+//                decoded into the tiles.
+//
+
+void CGrTextureSamplerp::SetTexture(CGrTexture *texture, bool tiled)
+{
+    Release();
+    if(texture == NULL || texture->IsEmpty())
+        return;
+
+    mTexture = texture;
+    mTiled = tiled;
+    texture->BuildMipmaps();
+
+    bool compressed = texture->IsCompressed();
+    mLevels.resize(texture->GetMipLevels());
+    for(int i=0;  i<(int)mLevels.size();  i++)
+    {
+        const CGrImageBgr8 &image = texture->GetMipLevel(i);
+        const CGrBlockImage &blocks = texture->GetBlockLevel(i);
+        SamplerLevel &level = mLevels[i];
+        level.mRows = image.GetData();
+        level.mPitch = image.GetPitch();
+        level.mBlocks = compressed ? &blocks : NULL;
+        level.mWidth = compressed ? blocks.GetWidth() : image.GetWidth();
+        level.mHeight = compressed ? blocks.GetHeight() : image.GetHeight();
+        level.mTiles = NULL;
+        level.mTilesAcross = (level.mWidth + 7) >> TileShift;
+        if(!tiled)
+            continue;
+
+        int tilesDown = (level.mHeight + 7) >> TileShift;
+        size_t bytes = size_t(level.mTilesAcross) * tilesDown * TileBytes;
+        unsigned char *tiles = (unsigned char *)CGrImageKernels::Allocate(bytes);
+        memset(tiles, 0, bytes);
+
+        for(int y=0;  y<level.mHeight;  y++)
+        {
+            for(int x=0;  x<level.mWidth;  x++)
+            {
+                unsigned texel = level.Texel32(x, y) & 0xffffff;
+                memcpy(tiles + level.TileOffset(x, y), &texel, 4);
+            }
+        }
+
+        level.mTiles = tiles;
+    }
+}
+
+
+int CGrTextureSamplerp::NearestLevel(float lod) const
+{
+    int last = (int)mLevels.size() - 1;
+    int level = lod > 0 ? int(lod + 0.5f) : 0;
+    return level < last ? level : last;
+}
+
+
+//
+// Name :         CGrTextureSamplerp::TrilinearLevels()
+// Description :  The level below the level of detail and the weight
+//                of the one after it.
+//
+
+void CGrTextureSamplerp::TrilinearLevels(float lod, int &level, float &f) const
+{
+    int last = (int)mLevels.size() - 1;
+    if(!(lod > 0))
+    {
+        level = 0;
+        f = 0;
+    }
+    else if(lod >= last)
+    {
+        level = last;
+        f = 0;
+    }
+    else
+    {
+        level = int(lod);
+        f = lod - level;
+    }
+}
+
+
+void CGrTextureSamplerp::Nearest(const SamplerLevel &level, float s, float t, float *bgr) const
+{
+    unsigned texel = level.Texel32(NearestCoord(s, mWrapS, level.mWidth),
+        NearestCoord(t, mWrapT, level.mHeight));
+
+    bgr[0] = float(texel & 0xff);
+    bgr[1] = float((texel >> 8) & 0xff);
+    bgr[2] = float((texel >> 16) & 0xff);
+}
+
+
+void CGrTextureSamplerp::Bilinear(const SamplerLevel &level, float s, float t, float *bgr) const
+{
+    int x0, x1, y0, y1;
+    float fx, fy;
+    BilinearCoord(s, mWrapS, level.mWidth, x0, x1, fx);
+    BilinearCoord(t, mWrapT, level.mHeight, y0, y1, fy);
+
+    unsigned a = level.Texel32(x0, y0);
+    unsigned b = level.Texel32(x1, y0);
+    unsigned c = level.Texel32(x0, y1);
+    unsigned d = level.Texel32(x1, y1);
+    for(int i=0;  i<3;  i++, a >>= 8, b >>= 8, c >>= 8, d >>= 8)
+    {
+        int ai = a & 0xff, bi = b & 0xff, ci = c & 0xff, di = d & 0xff;
+        float bottom = ai + (bi - ai) * fx;
+        float top = ci + (di - ci) * fx;
+        bgr[i] = bottom + (top - bottom) * fy;
+    }
+}
+
+
+//
+// Name :         CGrTextureSamplerp::Bilinear4()
+// Description :  Bilinear() for four coordinates at once, each on its
+//                own level. The coordinates are worked out for all four
+//                together, then each lane filters its B, G, and R
+//                together. The result is bgrx[lane][channel].
+//
+
+void CGrTextureSamplerp::Bilinear4(const SamplerLevel *const *levels, const float *s, const float *t, float (*bgrx)[4]) const
+{
+#ifdef GRSAMPLER_SSE2
+    int widths[4], heights[4];
+    for(int j=0;  j<4;  j++)
+    {
+        widths[j] = levels[j]->mWidth;
+        heights[j] = levels[j]->mHeight;
+    }
+
+    int x0[4], x1[4], y0[4], y1[4];
+    float fx[4], fy[4];
+    BilinearCoord4(s, mWrapS, widths, x0, x1, fx);
+    BilinearCoord4(t, mWrapT, heights, y0, y1, fy);
+
+    for(int j=0;  j<4;  j++)
+    {
+        const SamplerLevel &level = *levels[j];
+        __m128 a = Unpack4(level.Texel32(x0[j], y0[j]));
+        __m128 b = Unpack4(level.Texel32(x1[j], y0[j]));
+        __m128 c = Unpack4(level.Texel32(x0[j], y1[j]));
+        __m128 d = Unpack4(level.Texel32(x1[j], y1[j]));
+
+        __m128 wx = _mm_set1_ps(fx[j]);
+        __m128 bottom = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), wx));
+        __m128 top = _mm_add_ps(c, _mm_mul_ps(_mm_sub_ps(d, c), wx));
+        _mm_storeu_ps(bgrx[j], _mm_add_ps(bottom, _mm_mul_ps(_mm_sub_ps(top, bottom), _mm_set1_ps(fy[j]))));
+    }
+#else
+    for(int j=0;  j<4;  j++)
+    {
+        Bilinear(*levels[j], s[j], t[j], bgrx[j]);
+        bgrx[j][3] = 0;
+    }
+#endif
+}
+
+//! \endcond
+
+
+CGrTextureSampler::CGrTextureSampler()
+{
+    mSampler = new CGrTextureSamplerp;
+}
+
+
+CGrTextureSampler::CGrTextureSampler(CGrTexture *texture, Filter filter, Wrap wrap, bool tiled)
+{
+    mSampler = new CGrTextureSamplerp;
+    mSampler->mFilter = filter;
+    mSampler->mWrapS = wrap;
+    mSampler->mWrapT = wrap;
+    mSampler->SetTexture(texture, tiled);
+}
+
+
+CGrTextureSampler::~CGrTextureSampler()
+{
+    delete mSampler;
+}
+
+
+void CGrTextureSampler::SetTexture(CGrTexture *texture, bool tiled) {mSampler->SetTexture(texture, tiled);}
+CGrTexture *CGrTextureSampler::GetTexture() const {return mSampler->mTexture;}
+bool CGrTextureSampler::IsTiled() const {return mSampler->mTiled;}
+
+void CGrTextureSampler::SetFilter(Filter filter) {mSampler->mFilter = filter;}
+CGrTextureSampler::Filter CGrTextureSampler::GetFilter() const {return mSampler->mFilter;}
+
+void CGrTextureSampler::SetWrap(Wrap wrapS, Wrap wrapT)
+{
+    mSampler->mWrapS = wrapS;
+    mSampler->mWrapT = wrapT;
+}
+
+CGrTextureSampler::Wrap CGrTextureSampler::GetWrapS() const {return mSampler->mWrapS;}
+CGrTextureSampler::Wrap CGrTextureSampler::GetWrapT() const {return mSampler->mWrapT;}
+
+int CGrTextureSampler::GetLevels() const {return (int)mSampler->mLevels.size();}
+
+
+float CGrTextureSampler::GetLod(float dsdx, float dtdx, float dsdy, float dtdy) const
+{
+    if(mSampler->mLevels.empty())
+        return 0;
+
+    float w = float(mSampler->mLevels[0].mWidth);
+    float h = float(mSampler->mLevels[0].mHeight);
+    float x = dsdx * dsdx * w * w + dtdx * dtdx * h * h;
+    float y = dsdy * dsdy * w * w + dtdy * dtdy * h * h;
+    float rho2 = x > y ? x : y;
+
+    // log2(sqrt(rho2))
+    return rho2 > 0 ? 0.72134752f * log(rho2) : -100.f;
+}
+
+
+void CGrTextureSampler::Sample(float s, float t, float lod, float *color) const
+{
+    const CGrTextureSamplerp &p = *mSampler;
+    if(p.mLevels.empty())
+    {
+        color[0] = color[1] = color[2] = 1;
+        return;
+    }
+
+    float bgr[3];
+    switch(p.mFilter)
+    {
+    case Nearest:
+        p.Nearest(p.mLevels[p.NearestLevel(lod)], s, t, bgr);
+        break;
+
+    case Bilinear:
+        p.Bilinear(p.mLevels[p.NearestLevel(lod)], s, t, bgr);
+        break;
+
+    case Trilinear:
+        {
+            int level;
+            float f;
+            p.TrilinearLevels(lod, level, f);
+            p.Bilinear(p.mLevels[level], s, t, bgr);
+            if(f > 0)
+            {
+                float next[3];
+                p.Bilinear(p.mLevels[level + 1], s, t, next);
+                for(int i=0;  i<3;  i++)
+                    bgr[i] += (next[i] - bgr[i]) * f;
+            }
+        }
+        break;
+    }
+
+    color[0] = bgr[2] * (1.f / 255.f);
+    color[1] = bgr[1] * (1.f / 255.f);
+    color[2] = bgr[0] * (1.f / 255.f);
+}
+
+
+//
+// Name :         CGrTextureSampler::SampleBatch()
+// Description :  The batch is done four lanes at a time. A short batch
+//                is padded with copies of the first lookup.
+//
+
+void CGrTextureSampler::SampleBatch(const float *s, const float *t, const float *lod, float (*colors)[3], int count) const
+{
+    const CGrTextureSamplerp &p = *mSampler;
+    if(count > BatchSize)
+        count = BatchSize;
+
+    if(count <= 0)
+        return;
+
+    if(p.mLevels.empty() || p.mFilter == Nearest)
+    {
+        for(int j=0;  j<count;  j++)
+            Sample(s[j], t[j], lod != NULL ? lod[j] : 0.f, colors[j]);
+
+        return;
+    }
+
+    float ls[BatchSize], lt[BatchSize], f[BatchSize];
+    const SamplerLevel *levels[BatchSize];
+    const SamplerLevel *next[BatchSize];
+    bool blend = false;
+    for(int j=0;  j<BatchSize;  j++)
+    {
+        int k = j < count ? j : 0;
+        ls[j] = s[k];
+        lt[j] = t[k];
+
+        float d = lod != NULL ? lod[k] : 0.f;
+        int level;
+        if(p.mFilter == Trilinear)
+        {
+            p.TrilinearLevels(d, level, f[j]);
+            blend = blend || f[j] > 0;
+            next[j] = &p.mLevels[f[j] > 0 ? level + 1 : level];
+        }
+        else
+        {
+            level = p.NearestLevel(d);
+            f[j] = 0;
+        }
+
+        levels[j] = &p.mLevels[level];
+    }
+
+    for(int g=0;  g<count;  g+=4)
+    {
+        float bgrx[4][4];
+        p.Bilinear4(levels + g, ls + g, lt + g, bgrx);
+
+        if(blend)
+        {
+            float upper[4][4];
+            p.Bilinear4(next + g, ls + g, lt + g, upper);
+            for(int j=0;  j<4;  j++)
+            {
+                for(int i=0;  i<3;  i++)
+                    bgrx[j][i] += (upper[j][i] - bgrx[j][i]) * f[g + j];
+            }
+        }
+
+        for(int j=0;  j<4 && g + j<count;  j++)
+        {
+            colors[g + j][0] = bgrx[j][2] * (1.f / 255.f);
+            colors[g + j][1] = bgrx[j][1] * (1.f / 255.f);
+            colors[g + j][2] = bgrx[j][0] * (1.f / 255.f);
+        }
+    }
+}
@@ -0,0 +1,142 @@
+//
+// Name :         GrTextureSampler.h
+// Description :  Header for CGrTextureSampler, filtered texture
+//                lookups on the CPU.
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+#pragma once
+
+#if !defined(_GRTEXTURESAMPLER_H)
+#define _GRTEXTURESAMPLER_H
+
+#if !defined(LibGrafx)
+#define LibGrafx
+#endif
+
+class CGrTexture;
+class CGrTextureSamplerp;
+
+//! Filtered lookups into a CGrTexture for renderers that do not use OpenGL.
+
+/*! Texture coordinates work the way they do in OpenGL. (0, 0) is the
+bottom left corner of row 0, (1, 1) is the top right corner of the last
+row, and texel centers are at half texel offsets. Colors are returned
+as R, G, and B from 0 to 1.
+
+The level of detail is the mipmap level to sample, where 0 is the image
+itself and each level after is half the size. Nearest and Bilinear
+sample the level closest to it. Trilinear samples the two levels on
+either side of it and blends between them.
+
+The sampler can keep its own tiled copy of the texture. The tiles are
+8 by 8 texels of 4 bytes, and within a tile the texels are in Morton
+order, so each 4 by 4 block of texels is one 64 byte cache line. A
+bilinear lookup then touches one cache line more often than not, where
+the rows of the texture itself put the two pairs of texels it needs
+a whole row apart. That matters for rays that bounce, which hit the
+texture in no particular order.
+
+A texture kept block compressed with CGrTexture::Compress() is sampled
+from its blocks, decoding only the texels each lookup needs, so it
+stays compressed in memory. A tiled copy of it is decoded.
+
+Once the texture is set, the sampler does not change, so any number of
+threads can sample with it at once. The texture must not change while
+it is in use.
+
+\version 1.00 Initial version
+*/
+
+class LibGrafx CGrTextureSampler
+{
+public:
+    //! How texels are filtered
+    enum Filter {Nearest, Bilinear, Trilinear};
+
+    //! What happens to coordinates outside of 0 to 1
+    enum Wrap {Repeat, Clamp};
+
+    //! Number of lookups done together by SampleBatch()
+    enum {BatchSize = 8};
+
+    //! Constructor. The sampler has no texture.
+    CGrTextureSampler();
+
+    //! Constructor
+    /*! \param texture The texture to sample. See SetTexture().
+        \param filter How texels are filtered
+        \param wrap What happens to coordinates outside of 0 to 1
+        \param tiled Make a tiled copy of the texture? */
+    CGrTextureSampler(CGrTexture *texture, Filter filter=Bilinear, Wrap wrap=Repeat, bool tiled=false);
+
+    virtual ~CGrTextureSampler();
+
+    //! Set the texture to sample
+    /*! Builds the mipmap levels of the texture if it does not have
+        them yet and makes the tiled copy, if there is to be one.
+        \param texture The texture, or NULL for none
+        \param tiled Make a tiled copy of the texture? */
+    void SetTexture(CGrTexture *texture, bool tiled=false);
+
+    //! The texture sampled, or NULL
+    CGrTexture *GetTexture() const;
+
+    //! Is there a tiled copy of the texture?
+    bool IsTiled() const;
+
+    void SetFilter(Filter filter);
+    Filter GetFilter() const;
+
+    //! Set the wrap mode for both coordinates
+    void SetWrap(Wrap wrap) {SetWrap(wrap, wrap);}
+
+    //! Set the wrap mode for each coordinate
+    /*! \param wrapS Wrap mode across the rows
+        \param wrapT Wrap mode down the columns */
+    void SetWrap(Wrap wrapS, Wrap wrapT);
+
+    Wrap GetWrapS() const;
+    Wrap GetWrapT() const;
+
+    //! Number of mipmap levels that can be sampled
+    int GetLevels() const;
+
+    //! Level of detail for a footprint on the texture
+    /*! This picks the level the way OpenGL does, as the base 2 log of
+        the longer side of the footprint in texels of the image itself.
+        \param dsdx Change in s for a step across the image
+        \param dtdx Change in t for a step across the image
+        \param dsdy Change in s for a step up the image
+        \param dtdy Change in t for a step up the image
+        \return The level of detail. Less than 0 is magnified. */
+    float GetLod(float dsdx, float dtdx, float dsdy, float dtdy) const;
+
+    //! Sample the texture
+    /*! \param s Texture coordinate across the rows
+        \param t Texture coordinate down the columns
+        \param lod Level of detail
+        \param color Returned R, G, and B. White if there is no texture. */
+    void Sample(float s, float t, float lod, float *color) const;
+
+    //! Sample the texture at BatchSize coordinates at once
+    /*! The coordinate and filter weight arithmetic is done for the
+        whole batch with vector instructions.
+        \param s BatchSize texture coordinates across the rows
+        \param t BatchSize texture coordinates down the columns
+        \param lod BatchSize levels of detail, or NULL for level 0
+        \param colors Returned R, G, and B for each coordinate
+        \param count Lookups to do, up to BatchSize */
+    void SampleBatch(const float *s, const float *t, const float *lod, float (*colors)[3], int count=BatchSize) const;
+
+private:
+    CGrTextureSampler(const CGrTextureSampler &);
+    CGrTextureSampler &operator=(const CGrTextureSampler &);
+
+    CGrTextureSamplerp *mSampler;
+};
+
+#endif
@@ -0,0 +1,320 @@
+//
+//  Name :         GrThreadPool.cpp
+//  Description :  Implementation of the CGrThreadPool class.
+//  Version :      See GrThreadPool.h
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+
+#include <stdafx.h>
+#include "GrThreadPool.h"
+#include <process.h>
+#include <deque>
+
+using namespace std;
+
+#ifdef _DEBUG
+#undef THIS_FILE
+static char THIS_FILE[]=__FILE__;
+#define new DEBUG_NEW
+#endif
+
+//! \cond ignore
+
+//
+// Private implementation of the thread pool
+//
+
+class CGrThreadPoolp
+{
+public:
+    CGrThreadPoolp(int numThreads);
+    ~CGrThreadPoolp();
+
+    int GetNumThreads() const {return (int)mQueues.size();}
+    void Run(CGrThreadPool::ITask **tasks, int count);
+
+private:
+    // A group of tasks submitted together by Run()
+    struct Batch
+    {
+        volatile LONG mRemaining;
+        HANDLE mDone;
+    };
+
+    struct Job
+    {
+        CGrThreadPool::ITask *mTask;
+        Batch *mBatch;
+    };
+
+    // One queue per worker. The owner takes from the front,
+    // thieves take from the back.
+    struct Queue
+    {
+        Queue() {InitializeCriticalSection(&mLock);  mCount = 0;}
+        ~Queue() {DeleteCriticalSection(&mLock);}
+
+        CRITICAL_SECTION mLock;
+        deque<Job> mJobs;
+
+        // Size of mJobs, readable without the lock
+        volatile LONG mCount;
+    };
+
+    struct Worker
+    {
+        CGrThreadPoolp *mPool;
+        int mIndex;
+    };
+
+    static unsigned __stdcall ThreadProc(void *param);
+    void WorkerLoop(int index);
+
+    bool FindJob(int index, Job &job);
+    void RunJob(const Job &job, int index);
+
+    vector<HANDLE> mThreads;
+    vector<Worker> mWorkers;
+    vector<Queue *> mQueues;
+
+    // Counts submitted jobs so sleeping workers wake to look for them
+    HANDLE mWake;
+
+    volatile LONG mShutdown;
+};
+
+
+CGrThreadPoolp::CGrThreadPoolp(int numThreads)
+{
+    mShutdown = 0;
+    mWake = CreateSemaphore(NULL, 0, 0x7fffffff, NULL);
+
+    mWorkers.resize(numThreads);
+    for(int i=0;  i<numThreads;  i++)
+    {
+        mQueues.push_back(new Queue());
+        mWorkers[i].mPool = this;
+        mWorkers[i].mIndex = i;
+    }
+
+    for(int i=0;  i<numThreads;  i++)
+    {
+        HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, ThreadProc, &mWorkers[i], 0, NULL);
+        if(thread != NULL)
+            mThreads.push_back(thread);
+    }
+}
+
+
+CGrThreadPoolp::~CGrThreadPoolp()
+{
+    InterlockedExchange(&mShutdown, 1);
+    ReleaseSemaphore(mWake, (LONG)mThreads.size(), NULL);
+
+    for(vector<HANDLE>::iterator t=mThreads.begin();  t!=mThreads.end();  t++)
+    {
+        WaitForSingleObject(*t, INFINITE);
+        CloseHandle(*t);
+    }
+
+    for(vector<Queue *>::iterator q=mQueues.begin();  q!=mQueues.end();  q++)
+        delete *q;
+
+    CloseHandle(mWake);
+}
+
+
+unsigned __stdcall CGrThreadPoolp::ThreadProc(void *param)
+{
+    Worker *worker = (Worker *)param;
+    worker->mPool->WorkerLoop(worker->mIndex);
+    return 0;
+}
+
+
+//
+// Name :         CGrThreadPoolp::WorkerLoop()
+// Description :  Run jobs until there are none left to find, then
+//                sleep until more are submitted.
+//
+void CGrThreadPoolp::WorkerLoop(int index)
+{
+    while(!mShutdown)
+    {
+        Job job;
+        if(FindJob(index, job))
+        {
+            RunJob(job, index);
+            continue;
+        }
+
+        WaitForSingleObject(mWake, INFINITE);
+    }
+}
+
+
+//
+// Name :         CGrThreadPoolp::FindJob()
+// Description :  Take a job from our own queue, or steal one from
+//                another. An index outside of the workers only steals.
+//
+bool CGrThreadPoolp::FindJob(int index, Job &job)
+{
+    int n = (int)mQueues.size();
+
+    if(index < n)
+    {
+        Queue *q = mQueues[index];
+        EnterCriticalSection(&q->mLock);
+        bool found = !q->mJobs.empty();
+        if(found)
+        {
+            job = q->mJobs.front();
+            q->mJobs.pop_front();
+            q->mCount--;
+        }
+        LeaveCriticalSection(&q->mLock);
+
+        if(found)
+            return true;
+    }
+
+    for(int i=1;  i<=n;  i++)
+    {
+        Queue *q = mQueues[(index + i) % n];
+
+        // Cheap check before taking the lock
+        if(q->mCount == 0)
+            continue;
+
+        EnterCriticalSection(&q->mLock);
+        bool found = !q->mJobs.empty();
+        if(found)
+        {
+            job = q->mJobs.back();
+            q->mJobs.pop_back();
+            q->mCount--;
+        }
+        LeaveCriticalSection(&q->mLock);
+
+        if(found)
+            return true;
+    }
+
+    return false;
+}
+
+
+void CGrThreadPoolp::RunJob(const Job &job, int index)
+{
+    job.mTask->Run(index);
+
+    if(InterlockedDecrement(&job.mBatch->mRemaining) == 0)
+        SetEvent(job.mBatch->mDone);
+}
+
+
+//
+// Name :         CGrThreadPoolp::Run()
+// Description :  Divide the tasks into contiguous runs, one per worker,
+//                then help until the whole batch is done.
+//
+void CGrThreadPoolp::Run(CGrThreadPool::ITask **tasks, int count)
+{
+    if(count <= 0)
+        return;
+
+    int n = (int)mQueues.size();
+    int self = n;
+
+    // With no workers, or a single task, just run it here
+    if(mThreads.empty() || count == 1)
+    {
+        for(int i=0;  i<count;  i++)
+            tasks[i]->Run(self);
+        return;
+    }
+
+    Batch batch;
+    batch.mRemaining = count;
+    batch.mDone = CreateEvent(NULL, TRUE, FALSE, NULL);
+
+    for(int w=0;  w<n;  w++)
+    {
+        int begin = int(__int64(count) * w / n);
+        int end = int(__int64(count) * (w + 1) / n);
+        if(begin == end)
+            continue;
+
+        Queue *q = mQueues[w];
+        EnterCriticalSection(&q->mLock);
+        for(int i=begin;  i<end;  i++)
+        {
+            Job job;
+            job.mTask = tasks[i];
+            job.mBatch = &batch;
+            q->mJobs.push_back(job);
+        }
+        q->mCount = (LONG)q->mJobs.size();
+        LeaveCriticalSection(&q->mLock);
+    }
+
+    ReleaseSemaphore(mWake, count < n ? count : n, NULL);
+
+    // Help out while we wait
+    while(batch.mRemaining > 0)
+    {
+        Job job;
+        if(FindJob(self, job))
+        {
+            RunJob(job, self);
+        }
+        else
+        {
+            WaitForSingleObject(batch.mDone, INFINITE);
+        }
+    }
+
+    // The thread that finished the last job may not have set the
+    // event yet. Make sure it is done with the batch before it goes away.
+    WaitForSingleObject(batch.mDone, INFINITE);
+    CloseHandle(batch.mDone);
+}
+
+//! \endcond
+
+
+//
+// CGrThreadPool
+//
+
+CGrThreadPool::ITask::ITask() {}
+CGrThreadPool::ITask::~ITask() {}
+
+CGrThreadPool::CGrThreadPool(int numThreads)
+{
+    if(numThreads <= 0)
+        numThreads = GetHardwareThreads();
+
+    mPool = new CGrThreadPoolp(numThreads);
+}
+
+CGrThreadPool::~CGrThreadPool()
+{
+    delete mPool;
+}
+
+int CGrThreadPool::GetNumThreads() const {return mPool->GetNumThreads();}
+void CGrThreadPool::Run(ITask **tasks, int count) {mPool->Run(tasks, count);}
+
+
+int CGrThreadPool::GetHardwareThreads()
+{
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors > 0 ? int(info.dwNumberOfProcessors) : 1;
+}
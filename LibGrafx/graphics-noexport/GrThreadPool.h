@@ -0,0 +1,132 @@
+//
+// Name :         GrThreadPool.h
+// Description :  Header for CGrThreadPool, a work stealing thread pool.
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+#pragma once
+
+#if !defined(_GRTHREADPOOL_H)
+#define _GRTHREADPOOL_H
+
+#if !defined(LibGrafx)
+#define LibGrafx
+#endif
+
+#include <vector>
+
+class CGrThreadPoolp;
+
+//! A work stealing thread pool.
+
+/*! The pool owns a fixed set of worker threads, by default one per
+hardware thread. Each worker has its own task queue. A batch of tasks
+submitted with Run() is divided into contiguous runs, one per worker, so
+neighboring tasks tend to run on the same thread. A worker takes tasks
+from the front of its own queue and, when that is empty, steals from the
+back of the other queues, which balances the load when some tasks take
+much longer than others.
+
+Run() blocks until every task in the batch has completed. The calling
+thread does not sit idle while it waits; it steals and runs tasks as well.
+Tasks may themselves call Run().
+
+\version 1.00 Initial version
+*/
+
+class LibGrafx CGrThreadPool
+{
+public:
+    //! Interface for a unit of work
+    class LibGrafx ITask
+    {
+    public:
+        ITask();
+        virtual ~ITask();
+
+        //! Run the task
+        /*! \param worker The index of the thread running the task,
+            0 to GetNumSlots() - 1. Threads other than the workers that
+            help with a batch use GetNumThreads() as the index. */
+        virtual void Run(int worker) = 0;
+    };
+
+    //! Constructor
+    /*! \param numThreads Number of worker threads. If 0, one is created
+        for each hardware thread. */
+    CGrThreadPool(int numThreads=0);
+
+    //! Destructor. Stops and joins the worker threads
+    virtual ~CGrThreadPool();
+
+    //! Number of worker threads
+    int GetNumThreads() const;
+
+    //! Number of distinct worker indices passed to ITask::Run()
+    /*! This is one more than the number of threads, since the thread
+        calling Run() helps as well. Use this to size per worker data. */
+    int GetNumSlots() const {return GetNumThreads() + 1;}
+
+    //! Run a batch of tasks and wait for all of them to complete
+    /*! \param tasks Array of task pointers. The tasks are not deleted.
+        \param count Number of tasks */
+    void Run(ITask **tasks, int count);
+
+    //! Run func(i, worker) for every i from 0 to count - 1
+    /*! The range is split into chunks of grain iterations, each of which
+        is a task.
+        \param count Number of iterations
+        \param grain Number of iterations per task
+        \param func Function object called as func(int i, int worker) */
+    template<class F> void ParallelFor(int count, int grain, const F &func)
+    {
+        if(count <= 0)
+            return;
+
+        if(grain < 1)
+            grain = 1;
+
+        int numChunks = (count + grain - 1) / grain;
+        std::vector<ForChunk<F> > chunks(numChunks);
+        std::vector<ITask *> tasks(numChunks);
+        for(int c=0;  c<numChunks;  c++)
+        {
+            chunks[c].mFunc = &func;
+            chunks[c].mBegin = c * grain;
+            chunks[c].mEnd = c * grain + grain < count ? c * grain + grain : count;
+            tasks[c] = &chunks[c];
+        }
+
+        Run(&tasks[0], numChunks);
+    }
+
+    //! Number of hardware threads on this system
+    static int GetHardwareThreads();
+
+private:
+    // A range of ParallelFor() iterations
+    template<class F> class ForChunk : public ITask
+    {
+    public:
+        virtual void Run(int worker)
+        {
+            for(int i=mBegin;  i<mEnd;  i++)
+                (*mFunc)(i, worker);
+        }
+
+        const F *mFunc;
+        int mBegin;
+        int mEnd;
+    };
+
+    // Not copyable
+    CGrThreadPool(const CGrThreadPool &);
+    CGrThreadPool &operator=(const CGrThreadPool &);
+
+    CGrThreadPoolp *mPool;
+};
+
+#endif
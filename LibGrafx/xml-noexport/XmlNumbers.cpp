@@ -0,0 +1,448 @@
+//
+// Name :         XmlNumbers.cpp
+// Description :  Fast scanning of numbers in XML attribute values.
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+
+#include "StdAfx.h"
+#include "XmlNumbers.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <clocale>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define XMLNUMBERS_SSE2
+#endif
+
+using namespace std;
+
+typedef unsigned long long u64;
+
+// Powers of ten that are exact as doubles and floats
+static const double Pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+static const float Pow10f[] = {1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f};
+
+// Anything the fast paths cannot do exactly is left to the C runtime,
+// which must not use the decimal point of the current locale.
+#ifdef _MSC_VER
+static _locale_t CLocale = _create_locale(LC_NUMERIC, "C");
+
+inline double SlowStrtod(const char *s, char **end) {return _strtod_l(s, end, CLocale);}
+#else
+inline double SlowStrtod(const char *s, char **end) {return strtod(s, end);}
+#endif
+
+inline bool IsSpace(char c) {return c == ' ' || c == '\t' || c == '\r' || c == '\n';}
+inline bool IsDigit(char c) {return unsigned(c - '0') < 10;}
+
+static const u64 Pow10Int[] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000};
+
+//
+// Up to eight ASCII digits at a time. The bytes are loaded little
+// endian so the first character is the low byte.
+//
+
+// Subtract '0' from each byte. A byte that is not a digit ends up
+// 10 or more or with its high bit set. Borrows only move toward later
+// characters, so everything up to the first non digit is exact.
+inline u64 DigitBytes(const char *s)
+{
+    u64 v;
+    memcpy(&v, s, 8);
+    return v - 0x3030303030303030ULL;
+}
+
+// Number of digits before the first non digit, 0 to 8
+inline int LeadingDigits(u64 x)
+{
+    u64 mask = (x | (x + 0x7676767676767676ULL)) & 0x8080808080808080ULL;
+    if(mask == 0)
+        return 8;
+
+    // The lowest set bit is 0x80 << 8k. Multiplying 1 << 8k by this
+    // constant puts k in the top byte.
+    return int((((mask & (0 - mask)) >> 7) * 0x0001020304050607ULL) >> 56);
+}
+
+// Value of eight digit bytes, the first being the most significant
+inline unsigned EightDigits(u64 x)
+{
+    x = (x * 10) + (x >> 8);
+    x = (((x & 0x000000ff000000ffULL) * (100 + (1000000ULL << 32))) +
+        (((x >> 16) & 0x000000ff000000ffULL) * (1 + (10000ULL << 32)))) >> 32;
+    return unsigned(x);
+}
+
+//
+// A number as read from the text: mantissa * 10^exponent. Only the
+// first 19 significant digits fit in the mantissa. If any digit after
+// those is not zero, the number is truncated and must be converted
+// the slow way.
+//
+struct Decimal
+{
+    u64 mMantissa;
+    int mExponent;
+    int mSignificant;
+    bool mNegative;
+    bool mTruncated;
+};
+
+//
+// Name :         ScanDigits()
+// Description :  Add a run of digits to the mantissa.
+// Parameters :   used - Receives the number of digits added
+//                dropped - Receives the number of digits that did
+//                          not fit
+//
+static const char *ScanDigits(const char *s, Decimal &d, int &used, int &dropped)
+{
+    used = 0;
+    dropped = 0;
+
+    while(true)
+    {
+        u64 x = DigitBytes(s);
+        int k = LeadingDigits(x);
+        if(k == 0 || d.mSignificant + k > 19)
+            break;
+
+        // Shift out what follows the digits. The zero bytes shifted
+        // in at the bottom are leading zeros.
+        if(k < 8)
+            x <<= 8 * (8 - k);
+
+        d.mMantissa = d.mMantissa * Pow10Int[k] + EightDigits(x);
+        if(d.mMantissa != 0)
+            d.mSignificant += k;
+
+        used += k;
+        s += k;
+        if(k < 8)
+            return s;
+    }
+
+    for( ;  IsDigit(*s);  s++)
+    {
+        if(d.mSignificant < 19)
+        {
+            d.mMantissa = d.mMantissa * 10 + (*s - '0');
+            if(d.mMantissa != 0)
+                d.mSignificant++;
+
+            used++;
+        }
+        else
+        {
+            dropped++;
+            if(*s != '0')
+                d.mTruncated = true;
+        }
+    }
+
+    return s;
+}
+
+//
+// Name :         ScanDecimal()
+// Description :  Read [+-]digits[.digits][(e|E)[+-]digits].
+// Returns :      Pointer past the number or NULL if there is none
+//
+static const char *ScanDecimal(const char *s, Decimal &d)
+{
+    d.mMantissa = 0;
+    d.mExponent = 0;
+    d.mSignificant = 0;
+    d.mNegative = false;
+    d.mTruncated = false;
+
+    if(*s == '-')
+    {
+        d.mNegative = true;
+        s++;
+    }
+    else if(*s == '+')
+    {
+        s++;
+    }
+
+    int used, dropped;
+    const char *start = s;
+    s = ScanDigits(s, d, used, dropped);
+    d.mExponent += dropped;
+    bool any = s != start;
+
+    if(*s == '.')
+    {
+        start = ++s;
+        s = ScanDigits(s, d, used, dropped);
+        d.mExponent -= used;
+        any = any || s != start;
+    }
+
+    if(!any)
+        return NULL;
+
+    if(*s == 'e' || *s == 'E')
+    {
+        const char *e = s + 1;
+        bool negative = false;
+        if(*e == '-')
+        {
+            negative = true;
+            e++;
+        }
+        else if(*e == '+')
+        {
+            e++;
+        }
+
+        if(IsDigit(*e))
+        {
+            int x = 0;
+            for( ;  IsDigit(*e);  e++)
+            {
+                if(x < 100000)
+                    x = x * 10 + (*e - '0');
+            }
+
+            d.mExponent += negative ? -x : x;
+            s = e;
+        }
+    }
+
+    return s;
+}
+
+//
+// Name :         ToDouble()
+// Description :  Clinger's fast path. When the mantissa and the power
+//                of ten are both exact doubles, one correctly rounded
+//                multiply or divide gives the correctly rounded result.
+// Returns :      false if the fast path does not apply
+//
+inline bool ToDouble(const Decimal &d, double &value)
+{
+    if(d.mTruncated || d.mMantissa > (1ULL << 53) || d.mExponent < -22 || d.mExponent > 22)
+        return false;
+
+#ifdef XMLNUMBERS_SSE2
+    // SSE arithmetic, so an x87 build cannot round twice
+    __m128d m = _mm_set_sd(double((long long)d.mMantissa));
+    __m128d p = _mm_set_sd(Pow10[d.mExponent < 0 ? -d.mExponent : d.mExponent]);
+    double v = _mm_cvtsd_f64(d.mExponent < 0 ? _mm_div_sd(m, p) : _mm_mul_sd(m, p));
+#else
+    double v = double((long long)d.mMantissa);
+    v = d.mExponent < 0 ? v / Pow10[-d.mExponent] : v * Pow10[d.mExponent];
+#endif
+
+    value = d.mNegative ? -v : v;
+    return true;
+}
+
+inline bool ToFloat(const Decimal &d, float &value)
+{
+    if(d.mTruncated || d.mMantissa > (1ULL << 24) || d.mExponent < -10 || d.mExponent > 10)
+        return false;
+
+#ifdef XMLNUMBERS_SSE2
+    __m128 m = _mm_set_ss(float(int(d.mMantissa)));
+    __m128 p = _mm_set_ss(Pow10f[d.mExponent < 0 ? -d.mExponent : d.mExponent]);
+    float v = _mm_cvtss_f32(d.mExponent < 0 ? _mm_div_ss(m, p) : _mm_mul_ss(m, p));
+#else
+    float v = float(int(d.mMantissa));
+    v = d.mExponent < 0 ? v / Pow10f[-d.mExponent] : v * Pow10f[d.mExponent];
+#endif
+
+    value = d.mNegative ? -v : v;
+    return true;
+}
+
+
+const char *XmlScanDouble(const char *s, double &value)
+{
+    const char *p = s;
+    while(IsSpace(*p))
+        p++;
+
+    Decimal d;
+    const char *end = ScanDecimal(p, d);
+    if(end == NULL)
+    {
+        // Not a plain decimal number, perhaps inf or nan
+        char *e;
+        double v = SlowStrtod(p, &e);
+        if(e == p)
+            return s;
+
+        value = v;
+        return e;
+    }
+
+    if(!ToDouble(d, value))
+        value = SlowStrtod(p, NULL);
+
+    return end;
+}
+
+
+const char *XmlScanFloat(const char *s, float &value)
+{
+    const char *p = s;
+    while(IsSpace(*p))
+        p++;
+
+    Decimal d;
+    const char *end = ScanDecimal(p, d);
+    if(end == NULL || !ToFloat(d, value))
+    {
+        double v;
+        end = XmlScanDouble(p, v);
+        if(end == p)
+            return s;
+
+        value = float(v);
+    }
+
+    return end;
+}
+
+
+const char *XmlScanInt(const char *s, int &value)
+{
+    const char *p = s;
+    while(IsSpace(*p))
+        p++;
+
+    bool negative = false;
+    if(*p == '-')
+    {
+        negative = true;
+        p++;
+    }
+    else if(*p == '+')
+    {
+        p++;
+    }
+
+    if(!IsDigit(*p))
+        return s;
+
+    unsigned v = 0;
+    for( ;  IsDigit(*p);  p++)
+        v = v * 10 + (*p - '0');
+
+    value = negative ? -int(v) : int(v);
+    return p;
+}
+
+
+int XmlScanDoubles(const char *s, double *values, int n)
+{
+    for(int i=0;  i<n;  i++)
+    {
+        const char *e = XmlScanDouble(s, values[i]);
+        if(e == s)
+            return i;
+
+        s = e;
+    }
+
+    return n;
+}
+
+
+int XmlScanFloats(const char *s, float *values, int n)
+{
+    for(int i=0;  i<n;  i++)
+    {
+        const char *e = XmlScanFloat(s, values[i]);
+        if(e == s)
+            return i;
+
+        s = e;
+    }
+
+    return n;
+}
+
+
+//
+// Name :         XmlCountNumbers()
+// Description :  Count the places where whitespace is followed by
+//                something else, 16 characters at a time.
+//
+size_t XmlCountNumbers(const char *s)
+{
+    size_t count = 0;
+
+#ifdef XMLNUMBERS_SSE2
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i zero = _mm_setzero_si128();
+
+    unsigned previous = 1;      // Start of the string counts as whitespace
+    while(true)
+    {
+        __m128i c = _mm_loadu_si128((const __m128i *)s);
+        __m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, space), _mm_cmpeq_epi8(c, tab)),
+                                  _mm_or_si128(_mm_cmpeq_epi8(c, cr), _mm_cmpeq_epi8(c, lf)));
+        unsigned nul = _mm_movemask_epi8(_mm_cmpeq_epi8(c, zero));
+        unsigned white = _mm_movemask_epi8(ws);
+
+        unsigned starts = ~white & ((white << 1) | previous) & 0xffff;
+        if(nul != 0)
+            starts &= (nul & (0 - nul)) - 1;    // Only before the terminator
+
+        // Population count
+        starts = starts - ((starts >> 1) & 0x5555);
+        starts = (starts & 0x3333) + ((starts >> 2) & 0x3333);
+        starts = (starts + (starts >> 4)) & 0x0f0f;
+        count += (starts + (starts >> 8)) & 0x1f;
+
+        if(nul != 0)
+            return count;
+
+        previous = (white >> 15) & 1;
+        s += 16;
+    }
+#else
+    bool previous = true;
+    for( ;  *s;  s++)
+    {
+        bool white = IsSpace(*s);
+        if(previous && !white)
+            count++;
+
+        previous = white;
+    }
+
+    return count;
+#endif
+}
+
+
+void XmlScanInts(const char *s, std::vector<int> &values)
+{
+    values.reserve(values.size() + XmlCountNumbers(s));
+
+    while(true)
+    {
+        int i;
+        const char *e = XmlScanInt(s, i);
+        if(e == s)
+            break;
+
+        values.push_back(i);
+        s = e;
+    }
+}
@@ -0,0 +1,54 @@
+//
+// Name :         XmlNumbers.h
+// Description :  Fast scanning of numbers and lists of numbers in
+//                XML attribute values.
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+
+#pragma once
+//! \cond IGNORE
+
+#include <vector>
+#include <cstddef>
+
+//
+// These replace strtod/strtol for the long whitespace separated lists
+// of numbers in model files. They always use '.' as the decimal point,
+// no matter what locale the application has set.
+//
+// Each scanner skips leading whitespace and returns a pointer just
+// past the number. If there is no number there, the pointer passed in
+// is returned and the value is not changed.
+//
+// Doubles with up to 15 significant digits and an exponent within 22
+// are converted exactly without calling the C runtime. Floats are
+// converted exactly when the text has up to 7 significant digits and
+// an exponent within 10, and otherwise go through double, which still
+// round trips any float printed with 9 digits.
+//
+// The scanners read ahead in blocks, so the string must be followed by
+// XmlNumberPadding readable bytes after its terminating null. Attribute
+// values from CXmlPullParser always are.
+//
+
+const size_t XmlNumberPadding = 16;
+
+const char *XmlScanDouble(const char *s, double &value);
+const char *XmlScanFloat(const char *s, float &value);
+const char *XmlScanInt(const char *s, int &value);
+
+// Scan up to n numbers. Returns the number scanned.
+int XmlScanDoubles(const char *s, double *values, int n);
+int XmlScanFloats(const char *s, float *values, int n);
+
+// Count the whitespace separated items in a string
+size_t XmlCountNumbers(const char *s);
+
+// Append all of the integers in a string, reserving space first
+void XmlScanInts(const char *s, std::vector<int> &values);
+
+//! \endcond
@@ -0,0 +1,798 @@
+//
+// Name :         XmlPullParser.cpp
+// Description :  Implementation of CXmlPullParser.
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+
+#include "StdAfx.h"
+#include "XmlPullParser.h"
+#include "XmlNumbers.h"
+
+#include <sstream>
+#include <cstring>
+#include <cstdlib>
+
+using namespace std;
+
+// Size of each read from the input
+const size_t BlockSize = 64 * 1024;
+
+inline bool IsSpace(char c) {return c == ' ' || c == '\t' || c == '\r' || c == '\n';}
+
+//
+// Name :         EncodeUtf8()
+// Description :  Write a code point as UTF-8.
+// Returns :      Number of bytes written, at most 4
+//
+static size_t EncodeUtf8(unsigned cp, char *dest)
+{
+    if(cp < 0x80)
+    {
+        dest[0] = char(cp);
+        return 1;
+    }
+
+    if(cp < 0x800)
+    {
+        dest[0] = char(0xc0 | (cp >> 6));
+        dest[1] = char(0x80 | (cp & 0x3f));
+        return 2;
+    }
+
+    if(cp < 0x10000)
+    {
+        dest[0] = char(0xe0 | (cp >> 12));
+        dest[1] = char(0x80 | ((cp >> 6) & 0x3f));
+        dest[2] = char(0x80 | (cp & 0x3f));
+        return 3;
+    }
+
+    dest[0] = char(0xf0 | (cp >> 18));
+    dest[1] = char(0x80 | ((cp >> 12) & 0x3f));
+    dest[2] = char(0x80 | ((cp >> 6) & 0x3f));
+    dest[3] = char(0x80 | (cp & 0x3f));
+    return 4;
+}
+
+
+CXmlPullParser::CXmlPullParser(void)
+{
+    mFile = NULL;
+    Close();
+}
+
+
+CXmlPullParser::~CXmlPullParser(void)
+{
+    Close();
+}
+
+
+void CXmlPullParser::Close()
+{
+    if(mFile != NULL)
+        fclose(mFile);
+
+    mFile = NULL;
+    mMemory = NULL;
+    mMemorySize = 0;
+    mMemoryPos = 0;
+
+    mEncoding = Utf8;
+    vector<unsigned char>().swap(mRaw);
+    mHighSurrogate = 0;
+    mAtEof = true;
+
+    vector<char>().swap(mBuffer);
+    mPos = mEnd = mConsumed = 0;
+
+    mEvent = EndDocument;
+    mTagOffset = 0;
+    mName = "";
+    mDepth = 0;
+    mPendingEnd = false;
+    mAttributes.clear();
+}
+
+
+//
+// Name :         CXmlPullParser::Open()
+// Description :  Open a file to parse.
+//
+bool CXmlPullParser::Open(const wchar_t *fileName)
+{
+    Close();
+    mErrorMessage.clear();
+
+#ifdef _WIN32
+    mFile = _wfopen(fileName, L"rb");
+#else
+    string name;
+    for(const wchar_t *c=fileName;  *c;  c++)
+    {
+        char utf8[4];
+        name.append(utf8, EncodeUtf8(unsigned(*c), utf8));
+    }
+
+    mFile = fopen(name.c_str(), "rb");
+#endif
+
+    if(mFile == NULL)
+    {
+        mErrorMessage = L"Unable to open ";
+        mErrorMessage += fileName;
+        return false;
+    }
+
+    return Begin();
+}
+
+
+bool CXmlPullParser::OpenMemory(const char *data, size_t size, size_t offset)
+{
+    Close();
+    mErrorMessage.clear();
+
+    mMemory = data;
+    mMemorySize = size;
+    if(!Begin())
+        return false;
+
+    mConsumed += offset;
+    return true;
+}
+
+
+//
+// Name :         CXmlPullParser::Begin()
+// Description :  Determine the encoding from the byte order mark
+//                and prepare to read.
+//
+bool CXmlPullParser::Begin()
+{
+    mBuffer.resize(BlockSize);
+    mAtEof = false;
+    mEvent = StartDocument;
+
+    unsigned char bom[3];
+    size_t n = ReadRaw(bom, 3);
+    if(n == 3 && bom[0] == 0xef && bom[1] == 0xbb && bom[2] == 0xbf)
+    {
+        mEncoding = Utf8;
+        mConsumed = 3;
+    }
+    else if(n >= 2 && ((bom[0] == 0xff && bom[1] == 0xfe) || (bom[0] == 0xfe && bom[1] == 0xff)))
+    {
+        mEncoding = bom[0] == 0xff ? Utf16LE : Utf16BE;
+        mRaw.assign(bom + 2, bom + n);
+    }
+    else
+    {
+        mEncoding = Utf8;
+        memcpy(&mBuffer[0], bom, n);
+        mEnd = n;
+    }
+
+    return true;
+}
+
+
+size_t CXmlPullParser::ReadRaw(void *dest, size_t size)
+{
+    if(mFile != NULL)
+        return fread(dest, 1, size, mFile);
+
+    size_t n = mMemorySize - mMemoryPos;
+    if(n > size)
+        n = size;
+
+    if(n > 0)
+        memcpy(dest, mMemory + mMemoryPos, n);
+
+    mMemoryPos += n;
+    return n;
+}
+
+
+//
+// Name :         CXmlPullParser::Read()
+// Description :  Read up to size bytes of the document as UTF-8.
+// Returns :      Number of bytes read, 0 at the end of the input
+//
+size_t CXmlPullParser::Read(char *dest, size_t size)
+{
+    if(mEncoding == Utf8)
+        return ReadRaw(dest, size);
+
+    // A UTF-16 code unit becomes at most 3 bytes. A surrogate
+    // pair is 2 units and becomes 4.
+    size_t have = mRaw.size();
+    size_t want = (size / 3) * 2;
+    if(have < want)
+    {
+        mRaw.resize(want);
+        mRaw.resize(have + ReadRaw(&mRaw[have], want - have));
+    }
+
+    size_t out = 0;
+    size_t i = 0;
+    for( ;  i + 1 < mRaw.size();  i+=2)
+    {
+        unsigned u = mEncoding == Utf16LE ? mRaw[i] | (mRaw[i + 1] << 8) : (mRaw[i] << 8) | mRaw[i + 1];
+        if(u >= 0xd800 && u < 0xdc00)
+        {
+            mHighSurrogate = u;
+            continue;
+        }
+
+        unsigned cp = u;
+        if(u >= 0xdc00 && u < 0xe000)
+            cp = mHighSurrogate != 0 ? 0x10000 + ((mHighSurrogate - 0xd800) << 10) + (u - 0xdc00) : 0xfffd;
+
+        mHighSurrogate = 0;
+        out += EncodeUtf8(cp, dest + out);
+    }
+
+    // Keep an odd byte for next time
+    mRaw.erase(mRaw.begin(), mRaw.begin() + i);
+    return out;
+}
+
+
+//
+// Name :         CXmlPullParser::Refill()
+// Description :  Discard everything before mPos and read another
+//                block. The buffer grows if a tag does not fit.
+// Returns :      false if there is no more input
+//
+bool CXmlPullParser::Refill()
+{
+    if(mAtEof)
+        return false;
+
+    if(mPos > 0)
+    {
+        memmove(&mBuffer[0], &mBuffer[mPos], mEnd - mPos);
+        mConsumed += mPos;
+        mEnd -= mPos;
+        mPos = 0;
+    }
+
+    if(mBuffer.size() - mEnd < BlockSize)
+        mBuffer.resize(mBuffer.size() * 2 > mEnd + BlockSize ? mBuffer.size() * 2 : mEnd + BlockSize);
+
+    // Leave room for a terminator after the data and for
+    // the number scanners to read ahead
+    size_t n = Read(&mBuffer[mEnd], mBuffer.size() - mEnd - XmlNumberPadding);
+    if(n == 0)
+    {
+        mAtEof = true;
+        return false;
+    }
+
+    mEnd += n;
+    return true;
+}
+
+
+bool CXmlPullParser::Available(size_t n)
+{
+    while(mEnd - mPos < n)
+    {
+        if(!Refill())
+            return false;
+    }
+
+    return true;
+}
+
+
+//
+// Name :         CXmlPullParser::Find()
+// Description :  Find a pattern at or after mPos + offset, reading
+//                more input as needed. If quotes is true, anything in
+//                single or double quotes is skipped over.
+// Returns :      Offset of the pattern from mPos or -1 if not found
+//
+long CXmlPullParser::Find(size_t offset, const char *pattern, bool quotes)
+{
+    size_t len = strlen(pattern);
+    char quote = 0;
+
+    while(true)
+    {
+        while(mPos + offset < mEnd)
+        {
+            const char *p = &mBuffer[mPos + offset];
+            size_t avail = mEnd - mPos - offset;
+
+            if(quote != 0)
+            {
+                const char *q = (const char *)memchr(p, quote, avail);
+                if(q == NULL)
+                {
+                    offset += avail;
+                    break;
+                }
+
+                offset += q - p + 1;
+                quote = 0;
+                continue;
+            }
+
+            if(quotes && (*p == '"' || *p == '\''))
+            {
+                quote = *p;
+                offset++;
+                continue;
+            }
+
+            if(*p == pattern[0])
+            {
+                if(avail < len)
+                    break;
+
+                if(memcmp(p, pattern, len) == 0)
+                    return long(offset);
+            }
+
+            offset++;
+        }
+
+        if(!Refill())
+            return -1;
+    }
+}
+
+
+bool CXmlPullParser::SkipTo(const char *pattern)
+{
+    long at = Find(0, pattern, false);
+    if(at < 0)
+        return false;
+
+    mPos += at + strlen(pattern);
+    return true;
+}
+
+
+CXmlPullParser::Event CXmlPullParser::Fail(const wchar_t *msg)
+{
+    wstringstream str;
+    str << msg << L" at byte " << mConsumed + mPos;
+    mErrorMessage = str.str();
+    mEvent = Error;
+    return mEvent;
+}
+
+
+//
+// Name :         CXmlPullParser::Next()
+// Description :  Advance to the next start or end tag.
+//
+CXmlPullParser::Event CXmlPullParser::Next()
+{
+    if(mEvent == Error || mEvent == EndDocument)
+        return mEvent;
+
+    mAttributes.clear();
+
+    if(mPendingEnd)
+    {
+        mPendingEnd = false;
+        mDepth--;
+        mEvent = EndElement;
+        return mEvent;
+    }
+
+    while(true)
+    {
+        // Skip character data, discarding it as we go
+        while(true)
+        {
+            const char *lt = mPos < mEnd ? (const char *)memchr(&mBuffer[mPos], '<', mEnd - mPos) : NULL;
+            if(lt != NULL)
+            {
+                mPos = lt - &mBuffer[0];
+                break;
+            }
+
+            mPos = mEnd;
+            if(!Refill())
+            {
+                if(mDepth > 0)
+                    return Fail(L"Unexpected end of document");
+
+                mName = "";
+                mEvent = EndDocument;
+                return mEvent;
+            }
+        }
+
+        Available(9);
+        const char *p = &mBuffer[mPos];
+        size_t avail = mEnd - mPos;
+
+        if(avail >= 4 && memcmp(p, "<!--", 4) == 0)
+        {
+            if(!SkipTo("-->"))
+                return Fail(L"Unterminated comment");
+        }
+        else if(avail >= 9 && memcmp(p, "<![CDATA[", 9) == 0)
+        {
+            if(!SkipTo("]]>"))
+                return Fail(L"Unterminated CDATA section");
+        }
+        else if(avail >= 2 && p[1] == '?')
+        {
+            if(!SkipTo("?>"))
+                return Fail(L"Unterminated processing instruction");
+        }
+        else if(avail >= 2 && p[1] == '!')
+        {
+            // A declaration, which may have an internal subset in brackets
+            long gt = Find(0, ">", true);
+            if(gt < 0)
+                return Fail(L"Unterminated declaration");
+
+            if(memchr(&mBuffer[mPos], '[', gt) != NULL)
+            {
+                if(!SkipTo("]"))
+                    return Fail(L"Unterminated declaration");
+
+                gt = Find(0, ">", true);
+                if(gt < 0)
+                    return Fail(L"Unterminated declaration");
+            }
+
+            mPos += gt + 1;
+        }
+        else
+        {
+            long gt = Find(1, ">", true);
+            if(gt < 0)
+                return Fail(L"Unterminated tag");
+
+            mTagOffset = mConsumed + mPos;
+            return ParseTag(size_t(gt));
+        }
+    }
+}
+
+
+//
+// Name :         CXmlPullParser::ParseTag()
+// Description :  Parse the tag at mPos, which ends with the '>' at
+//                mPos + length. The name and attribute values are
+//                terminated in place.
+//
+CXmlPullParser::Event CXmlPullParser::ParseTag(size_t length)
+{
+    char *tag = &mBuffer[mPos];
+    char *end = tag + length;
+    *end = '\0';
+
+    if(tag[1] == '/')
+    {
+        char *name = tag + 2;
+        char *e = name;
+        while(*e && !IsSpace(*e))
+            e++;
+        *e = '\0';
+
+        if(mDepth == 0)
+            return Fail(L"End tag without a start tag");
+
+        mName = name;
+        mDepth--;
+        mPos += length + 1;
+        mEvent = EndElement;
+        return mEvent;
+    }
+
+    bool empty = false;
+    if(end[-1] == '/')
+    {
+        empty = true;
+        end[-1] = '\0';
+    }
+
+    char *p = tag + 1;
+    mName = p;
+    while(*p && !IsSpace(*p))
+        p++;
+
+    if(*p)
+        *p++ = '\0';
+
+    while(true)
+    {
+        while(IsSpace(*p))
+            p++;
+
+        if(*p == '\0')
+            break;
+
+        Attribute attribute;
+        attribute.mName = p;
+        while(*p && *p != '=' && !IsSpace(*p))
+            p++;
+
+        char *nameEnd = p;
+        while(IsSpace(*p))
+            p++;
+
+        if(*p != '=')
+            return Fail(L"Expected = after an attribute name");
+
+        p++;
+        *nameEnd = '\0';
+
+        while(IsSpace(*p))
+            p++;
+
+        char quote = *p;
+        if(quote != '"' && quote != '\'')
+            return Fail(L"Expected a quoted attribute value");
+
+        p++;
+        char *close = strchr(p, quote);
+        if(close == NULL)
+            return Fail(L"Unterminated attribute value");
+
+        *close = '\0';
+        if(memchr(p, '&', close - p) != NULL)
+            DecodeEntities(p);
+
+        attribute.mValue = p;
+        mAttributes.push_back(attribute);
+        p = close + 1;
+    }
+
+    mDepth++;
+    mPendingEnd = empty;
+    mPos += length + 1;
+    mEvent = StartElement;
+    return mEvent;
+}
+
+
+//
+// Name :         CXmlPullParser::DecodeEntities()
+// Description :  Replace entity and character references in place.
+//                The result is never longer than the original.
+//
+void CXmlPullParser::DecodeEntities(char *value)
+{
+    static const struct {const char *mName; char mChar;} entities[] =
+        {{"lt;", '<'}, {"gt;", '>'}, {"amp;", '&'}, {"quot;", '"'}, {"apos;", '\''}};
+
+    char *d = value;
+    for(const char *s=value;  *s;  )
+    {
+        if(*s != '&')
+        {
+            *d++ = *s++;
+            continue;
+        }
+
+        if(s[1] == '#')
+        {
+            char *e;
+            unsigned long cp = s[2] == 'x' ? strtoul(s + 3, &e, 16) : strtoul(s + 2, &e, 10);
+            if(*e == ';' && cp > 0 && cp < 0x110000)
+            {
+                d += EncodeUtf8(unsigned(cp), d);
+                s = e + 1;
+                continue;
+            }
+        }
+        else
+        {
+            bool found = false;
+            for(size_t i=0;  i<sizeof(entities) / sizeof(entities[0]);  i++)
+            {
+                size_t len = strlen(entities[i].mName);
+                if(strncmp(s + 1, entities[i].mName, len) == 0)
+                {
+                    *d++ = entities[i].mChar;
+                    s += len + 1;
+                    found = true;
+                    break;
+                }
+            }
+
+            if(found)
+                continue;
+        }
+
+        // Not something we know, so leave it alone
+        *d++ = *s++;
+    }
+
+    *d = '\0';
+}
+
+
+bool CXmlPullParser::IsName(const char *name) const
+{
+    return strcmp(mName, name) == 0;
+}
+
+
+//
+// Name :         CXmlPullParser::SkipElement()
+// Description :  Skip over the children of the current element.
+//
+bool CXmlPullParser::SkipElement()
+{
+    if(mEvent != StartElement)
+        return false;
+
+    int depth = mDepth - 1;
+    while(true)
+    {
+        Event event = Next();
+        if(event == Error || event == EndDocument)
+            return false;
+
+        if(event == EndElement && mDepth == depth)
+            return true;
+    }
+}
+
+
+//
+// Name :         CXmlPullParser::SkipElementFast()
+// Description :  Skip over the children of the current element by
+//                searching for its end tag.
+//
+bool CXmlPullParser::SkipElementFast()
+{
+    if(mEvent != StartElement)
+        return false;
+
+    if(mPendingEnd)
+        return Next() == EndElement;
+
+    // The name points into the buffer, which moves as we read
+    string end = string("</") + mName;
+    size_t len = end.size();
+
+    while(true)
+    {
+        while(mPos < mEnd)
+        {
+            const char *lt = (const char *)memchr(&mBuffer[mPos], '<', mEnd - mPos);
+            if(lt == NULL)
+            {
+                mPos = mEnd;
+                break;
+            }
+
+            mPos = lt - &mBuffer[0];
+
+            // Need the character after the name as well
+            if(mEnd - mPos <= len)
+                break;
+
+            if(memcmp(lt, end.c_str(), len) == 0 && (lt[len] == '>' || IsSpace(lt[len])))
+                return Next() == EndElement;
+
+            mPos++;
+        }
+
+        if(!Refill())
+        {
+            Fail(L"Unexpected end of document");
+            return false;
+        }
+    }
+}
+
+
+const char *CXmlPullParser::GetAttribute(const char *name) const
+{
+    for(vector<Attribute>::const_iterator a=mAttributes.begin();  a!=mAttributes.end();  a++)
+    {
+        if(strcmp(a->mName, name) == 0)
+            return a->mValue;
+    }
+
+    return NULL;
+}
+
+
+bool CXmlPullParser::GetAttribute(const char *name, int &value) const
+{
+    const char *v = GetAttribute(name);
+    if(v == NULL)
+        return false;
+
+    return XmlScanInt(v, value) != v;
+}
+
+
+bool CXmlPullParser::GetAttribute(const char *name, double &value) const
+{
+    const char *v = GetAttribute(name);
+    if(v == NULL)
+        return false;
+
+    return XmlScanDouble(v, value) != v;
+}
+
+
+bool CXmlPullParser::GetAttribute(const char *name, std::wstring &value) const
+{
+    const char *v = GetAttribute(name);
+    if(v == NULL)
+        return false;
+
+    value = Widen(v);
+    return true;
+}
+
+
+//
+// Name :         CXmlPullParser::Widen()
+// Description :  Convert UTF-8 to a wide string, which is UTF-16 where
+//                wchar_t is 16 bits. Bad sequences become U+FFFD.
+//
+std::wstring CXmlPullParser::Widen(const char *utf8)
+{
+    wstring result;
+    const unsigned char *s = (const unsigned char *)utf8;
+    while(*s)
+    {
+        unsigned cp = *s++;
+        int more = 0;
+        if(cp >= 0xf0)
+        {
+            cp &= 0x07;
+            more = 3;
+        }
+        else if(cp >= 0xe0)
+        {
+            cp &= 0x0f;
+            more = 2;
+        }
+        else if(cp >= 0xc0)
+        {
+            cp &= 0x1f;
+            more = 1;
+        }
+        else if(cp >= 0x80)
+        {
+            cp = 0xfffd;
+        }
+
+        for( ;  more > 0;  more--)
+        {
+            if((*s & 0xc0) != 0x80)
+            {
+                cp = 0xfffd;
+                break;
+            }
+
+            cp = (cp << 6) | (*s++ & 0x3f);
+        }
+
+        if(cp >= 0x10000 && sizeof(wchar_t) == 2)
+        {
+            cp -= 0x10000;
+            result += wchar_t(0xd800 + (cp >> 10));
+            result += wchar_t(0xdc00 + (cp & 0x3ff));
+        }
+        else
+        {
+            result += wchar_t(cp);
+        }
+    }
+
+    return result;
+}
@@ -0,0 +1,158 @@
+//
+// Name :         XmlPullParser.h
+// Description :  Header for CXmlPullParser, a streaming XML reader.
+//
+// This work is Copyright (C) 2002-2012 Michigan State University
+// This work is licensed under Microsoft Public License (Ms-PL)
+//
+// Please include author attribution when using this code.
+//
+
+#pragma once
+//! \cond IGNORE
+
+#include <string>
+#include <vector>
+#include <cstdio>
+
+//
+// class CXmlPullParser
+// Single pass, pull style XML reader. Next() advances to the next start
+// or end tag. Nothing is kept but the tag being read, so memory use is
+// the size of the largest tag no matter how large the document.
+//
+// The document is read in blocks through a buffer. Each tag is parsed
+// in place: the element name and attribute values are null terminated
+// UTF-8 strings pointing into the buffer, valid until the next call to
+// Next(). They are followed by enough buffer for the XmlNumbers.h
+// scanners. Character data, comments, processing instructions, and
+// DOCTYPE declarations are skipped. An empty element <a/> is reported
+// as a start tag followed by an end tag.
+//
+// UTF-8 input is read as is. UTF-16 input with a byte order mark is
+// converted to UTF-8 as it is read. Only the standard entities and
+// character references are decoded.
+//
+// This uses only the standard library, so it is portable.
+//
+
+class CXmlPullParser
+{
+public:
+    CXmlPullParser(void);
+    virtual ~CXmlPullParser(void);
+
+    enum Event {StartDocument, StartElement, EndElement, EndDocument, Error};
+
+    // Open a file to read
+    bool Open(const wchar_t *fileName);
+
+    // Read a document that is already in memory. The memory
+    // must stay valid until Close() and is not modified. If the
+    // memory is part of a larger document, offset is where it
+    // starts, so offsets and error messages refer to the whole.
+    bool OpenMemory(const char *data, size_t size, size_t offset=0);
+
+    void Close();
+
+    // Advance to the next start or end tag
+    Event Next();
+
+    // The current event
+    Event GetEvent() const {return mEvent;}
+
+    // Name of the current element
+    const char *GetName() const {return mName;}
+    bool IsName(const char *name) const;
+
+    // Nesting depth. The root element is depth 1.
+    int GetDepth() const {return mDepth;}
+
+    // Byte offsets of the '<' that starts the current tag and of
+    // what follows the tag. These are offsets in the file unless it
+    // is UTF-16, in which case they count the converted UTF-8.
+    size_t GetTagOffset() const {return mTagOffset;}
+    size_t GetOffset() const {return mConsumed + mPos;}
+    bool IsUtf16() const {return mEncoding != Utf8;}
+
+    // Attributes of the current start tag. Values have their
+    // entities decoded.
+    int GetAttributeCount() const {return (int)mAttributes.size();}
+    const char *GetAttributeName(int i) const {return mAttributes[i].mName;}
+    const char *GetAttributeValue(int i) const {return mAttributes[i].mValue;}
+
+    // Value of a named attribute or NULL if there is none
+    const char *GetAttribute(const char *name) const;
+
+    bool GetAttribute(const char *name, int &value) const;
+    bool GetAttribute(const char *name, double &value) const;
+    bool GetAttribute(const char *name, std::wstring &value) const;
+
+    // Skip the rest of the element the current start tag begins,
+    // leaving the parser at its end tag
+    bool SkipElement();
+
+    // Like SkipElement(), but searches the text for the end tag
+    // rather than reading the tags in between, which is much faster.
+    // Only use it on elements that never contain an element of the
+    // same name, or its end tag in a comment or CDATA section.
+    bool SkipElementFast();
+
+    const wchar_t *GetErrorMessage() const {return mErrorMessage.c_str();}
+
+    // Convert UTF-8 to a wide string
+    static std::wstring Widen(const char *utf8);
+
+private:
+    CXmlPullParser(const CXmlPullParser &);
+    CXmlPullParser &operator=(const CXmlPullParser &);
+
+    Event Fail(const wchar_t *msg);
+
+    bool Begin();
+    bool Refill();
+    bool Available(size_t n);
+    size_t Read(char *dest, size_t size);
+    size_t ReadRaw(void *dest, size_t size);
+    long Find(size_t offset, const char *pattern, bool quotes);
+    bool SkipTo(const char *pattern);
+    Event ParseTag(size_t length);
+    static void DecodeEntities(char *value);
+
+    // Input: a file or a block of memory
+    FILE *mFile;
+    const char *mMemory;
+    size_t mMemorySize;
+    size_t mMemoryPos;
+
+    // UTF-16 input is converted as it is read
+    enum Encoding {Utf8, Utf16LE, Utf16BE};
+    Encoding mEncoding;
+    std::vector<unsigned char> mRaw;
+    unsigned mHighSurrogate;
+    bool mAtEof;
+
+    // The buffer holds the document from mPos to mEnd
+    std::vector<char> mBuffer;
+    size_t mPos;
+    size_t mEnd;
+    size_t mConsumed;       // Bytes of the document before the buffer
+
+    Event mEvent;
+    size_t mTagOffset;
+    const char *mName;
+    int mDepth;
+    bool mPendingEnd;       // An empty element still needs its end tag
+
+    struct Attribute
+    {
+        const char *mName;
+        const char *mValue;
+    };
+
+    std::vector<Attribute> mAttributes;
+
+    std::wstring mErrorMessage;
+};
+
+//! \endcond
@@ -0,0 +1,637 @@
+//
+// Name :         Bvh.cpp
+// Description :  Implementation of CBvh, a binned SAH bounding volume
+//                hierarchy.
+//
+
+#include "StdAfx.h"
+#include "Bvh.h"
+#include "TriangleStore.h"
+
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <intrin.h>
+
+using namespace std;
+
+// Packet traversal, in BvhSse.cpp and BvhAvx.cpp
+// They take the hierarchy as raw pointers, see BvhAvx.cpp.
+void BvhIntersectPacketSse(const CBvh::Node *nodes, const float *tris, const int *ids,
+    const CBvh::RayPacket &packet, CBvh::Hit *hits, bool *found);
+void BvhOccludedPacketSse(const CBvh::Node *nodes, const float *tris, const CBvh::RayPacket &packet, bool *occluded);
+void BvhIntersectPacketAvx(const CBvh::Node *nodes, const float *tris, const int *ids,
+    const CBvh::RayPacket &packet, CBvh::Hit *hits, bool *found);
+void BvhOccludedPacketAvx(const CBvh::Node *nodes, const float *tris, const CBvh::RayPacket &packet, bool *occluded);
+
+//
+// Name :         DetectSimdLevel()
+// Description :  Determine the best instruction set this CPU and
+//                operating system support.
+//
+static CBvh::SimdLevel DetectSimdLevel()
+{
+    int info[4];
+    __cpuid(info, 0);
+    if(info[0] < 1)
+        return CBvh::SimdScalar;
+
+    __cpuid(info, 1);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+
+    // AVX also needs the OS to save the upper halves of the registers
+    if(avx && osxsave && (_xgetbv(0) & 6) == 6)
+        return CBvh::SimdAvx;
+
+    return sse2 ? CBvh::SimdSse : CBvh::SimdScalar;
+}
+
+static const CBvh::SimdLevel SupportedSimdLevel = DetectSimdLevel();
+static CBvh::SimdLevel CurrentSimdLevel = SupportedSimdLevel;
+
+// Half of the surface area of a box
+inline float HalfArea(const float *mn, const float *mx)
+{
+    float dx = mx[0] - mn[0];
+    float dy = mx[1] - mn[1];
+    float dz = mx[2] - mn[2];
+    return dx * dy + dy * dz + dz * dx;
+}
+
+inline void EmptyBox(float *mn, float *mx)
+{
+    mn[0] = mn[1] = mn[2] = 1e30f;
+    mx[0] = mx[1] = mx[2] = -1e30f;
+}
+
+inline void GrowBox(float *mn, float *mx, const float *pmn, const float *pmx)
+{
+    for(int i=0;  i<3;  i++)
+    {
+        if(pmn[i] < mn[i])
+            mn[i] = pmn[i];
+        if(pmx[i] > mx[i])
+            mx[i] = pmx[i];
+    }
+}
+
+//
+// Name :         SlabTest()
+// Description :  Ray/box test. Returns true if the ray enters the box
+//                before tmax.
+//
+inline bool SlabTest(const CBvh::Node &n, const CBvh::Ray &r, float tmax)
+{
+    float t1 = (n.mMin[0] - r.mOrigin[0]) * r.mInvDir[0];
+    float t2 = (n.mMax[0] - r.mOrigin[0]) * r.mInvDir[0];
+    float tnear = min(t1, t2);
+    float tfar = max(t1, t2);
+
+    t1 = (n.mMin[1] - r.mOrigin[1]) * r.mInvDir[1];
+    t2 = (n.mMax[1] - r.mOrigin[1]) * r.mInvDir[1];
+    tnear = max(tnear, min(t1, t2));
+    tfar = min(tfar, max(t1, t2));
+
+    t1 = (n.mMin[2] - r.mOrigin[2]) * r.mInvDir[2];
+    t2 = (n.mMax[2] - r.mOrigin[2]) * r.mInvDir[2];
+    tnear = max(tnear, min(t1, t2));
+    tfar = min(tfar, max(t1, t2));
+
+    return tfar >= tnear && tfar >= r.mTMin && tnear < tmax;
+}
+
+
+CBvh::CBvh()
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+
+CBvh::~CBvh()
+{
+}
+
+
+void CBvh::Clear()
+{
+    m_nodes.clear();
+    m_tris.clear();
+    m_triIds.clear();
+    m_build.clear();
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+
+void CBvh::Build(const CTriangleStore &triangles)
+{
+    Build(triangles, 0, triangles.GetNumTriangles());
+}
+
+
+//
+// Name :         CBvh::Build()
+// Description :  Build the hierarchy over a range of triangles in a store.
+//
+void CBvh::Build(const CTriangleStore &triangles, int first, int count)
+{
+    LARGE_INTEGER freq, start, end;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+
+    Clear();
+
+    int n = count;
+    m_stats.mNumTriangles = n;
+    if(n == 0)
+        return;
+
+    // Bounds and centroids for every triangle
+    m_build.resize(n);
+    for(int t=0;  t<n;  t++)
+    {
+        BuildTri &bt = m_build[t];
+        const float *p = triangles.GetPositions(first + t);
+        for(int i=0;  i<3;  i++)
+        {
+            bt.mMin[i] = min(p[i], min(p[3 + i], p[6 + i]));
+            bt.mMax[i] = max(p[i], max(p[3 + i], p[6 + i]));
+            bt.mCentroid[i] = (bt.mMin[i] + bt.mMax[i]) * 0.5f;
+        }
+
+        bt.mId = first + t;
+    }
+
+    // A binary tree with at least one triangle per leaf
+    // never has more than 2n - 1 nodes
+    m_nodes.reserve(n * 2);
+    BuildNode(0, n, 0);
+
+    // Copy the triangles into leaf order as a vertex and two edges
+    m_tris.resize(n * 9);
+    m_triIds.resize(n);
+    for(int i=0;  i<n;  i++)
+    {
+        int id = m_build[i].mId;
+        const float *p = triangles.GetPositions(id);
+        float *d = &m_tris[i * 9];
+        for(int j=0;  j<3;  j++)
+        {
+            d[j] = p[j];
+            d[3 + j] = p[3 + j] - p[j];
+            d[6 + j] = p[6 + j] - p[j];
+        }
+
+        m_triIds[i] = id;
+    }
+
+    vector<BuildTri>().swap(m_build);
+
+    // Expected cost of a ray through the root, assuming a node traversal
+    // and a triangle test cost the same
+    const Node &root = m_nodes[0];
+    float rootArea = HalfArea(root.mMin, root.mMax);
+    double cost = 0;
+    for(vector<Node>::const_iterator i=m_nodes.begin();  i!=m_nodes.end();  i++)
+    {
+        double p = rootArea > 0 ? HalfArea(i->mMin, i->mMax) / rootArea : 1;
+        cost += i->IsLeaf() ? p * i->mCount : p;
+    }
+
+    m_stats.mSahCost = cost;
+    m_stats.mNumNodes = (int)m_nodes.size();
+
+    QueryPerformanceCounter(&end);
+    m_stats.mBuildTime = double(end.QuadPart - start.QuadPart) * 1000. / double(freq.QuadPart);
+}
+
+
+//
+// Name :         CBvh::BuildNode()
+// Description :  Recursively build a node over m_build[first, first+count).
+//                Nodes are appended depth first, so the left child is
+//                always the next node after its parent.
+// Returns :      Index of the new node
+//
+int CBvh::BuildNode(int first, int count, int depth)
+{
+    int index = (int)m_nodes.size();
+    m_nodes.push_back(Node());
+
+    // Node bounds and bounds of the centroids
+    float mn[3], mx[3], cmn[3], cmx[3];
+    EmptyBox(mn, mx);
+    EmptyBox(cmn, cmx);
+    for(int i=first;  i<first + count;  i++)
+    {
+        GrowBox(mn, mx, m_build[i].mMin, m_build[i].mMax);
+        GrowBox(cmn, cmx, m_build[i].mCentroid, m_build[i].mCentroid);
+    }
+
+    Node &node = m_nodes[index];
+    for(int i=0;  i<3;  i++)
+    {
+        node.mMin[i] = mn[i];
+        node.mMax[i] = mx[i];
+    }
+
+    if(depth > m_stats.mMaxDepth)
+        m_stats.mMaxDepth = depth;
+
+    //
+    // Find the best split over the bins of all three axes
+    //
+
+    int bestAxis = -1;
+    int bestBin = 0;
+    float bestCost = 1e30f;
+
+    if(count > 2)
+    {
+        for(int axis=0;  axis<3;  axis++)
+        {
+            float extent = cmx[axis] - cmn[axis];
+            if(extent <= 0)
+                continue;
+
+            int binCount[NumBins];
+            float binMin[NumBins][3], binMax[NumBins][3];
+            for(int b=0;  b<NumBins;  b++)
+            {
+                binCount[b] = 0;
+                EmptyBox(binMin[b], binMax[b]);
+            }
+
+            float scale = NumBins / extent;
+            for(int i=first;  i<first + count;  i++)
+            {
+                const BuildTri &bt = m_build[i];
+                int b = min(NumBins - 1, int((bt.mCentroid[axis] - cmn[axis]) * scale));
+                binCount[b]++;
+                GrowBox(binMin[b], binMax[b], bt.mMin, bt.mMax);
+            }
+
+            // Sweep from the left accumulating area times count
+            float leftCost[NumBins - 1];
+            float lmn[3], lmx[3];
+            EmptyBox(lmn, lmx);
+            int leftCount = 0;
+            for(int b=0;  b<NumBins - 1;  b++)
+            {
+                leftCount += binCount[b];
+                GrowBox(lmn, lmx, binMin[b], binMax[b]);
+                leftCost[b] = leftCount > 0 ? HalfArea(lmn, lmx) * leftCount : 0;
+            }
+
+            // Sweep from the right and evaluate each split plane
+            float rmn[3], rmx[3];
+            EmptyBox(rmn, rmx);
+            int rightCount = 0;
+            for(int b=NumBins - 1;  b>0;  b--)
+            {
+                rightCount += binCount[b];
+                GrowBox(rmn, rmx, binMin[b], binMax[b]);
+                float cost = leftCost[b - 1] + (rightCount > 0 ? HalfArea(rmn, rmx) * rightCount : 0);
+                if(cost < bestCost && rightCount > 0 && rightCount < count)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b;
+                }
+            }
+        }
+    }
+
+    // Compare to the cost of making a leaf, with the split
+    // cost normalized by the node area
+    float area = HalfArea(mn, mx);
+    float splitCost = area > 0 ? 1.f + bestCost / area : 1e30f;
+    bool makeLeaf = count <= 2 || depth >= MaxDepth - 1 || 
+        (splitCost >= float(count) && count <= MaxLeafSize);
+
+    if(makeLeaf)
+    {
+        node.mOffset = first;
+        node.mCount = count;
+        m_stats.mNumLeaves++;
+        if(count > m_stats.mMaxLeafSize)
+            m_stats.mMaxLeafSize = count;
+        return index;
+    }
+
+    //
+    // Partition the triangles
+    //
+
+    int mid;
+    int axis = bestAxis;
+    if(axis >= 0)
+    {
+        float scale = NumBins / (cmx[axis] - cmn[axis]);
+        int i = first;
+        int j = first + count - 1;
+        while(i <= j)
+        {
+            int b = min(NumBins - 1, int((m_build[i].mCentroid[axis] - cmn[axis]) * scale));
+            if(b < bestBin)
+            {
+                i++;
+            }
+            else
+            {
+                swap(m_build[i], m_build[j]);
+                j--;
+            }
+        }
+
+        mid = i;
+    }
+    else
+    {
+        mid = first;
+    }
+
+    // If no useful split was found (all of the centroids are in the
+    // same place), just split the list in half.
+    if(mid == first || mid == first + count)
+    {
+        mid = first + count / 2;
+        if(axis < 0)
+        {
+            axis = 0;
+            for(int i=1;  i<3;  i++)
+            {
+                if(mx[i] - mn[i] > mx[axis] - mn[axis])
+                    axis = i;
+            }
+        }
+    }
+
+    m_nodes[index].mCount = -1 - axis;
+    BuildNode(first, mid - first, depth + 1);
+    int right = BuildNode(mid, first + count - mid, depth + 1);
+    m_nodes[index].mOffset = right;
+
+    return index;
+}
+
+
+//
+// Name :         CBvh::IntersectTriangle()
+// Description :  Moller-Trumbore ray/triangle test against triangle t
+//                in leaf order.
+//
+inline bool CBvh::IntersectTriangle(int t, const Ray &ray, float tmax, float &tt, float &u, float &v) const
+{
+    const float *v0 = &m_tris[t * 9];
+    const float *e1 = v0 + 3;
+    const float *e2 = v0 + 6;
+    const float *d = ray.mDir;
+
+    float px = d[1] * e2[2] - d[2] * e2[1];
+    float py = d[2] * e2[0] - d[0] * e2[2];
+    float pz = d[0] * e2[1] - d[1] * e2[0];
+
+    float det = e1[0] * px + e1[1] * py + e1[2] * pz;
+    if(fabs(det) < 1e-12f)
+        return false;
+
+    float inv = 1.f / det;
+
+    float sx = ray.mOrigin[0] - v0[0];
+    float sy = ray.mOrigin[1] - v0[1];
+    float sz = ray.mOrigin[2] - v0[2];
+
+    u = (sx * px + sy * py + sz * pz) * inv;
+    if(u < 0 || u > 1)
+        return false;
+
+    float qx = sy * e1[2] - sz * e1[1];
+    float qy = sz * e1[0] - sx * e1[2];
+    float qz = sx * e1[1] - sy * e1[0];
+
+    v = (d[0] * qx + d[1] * qy + d[2] * qz) * inv;
+    if(v < 0 || u + v > 1)
+        return false;
+
+    tt = (e2[0] * qx + e2[1] * qy + e2[2] * qz) * inv;
+    return tt > ray.mTMin && tt < tmax;
+}
+
+
+//
+// Name :         CBvh::Intersect()
+// Description :  Closest hit traversal. The child on the near side of
+//                the split axis is visited first.
+//
+bool CBvh::Intersect(const Ray &ray, Hit &hit) const
+{
+    if(m_nodes.empty())
+        return false;
+
+    float tmax = ray.mTMax;
+    bool found = false;
+
+    int stack[MaxDepth];
+    int sp = 0;
+    int node = 0;
+
+    while(true)
+    {
+        const Node &n = m_nodes[node];
+        if(SlabTest(n, ray, tmax))
+        {
+            if(!n.IsLeaf())
+            {
+                int axis = -1 - n.mCount;
+                int nearChild = node + 1;
+                int farChild = n.mOffset;
+                if(ray.mDir[axis] < 0)
+                    swap(nearChild, farChild);
+
+                stack[sp++] = farChild;
+                node = nearChild;
+                continue;
+            }
+
+            for(int t=n.mOffset;  t<n.mOffset + n.mCount;  t++)
+            {
+                float tt, u, v;
+                if(IntersectTriangle(t, ray, tmax, tt, u, v))
+                {
+                    tmax = tt;
+                    hit.mT = tt;
+                    hit.mU = u;
+                    hit.mV = v;
+                    hit.mTriangle = m_triIds[t];
+                    found = true;
+                }
+            }
+        }
+
+        if(sp == 0)
+            break;
+
+        node = stack[--sp];
+    }
+
+    return found;
+}
+
+
+//
+// Name :         CBvh::Occluded()
+// Description :  Any hit traversal. Returns at the first hit.
+//
+bool CBvh::Occluded(const Ray &ray) const
+{
+    if(m_nodes.empty())
+        return false;
+
+    int stack[MaxDepth];
+    int sp = 0;
+    int node = 0;
+
+    while(true)
+    {
+        const Node &n = m_nodes[node];
+        if(SlabTest(n, ray, ray.mTMax))
+        {
+            if(!n.IsLeaf())
+            {
+                stack[sp++] = n.mOffset;
+                node = node + 1;
+                continue;
+            }
+
+            for(int t=n.mOffset;  t<n.mOffset + n.mCount;  t++)
+            {
+                float tt, u, v;
+                if(IntersectTriangle(t, ray, ray.mTMax, tt, u, v))
+                    return true;
+            }
+        }
+
+        if(sp == 0)
+            break;
+
+        node = stack[--sp];
+    }
+
+    return false;
+}
+
+
+CBvh::SimdLevel CBvh::GetSimdLevel()
+{
+    return CurrentSimdLevel;
+}
+
+
+void CBvh::SetSimdLevel(SimdLevel level)
+{
+    CurrentSimdLevel = level < SupportedSimdLevel ? level : SupportedSimdLevel;
+}
+
+
+//
+// Name :         CBvh::IntersectPacket()
+// Description :  Closest hit query for a packet of rays, using the
+//                widest instruction set available.
+//
+void CBvh::IntersectPacket(const RayPacket &packet, Hit *hits, bool *found) const
+{
+    if(m_nodes.empty() || packet.mCount == 0)
+    {
+        for(int i=0;  i<packet.mCount;  i++)
+            found[i] = false;
+        return;
+    }
+
+    switch(CurrentSimdLevel)
+    {
+    case SimdAvx:
+        BvhIntersectPacketAvx(&m_nodes[0], &m_tris[0], &m_triIds[0], packet, hits, found);
+        break;
+
+    case SimdSse:
+        BvhIntersectPacketSse(&m_nodes[0], &m_tris[0], &m_triIds[0], packet, hits, found);
+        break;
+
+    default:
+        for(int i=0;  i<packet.mCount;  i++)
+        {
+            Ray ray;
+            for(int j=0;  j<3;  j++)
+            {
+                ray.mOrigin[j] = packet.mOrigin[j][i];
+                ray.mDir[j] = packet.mDir[j][i];
+                ray.mInvDir[j] = packet.mInvDir[j][i];
+            }
+
+            ray.mTMin = packet.mTMin[i];
+            ray.mTMax = packet.mTMax[i];
+            found[i] = Intersect(ray, hits[i]);
+        }
+        break;
+    }
+}
+
+
+//
+// Name :         CBvh::OccludedPacket()
+// Description :  Any hit query for a packet of rays, using the
+//                widest instruction set available.
+//
+void CBvh::OccludedPacket(const RayPacket &packet, bool *occluded) const
+{
+    if(m_nodes.empty() || packet.mCount == 0)
+    {
+        for(int i=0;  i<packet.mCount;  i++)
+            occluded[i] = false;
+        return;
+    }
+
+    switch(CurrentSimdLevel)
+    {
+    case SimdAvx:
+        BvhOccludedPacketAvx(&m_nodes[0], &m_tris[0], packet, occluded);
+        break;
+
+    case SimdSse:
+        BvhOccludedPacketSse(&m_nodes[0], &m_tris[0], packet, occluded);
+        break;
+
+    default:
+        for(int i=0;  i<packet.mCount;  i++)
+        {
+            Ray ray;
+            for(int j=0;  j<3;  j++)
+            {
+                ray.mOrigin[j] = packet.mOrigin[j][i];
+                ray.mDir[j] = packet.mDir[j][i];
+                ray.mInvDir[j] = packet.mInvDir[j][i];
+            }
+
+            ray.mTMin = packet.mTMin[i];
+            ray.mTMax = packet.mTMax[i];
+            occluded[i] = Occluded(ray);
+        }
+        break;
+    }
+}
+
+
+std::wstring CBvh::GetReport() const
+{
+    wstringstream str;
+    str << L"BVH: " << m_stats.mNumTriangles << L" triangles, " 
+        << m_stats.mNumNodes << L" nodes, " 
+        << m_stats.mNumLeaves << L" leaves (max " << m_stats.mMaxLeafSize << L"), "
+        << L"depth " << m_stats.mMaxDepth << L", "
+        << L"SAH cost " << m_stats.mSahCost << L", "
+        << L"built in " << m_stats.mBuildTime << L" ms, "
+        << L"packets " << (CurrentSimdLevel == SimdAvx ? L"AVX" : (CurrentSimdLevel == SimdSse ? L"SSE" : L"scalar"));
+    return str.str();
+}
@@ -0,0 +1,227 @@
+//
+// Name :         Bvh.h
+// Description :  Header for CBvh, a bounding volume hierarchy over the 
+//                triangles in a CTriangleStore.
+//
+
+#pragma once
+
+#include <vector>
+#include <string>
+
+class CTriangleStore;
+
+//! Bounding volume hierarchy for ray queries.
+
+/*! The hierarchy is built with the surface area heuristic (SAH), evaluated 
+    over a fixed number of bins along each axis. Nodes are 32 bytes and 
+    stored in depth first order, so the left child of an interior node 
+    always immediately follows it. The triangles are copied into leaf order
+    in a precomputed vertex and edge form.
+
+    Both a closest hit query (Intersect) and an any hit query (Occluded, 
+    used for shadow rays) are provided. Each also has a packet version 
+    that traces up to eight coherent rays together using SSE (4 wide) or
+    AVX (8 wide) instructions, chosen at run time from what the CPU 
+    supports, with a scalar fallback. */
+
+class CBvh
+{
+public:
+    CBvh();
+    virtual ~CBvh();
+
+    //! A ray for a query
+    /*! Use Set() to initialize, which also computes the inverse
+        direction the traversal needs. */
+    struct Ray
+    {
+        float mOrigin[3];
+        float mDir[3];
+        float mInvDir[3];
+        float mTMin;
+        float mTMax;
+
+        void Set(const float *o, const float *d, float tmin=0.f, float tmax=1e30f)
+        {
+            for(int i=0;  i<3;  i++)
+            {
+                mOrigin[i] = o[i];
+                mDir[i] = d[i];
+                mInvDir[i] = 1.f / d[i];
+            }
+
+            mTMin = tmin;
+            mTMax = tmax;
+        }
+    };
+
+    //! Maximum number of rays in a packet
+    static const int MaxPacketSize = 8;
+
+    //! Deepest possible hierarchy. The traversal stacks are this size.
+    static const int MaxDepth = 64;
+
+    //! A packet of rays, stored as a structure of arrays
+    /*! Use Clear() and Add() to fill. */
+    struct RayPacket
+    {
+        float mOrigin[3][MaxPacketSize];
+        float mDir[3][MaxPacketSize];
+        float mInvDir[3][MaxPacketSize];
+        float mTMin[MaxPacketSize];
+        float mTMax[MaxPacketSize];
+        int mCount;
+
+        RayPacket() : mCount(0) {}
+
+        void Clear() {mCount = 0;}
+        bool IsFull() const {return mCount == MaxPacketSize;}
+
+        //! Add a ray to the packet
+        //! \return Index of the ray in the packet
+        int Add(const Ray &ray)
+        {
+            int i = mCount++;
+            for(int j=0;  j<3;  j++)
+            {
+                mOrigin[j][i] = ray.mOrigin[j];
+                mDir[j][i] = ray.mDir[j];
+                mInvDir[j][i] = ray.mInvDir[j];
+            }
+
+            mTMin[i] = ray.mTMin;
+            mTMax[i] = ray.mTMax;
+            return i;
+        }
+    };
+
+    //! Instruction sets the packet queries can use
+    enum SimdLevel {SimdScalar, SimdSse, SimdAvx};
+
+    //! The result of a closest hit query
+    struct Hit
+    {
+        float mT;           //!< Distance along the ray
+        float mU;           //!< Barycentric weight of corner 1
+        float mV;           //!< Barycentric weight of corner 2
+        int mTriangle;      //!< Triangle index in the CTriangleStore
+        int mInstance;      //!< Instance that was hit. Only set by CSceneBvh.
+    };
+
+    //! Statistics about the last build
+    struct Stats
+    {
+        double mBuildTime;  //!< Build time in milliseconds
+        int mNumTriangles;
+        int mNumNodes;
+        int mNumLeaves;
+        int mMaxDepth;
+        int mMaxLeafSize;
+        double mSahCost;    //!< Expected cost of a random ray, in node traversals
+    };
+
+    //! A node of the hierarchy (32 bytes)
+    /*! For a leaf, mCount is the number of triangles and mOffset is the
+        first triangle. For an interior node, mOffset is the index of the
+        right child and mCount is -1 - the split axis. */
+    struct Node
+    {
+        float mMin[3];
+        int mOffset;
+        float mMax[3];
+        int mCount;
+
+        bool IsLeaf() const {return mCount > 0;}
+    };
+
+    //! Build the hierarchy over all of the triangles in a store
+    void Build(const CTriangleStore &triangles);
+
+    //! Build the hierarchy over a range of the triangles in a store
+    /*! The hit triangle numbers are still store indices.
+        \param triangles The triangle store
+        \param first First triangle to include
+        \param count Number of triangles to include */
+    void Build(const CTriangleStore &triangles, int first, int count);
+
+    //! Remove the hierarchy
+    void Clear();
+
+    //! Closest hit query
+    /*! \param ray The ray to test
+        \param hit Receives the closest hit if any
+        \return true if the ray hits anything between mTMin and mTMax */
+    bool Intersect(const Ray &ray, Hit &hit) const;
+
+    //! Any hit query
+    /*! Stops at the first hit found. 
+        \param ray The ray to test
+        \return true if the ray hits anything between mTMin and mTMax */
+    bool Occluded(const Ray &ray) const;
+
+    //! Closest hit query for a packet of rays
+    /*! \param packet The rays
+        \param hits Receives the closest hit for each ray
+        \param found For each ray, set to true if it hit anything */
+    void IntersectPacket(const RayPacket &packet, Hit *hits, bool *found) const;
+
+    //! Any hit query for a packet of rays
+    /*! \param packet The rays
+        \param occluded For each ray, set to true if it hit anything */
+    void OccludedPacket(const RayPacket &packet, bool *occluded) const;
+
+    //! The instruction set the packet queries use
+    static SimdLevel GetSimdLevel();
+
+    //! Force the packet queries to a lower instruction set
+    /*! Levels the CPU does not support are ignored. This is useful
+        for comparing the speed of the paths. */
+    static void SetSimdLevel(SimdLevel level);
+
+    //! Is the hierarchy empty?
+    bool IsEmpty() const {return m_nodes.empty();}
+
+    //! Statistics for the last build
+    const Stats &GetStats() const {return m_stats;}
+
+    //! A printable summary of the last build
+    std::wstring GetReport() const;
+
+    //! Direct access to the nodes
+    const std::vector<Node> &GetNodes() const {return m_nodes;}
+
+    //! Triangles in leaf order as v0, edge1, edge2 (9 floats each)
+    const std::vector<float> &GetLeafTriangles() const {return m_tris;}
+
+    //! Map from leaf order to the triangle store index
+    const std::vector<int> &GetLeafTriangleIds() const {return m_triIds;}
+
+    //! Number of bins used to evaluate splits along each axis
+    static const int NumBins = 16;
+
+    //! Leaves will not be made larger than this
+    static const int MaxLeafSize = 8;
+
+private:
+    // Per triangle build data
+    struct BuildTri
+    {
+        float mMin[3];
+        float mMax[3];
+        float mCentroid[3];
+        int mId;
+    };
+
+    int BuildNode(int first, int count, int depth);
+    bool IntersectTriangle(int t, const Ray &ray, float tmax, float &tt, float &u, float &v) const;
+
+    std::vector<Node> m_nodes;
+    std::vector<float> m_tris;
+    std::vector<int> m_triIds;
+
+    // Only valid while building
+    std::vector<BuildTri> m_build;
+
+    Stats m_stats;
+};
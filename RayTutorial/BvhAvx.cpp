@@ -0,0 +1,57 @@
+//
+// Name :         BvhAvx.cpp
+// Description :  8 wide AVX packet traversal for CBvh.
+//
+// This file is compiled with /arch:AVX and without the precompiled
+// header, which is built for the base instruction set. Nothing in it
+// may run unless CBvh::GetSimdLevel() has found AVX support. Only use
+// the packet templates and plain data here. An inline function shared
+// with other files, a CBvh member or std::vector::operator[] included,
+// could be compiled for AVX here and chosen by the linker for all of
+// them, so the hierarchy comes in as raw pointers.
+//
+
+#include "BvhPacket.h"
+
+#include <immintrin.h>
+
+// AVX operations for the packet traversal templates
+struct SimdAvx
+{
+    typedef __m256 F;
+    static const int Width = 8;
+
+    static F Load(const float *p) {return _mm256_loadu_ps(p);}
+    static void Store(float *p, F a) {_mm256_storeu_ps(p, a);}
+    static F Set1(float a) {return _mm256_set1_ps(a);}
+    static F Add(F a, F b) {return _mm256_add_ps(a, b);}
+    static F Sub(F a, F b) {return _mm256_sub_ps(a, b);}
+    static F Mul(F a, F b) {return _mm256_mul_ps(a, b);}
+    static F Div(F a, F b) {return _mm256_div_ps(a, b);}
+    static F Min(F a, F b) {return _mm256_min_ps(a, b);}
+    static F Max(F a, F b) {return _mm256_max_ps(a, b);}
+    static F CmpLt(F a, F b) {return _mm256_cmp_ps(a, b, _CMP_LT_OQ);}
+    static F CmpLe(F a, F b) {return _mm256_cmp_ps(a, b, _CMP_LE_OQ);}
+    static F CmpGe(F a, F b) {return _mm256_cmp_ps(a, b, _CMP_GE_OQ);}
+    static F And(F a, F b) {return _mm256_and_ps(a, b);}
+    static F Or(F a, F b) {return _mm256_or_ps(a, b);}
+    static F Select(F mask, F a, F b) {return _mm256_blendv_ps(b, a, mask);}
+    static int MoveMask(F a) {return _mm256_movemask_ps(a);}
+};
+
+
+void BvhIntersectPacketAvx(const CBvh::Node *nodes, const float *tris, const int *ids,
+    const CBvh::RayPacket &packet, CBvh::Hit *hits, bool *found)
+{
+    PacketIntersect<SimdAvx>(nodes, tris, ids, packet, 0, hits, found);
+
+    // Leave the upper halves of the registers clean for SSE code
+    _mm256_zeroupper();
+}
+
+
+void BvhOccludedPacketAvx(const CBvh::Node *nodes, const float *tris, const CBvh::RayPacket &packet, bool *occluded)
+{
+    PacketOccluded<SimdAvx>(nodes, tris, packet, 0, occluded);
+    _mm256_zeroupper();
+}
@@ -0,0 +1,299 @@
+//
+// Name :         BvhPacket.h
+// Description :  Packet traversal of CBvh, written once over a SIMD
+//                vector type. BvhSse.cpp and BvhAvx.cpp instantiate it
+//                for 4 and 8 wide vectors. Only include it from those.
+//
+// The hierarchy is passed as raw pointers and nothing here calls a
+// member of CBvh or std::vector. BvhAvx.cpp is compiled for AVX, and
+// an inline function it called could be compiled for AVX there and
+// chosen by the linker for the other files too.
+//
+
+#pragma once
+
+#include "Bvh.h"
+
+//
+// V must provide:
+//      typedef F               The vector type
+//      static const int Width  Number of lanes
+//      Load, Store, Set1, Add, Sub, Mul, Div, Min, Max,
+//      CmpLt, CmpLe, CmpGe, And, Or, Select(mask, a, b), MoveMask
+//
+
+//
+// Name :         PacketSetup
+// Description :  Loads lanes first to first + V::Width - 1 of a packet.
+//                Lanes past the end of the packet copy the first ray
+//                with an empty interval so they never hit anything.
+//
+template<class V> struct PacketSetup
+{
+    typedef typename V::F F;
+
+    PacketSetup(const CBvh::RayPacket &packet, int first)
+    {
+        float buf[11][V::Width];
+        for(int l=0;  l<V::Width;  l++)
+        {
+            int i = first + l < packet.mCount ? first + l : first;
+            for(int j=0;  j<3;  j++)
+            {
+                buf[j][l] = packet.mOrigin[j][i];
+                buf[3 + j][l] = packet.mDir[j][i];
+                buf[6 + j][l] = packet.mInvDir[j][i];
+            }
+
+            buf[9][l] = packet.mTMin[i];
+            buf[10][l] = first + l < packet.mCount ? packet.mTMax[i] : -1e30f;
+        }
+
+        ox = V::Load(buf[0]);   oy = V::Load(buf[1]);   oz = V::Load(buf[2]);
+        dx = V::Load(buf[3]);   dy = V::Load(buf[4]);   dz = V::Load(buf[5]);
+        ix = V::Load(buf[6]);   iy = V::Load(buf[7]);   iz = V::Load(buf[8]);
+        tmin = V::Load(buf[9]);
+        tmax = V::Load(buf[10]);
+
+        // Children are visited in the order the first ray would visit them
+        for(int j=0;  j<3;  j++)
+            negative[j] = packet.mDir[j][first] < 0;
+    }
+
+    F ox, oy, oz;
+    F dx, dy, dz;
+    F ix, iy, iz;
+    F tmin, tmax;
+    bool negative[3];
+};
+
+
+//
+// Name :         PacketSlab()
+// Description :  Ray/box test for all lanes against the current tmax.
+// Returns :      Mask of the lanes that enter the box
+//
+template<class V> inline int PacketSlab(const CBvh::Node &n, const PacketSetup<V> &p, typename V::F tmax)
+{
+    typedef typename V::F F;
+
+    F t1 = V::Mul(V::Sub(V::Set1(n.mMin[0]), p.ox), p.ix);
+    F t2 = V::Mul(V::Sub(V::Set1(n.mMax[0]), p.ox), p.ix);
+    F tnear = V::Min(t1, t2);
+    F tfar = V::Max(t1, t2);
+
+    t1 = V::Mul(V::Sub(V::Set1(n.mMin[1]), p.oy), p.iy);
+    t2 = V::Mul(V::Sub(V::Set1(n.mMax[1]), p.oy), p.iy);
+    tnear = V::Max(tnear, V::Min(t1, t2));
+    tfar = V::Min(tfar, V::Max(t1, t2));
+
+    t1 = V::Mul(V::Sub(V::Set1(n.mMin[2]), p.oz), p.iz);
+    t2 = V::Mul(V::Sub(V::Set1(n.mMax[2]), p.oz), p.iz);
+    tnear = V::Max(tnear, V::Min(t1, t2));
+    tfar = V::Min(tfar, V::Max(t1, t2));
+
+    tnear = V::Max(tnear, p.tmin);
+    tfar = V::Min(tfar, tmax);
+    return V::MoveMask(V::CmpLe(tnear, tfar));
+}
+
+
+//
+// Name :         PacketTriangle()
+// Description :  Moller-Trumbore test of one triangle against all lanes.
+// Returns :      Mask of the lanes that hit it before tmax, with the
+//                distance and barycentrics in t, u, and v.
+//
+template<class V> inline typename V::F PacketTriangle(const float *tri, const PacketSetup<V> &p,
+    typename V::F tmax, typename V::F &t, typename V::F &u, typename V::F &v)
+{
+    typedef typename V::F F;
+
+    F e1x = V::Set1(tri[3]), e1y = V::Set1(tri[4]), e1z = V::Set1(tri[5]);
+    F e2x = V::Set1(tri[6]), e2y = V::Set1(tri[7]), e2z = V::Set1(tri[8]);
+
+    F px = V::Sub(V::Mul(p.dy, e2z), V::Mul(p.dz, e2y));
+    F py = V::Sub(V::Mul(p.dz, e2x), V::Mul(p.dx, e2z));
+    F pz = V::Sub(V::Mul(p.dx, e2y), V::Mul(p.dy, e2x));
+
+    F det = V::Add(V::Add(V::Mul(e1x, px), V::Mul(e1y, py)), V::Mul(e1z, pz));
+    F inv = V::Div(V::Set1(1.f), det);
+
+    F sx = V::Sub(p.ox, V::Set1(tri[0]));
+    F sy = V::Sub(p.oy, V::Set1(tri[1]));
+    F sz = V::Sub(p.oz, V::Set1(tri[2]));
+
+    u = V::Mul(V::Add(V::Add(V::Mul(sx, px), V::Mul(sy, py)), V::Mul(sz, pz)), inv);
+
+    F qx = V::Sub(V::Mul(sy, e1z), V::Mul(sz, e1y));
+    F qy = V::Sub(V::Mul(sz, e1x), V::Mul(sx, e1z));
+    F qz = V::Sub(V::Mul(sx, e1y), V::Mul(sy, e1x));
+
+    v = V::Mul(V::Add(V::Add(V::Mul(p.dx, qx), V::Mul(p.dy, qy)), V::Mul(p.dz, qz)), inv);
+    t = V::Mul(V::Add(V::Add(V::Mul(e2x, qx), V::Mul(e2y, qy)), V::Mul(e2z, qz)), inv);
+
+    // A zero determinant gives infinities or NaNs, which fail these
+    F zero = V::Set1(0.f);
+    F mask = V::And(V::CmpGe(u, zero), V::CmpGe(v, zero));
+    mask = V::And(mask, V::CmpLe(V::Add(u, v), V::Set1(1.f)));
+    mask = V::And(mask, V::CmpLt(p.tmin, t));
+    mask = V::And(mask, V::CmpLt(t, tmax));
+    return mask;
+}
+
+
+//
+// Name :         PacketIntersect()
+// Description :  Closest hit traversal for lanes first to
+//                first + V::Width - 1 of a packet.
+//
+template<class V> void PacketIntersect(const CBvh::Node *nodes, const float *tris, const int *ids,
+    const CBvh::RayPacket &packet, int first, CBvh::Hit *hits, bool *found)
+{
+    typedef typename V::F F;
+    const int W = V::Width;
+
+    PacketSetup<V> p(packet, first);
+    F tmax = p.tmax;
+
+    float hitU[W], hitV[W];
+    int hitTri[W];
+    for(int l=0;  l<W;  l++)
+        hitTri[l] = -1;
+
+    int stack[CBvh::MaxDepth];
+    int sp = 0;
+    int node = 0;
+
+    while(true)
+    {
+        const CBvh::Node &n = nodes[node];
+        if(PacketSlab<V>(n, p, tmax))
+        {
+            if(n.mCount <= 0)
+            {
+                int axis = -1 - n.mCount;
+                int nearChild = node + 1;
+                int farChild = n.mOffset;
+                if(p.negative[axis])
+                {
+                    nearChild = n.mOffset;
+                    farChild = node + 1;
+                }
+
+                stack[sp++] = farChild;
+                node = nearChild;
+                continue;
+            }
+
+            for(int t=n.mOffset;  t<n.mOffset + n.mCount;  t++)
+            {
+                F tt, u, v;
+                F mask = PacketTriangle<V>(tris + t * 9, p, tmax, tt, u, v);
+                int bits = V::MoveMask(mask);
+                if(bits == 0)
+                    continue;
+
+                tmax = V::Select(mask, tt, tmax);
+
+                float us[W], vs[W];
+                V::Store(us, u);
+                V::Store(vs, v);
+                for(int l=0;  l<W;  l++)
+                {
+                    if(bits & (1 << l))
+                    {
+                        hitU[l] = us[l];
+                        hitV[l] = vs[l];
+                        hitTri[l] = ids[t];
+                    }
+                }
+            }
+        }
+
+        if(sp == 0)
+            break;
+
+        node = stack[--sp];
+    }
+
+    float ts[W];
+    V::Store(ts, tmax);
+    for(int l=0;  l<W && first + l < packet.mCount;  l++)
+    {
+        int i = first + l;
+        found[i] = hitTri[l] >= 0;
+        if(found[i])
+        {
+            hits[i].mT = ts[l];
+            hits[i].mU = hitU[l];
+            hits[i].mV = hitV[l];
+            hits[i].mTriangle = hitTri[l];
+        }
+    }
+}
+
+
+//
+// Name :         PacketOccluded()
+// Description :  Any hit traversal for lanes first to first + V::Width - 1
+//                of a packet. A lane stops as soon as it hits anything,
+//                and the traversal stops when every lane has.
+//
+template<class V> void PacketOccluded(const CBvh::Node *nodes, const float *tris,
+    const CBvh::RayPacket &packet, int first, bool *occluded)
+{
+    typedef typename V::F F;
+    const int W = V::Width;
+
+    PacketSetup<V> p(packet, first);
+
+    // Lanes that are done get an interval that can't be hit
+    F tmax = p.tmax;
+    F done = V::Set1(-1e30f);
+
+    int active = 0;
+    for(int l=0;  l<W && first + l < packet.mCount;  l++)
+        active |= 1 << l;
+
+    int blocked = 0;
+
+    int stack[CBvh::MaxDepth];
+    int sp = 0;
+    int node = 0;
+
+    while(active != 0)
+    {
+        const CBvh::Node &n = nodes[node];
+        if(PacketSlab<V>(n, p, tmax))
+        {
+            if(n.mCount <= 0)
+            {
+                stack[sp++] = n.mOffset;
+                node = node + 1;
+                continue;
+            }
+
+            for(int t=n.mOffset;  t<n.mOffset + n.mCount && active != 0;  t++)
+            {
+                F tt, u, v;
+                F mask = PacketTriangle<V>(tris + t * 9, p, tmax, tt, u, v);
+                int bits = V::MoveMask(mask) & active;
+                if(bits == 0)
+                    continue;
+
+                blocked |= bits;
+                active &= ~bits;
+                tmax = V::Select(mask, done, tmax);
+            }
+        }
+
+        if(sp == 0)
+            break;
+
+        node = stack[--sp];
+    }
+
+    for(int l=0;  l<W && first + l < packet.mCount;  l++)
+        occluded[first + l] = (blocked & (1 << l)) != 0;
+}
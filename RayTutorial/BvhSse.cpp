@@ -0,0 +1,48 @@
+//
+// Name :         BvhSse.cpp
+// Description :  4 wide SSE packet traversal for CBvh.
+//
+
+#include "StdAfx.h"
+#include "BvhPacket.h"
+
+#include <xmmintrin.h>
+
+// SSE operations for the packet traversal templates
+struct SimdSse
+{
+    typedef __m128 F;
+    static const int Width = 4;
+
+    static F Load(const float *p) {return _mm_loadu_ps(p);}
+    static void Store(float *p, F a) {_mm_storeu_ps(p, a);}
+    static F Set1(float a) {return _mm_set1_ps(a);}
+    static F Add(F a, F b) {return _mm_add_ps(a, b);}
+    static F Sub(F a, F b) {return _mm_sub_ps(a, b);}
+    static F Mul(F a, F b) {return _mm_mul_ps(a, b);}
+    static F Div(F a, F b) {return _mm_div_ps(a, b);}
+    static F Min(F a, F b) {return _mm_min_ps(a, b);}
+    static F Max(F a, F b) {return _mm_max_ps(a, b);}
+    static F CmpLt(F a, F b) {return _mm_cmplt_ps(a, b);}
+    static F CmpLe(F a, F b) {return _mm_cmple_ps(a, b);}
+    static F CmpGe(F a, F b) {return _mm_cmpge_ps(a, b);}
+    static F And(F a, F b) {return _mm_and_ps(a, b);}
+    static F Or(F a, F b) {return _mm_or_ps(a, b);}
+    static F Select(F mask, F a, F b) {return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));}
+    static int MoveMask(F a) {return _mm_movemask_ps(a);}
+};
+
+
+void BvhIntersectPacketSse(const CBvh::Node *nodes, const float *tris, const int *ids,
+    const CBvh::RayPacket &packet, CBvh::Hit *hits, bool *found)
+{
+    for(int first=0;  first<packet.mCount;  first+=SimdSse::Width)
+        PacketIntersect<SimdSse>(nodes, tris, ids, packet, first, hits, found);
+}
+
+
+void BvhOccludedPacketSse(const CBvh::Node *nodes, const float *tris, const CBvh::RayPacket &packet, bool *occluded)
+{
+    for(int first=0;  first<packet.mCount;  first+=SimdSse::Width)
+        PacketOccluded<SimdSse>(nodes, tris, packet, first, occluded);
+}
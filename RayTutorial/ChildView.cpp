@@ -35,6 +35,7 @@ CChildView::CChildView()
 
 	m_raytrace = false;
 	m_rayimage = NULL;
+    m_renderer = NULL;
 
     //
     // Load our object
@@ -49,9 +50,16 @@ CChildView::CChildView()
 
 CChildView::~CChildView()
 {
+    // The background render uses the image and the renderer
+    m_progressive.Cancel();
+    delete m_renderer;
+
+    if(m_rayimage != NULL)
+    {
         delete m_rayimage[0];
         delete m_rayimage;
         m_rayimage = NULL;
+    }
 }
 
 
@@ -69,6 +77,10 @@ void CChildView::LoadModel(const wchar_t *file)
         AfxMessageBox(msg.str().c_str());
     }
 
+    // The scene shows the model once, where it was placed in the file
+    m_scene.SetModel(&m_model);
+    m_scene.AddInstance(CGrTransform());
+
     // Set the camera to the settings from the file
     CGrVector cameraEye = m_model.GetCameraPosition();
     CGrVector cameraCenter = m_model.GetCameraTarget();
@@ -88,6 +100,7 @@ BEGIN_MESSAGE_MAP(CChildView, COpenGLWnd)
     ON_WM_MOUSEWHEEL()
 	ON_COMMAND(ID_RENDER_RAYTRACE, &CChildView::OnRenderRaytrace)
 	ON_UPDATE_COMMAND_UI(ID_RENDER_RAYTRACE, &CChildView::OnUpdateRenderRaytrace)
+    ON_MESSAGE(WM_RAYTRACE_PASS, &CChildView::OnRaytracePass)
 END_MESSAGE_MAP()
 
 
@@ -128,12 +141,15 @@ void CChildView::OnGLDraw(CDC * pDC)
         glMatrixMode(GL_MODELVIEW);
         glLoadIdentity();
 
-        // If we got it, draw it
+        // If we got it, draw it. The background render
+        // updates it when a pass completes.
         if(m_rayimage)
         {
+            m_progressive.Lock();
             glRasterPos3i(0, 0, 0);
             glDrawPixels(m_rayimagewidth, m_rayimageheight, 
                 GL_RGB, GL_UNSIGNED_BYTE, m_rayimage[0]);
+            m_progressive.Unlock();
         }
 
         return;
@@ -186,7 +202,7 @@ void CChildView::OnGLDraw(CDC * pDC)
     CGlRenderer renderer;
 
 	glEnable(GL_NORMALIZE);
-    m_model.Draw(&renderer);
+    m_scene.Draw(&renderer);
 
     glFlush();
 }
@@ -210,6 +226,9 @@ void CChildView::OnMouseMove(UINT nFlags, CPoint point)
 {
     if(m_camera.MouseMove(point.x, point.y, nFlags))
     {
+        if(m_raytrace)
+            StartRaytrace();
+
          Invalidate();
     }
 
@@ -220,6 +239,9 @@ void CChildView::OnMouseMove(UINT nFlags, CPoint point)
 BOOL CChildView::OnMouseWheel(UINT nFlags, short zDelta, CPoint pt)
 {
     m_camera.MouseWheel(zDelta);
+    if(m_raytrace)
+        StartRaytrace();
+
     Invalidate();
 
     return COpenGLWnd::OnMouseWheel(nFlags, zDelta, pt);
@@ -230,8 +252,16 @@ void CChildView::OnRenderRaytrace()
 {
     m_raytrace = !m_raytrace;
     Invalidate();
+
+    // Stop any render in progress before we touch the image
+    m_progressive.Cancel();
+
     if(!m_raytrace)
+    {
+        delete m_renderer;
+        m_renderer = NULL;
         return;
+    }
 
 	//
     // If an existing image already exists, delete it
@@ -275,18 +305,55 @@ void CChildView::OnRenderRaytrace()
     //
 
     // Instantiate the raytrace renderer
-    CMyRaytraceRenderer renderer;
+    delete m_renderer;
+    m_renderer = new CMyRaytraceRenderer();
 
     // Configure the renderer
-    // TODO1
+    m_renderer->Reserve(m_model.GetTriangleCount());
+    m_renderer->SetThreadPool(&m_pool);
+    m_renderer->SetAmbient(LightAmbientColor);
+    m_renderer->AddLight(Light0Pos, Light0Color);
+    m_renderer->AddLight(Light1Pos, Light1Color);
+
+    const float background[] = {0.3f, 0.5f, 1.0f};
+    m_renderer->SetBackground(background);
+
+    // Capture the model once. The scene instances share it.
+    m_model.Draw(m_renderer);
+
+    // Start the ray tracing in the background. Each completed
+    // pass is copied into m_rayimage.
+    m_progressive.SetDisplay(m_rayimage, m_rayimagewidth, m_rayimageheight);
+    m_progressive.SetNotify(m_hWnd, WM_RAYTRACE_PASS);
+    StartRaytrace();
+}
 
-    // Render the scene
-    m_model.Draw(&renderer);
 
-    // Tell it to do the actual ray tracing now
-    // TODO2
+//
+// Name :         CChildView::StartRaytrace()
+// Description :  Start or restart the background ray trace from the
+//                current camera.
+//
+void CChildView::StartRaytrace()
+{
+    if(m_renderer == NULL)
+        return;
 
+    m_progressive.Cancel();
+    m_renderer->UpdateScene(m_scene);
+    m_renderer->SetCamera(m_camera);
+    m_progressive.Start(m_renderer);
+}
+
+
+//
+// Name :         CChildView::OnRaytracePass()
+// Description :  Posted by the background render when a pass completes.
+//
+LRESULT CChildView::OnRaytracePass(WPARAM wParam, LPARAM lParam)
+{
     Invalidate();
+    return 0;
 }
 
 
@@ -8,6 +8,12 @@
 #include <grafx.h>
 #include "graphics/OpenGLWnd.h"
 #include "graphics/GrCamera.h"
+#include "ProgressiveRender.h"
+
+class CMyRaytraceRenderer;
+
+// Posted by the background ray trace when a pass completes
+#define WM_RAYTRACE_PASS (WM_APP + 1)
 
 // CChildView window
 
@@ -37,16 +43,27 @@ protected:
 
 private:
     void LoadModel(const wchar_t *file);
+    void StartRaytrace();
 
     CGrCamera m_camera;
     CGrModelX m_model;
 
+    // Instances of m_model to draw
+    CGrModelXScene m_scene;
+
+    // Threads for ray tracing
+    CGrThreadPool m_pool;
+
 	bool m_raytrace;
 
 	BYTE      **m_rayimage;
     int         m_rayimagewidth;
     int         m_rayimageheight;
 
+    // The scene captured for ray tracing and the background render
+    CMyRaytraceRenderer *m_renderer;
+    CProgressiveRender m_progressive;
+
     virtual void OnGLDraw(CDC * pDC);
 
 public:
@@ -56,5 +73,6 @@ public:
     afx_msg BOOL OnMouseWheel(UINT nFlags, short zDelta, CPoint pt);
 	afx_msg void OnRenderRaytrace();
 	afx_msg void OnUpdateRenderRaytrace(CCmdUI *pCmdUI);
+    afx_msg LRESULT OnRaytracePass(WPARAM wParam, LPARAM lParam);
 };
 
@@ -33,4 +33,36 @@ void CGlRenderer::EndEffect(CGrModelX::IEffect *effect)
     {
         glDisable(GL_TEXTURE_2D);
     }
-}
\ No newline at end of file
+}
+
+//
+// Name :         CGlRenderer::DrawMeshPart()
+// Description :  Draw an entire mesh part with a single glDrawElements() 
+//                call rather than one call per vertex. The model triangles
+//                are clockwise, so the front face is switched while drawing.
+//
+void CGlRenderer::DrawMeshPart(const MeshPart &part)
+{
+    glFrontFace(GL_CW);
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+
+    glVertexPointer(3, GL_FLOAT, 0, part.mVertices);
+    glNormalPointer(GL_FLOAT, 0, part.mNormals);
+
+    if(part.mTcoords != NULL)
+    {
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glTexCoordPointer(2, GL_FLOAT, 0, part.mTcoords);
+    }
+
+    glDrawElements(GL_TRIANGLES, part.mNumTriangles * 3, GL_UNSIGNED_INT, part.mIndices);
+
+    if(part.mTcoords != NULL)
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_NORMAL_ARRAY);
+    glFrontFace(GL_CCW);
+}
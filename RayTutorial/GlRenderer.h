@@ -18,4 +18,5 @@ public:
     virtual void TexCoord2fv(float *t) {glTexCoord2fv(t);}
     virtual void Normal3fv(float *n) {glNormal3fv(n);}
     virtual void Vertex3fv(float *v) {glVertex3fv(v);}
+    virtual void DrawMeshPart(const MeshPart &part);
 };
\ No newline at end of file
@@ -1,12 +1,1077 @@
 #include "StdAfx.h"
 #include "MyRaytraceRenderer.h"
+#include "graphics/GrCamera.h"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+inline float Dot3(const float *a, const float *b) {return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];}
+
+inline void Cross3(const float *a, const float *b, float *r)
+{
+    r[0] = a[1] * b[2] - a[2] * b[1];
+    r[1] = a[2] * b[0] - a[0] * b[2];
+    r[2] = a[0] * b[1] - a[1] * b[0];
+}
+
+// Radical inverse, used for low discrepancy sample positions
+inline float Halton(int i, int base)
+{
+    float f = 1;
+    float r = 0;
+    while(i > 0)
+    {
+        f /= base;
+        r += f * (i % base);
+        i /= base;
+    }
+
+    return r;
+}
+
+inline void Normalize3(float *a)
+{
+    float len = sqrt(Dot3(a, a));
+    if(len > 0)
+    {
+        a[0] /= len;
+        a[1] /= len;
+        a[2] /= len;
+    }
+}
 
 
 CMyRaytraceRenderer::CMyRaytraceRenderer(void)
 {
+    m_stack.push_back(CGrTransform());
+    ComputeCurrentMatrix();
+
+    m_effect = -1;
+    m_numCorners = 0;
+    m_tcoord[0] = m_tcoord[1] = 0;
+    m_normal[0] = m_normal[1] = 0;
+    m_normal[2] = 1;
+
+    m_image = NULL;
+    m_width = m_height = 0;
+    m_fieldOfView = 35;
+    m_planeWidth = m_planeHeight = 1;
+    m_pool = NULL;
+    m_blockSize = 1;
+    m_sample = 0;
+    m_jitter[0] = m_jitter[1] = 0.5f;
+    m_cancel = NULL;
+    m_textureFilter = CGrTextureSampler::Trilinear;
+    m_tiledTextures = false;
+    m_maxDepth = 0;
+    for(int i=0;  i<3;  i++)
+    {
+        m_eye[i] = 0;
+        m_forward[i] = i == 2 ? -1.f : 0.f;
+        m_right[i] = i == 0 ? 1.f : 0.f;
+        m_up[i] = i == 1 ? 1.f : 0.f;
+        m_ambient[i] = 0.2f;
+        m_background[i] = 0;
+    }
 }
 
 
 CMyRaytraceRenderer::~CMyRaytraceRenderer(void)
 {
+    for(vector<CGrTextureSampler *>::iterator s=m_samplers.begin();  s!=m_samplers.end();  s++)
+        delete *s;
+}
+
+
+void CMyRaytraceRenderer::PushMatrix()
+{
+    m_stack.push_back(m_stack.back());
+}
+
+
+void CMyRaytraceRenderer::PopMatrix()
+{
+    if(m_stack.size() > 1)
+        m_stack.pop_back();
+
+    ComputeCurrentMatrix();
+}
+
+
+void CMyRaytraceRenderer::MultMatrix(const CGrTransform &t)
+{
+    m_stack.back() *= t;
+    ComputeCurrentMatrix();
+}
+
+
+//
+// Name :         CMyRaytraceRenderer::ComputeCurrentMatrix()
+// Description :  Convert the top of the matrix stack into the float
+//                matrices used to transform vertices and normals.
+//                Once the current mesh is placed, triangles are 
+//                captured relative to the mesh transform.
+//
+void CMyRaytraceRenderer::ComputeCurrentMatrix()
+{
+    CGrTransform m = m_stack.back();
+    if(!m_meshes.empty() && m_meshes.back().mPlaced)
+        m = CGrTransform::GetAffineInverse(m_meshes.back().mTransform) * m;
+
+    for(int r=0;  r<3;  r++)
+    {
+        for(int c=0;  c<4;  c++)
+        {
+            m_matrix[r * 4 + c] = float(m[r][c]);
+        }
+    }
+
+    // Normals transform by the inverse transpose
+    CGrTransform inv = CGrTransform::GetAffineInverse(m);
+    for(int r=0;  r<3;  r++)
+    {
+        for(int c=0;  c<3;  c++)
+        {
+            m_normalMatrix[r * 3 + c] = float(inv[c][r]);
+        }
+    }
+}
+
+
+inline void CMyRaytraceRenderer::TransformPoint(const float *v, float *r) const
+{
+    const float *m = m_matrix;
+    r[0] = m[0] * v[0] + m[1] * v[1] + m[2] * v[2] + m[3];
+    r[1] = m[4] * v[0] + m[5] * v[1] + m[6] * v[2] + m[7];
+    r[2] = m[8] * v[0] + m[9] * v[1] + m[10] * v[2] + m[11];
+}
+
+
+inline void CMyRaytraceRenderer::TransformNormal(const float *n, float *r) const
+{
+    const float *m = m_normalMatrix;
+    float x = m[0] * n[0] + m[1] * n[1] + m[2] * n[2];
+    float y = m[3] * n[0] + m[4] * n[1] + m[5] * n[2];
+    float z = m[6] * n[0] + m[7] * n[1] + m[8] * n[2];
+
+    float len = sqrt(x * x + y * y + z * z);
+    if(len > 0)
+    {
+        x /= len;
+        y /= len;
+        z /= len;
+    }
+
+    r[0] = x;
+    r[1] = y;
+    r[2] = z;
+}
+
+
+void CMyRaytraceRenderer::SetEffect(CGrModelX::IEffect *effect)
+{
+    m_effect = m_triangles.AddEffect(effect);
+}
+
+
+void CMyRaytraceRenderer::NewMesh(const wchar_t *name)
+{
+    m_triangles.AddMesh(name);
+
+    MeshPlacement mesh;
+    mesh.mParent = m_stack.back();
+    mesh.mPlaced = false;
+    m_meshes.push_back(mesh);
+
+    ComputeCurrentMatrix();
+}
+
+
+//
+// Name :         CMyRaytraceRenderer::PlaceMesh()
+// Description :  The current matrix when the first triangle of a mesh
+//                arrives becomes the mesh transform. For a ModelX mesh
+//                that is the absolute transform of its bone.
+//
+void CMyRaytraceRenderer::PlaceMesh()
+{
+    if(m_meshes.empty())
+        NewMesh(L"");
+
+    MeshPlacement &mesh = m_meshes.back();
+    if(mesh.mPlaced)
+        return;
+
+    mesh.mTransform = m_stack.back();
+    mesh.mPlaced = true;
+    ComputeCurrentMatrix();
+}
+
+
+void CMyRaytraceRenderer::BeginTriangles()
+{
+    m_numCorners = 0;
+    m_tcoord[0] = m_tcoord[1] = 0;
+}
+
+
+void CMyRaytraceRenderer::TexCoord2fv(float *t)
+{
+    m_tcoord[0] = t[0];
+    m_tcoord[1] = t[1];
+}
+
+
+void CMyRaytraceRenderer::Normal3fv(float *n)
+{
+    m_normal[0] = n[0];
+    m_normal[1] = n[1];
+    m_normal[2] = n[2];
+}
+
+
+//
+// Name :         CMyRaytraceRenderer::Vertex3fv()
+// Description :  Per vertex interface. Every third vertex completes
+//                a triangle.
+//
+void CMyRaytraceRenderer::Vertex3fv(float *v)
+{
+    PlaceMesh();
+
+    float *corner = m_corners[m_numCorners];
+    TransformPoint(v, corner);
+    TransformNormal(m_normal, corner + 3);
+    corner[6] = m_tcoord[0];
+    corner[7] = m_tcoord[1];
+
+    if(++m_numCorners < 3)
+        return;
+
+    const float *p[3] = {m_corners[0], m_corners[1], m_corners[2]};
+    const float *n[3] = {m_corners[0] + 3, m_corners[1] + 3, m_corners[2] + 3};
+    const float *t[3] = {m_corners[0] + 6, m_corners[1] + 6, m_corners[2] + 6};
+    m_triangles.AddTriangle(p, n, t, m_effect);
+
+    m_numCorners = 0;
+}
+
+
+//
+// Name :         CMyRaytraceRenderer::DrawMeshPart()
+// Description :  Capture an entire mesh part. Each vertex of the part is
+//                transformed once into a scratch buffer, then the 
+//                triangles are gathered from it. The corner order is
+//                reversed just as the per vertex path does, since the
+//                model triangles are clockwise.
+//
+void CMyRaytraceRenderer::DrawMeshPart(const MeshPart &part)
+{
+    PlaceMesh();
+
+    int nv = part.mNumVertices;
+    m_scratch.resize(nv * 8);
+
+    static const float zero[2] = {0, 0};
+    for(int i=0;  i<nv;  i++)
+    {
+        float *s = &m_scratch[i * 8];
+        TransformPoint(part.mVertices + i * 3, s);
+        TransformNormal(part.mNormals + i * 3, s + 3);
+
+        const float *t = part.mTcoords != NULL ? part.mTcoords + i * 2 : zero;
+        s[6] = t[0];
+        s[7] = t[1];
+    }
+
+    m_triangles.Reserve(m_triangles.GetNumTriangles() + part.mNumTriangles);
+
+    const int *indices = part.mIndices;
+    for(int t=0;  t<part.mNumTriangles * 3;  t+=3)
+    {
+        const float *a = &m_scratch[indices[t + 2] * 8];
+        const float *b = &m_scratch[indices[t + 1] * 8];
+        const float *c = &m_scratch[indices[t] * 8];
+
+        const float *p[3] = {a, b, c};
+        const float *n[3] = {a + 3, b + 3, c + 3};
+        const float *tc[3] = {a + 6, b + 6, c + 6};
+        m_triangles.AddTriangle(p, n, tc, m_effect);
+    }
+}
+
+
+void CMyRaytraceRenderer::SetImage(BYTE **image, int width, int height)
+{
+    m_image = image;
+    m_width = width;
+    m_height = height;
+    m_accum.resize(width * height * 3);
+}
+
+
+//
+// Name :         CMyRaytraceRenderer::SetCamera()
+// Description :  Compute the camera frame the same way gluLookAt() does.
+//
+void CMyRaytraceRenderer::SetCamera(const CGrCamera &camera)
+{
+    const double *eye = camera.GetEye();
+    const double *center = camera.GetCenter();
+    const double *up = camera.GetUp();
+
+    float u[3];
+    for(int i=0;  i<3;  i++)
+    {
+        m_eye[i] = float(eye[i]);
+        m_forward[i] = float(center[i] - eye[i]);
+        u[i] = float(up[i]);
+    }
+
+    Normalize3(m_forward);
+    Cross3(m_forward, u, m_right);
+    Normalize3(m_right);
+    Cross3(m_right, m_forward, m_up);
+
+    m_fieldOfView = camera.GetFieldOfView();
+}
+
+
+void CMyRaytraceRenderer::SetAmbient(const float *color)
+{
+    for(int i=0;  i<3;  i++)
+        m_ambient[i] = color[i];
+}
+
+
+void CMyRaytraceRenderer::SetBackground(const float *color)
+{
+    for(int i=0;  i<3;  i++)
+        m_background[i] = color[i];
+}
+
+
+void CMyRaytraceRenderer::AddLight(const float *position, const float *color)
+{
+    Light light;
+    for(int i=0;  i<3;  i++)
+    {
+        light.mPosition[i] = position[i];
+        light.mColor[i] = color[i];
+    }
+
+    m_lights.push_back(light);
+}
+
+
+//
+// Name :         CMyRaytraceRenderer::Render()
+// Description :  Build the BVH and render the full image in tiles.
+//
+void CMyRaytraceRenderer::Render()
+{
+    BuildBvh();
+    RenderPass(1, 0);
+}
+
+
+void CMyRaytraceRenderer::BuildBvh()
+{
+    m_scene.BuildMeshes(m_triangles);
+    UpdateSamplers();
+
+    if(m_instances.empty())
+    {
+        for(int m=0;  m<(int)m_meshes.size();  m++)
+        {
+            Instance instance;
+            instance.mMesh = m;
+            instance.mTransform = m_meshes[m].mTransform;
+            m_instances.push_back(instance);
+        }
+    }
+
+    PlaceInstances();
+}
+
+
+//
+// Name :         CMyRaytraceRenderer::UpdateSamplers()
+// Description :  Make a sampler for the texture of each effect. This
+//                builds the mipmap levels of the textures, so it is
+//                done here rather than while the tiles are rendering.
+//
+void CMyRaytraceRenderer::UpdateSamplers()
+{
+    for(vector<CGrTextureSampler *>::iterator s=m_samplers.begin();  s!=m_samplers.end();  s++)
+        delete *s;
+
+    m_samplers.assign(m_triangles.GetNumEffects(), (CGrTextureSampler *)NULL);
+    for(int e=0;  e<m_triangles.GetNumEffects();  e++)
+    {
+        CGrTexture *texture = m_triangles.GetEffect(e)->GetTexture();
+        if(texture != NULL && !texture->IsEmpty())
+            m_samplers[e] = new CGrTextureSampler(texture, m_textureFilter, CGrTextureSampler::Repeat, m_tiledTextures);
+    }
+}
+
+
+//
+// Name :         CMyRaytraceRenderer::PlaceInstances()
+// Description :  Rebuild the top level of the BVH from m_instances,
+//                provided the meshes have been built.
+//
+void CMyRaytraceRenderer::PlaceInstances()
+{
+    if(m_scene.GetNumMeshes() != m_triangles.GetNumMeshes())
+        return;
+
+    m_scene.ClearInstances();
+    for(vector<Instance>::const_iterator i=m_instances.begin();  i!=m_instances.end();  i++)
+        m_scene.AddInstance(i->mMesh, i->mTransform);
+
+    m_scene.BuildTop();
+}
+
+
+//
+// Name :         CMyRaytraceRenderer::UpdatePose()
+// Description :  Model::Draw() starts each mesh and multiplies in the
+//                absolute transform of its bone, so the mesh transform
+//                is the matrix the mesh was started with times that.
+//
+void CMyRaytraceRenderer::UpdatePose(CGrModelX &model)
+{
+    model.ComputeBonesAbsolute();
+
+    int numMeshes = min(model.GetMeshCount(), (int)m_meshes.size());
+    m_instances.clear();
+    for(int m=0;  m<numMeshes;  m++)
+    {
+        MeshPlacement &mesh = m_meshes[m];
+        const CGrModelX::IBone *bone = model.GetBone(model.GetMeshBone(m));
+        mesh.mTransform = mesh.mParent * bone->GetAbsoluteTransform();
+
+        Instance instance;
+        instance.mMesh = m;
+        instance.mTransform = mesh.mTransform;
+        m_instances.push_back(instance);
+    }
+
+    PlaceInstances();
+}
+
+
+//
+// Name :         CMyRaytraceRenderer::UpdateScene()
+// Description :  The captured meshes are in the coordinates of their
+//                bones, so each instance of a mesh is placed by the
+//                absolute transform of its bone in the instance pose.
+//
+void CMyRaytraceRenderer::UpdateScene(const CGrModelXScene &scene)
+{
+    CGrModelX *model = scene.GetModel();
+    if(model == NULL)
+        return;
+
+    int numMeshes = min(model->GetMeshCount(), (int)m_meshes.size());
+    m_bones.resize(model->GetBoneCount());
+
+    m_instances.clear();
+    m_instances.reserve(scene.GetInstanceCount() * numMeshes);
+    for(int i=0;  i<scene.GetInstanceCount() && !m_bones.empty();  i++)
+    {
+        scene.ComputeBonesAbsolute(i, &m_bones[0]);
+        for(int m=0;  m<numMeshes;  m++)
+        {
+            Instance instance;
+            instance.mMesh = m;
+            instance.mTransform = m_bones[model->GetMeshBone(m)];
+            m_instances.push_back(instance);
+        }
+    }
+
+    PlaceInstances();
+}
+
+
+//
+// Name :         CMyRaytraceRenderer::RenderPass()
+// Description :  Render one pass of the image in tiles.
+//
+void CMyRaytraceRenderer::RenderPass(int blockSize, int sample)
+{
+    if(m_image == NULL || m_width <= 0 || m_height <= 0)
+        return;
+
+    m_blockSize = blockSize > 1 ? blockSize : 1;
+    m_sample = m_blockSize == 1 ? sample : 0;
+
+    // Sample 0 goes through the pixel centers. Later samples are spread
+    // over the pixel with a Halton sequence.
+    m_jitter[0] = m_sample > 0 ? Halton(m_sample, 2) : 0.5f;
+    m_jitter[1] = m_sample > 0 ? Halton(m_sample, 3) : 0.5f;
+
+    // Size of the image plane at distance 1, matching gluPerspective()
+    m_planeHeight = float(tan(m_fieldOfView * GR_PI / 360.));
+    m_planeWidth = m_planeHeight * float(m_width) / float(m_height);
+
+    // Tiles must be whole blocks
+    int tile = 32;
+    tile -= tile % m_blockSize;
+    m_scheduler.SetTileSize(tile > 0 ? tile : m_blockSize, tile > 0 ? tile : m_blockSize);
+    m_scheduler.Render(this, m_width, m_height, m_pool);
+}
+
+
+//
+// Name :         CMyRaytraceRenderer::RenderTile()
+// Description :  Trace the rays for a tile. This writes only the 
+//                tile pixels, so tiles can be rendered concurrently.
+//                Rays along a row are traced together as a packet.
+//
+void CMyRaytraceRenderer::RenderTile(int x0, int y0, int width, int height, int worker)
+{
+    int step = m_blockSize;
+    float scale = 1.f / float(m_sample + 1);
+
+    for(int r=y0;  r<y0 + height;  r+=step)
+    {
+        if(m_cancel != NULL && *m_cancel)
+            return;
+
+        int bh = min(step, y0 + height - r);
+
+        for(int c=x0;  c<x0 + width;  c+=step * CBvh::MaxPacketSize)
+        {
+            // A packet of consecutive blocks in this row
+            CBvh::RayPacket packet;
+            CRayDifferential diffs[CBvh::MaxPacketSize];
+            int cols[CBvh::MaxPacketSize];
+            int widths[CBvh::MaxPacketSize];
+            for(int cc=c;  cc<x0 + width && !packet.IsFull();  cc+=step)
+            {
+                int bw = min(step, x0 + width - cc);
+
+                CBvh::Ray ray;
+                if(step == 1)
+                    CameraRay(cc + m_jitter[0], r + m_jitter[1], ray, diffs[packet.mCount]);
+                else
+                    CameraRay(cc + bw * 0.5f, r + bh * 0.5f, ray, diffs[packet.mCount]);
+
+                cols[packet.mCount] = cc;
+                widths[packet.mCount] = bw;
+                packet.Add(ray);
+            }
+
+            float colors[CBvh::MaxPacketSize][3];
+            TracePacket(packet, diffs, colors);
+
+            for(int j=0;  j<packet.mCount;  j++)
+            {
+                float *color = colors[j];
+                if(step == 1)
+                {
+                    // Average with the earlier samples
+                    float *accum = &m_accum[(r * m_width + cols[j]) * 3];
+                    for(int i=0;  i<3;  i++)
+                    {
+                        accum[i] = m_sample == 0 ? color[i] : accum[i] + color[i];
+                        color[i] = accum[i] * scale;
+                    }
+                }
+
+                BYTE rgb[3];
+                for(int i=0;  i<3;  i++)
+                {
+                    float v = color[i] * 255.f + 0.5f;
+                    rgb[i] = v < 0 ? 0 : (v > 255.f ? 255 : BYTE(v));
+                }
+
+                for(int y=r;  y<r + bh;  y++)
+                {
+                    BYTE *row = m_image[y] + cols[j] * 3;
+                    for(int x=0;  x<widths[j];  x++, row+=3)
+                    {
+                        row[0] = rgb[0];
+                        row[1] = rgb[1];
+                        row[2] = rgb[2];
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+//
+// Name :         CMyRaytraceRenderer::CameraRay()
+// Description :  The ray through a position in the image and its
+//                differentials. (0, 0) is the bottom left corner of the
+//                image. A pass in blocks covers a block per ray, so the
+//                differentials are for a step of a block.
+//
+void CMyRaytraceRenderer::CameraRay(float x, float y, CBvh::Ray &ray, CRayDifferential &diff) const
+{
+    float px = m_planeWidth * (2.f * x / m_width - 1.f);
+    float py = m_planeHeight * (2.f * y / m_height - 1.f);
+    float sx = m_planeWidth * 2.f * m_blockSize / m_width;
+    float sy = m_planeHeight * 2.f * m_blockSize / m_height;
+
+    float dir[3], dx[3], dy[3];
+    for(int i=0;  i<3;  i++)
+    {
+        dir[i] = m_forward[i] + px * m_right[i] + py * m_up[i];
+        dx[i] = sx * m_right[i];
+        dy[i] = sy * m_up[i];
+    }
+
+    diff.SetCamera(dir, dx, dy);
+    Normalize3(dir);
+
+    ray.Set(m_eye, dir);
+}
+
+
+void CMyRaytraceRenderer::TraceRay(const CBvh::Ray &ray, const CRayDifferential &diff, int depth, float *color) const
+{
+    CBvh::Hit hit;
+    if(m_scene.Intersect(ray, hit))
+    {
+        Shade(ray, diff, hit, depth, color);
+    }
+    else
+    {
+        for(int i=0;  i<3;  i++)
+            color[i] = m_background[i];
+    }
+}
+
+
+//
+// Name :         CMyRaytraceRenderer::TracePacket()
+// Description :  Trace and shade a packet of rays. The shadow rays
+//                toward each light are traced as a packet as well.
+//
+void CMyRaytraceRenderer::TracePacket(const CBvh::RayPacket &packet, const CRayDifferential *diffs, float (*colors)[3]) const
+{
+    const int MaxRays = CBvh::MaxPacketSize;
+
+    CBvh::Hit hits[MaxRays];
+    bool found[MaxRays];
+    m_scene.IntersectPacket(packet, hits, found);
+
+    Surface surfaces[MaxRays];
+    for(int i=0;  i<packet.mCount;  i++)
+    {
+        if(!found[i])
+            continue;
+
+        float origin[3] = {packet.mOrigin[0][i], packet.mOrigin[1][i], packet.mOrigin[2][i]};
+        float dir[3] = {packet.mDir[0][i], packet.mDir[1][i], packet.mDir[2][i]};
+        BeginShade(origin, dir, diffs[i], hits[i], surfaces[i]);
+    }
+
+    SampleTextures(surfaces, found, packet.mCount);
+
+    for(std::vector<Light>::const_iterator l=m_lights.begin();  l!=m_lights.end();  l++)
+    {
+        CBvh::RayPacket shadows;
+        int lanes[MaxRays];
+        float ndotl[MaxRays];
+        for(int i=0;  i<packet.mCount;  i++)
+        {
+            CBvh::Ray shadow;
+            if(found[i] && ShadowRay(surfaces[i], *l, shadow, ndotl[shadows.mCount]))
+                lanes[shadows.Add(shadow)] = i;
+        }
+
+        bool occluded[MaxRays];
+        m_scene.OccludedPacket(shadows, occluded);
+
+        for(int j=0;  j<shadows.mCount;  j++)
+        {
+            if(occluded[j])
+                continue;
+
+            float L[3] = {shadows.mDir[0][j], shadows.mDir[1][j], shadows.mDir[2][j]};
+            ApplyLight(surfaces[lanes[j]], *l, L, ndotl[j]);
+        }
+    }
+
+    for(int i=0;  i<packet.mCount;  i++)
+    {
+        if(found[i])
+        {
+            EndShade(surfaces[i], colors[i]);
+            Secondary(surfaces[i], 0, colors[i]);
+        }
+        else
+        {
+            for(int j=0;  j<3;  j++)
+                colors[i][j] = m_background[j];
+        }
+    }
+}
+
+
+//
+// Name :         CMyRaytraceRenderer::Shade()
+// Description :  Compute the color at a hit point the way the 
+//                fixed function OpenGL pipeline would, with shadows.
+//
+void CMyRaytraceRenderer::Shade(const CBvh::Ray &ray, const CRayDifferential &diff, const CBvh::Hit &hit, 
+                                int depth, float *color) const
+{
+    Surface s;
+    BeginShade(ray.mOrigin, ray.mDir, diff, hit, s);
+    SampleTextures(&s, NULL, 1);
+
+    for(std::vector<Light>::const_iterator l=m_lights.begin();  l!=m_lights.end();  l++)
+    {
+        CBvh::Ray shadow;
+        float ndotl;
+        if(ShadowRay(s, *l, shadow, ndotl) && !m_scene.Occluded(shadow))
+            ApplyLight(s, *l, shadow.mDir, ndotl);
+    }
+
+    EndShade(s, color);
+    Secondary(s, depth, color);
+}
+
+
+//
+// Name :         CMyRaytraceRenderer::BeginShade()
+// Description :  Set up the surface at a hit point: the position, 
+//                normal, material, texture color, and the light that
+//                does not depend on the light sources.
+//
+void CMyRaytraceRenderer::BeginShade(const float *origin, const float *dir, const CRayDifferential &diff, 
+                                     const CBvh::Hit &hit, Surface &s) const
+{
+    int t = hit.mTriangle;
+    float w0 = 1.f - hit.mU - hit.mV;
+
+    // Hit point and interpolated normal, which is in mesh coordinates
+    const float *n = m_triangles.GetNormals(t);
+    float normal[3];
+    for(int i=0;  i<3;  i++)
+    {
+        s.mPoint[i] = origin[i] + dir[i] * hit.mT;
+        normal[i] = n[i] * w0 + n[3 + i] * hit.mU + n[6 + i] * hit.mV;
+        s.mDir[i] = dir[i];
+    }
+
+    const float *nm = m_scene.GetInstance(hit.mInstance).mNormal;
+    for(int i=0;  i<3;  i++)
+        s.mNormal[i] = nm[i * 3] * normal[0] + nm[i * 3 + 1] * normal[1] + nm[i * 3 + 2] * normal[2];
+
+    float normalLength = sqrt(Dot3(s.mNormal, s.mNormal));
+    Normalize3(s.mNormal);
+
+    // Shade both sides
+    float side = 1;
+    if(Dot3(s.mNormal, dir) > 0)
+    {
+        s.mNormal[0] = -s.mNormal[0];
+        s.mNormal[1] = -s.mNormal[1];
+        s.mNormal[2] = -s.mNormal[2];
+        side = -1;
+    }
+
+    s.mInside = side < 0;
+
+    // Offset the shadow ray origins off of the surface
+    float eps = 1e-3f * (1.f + fabs(s.mPoint[0]) + fabs(s.mPoint[1]) + fabs(s.mPoint[2]));
+    for(int i=0;  i<3;  i++)
+        s.mOffset[i] = s.mPoint[i] + s.mNormal[i] * eps;
+
+    CGrModelX::IEffect *effect = m_triangles.GetEffect(t);
+    s.mEffect = effect;
+    const float *emissive = effect->GetEmissive();
+    s.mDiffuse = effect->GetDiffuse();
+    s.mSpecular = effect->GetSpecular();
+    s.mShininess = effect->GetShininess();
+
+    // Texture color modulates everything but specular. 
+    // SampleTextures() looks it up.
+    s.mTexel[0] = s.mTexel[1] = s.mTexel[2] = 1;
+    int e = m_triangles.GetEffectIndex(t);
+    s.mSampler = e < (int)m_samplers.size() ? m_samplers[e] : NULL;
+    if(s.mSampler != NULL)
+    {
+        const float *tc = m_triangles.GetTcoords(t);
+        for(int i=0;  i<2;  i++)
+            s.mTcoord[i] = tc[i] * w0 + tc[2 + i] * hit.mU + tc[4 + i] * hit.mV;
+    }
+
+    s.mDiff = diff;
+    s.mDiff.Transfer(dir, hit.mT, s.mNormal);
+    Footprint(hit, normalLength, side, s);
+
+    for(int i=0;  i<3;  i++)
+    {
+        s.mLit[i] = emissive[i] + m_ambient[i] * s.mDiffuse[i];
+        s.mSpec[i] = 0;
+    }
+}
+
+
+//
+// Name :         CMyRaytraceRenderer::Footprint()
+// Description :  The change in the hit point from pixel to pixel, taken
+//                into mesh coordinates, is a change in the barycentric
+//                coordinates of the hit. Those give the change in the
+//                normal, which reflection and refraction need, and the
+//                change in the texture coordinates, which picks the
+//                mipmap level.
+//                normalLength is the length of the interpolated normal
+//                before it was normalized, and side is -1 if it was
+//                turned around to face the ray.
+//
+void CMyRaytraceRenderer::Footprint(const CBvh::Hit &hit, float normalLength, float side, Surface &s) const
+{
+    const CSceneBvh::Instance &instance = m_scene.GetInstance(hit.mInstance);
+    const float *m = instance.mToMesh;
+    float dp[2][3];
+    for(int i=0;  i<3;  i++)
+    {
+        dp[0][i] = m[i * 4] * s.mDiff.mDPdx[0] + m[i * 4 + 1] * s.mDiff.mDPdx[1] + m[i * 4 + 2] * s.mDiff.mDPdx[2];
+        dp[1][i] = m[i * 4] * s.mDiff.mDPdy[0] + m[i * 4 + 1] * s.mDiff.mDPdy[1] + m[i * 4 + 2] * s.mDiff.mDPdy[2];
+    }
+
+    // Solve dp = du e1 + dv e2 in the plane of the triangle
+    int t = hit.mTriangle;
+    const float *p = m_triangles.GetPositions(t);
+    float e1[3], e2[3];
+    for(int i=0;  i<3;  i++)
+    {
+        e1[i] = p[3 + i] - p[i];
+        e2[i] = p[6 + i] - p[i];
+    }
+
+    float a = Dot3(e1, e1);
+    float b = Dot3(e1, e2);
+    float c = Dot3(e2, e2);
+    float det = a * c - b * b;
+
+    float du[2] = {0, 0};
+    float dv[2] = {0, 0};
+    if(det != 0)
+    {
+        for(int k=0;  k<2;  k++)
+        {
+            float r1 = Dot3(e1, dp[k]);
+            float r2 = Dot3(e2, dp[k]);
+            du[k] = (c * r1 - b * r2) / det;
+            dv[k] = (a * r2 - b * r1) / det;
+        }
+    }
+
+    // Change in the normal, differentiating the normalization too
+    const float *n = m_triangles.GetNormals(t);
+    const float *nm = instance.mNormal;
+    float *dN[2] = {s.mDNdx, s.mDNdy};
+    for(int k=0;  k<2;  k++)
+    {
+        float dn[3], dw[3];
+        for(int i=0;  i<3;  i++)
+            dn[i] = du[k] * (n[3 + i] - n[i]) + dv[k] * (n[6 + i] - n[i]);
+
+        for(int i=0;  i<3;  i++)
+            dw[i] = nm[i * 3] * dn[0] + nm[i * 3 + 1] * dn[1] + nm[i * 3 + 2] * dn[2];
+
+        float along = Dot3(s.mNormal, dw);
+        float scale = normalLength > 0 ? side / normalLength : 0.f;
+        for(int i=0;  i<3;  i++)
+            dN[k][i] = (dw[i] - along * s.mNormal[i]) * scale;
+    }
+
+    s.mLod = 0;
+    if(s.mSampler != NULL)
+    {
+        const float *tc = m_triangles.GetTcoords(t);
+        float ds[2], dt[2];
+        for(int k=0;  k<2;  k++)
+        {
+            ds[k] = du[k] * (tc[2] - tc[0]) + dv[k] * (tc[4] - tc[0]);
+            dt[k] = du[k] * (tc[3] - tc[1]) + dv[k] * (tc[5] - tc[1]);
+        }
+
+        s.mLod = s.mSampler->GetLod(ds[0], dt[0], ds[1], dt[1]);
+    }
+}
+
+
+//
+// Name :         CMyRaytraceRenderer::Secondary()
+// Description :  Add the light reflected and refracted at a surface,
+//                tracing rays that carry the differentials on.
+//
+void CMyRaytraceRenderer::Secondary(const Surface &s, int depth, float *color) const
+{
+    if(depth >= m_maxDepth)
+        return;
+
+    const float *kr = s.mEffect->GetSpecularOther();
+    const float *kt = s.mEffect->GetTransmission();
+    float dn = Dot3(s.mDir, s.mNormal);
+
+    if(kr[0] > 0 || kr[1] > 0 || kr[2] > 0)
+    {
+        float R[3];
+        for(int i=0;  i<3;  i++)
+            R[i] = s.mDir[i] - 2.f * dn * s.mNormal[i];
+
+        CRayDifferential diff = s.mDiff;
+        diff.Reflect(s.mDir, s.mNormal, s.mDNdx, s.mDNdy);
+
+        CBvh::Ray ray;
+        ray.Set(s.mOffset, R);
+
+        float reflected[3];
+        TraceRay(ray, diff, depth + 1, reflected);
+        for(int i=0;  i<3;  i++)
+            color[i] += kr[i] * reflected[i];
+    }
+
+    float eta = s.mEffect->GetEta();
+    if((kt[0] > 0 || kt[1] > 0 || kt[2] > 0) && eta > 0)
+    {
+        // Leaving the surface from the back goes from eta to 1
+        if(!s.mInside)
+            eta = 1.f / eta;
+
+        float c1 = -dn;
+        float k = 1.f - eta * eta * (1.f - c1 * c1);
+        if(k < 0)
+            return;     // Total internal reflection
+
+        float T[3], origin[3];
+        float mu = eta * c1 - sqrt(k);
+        for(int i=0;  i<3;  i++)
+        {
+            T[i] = eta * s.mDir[i] + mu * s.mNormal[i];
+            origin[i] = s.mPoint[i] * 2.f - s.mOffset[i];
+        }
+
+        CRayDifferential diff = s.mDiff;
+        diff.Refract(s.mDir, s.mNormal, s.mDNdx, s.mDNdy, eta, T);
+
+        CBvh::Ray ray;
+        ray.Set(origin, T);
+
+        float refracted[3];
+        TraceRay(ray, diff, depth + 1, refracted);
+        for(int i=0;  i<3;  i++)
+            color[i] += kt[i] * refracted[i];
+    }
+}
+
+
+//
+// Name :         CMyRaytraceRenderer::ShadowRay()
+// Description :  The ray from a surface toward a light.
+// Returns :      false if the surface faces away from the light
+//
+bool CMyRaytraceRenderer::ShadowRay(const Surface &s, const Light &light, CBvh::Ray &shadow, float &ndotl) const
+{
+    float L[3];
+    for(int i=0;  i<3;  i++)
+        L[i] = light.mPosition[i] - s.mOffset[i];
+
+    float dist = sqrt(Dot3(L, L));
+    if(dist <= 0)
+        return false;
+
+    L[0] /= dist;
+    L[1] /= dist;
+    L[2] /= dist;
+
+    ndotl = Dot3(s.mNormal, L);
+    if(ndotl <= 0)
+        return false;
+
+    shadow.Set(s.mOffset, L, 0.f, dist);
+    return true;
+}
+
+
+//
+// Name :         CMyRaytraceRenderer::ApplyLight()
+// Description :  Add the diffuse and specular light from an 
+//                unoccluded light in direction L.
+//
+void CMyRaytraceRenderer::ApplyLight(Surface &s, const Light &light, const float *L, float ndotl) const
+{
+    // Blinn-Phong half vector
+    float H[3] = {L[0] - s.mDir[0], L[1] - s.mDir[1], L[2] - s.mDir[2]};
+    Normalize3(H);
+    float ndoth = Dot3(s.mNormal, H);
+    float spec = ndoth > 0 ? pow(ndoth, s.mShininess) : 0.f;
+
+    for(int i=0;  i<3;  i++)
+    {
+        s.mLit[i] += s.mDiffuse[i] * light.mColor[i] * ndotl;
+        s.mSpec[i] += s.mSpecular[i] * light.mColor[i] * spec;
+    }
+}
+
+
+void CMyRaytraceRenderer::EndShade(const Surface &s, float *color) const
+{
+    for(int i=0;  i<3;  i++)
+        color[i] = s.mLit[i] * s.mTexel[i] + s.mSpec[i];
+}
+
+
+//
+// Name :         CMyRaytraceRenderer::SampleTextures()
+// Description :  Look up the texture colors for surfaces from
+//                BeginShade(). Surfaces with the same texture are
+//                sampled together as a batch.
+//                found says which surfaces are valid, or is NULL if
+//                they all are.
+//
+void CMyRaytraceRenderer::SampleTextures(Surface *surfaces, const bool *found, int count) const
+{
+    const int MaxBatch = CGrTextureSampler::BatchSize;
+    bool done[CBvh::MaxPacketSize];
+    for(int i=0;  i<count;  i++)
+        done[i] = (found != NULL && !found[i]) || surfaces[i].mSampler == NULL;
+
+    for(int i=0;  i<count;  i++)
+    {
+        if(done[i])
+            continue;
+
+        const CGrTextureSampler *sampler = surfaces[i].mSampler;
+        int lanes[MaxBatch];
+        float s[MaxBatch], t[MaxBatch], lod[MaxBatch];
+        int n = 0;
+        for(int j=i;  j<count && n<MaxBatch;  j++)
+        {
+            if(done[j] || surfaces[j].mSampler != sampler)
+                continue;
+
+            lanes[n] = j;
+            s[n] = surfaces[j].mTcoord[0];
+            t[n] = surfaces[j].mTcoord[1];
+            lod[n] = surfaces[j].mLod;
+            done[j] = true;
+            n++;
+        }
+
+        float colors[MaxBatch][3];
+        sampler->SampleBatch(s, t, lod, colors, n);
+        for(int j=0;  j<n;  j++)
+        {
+            float *texel = surfaces[lanes[j]].mTexel;
+            texel[0] = colors[j][0];
+            texel[1] = colors[j][1];
+            texel[2] = colors[j][2];
+        }
+    }
 }
@@ -1,21 +1,269 @@
 #pragma once
 
+#include <vector>
 #include <grafx.h>
+#include "TriangleStore.h"
+#include "SceneBvh.h"
+#include "TileScheduler.h"
+#include "RayDifferential.h"
 
-class CMyRaytraceRenderer : public CGrModelX::IRenderer
+class CGrCamera;
+
+class CMyRaytraceRenderer : public CGrModelX::IRenderer, public CTileScheduler::ITileRenderer
 {
 public:
     CMyRaytraceRenderer(void);
     virtual ~CMyRaytraceRenderer(void);
 
-    virtual void PushMatrix() {}
-    virtual void PopMatrix() {}
-    virtual void MultMatrix(const CGrTransform &t) {}
-    virtual void SetEffect(CGrModelX::IEffect *effect) {}
+    virtual void PushMatrix();
+    virtual void PopMatrix();
+    virtual void MultMatrix(const CGrTransform &t);
+    virtual void SetEffect(CGrModelX::IEffect *effect);
     virtual void EndEffect(CGrModelX::IEffect *effect) {}
-    virtual void BeginTriangles() {}
+    virtual void BeginTriangles();
     virtual void EndTriangles() {}
-    virtual void TexCoord2fv(float *t) {}
-    virtual void Normal3fv(float *n) {}
-    virtual void Vertex3fv(float *v) {}
-};
\ No newline at end of file
+    virtual void TexCoord2fv(float *t);
+    virtual void Normal3fv(float *n);
+    virtual void Vertex3fv(float *v);
+    virtual void NewMesh(const wchar_t *name);
+    virtual void DrawMeshPart(const MeshPart &part);
+
+    //! Reserve space for the triangles of a model before it is drawn
+    void Reserve(int numTriangles) {m_triangles.Reserve(numTriangles);}
+
+    //! The triangles captured so far
+    /*! Each mesh is stored in its own coordinate system, the one 
+        in effect when its first triangle was drawn. */
+    const CTriangleStore &GetTriangles() const {return m_triangles;}
+
+    //! Set the image to render into
+    /*! \param image Array of rows, RGB, 3 bytes per pixel. Row 0 is the bottom.
+        \param width Image width in pixels
+        \param height Image height in pixels */
+    void SetImage(BYTE **image, int width, int height);
+
+    //! Set the camera to render from. 
+    /*! The projection matches CGrCamera::Apply() for the image size. */
+    void SetCamera(const CGrCamera &camera);
+
+    //! Set the global ambient light color (RGB)
+    void SetAmbient(const float *color);
+
+    //! Add a point light
+    /*! \param position Light position in world coordinates
+        \param color Light color (RGB) used for both diffuse and specular */
+    void AddLight(const float *position, const float *color);
+
+    //! Set the color for rays that hit nothing (RGB)
+    void SetBackground(const float *color);
+
+    //! Set how many times rays may be reflected or refracted
+    /*! Surfaces reflect by their specularOther color and transmit by
+        their transmission color. The default is 0, which traces only
+        the rays from the camera and to the lights. */
+    void SetMaxDepth(int depth) {m_maxDepth = depth;}
+
+    //! Set how textures are filtered
+    /*! The mipmap level is chosen from the ray differentials, so with 
+        Trilinear, the default, one ray per pixel does not alias the
+        textures. Takes effect at the next BuildBvh().
+        \param filter Texture filter
+        \param tiled Sample from tiled copies of the textures? These
+        use more memory, but are kinder to the cache when the lookups
+        are spread all over a large texture. */
+    void SetTextureFilter(CGrTextureSampler::Filter filter, bool tiled) {m_textureFilter = filter; m_tiledTextures = tiled;}
+
+    //! Set a thread pool to render with
+    /*! If no pool is set, Render() runs on the calling thread. */
+    void SetThreadPool(CGrThreadPool *pool) {m_pool = pool;}
+
+    //! Ray trace the captured triangles into the image
+    /*! This builds the BVH over the triangles captured so far, 
+        then traces one ray per pixel, tile by tile. */
+    void Render();
+
+    //! Build the BVH over the triangles captured so far
+    /*! Each mesh gets its own hierarchy, and instances place 
+        the meshes in the world. Unless UpdateScene() says otherwise,
+        each mesh is placed once where it was drawn. */
+    void BuildBvh();
+
+    //! Move the captured meshes to the current pose of a model
+    /*! The triangles must have been captured by model.Draw(this). 
+        This recomputes the bones and moves each mesh to its bone,
+        then rebuilds only the top level of the BVH, so it is fast 
+        enough to call for every frame of an animation. It must not
+        be called while a render is in progress. */
+    void UpdatePose(CGrModelX &model);
+
+    //! Place the captured meshes for every instance of a scene
+    /*! The triangles must have been captured by drawing the scene
+        model once, with scene.GetModel()->Draw(this), rather than by
+        drawing the scene. Every instance shares those triangles and
+        the BVH for each mesh; only the top level of the BVH grows 
+        with the number of instances. Call this again after the 
+        instances move or change pose. It must not be called while
+        a render is in progress. */
+    void UpdateScene(const CGrModelXScene &scene);
+
+    //! Render one pass of a progressive render
+    /*! BuildBvh() must have been called first. 
+        \param blockSize Trace one ray for each blockSize x blockSize
+        block of pixels. 1 is full resolution.
+        \param sample Sample number for full resolution passes. Sample 0 
+        is through the pixel centers and replaces the image. Later samples
+        are jittered and averaged with the earlier ones. */
+    void RenderPass(int blockSize, int sample);
+
+    //! Set a flag that is polled while rendering
+    /*! When the flag becomes nonzero, rendering stops as soon as possible,
+        leaving the image partially updated. */
+    void SetCancelFlag(const volatile LONG *cancel) {m_cancel = cancel;}
+
+    //! Render one tile of the image. Called by the tile scheduler.
+    virtual void RenderTile(int x, int y, int width, int height, int worker);
+
+    //! The acceleration structure built by Render()
+    const CSceneBvh &GetScene() const {return m_scene;}
+
+    //! The tile scheduler, which has the timings for the last Render()
+    const CTileScheduler &GetScheduler() const {return m_scheduler;}
+
+private:
+    struct Light
+    {
+        float mPosition[3];
+        float mColor[3];
+    };
+
+    // Shading state for one hit point
+    struct Surface
+    {
+        float mPoint[3];
+        float mOffset[3];       // Point moved off of the surface for shadow rays
+        float mNormal[3];
+        float mDir[3];          // Direction of the incoming ray
+        const float *mDiffuse;
+        const float *mSpecular;
+        float mShininess;
+        CGrModelX::IEffect *mEffect;
+        bool mInside;           // Did the ray hit the back of the surface?
+        CRayDifferential mDiff; // Ray differentials moved to the hit
+        float mDNdx[3];         // Change in the normal for one pixel across
+        float mDNdy[3];         // Change in the normal for one pixel up
+        const CGrTextureSampler *mSampler;  // Texture, or NULL if none
+        float mTcoord[2];
+        float mLod;             // Mipmap level of detail from the differentials
+        float mTexel[3];
+        float mLit[3];          // Accumulated light modulated by the texture
+        float mSpec[3];         // Accumulated specular
+    };
+
+    void CameraRay(float x, float y, CBvh::Ray &ray, CRayDifferential &diff) const;
+    void TraceRay(const CBvh::Ray &ray, const CRayDifferential &diff, int depth, float *color) const;
+    void TracePacket(const CBvh::RayPacket &packet, const CRayDifferential *diffs, float (*colors)[3]) const;
+    void Shade(const CBvh::Ray &ray, const CRayDifferential &diff, const CBvh::Hit &hit, int depth, float *color) const;
+    void BeginShade(const float *origin, const float *dir, const CRayDifferential &diff, 
+                    const CBvh::Hit &hit, Surface &s) const;
+    void Footprint(const CBvh::Hit &hit, float normalLength, float side, Surface &s) const;
+    void Secondary(const Surface &s, int depth, float *color) const;
+    bool ShadowRay(const Surface &s, const Light &light, CBvh::Ray &shadow, float &ndotl) const;
+    void ApplyLight(Surface &s, const Light &light, const float *L, float ndotl) const;
+    void EndShade(const Surface &s, float *color) const;
+    void SampleTextures(Surface *surfaces, const bool *found, int count) const;
+    void UpdateSamplers();
+
+    void PlaceMesh();
+    void PlaceInstances();
+    void ComputeCurrentMatrix();
+    void TransformPoint(const float *v, float *r) const;
+    void TransformNormal(const float *n, float *r) const;
+
+    // The matrix stack. The back is the current matrix.
+    std::vector<CGrTransform> m_stack;
+
+    // Where each captured mesh is in the world
+    struct MeshPlacement
+    {
+        CGrTransform mParent;       // Current matrix when the mesh was started
+        CGrTransform mTransform;    // Mesh to world transform
+        bool mPlaced;               // Is mTransform set yet?
+    };
+
+    std::vector<MeshPlacement> m_meshes;
+
+    // A captured mesh placed in the world
+    struct Instance
+    {
+        int mMesh;
+        CGrTransform mTransform;
+    };
+
+    // What to ray trace. If empty, each mesh is placed where it was drawn.
+    std::vector<Instance> m_instances;
+
+    // Scratch space for scene bone transforms
+    std::vector<CGrTransform> m_bones;
+
+    // The current matrix relative to the mesh as floats (3x4) and
+    // the matching normal matrix (inverse transpose of the upper 3x3)
+    float m_matrix[12];
+    float m_normalMatrix[9];
+
+    // Current effect index in the triangle store
+    int m_effect;
+
+    // State for the per vertex interface
+    float m_tcoord[2];
+    float m_normal[3];
+    float m_corners[3][8];
+    int m_numCorners;
+
+    // Transformed vertices for the current mesh part
+    std::vector<float> m_scratch;
+
+    // The captured triangles
+    CTriangleStore m_triangles;
+
+    // Acceleration structure over the meshes of m_triangles
+    CSceneBvh m_scene;
+
+    // A sampler for each effect of m_triangles that has a texture
+    std::vector<CGrTextureSampler *> m_samplers;
+    CGrTextureSampler::Filter m_textureFilter;
+    bool m_tiledTextures;
+
+    // Reflection and refraction depth
+    int m_maxDepth;
+
+    // The image we render into
+    BYTE **m_image;
+    int m_width;
+    int m_height;
+
+    // Camera frame
+    float m_eye[3];
+    float m_forward[3];
+    float m_right[3];
+    float m_up[3];
+    double m_fieldOfView;
+
+    // Image plane half sizes at distance 1
+    float m_planeWidth;
+    float m_planeHeight;
+
+    // Lighting
+    float m_ambient[3];
+    float m_background[3];
+    std::vector<Light> m_lights;
+
+    CTileScheduler m_scheduler;
+    CGrThreadPool *m_pool;
+
+    // Progressive rendering state
+    int m_blockSize;
+    int m_sample;
+    float m_jitter[2];
+    std::vector<float> m_accum;
+    const volatile LONG *m_cancel;
+};
@@ -0,0 +1,151 @@
+//
+// Name :         ProgressiveRender.cpp
+// Description :  Implementation of CProgressiveRender.
+//
+
+#include "StdAfx.h"
+#include "ProgressiveRender.h"
+#include "MyRaytraceRenderer.h"
+
+#include <process.h>
+
+// Block sizes for the preview passes, ending at full resolution
+const int PassBlockSizes[] = {4, 2, 1};
+const int NumBlockPasses = sizeof(PassBlockSizes) / sizeof(int);
+
+
+CProgressiveRender::CProgressiveRender()
+{
+    InitializeCriticalSection(&m_lock);
+
+    m_renderer = NULL;
+    m_display = NULL;
+    m_width = m_height = 0;
+    m_hwnd = NULL;
+    m_message = 0;
+    m_maxSamples = 16;
+
+    m_thread = NULL;
+    m_cancel = 0;
+    m_running = 0;
+    m_completed = 0;
+}
+
+
+CProgressiveRender::~CProgressiveRender()
+{
+    Cancel();
+    DeleteCriticalSection(&m_lock);
+}
+
+
+//
+// Name :         CProgressiveRender::SetDisplay()
+// Description :  Set the display image and size the working image
+//                to match it.
+//
+void CProgressiveRender::SetDisplay(BYTE **image, int width, int height)
+{
+    Cancel();
+
+    m_display = image;
+    m_width = width;
+    m_height = height;
+
+    int rowwid = m_width * 3;
+    while(rowwid % 4)
+        rowwid++;
+
+    m_work.resize(rowwid * m_height);
+    m_workRows.resize(m_height);
+    for(int i=0;  i<m_height;  i++)
+        m_workRows[i] = &m_work[i * rowwid];
+}
+
+
+void CProgressiveRender::Start(CMyRaytraceRenderer *renderer)
+{
+    Cancel();
+
+    m_renderer = renderer;
+    if(m_renderer == NULL || m_display == NULL || m_width <= 0 || m_height <= 0)
+        return;
+
+    m_renderer->SetImage(&m_workRows[0], m_width, m_height);
+    m_renderer->SetCancelFlag(&m_cancel);
+
+    m_cancel = 0;
+    m_completed = 0;
+    m_running = 1;
+    m_thread = (HANDLE)_beginthreadex(NULL, 0, ThreadProc, this, 0, NULL);
+    if(m_thread == NULL)
+        m_running = 0;
+}
+
+
+//
+// Name :         CProgressiveRender::Cancel()
+// Description :  Signal the render thread to stop and wait for it.
+//
+void CProgressiveRender::Cancel()
+{
+    if(m_thread == NULL)
+        return;
+
+    InterlockedExchange(&m_cancel, 1);
+    WaitForSingleObject(m_thread, INFINITE);
+    CloseHandle(m_thread);
+    m_thread = NULL;
+}
+
+
+unsigned __stdcall CProgressiveRender::ThreadProc(void *param)
+{
+    CProgressiveRender *render = (CProgressiveRender *)param;
+    render->RenderThread();
+    InterlockedExchange(&render->m_running, 0);
+    return 0;
+}
+
+
+//
+// Name :         CProgressiveRender::RenderThread()
+// Description :  Render the passes, publishing each one that completes.
+//
+void CProgressiveRender::RenderThread()
+{
+    if(m_renderer->GetScene().IsEmpty())
+        m_renderer->BuildBvh();
+
+    int numPasses = NumBlockPasses + (m_maxSamples > 1 ? m_maxSamples - 1 : 0);
+    for(int pass=0;  pass<numPasses && !m_cancel;  pass++)
+    {
+        if(pass < NumBlockPasses)
+            m_renderer->RenderPass(PassBlockSizes[pass], 0);
+        else
+            m_renderer->RenderPass(1, pass - NumBlockPasses + 1);
+
+        if(m_cancel)
+            break;
+
+        Publish();
+
+        if(m_hwnd != NULL)
+            PostMessage(m_hwnd, m_message, WPARAM(pass), 0);
+    }
+}
+
+
+//
+// Name :         CProgressiveRender::Publish()
+// Description :  Copy the working image into the display image.
+//
+void CProgressiveRender::Publish()
+{
+    Lock();
+    for(int i=0;  i<m_height;  i++)
+        memcpy(m_display[i], m_workRows[i], m_width * 3);
+    Unlock();
+
+    InterlockedIncrement(&m_completed);
+}
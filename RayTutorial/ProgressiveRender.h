@@ -0,0 +1,92 @@
+//
+// Name :         ProgressiveRender.h
+// Description :  Header for CProgressiveRender, which runs a ray trace
+//                in the background and refines it in passes.
+//
+
+#pragma once
+
+#include <vector>
+
+class CMyRaytraceRenderer;
+
+//! Runs a progressive ray trace on a background thread.
+
+/*! The image is refined in passes: 1/16 resolution (4x4 blocks), 1/4
+    resolution (2x2 blocks), full resolution, and then additional
+    jittered samples that are averaged in. The renderer draws into a
+    private working image. When a pass completes it is copied into the
+    display image under a lock and a message is posted to a window so
+    it can redraw.
+
+    Cancel() sets a flag the renderer polls every row of every tile,
+    so a render in flight stops within a few milliseconds. A partially
+    rendered pass is never copied to the display. */
+
+class CProgressiveRender
+{
+public:
+    CProgressiveRender();
+    virtual ~CProgressiveRender();
+
+    //! Set the image the completed passes are copied into
+    /*! \param image Array of rows, RGB, 3 bytes per pixel. Row 0 is the bottom.
+        \param width Image width in pixels
+        \param height Image height in pixels */
+    void SetDisplay(BYTE **image, int width, int height);
+
+    //! Set the window and message posted when a pass completes
+    /*! The WPARAM is the number of the pass that completed. */
+    void SetNotify(HWND hwnd, UINT message) {m_hwnd = hwnd;  m_message = message;}
+
+    //! Set the total number of full resolution samples per pixel
+    void SetMaxSamples(int samples) {m_maxSamples = samples;}
+
+    //! Start rendering in the background
+    /*! Any render in progress is cancelled first. The BVH is built
+        on the background thread if it has not been built yet. */
+    void Start(CMyRaytraceRenderer *renderer);
+
+    //! Stop any render in progress and wait for the thread to exit
+    void Cancel();
+
+    //! Is a render running?
+    bool IsRunning() const {return m_thread != NULL && m_running != 0;}
+
+    //! Number of passes copied to the display since Start()
+    int GetCompletedPasses() const {return m_completed;}
+
+    //! Lock the display image while it is being read
+    void Lock() {EnterCriticalSection(&m_lock);}
+
+    //! Release the display image lock
+    void Unlock() {LeaveCriticalSection(&m_lock);}
+
+private:
+    // Not copyable
+    CProgressiveRender(const CProgressiveRender &);
+    CProgressiveRender &operator=(const CProgressiveRender &);
+
+    static unsigned __stdcall ThreadProc(void *param);
+    void RenderThread();
+    void Publish();
+
+    CMyRaytraceRenderer *m_renderer;
+
+    // The display image and the private one we render into
+    BYTE **m_display;
+    int m_width;
+    int m_height;
+    std::vector<BYTE> m_work;
+    std::vector<BYTE *> m_workRows;
+
+    HWND m_hwnd;
+    UINT m_message;
+    int m_maxSamples;
+
+    HANDLE m_thread;
+    CRITICAL_SECTION m_lock;
+    volatile LONG m_cancel;
+    volatile LONG m_running;
+    volatile LONG m_completed;
+};
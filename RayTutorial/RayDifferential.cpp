@@ -0,0 +1,131 @@
+//
+// Name :         RayDifferential.cpp
+// Description :  Implementation of CRayDifferential.
+//
+
+#include "StdAfx.h"
+#include "RayDifferential.h"
+
+#include <cmath>
+
+using namespace std;
+
+inline float Dot3(const float *a, const float *b) {return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];}
+
+
+void CRayDifferential::Clear()
+{
+    for(int i=0;  i<3;  i++)
+    {
+        mDPdx[i] = mDPdy[i] = 0;
+        mDDdx[i] = mDDdy[i] = 0;
+    }
+}
+
+
+//
+// Name :         CRayDifferential::SetCamera()
+// Description :  The direction is d / |d|, so its change is the change
+//                in d less the part along d, over |d|.
+//
+void CRayDifferential::SetCamera(const float *dir, const float *dx, const float *dy)
+{
+    float dd = Dot3(dir, dir);
+    float len = sqrt(dd);
+    float scale = len > 0 ? 1.f / (dd * len) : 0.f;
+    float ddx = Dot3(dir, dx);
+    float ddy = Dot3(dir, dy);
+
+    for(int i=0;  i<3;  i++)
+    {
+        mDPdx[i] = mDPdy[i] = 0;
+        mDDdx[i] = (dd * dx[i] - ddx * dir[i]) * scale;
+        mDDdy[i] = (dd * dy[i] - ddy * dir[i]) * scale;
+    }
+}
+
+
+//
+// Name :         CRayDifferential::Transfer()
+// Description :  The neighboring ray hits the plane of the surface a
+//                little nearer or farther than t. That change in t
+//                keeps the change in the hit point in the plane.
+//
+void CRayDifferential::Transfer(const float *dir, float t, const float *normal)
+{
+    float dn = Dot3(dir, normal);
+    if(dn == 0)
+        return;
+
+    float px[3], py[3];
+    for(int i=0;  i<3;  i++)
+    {
+        px[i] = mDPdx[i] + t * mDDdx[i];
+        py[i] = mDPdy[i] + t * mDDdy[i];
+    }
+
+    float dtx = -Dot3(px, normal) / dn;
+    float dty = -Dot3(py, normal) / dn;
+    for(int i=0;  i<3;  i++)
+    {
+        mDPdx[i] = px[i] + dtx * dir[i];
+        mDPdy[i] = py[i] + dty * dir[i];
+    }
+}
+
+
+//
+// Name :         CRayDifferential::Reflect()
+// Description :  R = D - 2 (D.N) N, differentiated.
+//
+void CRayDifferential::Reflect(const float *dir, const float *normal, const float *dNdx, const float *dNdy)
+{
+    float dn = Dot3(dir, normal);
+    float ddnx = Dot3(mDDdx, normal) + Dot3(dir, dNdx);
+    float ddny = Dot3(mDDdy, normal) + Dot3(dir, dNdy);
+
+    for(int i=0;  i<3;  i++)
+    {
+        mDDdx[i] -= 2.f * (dn * dNdx[i] + ddnx * normal[i]);
+        mDDdy[i] -= 2.f * (dn * dNdy[i] + ddny * normal[i]);
+    }
+}
+
+
+//
+// Name :         CRayDifferential::Refract()
+// Description :  T = eta D - mu N, where mu = eta (D.N) - (T.N),
+//                differentiated.
+//
+void CRayDifferential::Refract(const float *dir, const float *normal, const float *dNdx, const float *dNdy,
+                               float eta, const float *refracted)
+{
+    float dn = Dot3(dir, normal);
+    float tn = Dot3(refracted, normal);
+    if(tn == 0)
+        return;
+
+    float mu = eta * dn - tn;
+    float dmu = eta - eta * eta * dn / tn;
+
+    float ddnx = Dot3(mDDdx, normal) + Dot3(dir, dNdx);
+    float ddny = Dot3(mDDdy, normal) + Dot3(dir, dNdy);
+
+    for(int i=0;  i<3;  i++)
+    {
+        mDDdx[i] = eta * mDDdx[i] - (dmu * ddnx * normal[i] + mu * dNdx[i]);
+        mDDdy[i] = eta * mDDdy[i] - (dmu * ddny * normal[i] + mu * dNdy[i]);
+    }
+}
+
+
+void CRayDifferential::Scale(float s)
+{
+    for(int i=0;  i<3;  i++)
+    {
+        mDPdx[i] *= s;
+        mDPdy[i] *= s;
+        mDDdx[i] *= s;
+        mDDdy[i] *= s;
+    }
+}
@@ -0,0 +1,71 @@
+//
+// Name :         RayDifferential.h
+// Description :  Header for CRayDifferential, how a ray changes from
+//                one pixel to the next.
+//
+
+#pragma once
+
+//! Ray differentials for choosing texture detail.
+
+/*! A ray differential is how much the origin and direction of a ray
+    change for a step of one pixel across and one pixel up the image
+    (Igehy, "Tracing Ray Differentials", SIGGRAPH 99). They start at the
+    camera and follow the ray through each hit, reflection, and
+    refraction. At a hit, the change in the hit point is the size of
+    the pixel's footprint on the surface, which picks the mipmap level
+    to sample the texture from.
+
+    The normals passed in face against the incoming ray, the way the
+    renderer's shading normals do. */
+
+class CRayDifferential
+{
+public:
+    CRayDifferential() {Clear();}
+
+    //! Set everything to zero
+    void Clear();
+
+    //! Set the differentials of a ray from a pinhole camera
+    /*! The origin is the same for every pixel, so only the direction
+        changes.
+        \param dir Direction of the ray before it is normalized
+        \param dx Change in dir for one pixel across
+        \param dy Change in dir for one pixel up */
+    void SetCamera(const float *dir, const float *dx, const float *dy);
+
+    //! Move the origin to where the ray hits a surface
+    /*! \param dir Normalized ray direction
+        \param t Distance along the ray to the hit
+        \param normal Surface normal at the hit */
+    void Transfer(const float *dir, float t, const float *normal);
+
+    //! Change the direction for a mirror reflection
+    /*! Call Transfer() first.
+        \param dir Normalized incoming direction
+        \param normal Normalized surface normal
+        \param dNdx Change in the normal for one pixel across
+        \param dNdy Change in the normal for one pixel up */
+    void Reflect(const float *dir, const float *normal, const float *dNdx, const float *dNdy);
+
+    //! Change the direction for a refraction
+    /*! Call Transfer() first.
+        \param dir Normalized incoming direction
+        \param normal Normalized surface normal
+        \param dNdx Change in the normal for one pixel across
+        \param dNdy Change in the normal for one pixel up
+        \param eta Index of refraction on the incoming side over the
+        index on the other side
+        \param refracted The normalized refracted direction */
+    void Refract(const float *dir, const float *normal, const float *dNdx, const float *dNdy,
+                 float eta, const float *refracted);
+
+    //! Scale the differentials, to cover more than one pixel
+    void Scale(float s);
+
+    float mDPdx[3];     //!< Change in the origin for one pixel across
+    float mDPdy[3];     //!< Change in the origin for one pixel up
+    float mDDdx[3];     //!< Change in the direction for one pixel across
+    float mDDdy[3];     //!< Change in the direction for one pixel up
+};
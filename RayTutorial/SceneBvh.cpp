@@ -0,0 +1,674 @@
+//
+// Name :         SceneBvh.cpp
+// Description :  Implementation of CSceneBvh, a two level bounding
+//                volume hierarchy.
+//
+
+#include "StdAfx.h"
+#include "SceneBvh.h"
+#include "TriangleStore.h"
+
+#include <sstream>
+#include <algorithm>
+
+using namespace std;
+
+// Past this depth the top level is split at the median, which keeps it
+// well inside the traversal stack
+const int MaxSahDepth = 40;
+
+inline double ElapsedMs(const LARGE_INTEGER &start, const LARGE_INTEGER &end)
+{
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    return double(end.QuadPart - start.QuadPart) * 1000. / double(freq.QuadPart);
+}
+
+// Half of the surface area of a box
+inline float BoxHalfArea(const float *mn, const float *mx)
+{
+    float dx = mx[0] - mn[0];
+    float dy = mx[1] - mn[1];
+    float dz = mx[2] - mn[2];
+    return dx * dy + dy * dz + dz * dx;
+}
+
+inline void GrowBounds(float *mn, float *mx, const float *pmn, const float *pmx)
+{
+    for(int i=0;  i<3;  i++)
+    {
+        if(pmn[i] < mn[i])
+            mn[i] = pmn[i];
+        if(pmx[i] > mx[i])
+            mx[i] = pmx[i];
+    }
+}
+
+//
+// Name :         BoxTest()
+// Description :  Ray/box test for one ray, given as an origin and
+//                inverse direction.
+//
+inline bool BoxTest(const CBvh::Node &n, const float *o, const float *inv, float tmin, float tmax)
+{
+    float t1 = (n.mMin[0] - o[0]) * inv[0];
+    float t2 = (n.mMax[0] - o[0]) * inv[0];
+    float tnear = min(t1, t2);
+    float tfar = max(t1, t2);
+
+    t1 = (n.mMin[1] - o[1]) * inv[1];
+    t2 = (n.mMax[1] - o[1]) * inv[1];
+    tnear = max(tnear, min(t1, t2));
+    tfar = min(tfar, max(t1, t2));
+
+    t1 = (n.mMin[2] - o[2]) * inv[2];
+    t2 = (n.mMax[2] - o[2]) * inv[2];
+    tnear = max(tnear, min(t1, t2));
+    tfar = min(tfar, max(t1, t2));
+
+    return tfar >= tnear && tfar >= tmin && tnear < tmax;
+}
+
+//
+// Name :         ToMesh()
+// Description :  Transform a ray into the coordinate system of an instance.
+//
+inline void ToMesh(const CSceneBvh::Instance &inst, const float *o, const float *d,
+                   float tmin, float tmax, CBvh::Ray &ray)
+{
+    const float *m = inst.mToMesh;
+    float lo[3], ld[3];
+    for(int r=0;  r<3;  r++)
+    {
+        lo[r] = m[r * 4] * o[0] + m[r * 4 + 1] * o[1] + m[r * 4 + 2] * o[2] + m[r * 4 + 3];
+        ld[r] = m[r * 4] * d[0] + m[r * 4 + 1] * d[1] + m[r * 4 + 2] * d[2];
+    }
+
+    ray.Set(lo, ld, tmin, tmax);
+}
+
+// Origin, inverse direction, and direction of one ray of a packet
+struct PacketLane
+{
+    PacketLane(const CBvh::RayPacket &packet, int i)
+    {
+        for(int j=0;  j<3;  j++)
+        {
+            mOrigin[j] = packet.mOrigin[j][i];
+            mDir[j] = packet.mDir[j][i];
+            mInvDir[j] = packet.mInvDir[j][i];
+        }
+    }
+
+    float mOrigin[3];
+    float mDir[3];
+    float mInvDir[3];
+};
+
+//
+// Name :         PacketEnters()
+// Description :  Does any ray of a packet that is not skipped
+//                enter a node before its tmax?
+//
+inline bool PacketEnters(const CBvh::Node &n, const CBvh::RayPacket &packet, const float *tmax, const bool *skip)
+{
+    for(int i=0;  i<packet.mCount;  i++)
+    {
+        if(skip[i])
+            continue;
+
+        PacketLane lane(packet, i);
+        if(BoxTest(n, lane.mOrigin, lane.mInvDir, packet.mTMin[i], tmax[i]))
+            return true;
+    }
+
+    return false;
+}
+
+//
+// Name :         InstancePacket()
+// Description :  Gather the rays of a packet that enter an instance
+//                leaf into a packet in the instance mesh coordinates.
+//                lanes receives the packet index of each gathered ray.
+//
+inline void InstancePacket(const CSceneBvh::Instance &inst, const CBvh::Node &n, const CBvh::RayPacket &packet,
+                           const float *tmax, const bool *skip, CBvh::RayPacket &local, int *lanes)
+{
+    for(int i=0;  i<packet.mCount;  i++)
+    {
+        if(skip[i])
+            continue;
+
+        PacketLane lane(packet, i);
+        if(!BoxTest(n, lane.mOrigin, lane.mInvDir, packet.mTMin[i], tmax[i]))
+            continue;
+
+        CBvh::Ray ray;
+        ToMesh(inst, lane.mOrigin, lane.mDir, packet.mTMin[i], tmax[i], ray);
+        lanes[local.Add(ray)] = i;
+    }
+}
+
+// Orders instances by the center of their bounds along an axis
+struct InstanceCenterLess
+{
+    InstanceCenterLess(const vector<CSceneBvh::Instance> &instances, int axis)
+        : mInstances(instances), mAxis(axis) {}
+
+    bool operator()(int a, int b) const
+    {
+        const CSceneBvh::Instance &ia = mInstances[a];
+        const CSceneBvh::Instance &ib = mInstances[b];
+        return ia.mMin[mAxis] + ia.mMax[mAxis] < ib.mMin[mAxis] + ib.mMax[mAxis];
+    }
+
+    const vector<CSceneBvh::Instance> &mInstances;
+    int mAxis;
+};
+
+
+CSceneBvh::CSceneBvh()
+{
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+
+CSceneBvh::~CSceneBvh()
+{
+}
+
+
+void CSceneBvh::Clear()
+{
+    m_meshes.clear();
+    ClearInstances();
+    memset(&m_stats, 0, sizeof(m_stats));
+}
+
+
+void CSceneBvh::ClearInstances()
+{
+    m_instances.clear();
+    m_top.clear();
+    m_order.clear();
+}
+
+
+//
+// Name :         CSceneBvh::BuildMeshes()
+// Description :  Build a CBvh over the triangles of each mesh.
+//
+void CSceneBvh::BuildMeshes(const CTriangleStore &triangles)
+{
+    LARGE_INTEGER start, end;
+    QueryPerformanceCounter(&start);
+
+    Clear();
+
+    int numMeshes = triangles.GetNumMeshes();
+    m_meshes.resize(numMeshes);
+    for(int m=0;  m<numMeshes;  m++)
+    {
+        m_meshes[m].Build(triangles, triangles.GetMeshFirstTriangle(m), triangles.GetMeshNumTriangles(m));
+    }
+
+    QueryPerformanceCounter(&end);
+    m_stats.mMeshBuildTime = ElapsedMs(start, end);
+    m_stats.mNumMeshes = numMeshes;
+    m_stats.mNumTriangles = triangles.GetNumTriangles();
+}
+
+
+int CSceneBvh::AddInstance(int mesh, const CGrTransform &t)
+{
+    Instance inst;
+    inst.mMesh = mesh;
+    m_instances.push_back(inst);
+
+    int i = (int)m_instances.size() - 1;
+    SetInstanceTransform(i, t);
+    return i;
+}
+
+
+//
+// Name :         CSceneBvh::SetInstanceTransform()
+// Description :  Set the transforms for an instance and compute its
+//                world bounds from the corners of the mesh bounds.
+//
+void CSceneBvh::SetInstanceTransform(int instance, const CGrTransform &t)
+{
+    Instance &inst = m_instances[instance];
+
+    CGrTransform inv = CGrTransform::GetAffineInverse(t);
+    for(int r=0;  r<3;  r++)
+    {
+        for(int c=0;  c<4;  c++)
+        {
+            inst.mToWorld[r * 4 + c] = float(t[r][c]);
+            inst.mToMesh[r * 4 + c] = float(inv[r][c]);
+        }
+
+        // Normals transform by the inverse transpose
+        for(int c=0;  c<3;  c++)
+            inst.mNormal[r * 3 + c] = float(inv[c][r]);
+    }
+
+    for(int i=0;  i<3;  i++)
+    {
+        inst.mMin[i] = 1e30f;
+        inst.mMax[i] = -1e30f;
+    }
+
+    const CBvh &mesh = m_meshes[inst.mMesh];
+    if(mesh.IsEmpty())
+        return;
+
+    const CBvh::Node &root = mesh.GetNodes()[0];
+    const float *m = inst.mToWorld;
+    for(int corner=0;  corner<8;  corner++)
+    {
+        float p[3];
+        p[0] = corner & 1 ? root.mMax[0] : root.mMin[0];
+        p[1] = corner & 2 ? root.mMax[1] : root.mMin[1];
+        p[2] = corner & 4 ? root.mMax[2] : root.mMin[2];
+
+        float w[3];
+        for(int r=0;  r<3;  r++)
+            w[r] = m[r * 4] * p[0] + m[r * 4 + 1] * p[1] + m[r * 4 + 2] * p[2] + m[r * 4 + 3];
+
+        GrowBounds(inst.mMin, inst.mMax, w, w);
+    }
+}
+
+
+//
+// Name :         CSceneBvh::BuildTop()
+// Description :  Build the top level over the instances of
+//                meshes that have any triangles.
+//
+void CSceneBvh::BuildTop()
+{
+    LARGE_INTEGER start, end;
+    QueryPerformanceCounter(&start);
+
+    m_top.clear();
+    m_order.clear();
+
+    for(int i=0;  i<(int)m_instances.size();  i++)
+    {
+        if(!m_meshes[m_instances[i].mMesh].IsEmpty())
+            m_order.push_back(i);
+    }
+
+    int n = (int)m_order.size();
+    if(n > 0)
+    {
+        m_top.reserve(n * 2);
+        BuildTopNode(0, n, 0);
+    }
+
+    QueryPerformanceCounter(&end);
+    m_stats.mTopBuildTime = ElapsedMs(start, end);
+    m_stats.mNumInstances = (int)m_instances.size();
+    m_stats.mNumTopNodes = (int)m_top.size();
+}
+
+
+//
+// Name :         CSceneBvh::BuildTopNode()
+// Description :  Build a node over m_order[first] to m_order[first + count - 1].
+//                There are few instances, so the split is chosen by an
+//                exact sweep of the surface area heuristic over the
+//                instances sorted along each axis.
+// Returns :      Index of the node
+//
+int CSceneBvh::BuildTopNode(int first, int count, int depth)
+{
+    int index = (int)m_top.size();
+    m_top.push_back(CBvh::Node());
+
+    float mn[3] = {1e30f, 1e30f, 1e30f};
+    float mx[3] = {-1e30f, -1e30f, -1e30f};
+    for(int i=first;  i<first + count;  i++)
+        GrowBounds(mn, mx, m_instances[m_order[i]].mMin, m_instances[m_order[i]].mMax);
+
+    for(int i=0;  i<3;  i++)
+    {
+        m_top[index].mMin[i] = mn[i];
+        m_top[index].mMax[i] = mx[i];
+    }
+
+    if(count == 1)
+    {
+        m_top[index].mOffset = first;
+        m_top[index].mCount = 1;
+        return index;
+    }
+
+    vector<int>::iterator begin = m_order.begin() + first;
+    vector<int>::iterator end = begin + count;
+
+    int bestAxis = 0;
+    int bestSplit = count / 2;
+
+    if(depth < MaxSahDepth)
+    {
+        float bestCost = 1e30f;
+        vector<float> rightArea(count);
+        for(int axis=0;  axis<3;  axis++)
+        {
+            sort(begin, end, InstanceCenterLess(m_instances, axis));
+
+            float bmn[3] = {1e30f, 1e30f, 1e30f};
+            float bmx[3] = {-1e30f, -1e30f, -1e30f};
+            for(int i=count-1;  i>0;  i--)
+            {
+                const Instance &inst = m_instances[m_order[first + i]];
+                GrowBounds(bmn, bmx, inst.mMin, inst.mMax);
+                rightArea[i] = BoxHalfArea(bmn, bmx);
+            }
+
+            for(int i=0;  i<3;  i++)
+            {
+                bmn[i] = 1e30f;
+                bmx[i] = -1e30f;
+            }
+
+            for(int i=1;  i<count;  i++)
+            {
+                const Instance &inst = m_instances[m_order[first + i - 1]];
+                GrowBounds(bmn, bmx, inst.mMin, inst.mMax);
+                float cost = BoxHalfArea(bmn, bmx) * i + rightArea[i] * (count - i);
+                if(cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = i;
+                }
+            }
+        }
+    }
+    else
+    {
+        float ext = 0;
+        for(int i=0;  i<3;  i++)
+        {
+            if(mx[i] - mn[i] > ext)
+            {
+                ext = mx[i] - mn[i];
+                bestAxis = i;
+            }
+        }
+    }
+
+    sort(begin, end, InstanceCenterLess(m_instances, bestAxis));
+
+    BuildTopNode(first, bestSplit, depth + 1);
+    int right = BuildTopNode(first + bestSplit, count - bestSplit, depth + 1);
+
+    m_top[index].mOffset = right;
+    m_top[index].mCount = -1 - bestAxis;
+    return index;
+}
+
+
+//
+// Name :         CSceneBvh::Intersect()
+// Description :  Closest hit traversal of the top level, continuing
+//                into the mesh of each instance the ray enters.
+//
+bool CSceneBvh::Intersect(const CBvh::Ray &ray, CBvh::Hit &hit) const
+{
+    if(m_top.empty())
+        return false;
+
+    float tmax = ray.mTMax;
+    bool found = false;
+
+    int stack[CBvh::MaxDepth];
+    int sp = 0;
+    int node = 0;
+
+    while(true)
+    {
+        const CBvh::Node &n = m_top[node];
+        if(BoxTest(n, ray.mOrigin, ray.mInvDir, ray.mTMin, tmax))
+        {
+            if(!n.IsLeaf())
+            {
+                int axis = -1 - n.mCount;
+                int nearChild = node + 1;
+                int farChild = n.mOffset;
+                if(ray.mDir[axis] < 0)
+                    swap(nearChild, farChild);
+
+                stack[sp++] = farChild;
+                node = nearChild;
+                continue;
+            }
+
+            int i = m_order[n.mOffset];
+            const Instance &inst = m_instances[i];
+
+            CBvh::Ray local;
+            ToMesh(inst, ray.mOrigin, ray.mDir, ray.mTMin, tmax, local);
+
+            CBvh::Hit h;
+            if(m_meshes[inst.mMesh].Intersect(local, h))
+            {
+                tmax = h.mT;
+                hit = h;
+                hit.mInstance = i;
+                found = true;
+            }
+        }
+
+        if(sp == 0)
+            break;
+
+        node = stack[--sp];
+    }
+
+    return found;
+}
+
+
+//
+// Name :         CSceneBvh::Occluded()
+// Description :  Any hit traversal. Returns at the first hit.
+//
+bool CSceneBvh::Occluded(const CBvh::Ray &ray) const
+{
+    if(m_top.empty())
+        return false;
+
+    int stack[CBvh::MaxDepth];
+    int sp = 0;
+    int node = 0;
+
+    while(true)
+    {
+        const CBvh::Node &n = m_top[node];
+        if(BoxTest(n, ray.mOrigin, ray.mInvDir, ray.mTMin, ray.mTMax))
+        {
+            if(!n.IsLeaf())
+            {
+                stack[sp++] = n.mOffset;
+                node = node + 1;
+                continue;
+            }
+
+            const Instance &inst = m_instances[m_order[n.mOffset]];
+
+            CBvh::Ray local;
+            ToMesh(inst, ray.mOrigin, ray.mDir, ray.mTMin, ray.mTMax, local);
+            if(m_meshes[inst.mMesh].Occluded(local))
+                return true;
+        }
+
+        if(sp == 0)
+            break;
+
+        node = stack[--sp];
+    }
+
+    return false;
+}
+
+
+//
+// Name :         CSceneBvh::IntersectPacket()
+// Description :  Closest hit query for a packet. The top level is
+//                traversed one ray at a time, which is cheap for the
+//                few instances there are. The rays that enter an
+//                instance are transformed into a packet in its mesh
+//                coordinates and traced with the SIMD packet query.
+//
+void CSceneBvh::IntersectPacket(const CBvh::RayPacket &packet, CBvh::Hit *hits, bool *found) const
+{
+    const int MaxRays = CBvh::MaxPacketSize;
+
+    float tmax[MaxRays];
+    bool skip[MaxRays];
+    for(int i=0;  i<packet.mCount;  i++)
+    {
+        found[i] = false;
+        skip[i] = false;
+        tmax[i] = packet.mTMax[i];
+    }
+
+    if(m_top.empty() || packet.mCount == 0)
+        return;
+
+    int stack[CBvh::MaxDepth];
+    int sp = 0;
+    int node = 0;
+
+    while(true)
+    {
+        const CBvh::Node &n = m_top[node];
+        if(!n.IsLeaf())
+        {
+            if(PacketEnters(n, packet, tmax, skip))
+            {
+                int axis = -1 - n.mCount;
+                int nearChild = node + 1;
+                int farChild = n.mOffset;
+                if(packet.mDir[axis][0] < 0)
+                    swap(nearChild, farChild);
+
+                stack[sp++] = farChild;
+                node = nearChild;
+                continue;
+            }
+        }
+        else
+        {
+            int i = m_order[n.mOffset];
+            CBvh::RayPacket local;
+            int lanes[MaxRays];
+            InstancePacket(m_instances[i], n, packet, tmax, skip, local, lanes);
+
+            if(local.mCount > 0)
+            {
+                CBvh::Hit localHits[MaxRays];
+                bool localFound[MaxRays];
+                m_meshes[m_instances[i].mMesh].IntersectPacket(local, localHits, localFound);
+
+                for(int j=0;  j<local.mCount;  j++)
+                {
+                    int l = lanes[j];
+                    if(localFound[j] && localHits[j].mT < tmax[l])
+                    {
+                        tmax[l] = localHits[j].mT;
+                        hits[l] = localHits[j];
+                        hits[l].mInstance = i;
+                        found[l] = true;
+                    }
+                }
+            }
+        }
+
+        if(sp == 0)
+            break;
+
+        node = stack[--sp];
+    }
+}
+
+
+//
+// Name :         CSceneBvh::OccludedPacket()
+// Description :  Any hit query for a packet. Rays drop out as soon
+//                as they are blocked.
+//
+void CSceneBvh::OccludedPacket(const CBvh::RayPacket &packet, bool *occluded) const
+{
+    const int MaxRays = CBvh::MaxPacketSize;
+
+    for(int i=0;  i<packet.mCount;  i++)
+        occluded[i] = false;
+
+    if(m_top.empty() || packet.mCount == 0)
+        return;
+
+    int active = packet.mCount;
+
+    int stack[CBvh::MaxDepth];
+    int sp = 0;
+    int node = 0;
+
+    while(active > 0)
+    {
+        const CBvh::Node &n = m_top[node];
+        if(!n.IsLeaf())
+        {
+            if(PacketEnters(n, packet, packet.mTMax, occluded))
+            {
+                stack[sp++] = n.mOffset;
+                node = node + 1;
+                continue;
+            }
+        }
+        else
+        {
+            const Instance &inst = m_instances[m_order[n.mOffset]];
+            CBvh::RayPacket local;
+            int lanes[MaxRays];
+            InstancePacket(inst, n, packet, packet.mTMax, occluded, local, lanes);
+
+            if(local.mCount > 0)
+            {
+                bool localOccluded[MaxRays];
+                m_meshes[inst.mMesh].OccludedPacket(local, localOccluded);
+
+                for(int j=0;  j<local.mCount;  j++)
+                {
+                    if(localOccluded[j])
+                    {
+                        occluded[lanes[j]] = true;
+                        active--;
+                    }
+                }
+            }
+        }
+
+        if(sp == 0)
+            break;
+
+        node = stack[--sp];
+    }
+}
+
+
+std::wstring CSceneBvh::GetReport() const
+{
+    wstringstream str;
+    str << L"Scene: " << m_stats.mNumTriangles << L" triangles in "
+        << m_stats.mNumMeshes << L" meshes built in " << m_stats.mMeshBuildTime << L" ms, "
+        << m_stats.mNumInstances << L" instances, "
+        << m_stats.mNumTopNodes << L" top level nodes built in "
+        << m_stats.mTopBuildTime * 1000. << L" us";
+    return str.str();
+}
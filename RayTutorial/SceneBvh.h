@@ -0,0 +1,132 @@
+//
+// Name :         SceneBvh.h
+// Description :  Header for CSceneBvh, a two level acceleration structure
+//                over rigidly transformed meshes.
+//
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <grafx.h>
+#include "Bvh.h"
+
+class CTriangleStore;
+
+//! Two level bounding volume hierarchy for rigidly animated meshes.
+
+/*! Each mesh of a CTriangleStore gets its own CBvh (the bottom level),
+    built over the mesh triangles in the mesh coordinate system. An
+    instance places a mesh in the world with a transform. A small
+    hierarchy over the world bounds of the instances (the top level)
+    ties them together.
+
+    Queries traverse the top level, and for each instance they enter
+    transform the ray into the mesh coordinate system and continue in
+    that mesh CBvh. The transforms are affine and the ray directions are
+    not renormalized, so distances along a ray are the same in both
+    coordinate systems.
+
+    Changing the instance transforms only requires rebuilding the top
+    level, which takes microseconds for the few dozen meshes of a model.
+    The bottom levels are only built once. */
+
+class CSceneBvh
+{
+public:
+    CSceneBvh();
+    virtual ~CSceneBvh();
+
+    //! A mesh placed in the world
+    struct Instance
+    {
+        int mMesh;              //!< Mesh index in the triangle store
+        float mToWorld[12];     //!< Mesh to world transform, 3x4 row major
+        float mToMesh[12];      //!< World to mesh transform, 3x4 row major
+        float mNormal[9];       //!< Mesh to world transform for normals, 3x3
+        float mMin[3];          //!< World bounds
+        float mMax[3];
+    };
+
+    //! Statistics about the last builds
+    struct Stats
+    {
+        double mMeshBuildTime;  //!< Time to build all of the meshes in milliseconds
+        double mTopBuildTime;   //!< Time to build the top level in milliseconds
+        int mNumMeshes;
+        int mNumInstances;
+        int mNumTriangles;
+        int mNumTopNodes;
+    };
+
+    //! Build the bottom level hierarchy for every mesh in a store
+    /*! This removes any instances. */
+    void BuildMeshes(const CTriangleStore &triangles);
+
+    //! Remove the meshes and instances
+    void Clear();
+
+    //! Remove the instances, keeping the meshes
+    void ClearInstances();
+
+    //! Add an instance of a mesh
+    /*! BuildTop() must be called before the instance can be hit.
+        \param mesh Mesh index in the triangle store
+        \param t Mesh to world transform, which must be affine
+        \return Instance index */
+    int AddInstance(int mesh, const CGrTransform &t);
+
+    //! Move an instance
+    /*! BuildTop() must be called before the change is seen. */
+    void SetInstanceTransform(int instance, const CGrTransform &t);
+
+    //! Build the top level hierarchy over the instances
+    void BuildTop();
+
+    //! Closest hit query
+    /*! The hit mInstance is set to the instance that was hit. */
+    bool Intersect(const CBvh::Ray &ray, CBvh::Hit &hit) const;
+
+    //! Any hit query
+    bool Occluded(const CBvh::Ray &ray) const;
+
+    //! Closest hit query for a packet of rays
+    void IntersectPacket(const CBvh::RayPacket &packet, CBvh::Hit *hits, bool *found) const;
+
+    //! Any hit query for a packet of rays
+    void OccludedPacket(const CBvh::RayPacket &packet, bool *occluded) const;
+
+    //! Is there nothing to hit?
+    bool IsEmpty() const {return m_top.empty();}
+
+    //! Number of meshes
+    int GetNumMeshes() const {return (int)m_meshes.size();}
+
+    //! The hierarchy for a mesh
+    const CBvh &GetMesh(int m) const {return m_meshes[m];}
+
+    //! Number of instances
+    int GetNumInstances() const {return (int)m_instances.size();}
+
+    //! An instance
+    const Instance &GetInstance(int i) const {return m_instances[i];}
+
+    //! Statistics for the last builds
+    const Stats &GetStats() const {return m_stats;}
+
+    //! A printable summary of the last builds
+    std::wstring GetReport() const;
+
+private:
+    int BuildTopNode(int first, int count, int depth);
+
+    std::vector<CBvh> m_meshes;
+    std::vector<Instance> m_instances;
+
+    // The top level. Leaves hold one instance, and mOffset
+    // is its position in m_order.
+    std::vector<CBvh::Node> m_top;
+    std::vector<int> m_order;
+
+    Stats m_stats;
+};
@@ -0,0 +1,161 @@
+//
+// Name :         TileScheduler.cpp
+// Description :  Implementation of CTileScheduler.
+//
+
+#include "StdAfx.h"
+#include "TileScheduler.h"
+
+#include <sstream>
+
+using namespace std;
+
+inline double ElapsedMs(const LARGE_INTEGER &start, const LARGE_INTEGER &end)
+{
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    return double(end.QuadPart - start.QuadPart) * 1000. / double(freq.QuadPart);
+}
+
+
+CTileScheduler::CTileScheduler()
+{
+    m_tileWidth = 32;
+    m_tileHeight = 32;
+    m_numWorkers = 1;
+    m_totalTime = 0;
+}
+
+
+CTileScheduler::~CTileScheduler()
+{
+}
+
+
+//
+// Name :         CTileScheduler::MakeTiles()
+// Description :  Cover the image with tiles in row major order. The
+//                pool hands contiguous runs of tiles to each worker, so
+//                this keeps the work for a thread together.
+//
+void CTileScheduler::MakeTiles(int width, int height)
+{
+    m_tiles.clear();
+
+    for(int y=0;  y<height;  y+=m_tileHeight)
+    {
+        for(int x=0;  x<width;  x+=m_tileWidth)
+        {
+            Tile tile;
+            tile.mX = x;
+            tile.mY = y;
+            tile.mWidth = min(m_tileWidth, width - x);
+            tile.mHeight = min(m_tileHeight, height - y);
+            tile.mWorker = -1;
+            tile.mTime = 0;
+            m_tiles.push_back(tile);
+        }
+    }
+}
+
+
+void CTileScheduler::TileTask::Run(int worker)
+{
+    LARGE_INTEGER start, end;
+    QueryPerformanceCounter(&start);
+
+    mRenderer->RenderTile(mTile->mX, mTile->mY, mTile->mWidth, mTile->mHeight, worker);
+
+    QueryPerformanceCounter(&end);
+    mTile->mWorker = worker;
+    mTile->mTime = ElapsedMs(start, end);
+}
+
+
+//
+// Name :         CTileScheduler::Render()
+// Description :  Render all of the tiles and wait for them to finish.
+//
+void CTileScheduler::Render(ITileRenderer *renderer, int width, int height, CGrThreadPool *pool)
+{
+    LARGE_INTEGER start, end;
+    QueryPerformanceCounter(&start);
+
+    m_tileWidth = max(m_tileWidth, 1);
+    m_tileHeight = max(m_tileHeight, 1);
+    MakeTiles(width, height);
+
+    int numTiles = (int)m_tiles.size();
+    vector<TileTask> tasks(numTiles);
+    vector<CGrThreadPool::ITask *> taskPtrs(numTiles);
+    for(int i=0;  i<numTiles;  i++)
+    {
+        tasks[i].mRenderer = renderer;
+        tasks[i].mTile = &m_tiles[i];
+        taskPtrs[i] = &tasks[i];
+    }
+
+    if(pool != NULL && numTiles > 0)
+    {
+        m_numWorkers = pool->GetNumSlots();
+        pool->Run(&taskPtrs[0], numTiles);
+    }
+    else
+    {
+        m_numWorkers = 1;
+        for(int i=0;  i<numTiles;  i++)
+            tasks[i].Run(0);
+    }
+
+    QueryPerformanceCounter(&end);
+    m_totalTime = ElapsedMs(start, end);
+}
+
+
+std::wstring CTileScheduler::GetReport() const
+{
+    wstringstream str;
+
+    int numTiles = (int)m_tiles.size();
+    str << L"Tiles: " << numTiles << L" of " << m_tileWidth << L"x" << m_tileHeight
+        << L" in " << m_totalTime << L" ms" << endl;
+
+    if(numTiles == 0)
+        return str.str();
+
+    double total = 0;
+    double minTime = m_tiles[0].mTime;
+    double maxTime = m_tiles[0].mTime;
+    vector<double> workerTime(m_numWorkers, 0.);
+    vector<int> workerTiles(m_numWorkers, 0);
+
+    for(vector<Tile>::const_iterator t=m_tiles.begin();  t!=m_tiles.end();  t++)
+    {
+        total += t->mTime;
+        minTime = min(minTime, t->mTime);
+        maxTime = max(maxTime, t->mTime);
+        if(t->mWorker >= 0 && t->mWorker < m_numWorkers)
+        {
+            workerTime[t->mWorker] += t->mTime;
+            workerTiles[t->mWorker]++;
+        }
+    }
+
+    str << L"Tile time min " << minTime << L" ms, avg " << total / numTiles
+        << L" ms, max " << maxTime << L" ms" << endl;
+
+    // How much of the available thread time went into tiles
+    if(m_totalTime > 0)
+    {
+        str << L"Parallel efficiency " << 100. * total / (m_totalTime * m_numWorkers)
+            << L"% on " << m_numWorkers << L" threads" << endl;
+    }
+
+    for(int w=0;  w<m_numWorkers;  w++)
+    {
+        str << L"  Thread " << w << L": " << workerTiles[w] << L" tiles, "
+            << workerTime[w] << L" ms" << endl;
+    }
+
+    return str.str();
+}
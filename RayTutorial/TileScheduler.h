@@ -0,0 +1,90 @@
+//
+// Name :         TileScheduler.h
+// Description :  Header for CTileScheduler, which divides an image into
+//                tiles and renders them on a thread pool.
+//
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <grafx.h>
+
+//! Divides an image into tiles and renders them in parallel.
+
+/*! The tiles are handed to a CGrThreadPool as one batch. Tiles are
+    disjoint, so each one can write directly into the destination image
+    without locking. The time to render each tile is recorded so the
+    load balance can be inspected after a render. */
+
+class CTileScheduler
+{
+public:
+    CTileScheduler();
+    virtual ~CTileScheduler();
+
+    //! Interface for whatever renders the tiles
+    class ITileRenderer
+    {
+    public:
+        virtual ~ITileRenderer() {}
+
+        //! Render a rectangle of the image
+        /*! This is called from several threads at once.
+            \param x Left column
+            \param y Bottom row
+            \param width Tile width
+            \param height Tile height
+            \param worker Thread pool worker index */
+        virtual void RenderTile(int x, int y, int width, int height, int worker) = 0;
+    };
+
+    //! One tile and how long it took
+    struct Tile
+    {
+        int mX;
+        int mY;
+        int mWidth;
+        int mHeight;
+        int mWorker;        //!< Worker that rendered it
+        double mTime;       //!< Render time in milliseconds
+    };
+
+    //! Set the tile size in pixels
+    void SetTileSize(int width, int height) {m_tileWidth = width;  m_tileHeight = height;}
+
+    //! Render an image
+    /*! \param renderer The tile renderer
+        \param width Image width
+        \param height Image height
+        \param pool Thread pool to use, or NULL to render on this thread */
+    void Render(ITileRenderer *renderer, int width, int height, CGrThreadPool *pool);
+
+    //! The tiles from the last render
+    const std::vector<Tile> &GetTiles() const {return m_tiles;}
+
+    //! Wall clock time for the last render in milliseconds
+    double GetTotalTime() const {return m_totalTime;}
+
+    //! A printable summary of the tile timings
+    std::wstring GetReport() const;
+
+private:
+    class TileTask : public CGrThreadPool::ITask
+    {
+    public:
+        virtual void Run(int worker);
+
+        ITileRenderer *mRenderer;
+        Tile *mTile;
+    };
+
+    void MakeTiles(int width, int height);
+
+    int m_tileWidth;
+    int m_tileHeight;
+    int m_numWorkers;
+
+    std::vector<Tile> m_tiles;
+    double m_totalTime;
+};
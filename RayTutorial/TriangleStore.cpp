@@ -0,0 +1,79 @@
+//
+// Name :         TriangleStore.cpp
+// Description :  Implementation of CTriangleStore.
+//
+
+#include "StdAfx.h"
+#include "TriangleStore.h"
+
+using namespace std;
+
+CTriangleStore::CTriangleStore()
+{
+    m_currentMesh = -1;
+}
+
+
+CTriangleStore::~CTriangleStore()
+{
+}
+
+
+void CTriangleStore::Clear()
+{
+    m_positions.clear();
+    m_normals.clear();
+    m_tcoords.clear();
+    m_effects.clear();
+    m_meshes.clear();
+    m_effectList.clear();
+    m_meshNames.clear();
+    m_meshFirst.clear();
+    m_currentMesh = -1;
+}
+
+
+//
+// Name :         CTriangleStore::Reserve()
+// Description :  Reserve storage for a total number of triangles. If the
+//                store has to grow past the current capacity, it at least
+//                doubles, so the growth cost is amortized.
+//
+void CTriangleStore::Reserve(int numTriangles)
+{
+    size_t capacity = m_effects.capacity();
+    if(size_t(numTriangles) <= capacity)
+        return;
+
+    if(size_t(numTriangles) < capacity * 2)
+        numTriangles = int(capacity * 2);
+
+    m_positions.reserve(numTriangles * 9);
+    m_normals.reserve(numTriangles * 9);
+    m_tcoords.reserve(numTriangles * 6);
+    m_effects.reserve(numTriangles);
+    m_meshes.reserve(numTriangles);
+}
+
+
+int CTriangleStore::AddMesh(const wchar_t *name)
+{
+    m_meshNames.push_back(name);
+    m_meshFirst.push_back(GetNumTriangles());
+    m_currentMesh = (int)m_meshNames.size() - 1;
+    return m_currentMesh;
+}
+
+
+int CTriangleStore::AddEffect(CGrModelX::IEffect *effect)
+{
+    // There are only ever a few effects, so a linear search is fine
+    for(size_t i=0;  i<m_effectList.size();  i++)
+    {
+        if(m_effectList[i] == effect)
+            return (int)i;
+    }
+
+    m_effectList.push_back(effect);
+    return (int)m_effectList.size() - 1;
+}
@@ -0,0 +1,122 @@
+//
+// Name :         TriangleStore.h
+// Description :  Header for CTriangleStore, a flat store of the
+//                triangles captured from a model for ray tracing.
+//
+
+#pragma once
+
+#include <vector>
+#include <string>
+#include <grafx.h>
+
+//! Flat triangle storage for the ray tracer.
+
+/*! The triangles are kept as a structure of arrays. Each attribute
+    (positions, normals, texture coordinates, effect, and mesh) is a separate 
+    contiguous array indexed by triangle number, so a traversal that only 
+    needs positions never touches the shading data. Triangle storage
+    grows geometrically and can be reserved in advance, so adding a
+    triangle does not allocate. 
+    
+    The triangles of each mesh are contiguous, so a mesh can be 
+    treated as a unit. */
+
+class CTriangleStore
+{
+public:
+    CTriangleStore();
+    virtual ~CTriangleStore();
+
+    //! Remove all triangles, meshes, and effects
+    void Clear();
+
+    //! Reserve space for a number of triangles in total
+    void Reserve(int numTriangles);
+
+    //! Add a mesh name. Triangles added after this belong to the mesh.
+    //! \return Index for the mesh
+    int AddMesh(const wchar_t *name);
+
+    //! Get the index for an effect, adding it if it is new
+    int AddEffect(CGrModelX::IEffect *effect);
+
+    //! Add a triangle. 
+    /*! \param p Three corner positions, 3 floats each
+        \param n Three corner normals, 3 floats each
+        \param t Three corner texture coordinates, 2 floats each
+        \param effect Effect index from AddEffect() */
+    void AddTriangle(const float *p[3], const float *n[3], const float *t[3], int effect)
+    {
+        for(int c=0;  c<3;  c++)
+        {
+            m_positions.push_back(p[c][0]);
+            m_positions.push_back(p[c][1]);
+            m_positions.push_back(p[c][2]);
+            m_normals.push_back(n[c][0]);
+            m_normals.push_back(n[c][1]);
+            m_normals.push_back(n[c][2]);
+            m_tcoords.push_back(t[c][0]);
+            m_tcoords.push_back(t[c][1]);
+        }
+
+        m_effects.push_back(effect);
+        m_meshes.push_back(m_currentMesh);
+    }
+
+    //! Number of triangles in the store
+    int GetNumTriangles() const {return (int)m_effects.size();}
+
+    //! Positions for a triangle, 9 floats (3 corners, x, y, z)
+    const float *GetPositions(int t) const {return &m_positions[t * 9];}
+
+    //! Normals for a triangle, 9 floats (3 corners, x, y, z)
+    const float *GetNormals(int t) const {return &m_normals[t * 9];}
+
+    //! Texture coordinates for a triangle, 6 floats (3 corners, s, t)
+    const float *GetTcoords(int t) const {return &m_tcoords[t * 6];}
+
+    //! Effect index for a triangle
+    int GetEffectIndex(int t) const {return m_effects[t];}
+
+    //! Effect for a triangle
+    CGrModelX::IEffect *GetEffect(int t) const {return m_effectList[m_effects[t]];}
+
+    //! Mesh index for a triangle
+    int GetMeshIndex(int t) const {return m_meshes[t];}
+
+    //! Name of the mesh a triangle belongs to
+    const wchar_t *GetMeshName(int t) const {return m_meshes[t] < 0 ? L"" : m_meshNames[m_meshes[t]].c_str();}
+
+    //! Number of distinct effects
+    int GetNumEffects() const {return (int)m_effectList.size();}
+
+    //! Number of meshes
+    int GetNumMeshes() const {return (int)m_meshNames.size();}
+
+    //! First triangle of a mesh. The triangles of a mesh are contiguous.
+    int GetMeshFirstTriangle(int m) const {return m_meshFirst[m];}
+
+    //! Number of triangles in a mesh
+    int GetMeshNumTriangles(int m) const 
+    {
+        int end = m + 1 < GetNumMeshes() ? m_meshFirst[m + 1] : GetNumTriangles();
+        return end - m_meshFirst[m];
+    }
+
+private:
+    // Per triangle attributes
+    std::vector<float> m_positions;
+    std::vector<float> m_normals;
+    std::vector<float> m_tcoords;
+    std::vector<int> m_effects;
+    std::vector<int> m_meshes;
+
+    // Distinct effects, indexed by the per triangle effect index
+    std::vector<CGrModelX::IEffect *> m_effectList;
+
+    // Mesh names, indexed by the per triangle mesh index
+    std::vector<std::wstring> m_meshNames;
+    std::vector<int> m_meshFirst;
+    int m_currentMesh;
+};